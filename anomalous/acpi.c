@@ -0,0 +1,26 @@
+#include <anomalous/acpi.h>
+#include <efilib.h>
+
+EFI_STATUS locate_acpi(EFI_SYSTEM_TABLE *SystemTable, struct AcpiParams *params)
+{
+    EFI_GUID acpi20_guid = ACPI_20_TABLE_GUID;
+    EFI_GUID acpi10_guid = ACPI_TABLE_GUID;
+    VOID *rsdp = NULL;
+
+    // Prefer the ACPI 2.0+ RSDP, it carries the 64-bit XSDT address
+    for (UINTN i = 0; i < SystemTable->NumberOfTableEntries; ++i) {
+        EFI_CONFIGURATION_TABLE *table = &SystemTable->ConfigurationTable[i];
+        if (CompareGuid(&table->VendorGuid, &acpi20_guid)) {
+            rsdp = table->VendorTable;
+            break;
+        }
+        if (!rsdp && CompareGuid(&table->VendorGuid, &acpi10_guid)) {
+            rsdp = table->VendorTable;
+        }
+    }
+
+    if (!rsdp) return EFI_NOT_FOUND;
+
+    params->rsdp = (uint64_t)rsdp;
+    return EFI_SUCCESS;
+}
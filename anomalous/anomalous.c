@@ -17,6 +17,7 @@
 #include <anomalous/display.h>
 #include <anomalous/sample.h>
 #include <anomalous/topology.h>
+#include <anomalous/acpi.h>
 #include <xencore/core.h>
 
 EFI_STATUS EFIAPI efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable)
@@ -29,6 +30,7 @@ EFI_STATUS EFIAPI efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable
     struct FramebufferParams fb_params = { 0 };
     struct TestSampleParams sample_params = { 0 };
     struct MemoryMapParams memmap_params = { 0 };
+    struct AcpiParams acpi_params = { 0 };
 
     Print(L"[Anomalous Materials] Preparing test chamber display buffer...\r\n");
     status = setup_display(SystemTable, &fb_params);
@@ -44,6 +46,12 @@ EFI_STATUS EFIAPI efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable
         return status;
     }
 
+    Print(L"[Anomalous Materials] Locating facility schematics...\r\n");
+    status = locate_acpi(SystemTable, &acpi_params);
+    if (EFI_ERROR(status)) {
+        Print(L"[Anomalous Materials] No ACPI tables, continuing with a single processor\r\n");
+    }
+
     Print(L"[Anomalous Materials] Acquiring system topology...\r\n");
     status = acquire_topology(SystemTable, &map_key, &memmap_params);
     if (EFI_ERROR(status)) {
@@ -60,7 +68,7 @@ EFI_STATUS EFIAPI efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable
     //   We've assured the administrator that nothing will go wrong.
     // - Ah yes, you're right. Gordon, we have complete confidence in you.
     // - Well, go ahead. Let's let him in now...
-    resonance_cascade(fb_params, sample_params, memmap_params);
+    resonance_cascade(fb_params, sample_params, memmap_params, acpi_params);
 
     return EFI_SUCCESS;
 }
@@ -4,6 +4,7 @@
 
 #include <xencore/xenio/tty.h>
 #include <xencore/timer/sleep.h>
+#include <xencore/timer/clock.h>
 #include <xencore/xenmem/xenalloc.h>
 
 struct DemoTriangleState demo_triangle_init(void)
@@ -26,7 +27,8 @@ struct DemoTriangleState demo_triangle_init(void)
         fb_color_rgb(0.1f, 0.7f, 0.2f),
         {  0.0f,  0.5f },
         { -0.5f, -0.5f },
-        {  0.5f, -0.5f }
+        {  0.5f, -0.5f },
+        clock_monotonic_ns() + DEMO_FRAME_NS
     };
 
     return state;
@@ -73,7 +75,12 @@ void demo_triangle_tick(struct DemoTriangleState *state)
     );
 
     fb_present();
-    ksleep(1);
+
+    // Pace against absolute deadlines so render time doesn't add drift
+    ksleep_until_ns(state->next_frame_ns);
+    state->next_frame_ns += DEMO_FRAME_NS;
+    uint64_t now = clock_monotonic_ns();
+    if (state->next_frame_ns < now) state->next_frame_ns = now;
 
     // Update state
     float new_angle = angle + 0.01f;
@@ -0,0 +1,113 @@
+// Context switch microbenchmark: two processes pinned to one CPU hand it
+// back and forth with sched_yield(), touching a few pages each time so the
+// cost of losing the TLB on every CR3 switch shows up in the numbers.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <xencore/timer/xentime.h>
+
+#define ROUNDS       10000
+#define TOUCH_PAGES  64
+#define BENCH_CPU    1
+
+static volatile uint8_t touch_buffer[TOUCH_PAGES * 4096];
+
+static inline long __syscall(
+    long n,
+    long a1, long a2, long a3,
+    long a4, long a5, long a6
+) {
+    long ret;
+    __asm__ volatile (
+        "movq %5, %%r10\n\t"
+        "movq %6, %%r8\n\t"
+        "movq %7, %%r9\n\t"
+        "syscall"
+        : "=a"(ret)
+        : "a"(n),          /* %1 */
+          "D"(a1),         /* %2 */
+          "S"(a2),         /* %3 */
+          "d"(a3),         /* %4 */
+          "r"(a4),         /* %5 -> r10 */
+          "r"(a5),         /* %6 -> r8  */
+          "r"(a6)          /* %7 -> r9  */
+        : "rcx", "r11", "r10", "r8", "r9", "memory"
+    );
+    return ret;
+}
+
+long write(int fd, const void *buf, size_t len) {
+    return __syscall(1, fd, (long)buf, len, 0, 0, 0);
+}
+
+long sched_yield(void) {
+    return __syscall(24, 0, 0, 0, 0, 0, 0);
+}
+
+long getppid(void) {
+    return __syscall(110, 0, 0, 0, 0, 0, 0);
+}
+
+long sched_setaffinity(long pid, size_t len, const uint64_t *mask) {
+    return __syscall(203, pid, len, (long)mask, 0, 0, 0);
+}
+
+long wait4(long pid, int *status) {
+    return __syscall(61, pid, (long)status, 0, 0, 0, 0);
+}
+
+long spawn(const char *path) {
+    return __syscall(500, (long)path, 0, 0, 0, 0, 0);
+}
+
+void exit(int code) {
+    __syscall(60, code, 0, 0, 0, 0, 0);
+    __builtin_unreachable();
+}
+
+static uint64_t now_ns(void) {
+    return xentime_read((const struct XenTimePage *)XENTIME_USER_ADDR, CLOCK_MONOTONIC);
+}
+
+void write_uint(unsigned long val) {
+    char buf[24];
+    char *p = buf + sizeof(buf);
+    if (val == 0) *--p = '0';
+    while (val) { *--p = '0' + (val % 10); val /= 10; }
+    write(1, p, buf + sizeof(buf) - p);
+}
+
+void _start() {
+    // The copy started by the kernel leads and spawns its partner
+    int leader = getppid() == 0;
+    long partner = leader ? spawn("/test_sample/ctxswitch.elf") : 0;
+
+    uint64_t mask = 1ULL << BENCH_CPU;
+    if (sched_setaffinity(0, sizeof(mask), &mask) < 0) {
+        mask = 1;
+        sched_setaffinity(0, sizeof(mask), &mask);
+    }
+    sched_yield();
+
+    uint64_t start = now_ns();
+    for (int i = 0; i < ROUNDS; ++i) {
+        for (int page = 0; page < TOUCH_PAGES; ++page) touch_buffer[page * 4096]++;
+        sched_yield();
+    }
+    uint64_t elapsed = now_ns() - start;
+
+    if (leader && partner > 0) {
+        int status;
+        wait4(partner, &status);
+
+        // Every round is our yield plus the partner's
+        write(1, "ctxswitch: ", 11);
+        write_uint((unsigned long)(elapsed / (2 * ROUNDS)));
+        write(1, " ns per switch, ", 16);
+        write_uint(TOUCH_PAGES);
+        write(1, " pages touched in between\n", 26);
+    }
+    exit(0);
+    __builtin_unreachable();
+}
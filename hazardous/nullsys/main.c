@@ -0,0 +1,80 @@
+// Null syscall microbenchmark: getpid() does next to nothing in the kernel,
+// so the time per call is the cost of the entry and exit path itself.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ROUNDS   100000
+#define BATCHES  16
+
+static inline long __syscall(
+    long n,
+    long a1, long a2, long a3,
+    long a4, long a5, long a6
+) {
+    long ret;
+    __asm__ volatile (
+        "movq %5, %%r10\n\t"
+        "movq %6, %%r8\n\t"
+        "movq %7, %%r9\n\t"
+        "syscall"
+        : "=a"(ret)
+        : "a"(n),          /* %1 */
+          "D"(a1),         /* %2 */
+          "S"(a2),         /* %3 */
+          "d"(a3),         /* %4 */
+          "r"(a4),         /* %5 -> r10 */
+          "r"(a5),         /* %6 -> r8  */
+          "r"(a6)          /* %7 -> r9  */
+        : "rcx", "r11", "r10", "r8", "r9", "memory"
+    );
+    return ret;
+}
+
+long write(int fd, const void *buf, size_t len) {
+    return __syscall(1, fd, (long)buf, len, 0, 0, 0);
+}
+
+long getpid(void) {
+    return __syscall(39, 0, 0, 0, 0, 0, 0);
+}
+
+void exit(int code) {
+    __syscall(60, code, 0, 0, 0, 0, 0);
+    __builtin_unreachable();
+}
+
+static inline uint64_t rdtsc(void) {
+    uint32_t lo, hi;
+    __asm__ volatile ("lfence; rdtsc" : "=a"(lo), "=d"(hi) : : "memory");
+    return ((uint64_t)hi << 32) | lo;
+}
+
+void write_uint(unsigned long val) {
+    char buf[24];
+    char *p = buf + sizeof(buf);
+    if (val == 0) *--p = '0';
+    while (val) { *--p = '0' + (val % 10); val /= 10; }
+    write(1, p, buf + sizeof(buf) - p);
+}
+
+void _start() {
+    // Timer interrupts land in some batches, the best one is the steady state
+    uint64_t best = UINT64_MAX, total = 0;
+    for (int batch = 0; batch < BATCHES; ++batch) {
+        uint64_t start = rdtsc();
+        for (int i = 0; i < ROUNDS; ++i) getpid();
+        uint64_t cycles = rdtsc() - start;
+
+        total += cycles;
+        if (cycles < best) best = cycles;
+    }
+
+    write(1, "nullsys: ", 9);
+    write_uint((unsigned long)(best / ROUNDS));
+    write(1, " cycles per syscall (best), ", 28);
+    write_uint((unsigned long)(total / ((uint64_t)BATCHES * ROUNDS)));
+    write(1, " average\n", 9);
+    exit(0);
+    __builtin_unreachable();
+}
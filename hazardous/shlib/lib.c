@@ -0,0 +1,51 @@
+// libhazard.so: the bits of a libc the sample programs need, linked in by
+// the kernel at spawn time and shared by everyone using it.
+
+#include <stddef.h>
+
+int hz_calls = 0;
+
+static inline long hz_syscall(long n, long a1, long a2, long a3)
+{
+    long ret;
+    __asm__ volatile (
+        "syscall"
+        : "=a"(ret)
+        : "a"(n), "D"(a1), "S"(a2), "d"(a3)
+        : "rcx", "r11", "memory"
+    );
+    return ret;
+}
+
+size_t hz_strlen(const char *s)
+{
+    size_t len = 0;
+    while (s[len]) len++;
+    return len;
+}
+
+long hz_write(int fd, const void *buf, size_t len)
+{
+    hz_calls++;
+    return hz_syscall(1, fd, (long)buf, (long)len);
+}
+
+void hz_puts(const char *s)
+{
+    hz_write(1, s, hz_strlen(s));
+}
+
+void hz_put_uint(unsigned long val)
+{
+    char buf[24];
+    char *p = buf + sizeof(buf);
+    if (val == 0) *--p = '0';
+    while (val) { *--p = '0' + (val % 10); val /= 10; }
+    hz_write(1, p, buf + sizeof(buf) - p);
+}
+
+void hz_exit(int code)
+{
+    hz_syscall(60, code, 0, 0);
+    __builtin_unreachable();
+}
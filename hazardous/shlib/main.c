@@ -0,0 +1,19 @@
+// Dynamically linked against libhazard.so. Calls go through the PLT and
+// hz_calls through the GOT, both filled in by the kernel before we start.
+
+#include <stddef.h>
+
+extern int hz_calls;
+
+void hz_puts(const char *s);
+void hz_put_uint(unsigned long val);
+void hz_exit(int code);
+
+void _start() {
+    hz_puts("shlib: hello from a shared library\n");
+    hz_puts("shlib: ");
+    hz_put_uint((unsigned long)hz_calls);
+    hz_puts(" calls into libhazard.so so far\n");
+    hz_exit(hz_calls == 3 ? 0 : 1);
+    __builtin_unreachable();
+}
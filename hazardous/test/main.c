@@ -1,4 +1,18 @@
 #include <stddef.h>
+#include <stdint.h>
+
+#include <xencore/timer/xentime.h>
+#include <xencore/hazardous/xenring.h>
+
+struct timespec {
+    long tv_sec;
+    long tv_nsec;
+};
+
+struct iovec {
+    void *base;
+    size_t len;
+};
 
 static inline long __syscall(
     long n,
@@ -28,11 +42,98 @@ long write(int fd, const void *buf, size_t len) {
     return __syscall(1, fd, (long)buf, len, 0, 0, 0);
 }
 
+long read(int fd, void *buf, size_t len) {
+    return __syscall(0, fd, (long)buf, len, 0, 0, 0);
+}
+
+long open(const char *path, int flags) {
+    return __syscall(2, (long)path, flags, 0, 0, 0, 0);
+}
+
+long close(int fd) {
+    return __syscall(3, fd, 0, 0, 0, 0, 0);
+}
+
+long fstat_size(int fd) {
+    long st[18];    /* struct stat, st_size is the seventh word */
+    if (__syscall(5, fd, (long)st, 0, 0, 0, 0) < 0) return -1;
+    return st[6];
+}
+
+long lseek(int fd, long offset, int whence) {
+    return __syscall(8, fd, offset, whence, 0, 0, 0);
+}
+
+long pread(int fd, void *buf, size_t len, long offset) {
+    return __syscall(17, fd, (long)buf, len, offset, 0, 0);
+}
+
+long pwrite(int fd, const void *buf, size_t len, long offset) {
+    return __syscall(18, fd, (long)buf, len, offset, 0, 0);
+}
+
+long ftruncate(int fd, long length) {
+    return __syscall(77, fd, length, 0, 0, 0, 0);
+}
+
+long readv(int fd, const struct iovec *iov, int count) {
+    return __syscall(19, fd, (long)iov, count, 0, 0, 0);
+}
+
+long getdents64(int fd, void *buf, size_t len) {
+    return __syscall(217, fd, (long)buf, len, 0, 0, 0);
+}
+
+long mmap_anon(unsigned long len) {
+    return __syscall(9, 0, len, 0x3 /* PROT_READ | PROT_WRITE */, 0x22 /* MAP_PRIVATE | MAP_ANONYMOUS */, -1, 0);
+}
+
+long munmap(long addr, unsigned long len) {
+    return __syscall(11, addr, len, 0, 0, 0, 0);
+}
+
+long brk(long addr) {
+    return __syscall(12, addr, 0, 0, 0, 0, 0);
+}
+
+int fork(void) {
+    return (int)__syscall(57, 0, 0, 0, 0, 0, 0);
+}
+
+long wait4(long pid, int *status) {
+    return __syscall(61, pid, (long)status, 0, 0, 0, 0);
+}
+
+long ring_setup(unsigned flags) {
+    return __syscall(501, flags, 0, 0, 0, 0, 0);
+}
+
+long ring_enter(unsigned min_complete) {
+    return __syscall(502, min_complete, 0, 0, 0, 0, 0);
+}
+
 void exit(int code) {
     __syscall(60, code, 0, 0, 0, 0, 0);
     __builtin_unreachable();
 }
 
+// Served from the kernel's read-only time page, no syscall involved
+int clock_gettime(int clock_id, struct timespec *ts) {
+    const struct XenTimePage *page = (const struct XenTimePage *)XENTIME_USER_ADDR;
+    uint64_t ns = xentime_read(page, clock_id);
+    ts->tv_sec = (long)(ns / 1000000000);
+    ts->tv_nsec = (long)(ns % 1000000000);
+    return 0;
+}
+
+void write_uint(unsigned long val) {
+    char buf[24];
+    char *p = buf + sizeof(buf);
+    if (val == 0) *--p = '0';
+    while (val) { *--p = '0' + (val % 10); val /= 10; }
+    write(1, p, buf + sizeof(buf) - p);
+}
+
 const char hello_strings[5][46] = {
     "Hello, World!\n",
     "Welcome to Xencore!\n",
@@ -45,10 +146,137 @@ const size_t hello_lengths[] = {
     14, 20, 41, 46, 9
 };
 
-void _start() {
+// Queue every string and trap once for the lot. Returns 0 if the kernel
+// has no ring for us.
+int write_all_ring(void) {
+    long addr = ring_setup(0);
+    if (addr < 0) return 0;
+
+    struct XenRing *ring = (struct XenRing *)addr;
+    uint32_t tail = ring->sq_tail;
     for (int i = 0; i < 5; ++i) {
-        write(1, hello_strings[i], hello_lengths[i]);
+        struct XenRingSqe *sqe = xenring_get_sqe(ring, &tail);
+        sqe->opcode = XENRING_OP_WRITE;
+        sqe->fd = 1;
+        sqe->addr = (uint64_t)hello_strings[i];
+        sqe->len = hello_lengths[i];
+        sqe->user_data = i;
     }
+    xenring_publish(ring, tail);
+    ring_enter(5);
+
+    while (xenring_peek_cqe(ring)) xenring_cqe_seen(ring);
+    return 1;
+}
+
+// A large reservation only costs the pages that are touched
+int check_memory(void) {
+    const unsigned long len = 1UL << 30;
+    long addr = mmap_anon(len);
+    if (addr < 0) return 0;
+
+    volatile char *mem = (volatile char *)addr;
+    mem[0] = 1;
+    mem[len / 2] = 2;
+    mem[len - 1] = 3;
+    int ok = mem[0] == 1 && mem[len / 2] == 2 && mem[len - 1] == 3;
+    munmap(addr, len);
+
+    long base = brk(0);
+    if (brk(base + 8192) != base + 8192) return 0;
+    ((volatile char *)base)[8191] = 4;
+    brk(base);
+    return ok;
+}
+
+// The child scribbles over its copy of a page, the parent's stays intact
+int check_fork(void) {
+    static volatile long shared_page[512] __attribute__((aligned(4096))) = { 42 };
+
+    long pid = fork();
+    if (pid < 0) return 0;
+    if (pid == 0) {
+        shared_page[0] = 7;
+        exit(shared_page[0] == 7 ? 3 : 1);
+    }
+
+    int status = 0;
+    if (wait4(pid, &status) != pid) return 0;
+    return ((status >> 8) & 0xFF) == 3 && shared_page[0] == 42;
+}
+
+static int same_bytes(const char *a, const char *b, size_t len) {
+    for (size_t i = 0; i < len; ++i) if (a[i] != b[i]) return 0;
+    return 1;
+}
+
+// Read our own sample config back through every flavour of read
+int check_files(void) {
+    int fd = (int)open("/test_sample/config.cfg", 0 /* O_RDONLY */);
+    if (fd < 0) return 0;
+
+    char head[8], tail[248], again[8];
+    long size = fstat_size(fd);
+    struct iovec iov[2] = { { head, sizeof(head) }, { tail, sizeof(tail) } };
+    long got = readv(fd, iov, 2);
+    int ok = size > (long)sizeof(head) && got == (size < 256 ? size : 256) &&
+             pread(fd, again, sizeof(again), 0) == sizeof(again) && same_bytes(head, again, sizeof(again)) &&
+             lseek(fd, 0, 2 /* SEEK_END */) == size && read(fd, again, 1) == 0;
+    close(fd);
+    if (!ok || read(fd, again, 1) != -1) return 0;
+
+    // The directory lists the file we just read
+    fd = (int)open("/test_sample", 0200000 /* O_DIRECTORY */);
+    if (fd < 0) return 0;
+    char entries[512] __attribute__((aligned(8)));
+    int found = 0;
+    long len;
+    while (!found && (len = getdents64(fd, entries, sizeof(entries))) > 0) {
+        for (long at = 0; at < len; at += *(unsigned short *)(entries + at + 16)) {
+            if (same_bytes(entries + at + 19, "config.cfg", 11)) found = 1;
+        }
+    }
+    close(fd);
+    return found;
+}
+
+// A new file grows past a hole, appends, then shrinks back
+int check_scratch(void) {
+    int fd = (int)open("/test_sample/scratch.log", 01102 /* O_RDWR | O_CREAT | O_TRUNC */);
+    if (fd < 0) return 0;
+
+    char zeros[8], tail[4];
+    int ok = pwrite(fd, "end", 3, 8192) == 3 && fstat_size(fd) == 8195 &&
+             pread(fd, zeros, sizeof(zeros), 4096) == sizeof(zeros) && same_bytes(zeros, "\0\0\0\0\0\0\0\0", 8) &&
+             lseek(fd, 0, 2 /* SEEK_END */) == 8195 && write(fd, "!", 1) == 1 &&
+             pread(fd, tail, sizeof(tail), 8192) == 4 && same_bytes(tail, "end!", 4) &&
+             ftruncate(fd, 10) == 0 && fstat_size(fd) == 10 && pread(fd, tail, sizeof(tail), 8192) == 0;
+    close(fd);
+    return ok;
+}
+
+void _start() {
+    if (check_memory()) write(1, "mmap/brk ok\n", 12);
+    else write(1, "mmap/brk FAILED\n", 16);
+    if (check_fork()) write(1, "fork ok\n", 8);
+    else write(1, "fork FAILED\n", 12);
+    if (check_files()) write(1, "files ok\n", 9);
+    else write(1, "files FAILED\n", 13);
+    if (check_scratch()) write(1, "scratch ok\n", 11);
+    else write(1, "scratch FAILED\n", 15);
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (!write_all_ring()) {
+        for (int i = 0; i < 5; ++i) {
+            write(1, hello_strings[i], hello_lengths[i]);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    long elapsed = (end.tv_sec - start.tv_sec) * 1000000000 + (end.tv_nsec - start.tv_nsec);
+    write(1, "Writes took ", 12);
+    write_uint((unsigned long)elapsed);
+    write(1, " ns\n", 4);
     exit(0);
     __builtin_unreachable();
 }
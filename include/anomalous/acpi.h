@@ -0,0 +1,9 @@
+#ifndef _AM_ACPI_H
+#define _AM_ACPI_H
+
+#include <xencore/acpi/acpi.h>
+#include <efi.h>
+
+EFI_STATUS locate_acpi(EFI_SYSTEM_TABLE *SystemTable, struct AcpiParams *params);
+
+#endif
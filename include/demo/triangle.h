@@ -1,9 +1,13 @@
 #ifndef _DEMO_TRIANGLE_H
 #define _DEMO_TRIANGLE_H
 
+#include <stdint.h>
+
 #include <xencore/xenlib/math.h>
 #include <xencore/graphics/framebuffer.h>
 
+#define DEMO_FRAME_NS 16666667ULL // 60 Hz
+
 struct DemoTriangleState {
     float angle;
     fb_color_t clear_color;
@@ -11,6 +15,7 @@ struct DemoTriangleState {
     vector2 v1;
     vector2 v2;
     vector2 v3;
+    uint64_t next_frame_ns;
 };
 
 struct DemoTriangleState demo_triangle_init(void);
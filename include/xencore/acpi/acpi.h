@@ -0,0 +1,38 @@
+#ifndef _ACPI_H
+#define _ACPI_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+struct AcpiParams {
+    uint64_t rsdp;
+};
+
+struct __attribute__((packed)) AcpiRsdp {
+    char     signature[8];
+    uint8_t  checksum;
+    char     oem_id[6];
+    uint8_t  revision;
+    uint32_t rsdt_address;
+    uint32_t length;
+    uint64_t xsdt_address;
+    uint8_t  extended_checksum;
+    uint8_t  reserved[3];
+};
+
+struct __attribute__((packed)) AcpiSdtHeader {
+    char     signature[4];
+    uint32_t length;
+    uint8_t  revision;
+    uint8_t  checksum;
+    char     oem_id[6];
+    char     oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+};
+
+void acpi_init(struct AcpiParams *params);
+struct AcpiSdtHeader *acpi_find_table(const char *signature);
+
+#endif
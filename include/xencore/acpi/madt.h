@@ -0,0 +1,50 @@
+#ifndef _MADT_H
+#define _MADT_H
+
+#include <stdint.h>
+
+#include <xencore/acpi/acpi.h>
+#include <xencore/smp/cpu.h>
+
+#define MADT_LOCAL_APIC       0
+#define MADT_IO_APIC          1
+#define MADT_LAPIC_ENABLED    (1u << 0)
+#define MADT_LAPIC_ONLINE_CAP (1u << 1)
+
+struct __attribute__((packed)) AcpiMadt {
+    struct AcpiSdtHeader header;
+    uint32_t lapic_address;
+    uint32_t flags;
+    uint8_t  entries[];
+};
+
+struct __attribute__((packed)) MadtEntryHeader {
+    uint8_t type;
+    uint8_t length;
+};
+
+struct __attribute__((packed)) MadtLocalApic {
+    struct MadtEntryHeader header;
+    uint8_t  processor_id;
+    uint8_t  apic_id;
+    uint32_t flags;
+};
+
+struct __attribute__((packed)) MadtIoApic {
+    struct MadtEntryHeader header;
+    uint8_t  ioapic_id;
+    uint8_t  reserved;
+    uint32_t address;
+    uint32_t gsi_base;
+};
+
+struct MadtInfo {
+    uint32_t lapic_count;
+    uint8_t  lapic_ids[MAX_CPUS];
+    uint64_t lapic_address;
+    uint64_t ioapic_address;
+};
+
+bool madt_parse(struct MadtInfo *info);
+
+#endif
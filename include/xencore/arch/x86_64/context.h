@@ -0,0 +1,13 @@
+#ifndef _CONTEXT_H
+#define _CONTEXT_H
+
+#include <stdint.h>
+
+struct Thread;
+
+typedef void (*context_entry_t)(void *arg);
+
+uint64_t context_init_stack(uint64_t stack_top, context_entry_t entry, void *arg);
+void context_switch(struct Thread *prev, struct Thread *next);
+
+#endif
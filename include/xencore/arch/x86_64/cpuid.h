@@ -0,0 +1,38 @@
+#ifndef _CPUID_H
+#define _CPUID_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define CPUID_1_ECX_PCID           (1u << 17)
+#define CPUID_1_ECX_TSC_DEADLINE   (1u << 24)
+#define CPUID_1_ECX_XSAVE          (1u << 26)
+#define CPUID_1_ECX_AVX            (1u << 28)
+#define CPUID_7_EBX_AVX2           (1u << 5)
+#define CPUID_7_EBX_INVPCID        (1u << 10)
+#define CPUID_D1_EAX_XSAVEOPT      (1u << 0)
+#define CPUID_80000001_EDX_NX      (1u << 20)
+#define CPUID_80000007_EDX_INVTSC  (1u << 8)
+
+struct CPUIDResult {
+    uint32_t eax;
+    uint32_t ebx;
+    uint32_t ecx;
+    uint32_t edx;
+};
+
+static inline struct CPUIDResult cpuid(uint32_t leaf, uint32_t subleaf) {
+    struct CPUIDResult r;
+    __asm__ volatile (
+        "cpuid"
+        : "=a"(r.eax), "=b"(r.ebx), "=c"(r.ecx), "=d"(r.edx)
+        : "a"(leaf), "c"(subleaf)
+    );
+    return r;
+}
+
+static inline uint32_t cpuid_max_leaf(uint32_t base) {
+    return cpuid(base, 0).eax;
+}
+
+#endif
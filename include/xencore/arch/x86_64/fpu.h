@@ -1,6 +1,27 @@
 #ifndef _FPU_H
 #define _FPU_H
 
+#include <stdint.h>
+#include <stdbool.h>
+
+#define XCR0_X87 (1ULL << 0)
+#define XCR0_SSE (1ULL << 1)
+#define XCR0_AVX (1ULL << 2)
+
+struct Thread;
+
 void enable_fpu_sse(void);
+void fpu_init(void);
+uint32_t fpu_get_state_size(void);
+
+void *fpu_state_alloc(void);
+void fpu_state_free(void *state);
+
+void fpu_adopt(struct Thread *thread);
+void fpu_copy_state(struct Thread *dst, const struct Thread *src);
+void fpu_switch(struct Thread *prev, struct Thread *next);
+void fpu_handle_nm(void);
+void fpu_irq_enter(void);
+void fpu_irq_exit(void);
 
 #endif
@@ -35,5 +35,6 @@ struct __attribute__((packed)) GDTPtr {
 };
 
 void setup_gdt();
+void setup_gdt_cpu(uint32_t cpu);
 
 #endif
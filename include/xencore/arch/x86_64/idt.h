@@ -23,5 +23,6 @@ struct __attribute__((packed)) IDTPtr {
 
 void set_idt_entry(int vector, void* isr, uint8_t ist);
 void setup_idt(void);
+void load_idt(void);
 
 #endif
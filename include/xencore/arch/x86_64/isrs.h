@@ -9,15 +9,17 @@ struct __attribute__((packed)) interrupt_frame {
     uint64_t rflags;
 };
 
-typedef void (*isr_t)(struct interrupt_frame*);
-typedef void (*isr_err_t)(struct interrupt_frame*, uint64_t);
-
-void isr_divide_by_zero(struct interrupt_frame* frame);
-void isr_general_protection(struct interrupt_frame* frame, uint64_t error_code);
-void isr_page_fault(struct interrupt_frame* frame, uint64_t error_code);
-void isr_double_fault(struct interrupt_frame* frame, uint64_t error_code);
-void isr_timer(__attribute__((unused)) struct interrupt_frame* frame);
-void isr_default(struct interrupt_frame* frame);
-void isr_default_err(struct interrupt_frame* frame, uint64_t error_code);
+// Entry stubs for the IDT, see isrs.c
+void isr_divide_by_zero(void);
+void isr_device_not_available(void);
+void isr_general_protection(void);
+void isr_page_fault(void);
+void isr_double_fault(void);
+void isr_lapic_timer(void);
+void isr_resched(void);
+void isr_tlb_shootdown(void);
+void isr_spurious(void);
+void isr_default(void);
+void isr_default_err(void);
 
 #endif
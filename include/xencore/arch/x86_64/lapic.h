@@ -0,0 +1,22 @@
+#ifndef _LAPIC_H
+#define _LAPIC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define LAPIC_TIMER_VECTOR    0x40
+#define LAPIC_RESCHED_VECTOR  0x41
+#define LAPIC_TLB_VECTOR      0x42
+#define LAPIC_SPURIOUS_VECTOR 0xFF
+
+void setup_lapic(void);
+uint32_t lapic_id(void);
+void lapic_eoi(void);
+void lapic_send_init(uint32_t apic_id);
+void lapic_send_sipi(uint32_t apic_id, uint8_t page);
+void lapic_send_ipi(uint32_t apic_id, uint8_t vector);
+bool lapic_has_tsc_deadline(void);
+void lapic_timer_arm(uint64_t deadline_tsc);
+void lapic_timer_disarm(void);
+
+#endif
@@ -3,6 +3,14 @@
 
 #include <stdint.h>
 
+#define MSR_EFER            0xC0000080
+#define MSR_FS_BASE         0xC0000100
+#define MSR_GS_BASE         0xC0000101
+#define MSR_KERNEL_GS_BASE  0xC0000102
+
+#define EFER_SCE            (1ULL << 0)     /* SYSCALL/SYSRET */
+#define EFER_NXE            (1ULL << 11)    /* PAGE_NX is honoured */
+
 static inline void wrmsr(uint32_t msr, uint64_t val) {
     uint32_t lo = (uint32_t)val;
     uint32_t hi = (uint32_t)(val >> 32);
@@ -3,33 +3,57 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <stdbool.h>
 
 #include <xencore/xenmem/mem_entry.h>
 
 #define PAGE_SIZE_4KB   0x1000
 #define PAGE_SIZE_2MB   0x200000
 #define VIRT_HEAP_BASE  0xFFFF800000000000ULL
+#define PHYS_MAP_BASE   0xFFFF900000000000ULL  // All RAM, offset by this
 #define HEAP_MIN_SIZE   512     // In 4 KiB pages
 
 #define PAGE_PRESENT  (1ULL << 0)
 #define PAGE_RW       (1ULL << 1)
 #define PAGE_USER     (1ULL << 2)
+#define PAGE_PWT      (1ULL << 3)
+#define PAGE_PCD      (1ULL << 4)
 #define PAGE_PS       (1ULL << 7)
+#define PAGE_PRIVATE  (1ULL << 9)   // Table belongs to one address space
+#define PAGE_OWNED    (1ULL << 10)  // Frame is freed with the address space
 #define PAGE_NX       (1ULL << 63)
 
+#define PAGE_ADDR_MASK  0x000FFFFFFFFFF000ULL
+
 struct MemoryMapParams {
     struct MemoryMapEntry *memory_map;
     size_t memory_map_size;
     size_t descriptor_size;
 };
 
+extern uint64_t kernel_pml4[512];
+extern uint64_t page_nx;        // PAGE_NX if the CPU has it, 0 otherwise
+
+// Kernel view of any physical RAM address
+static inline void *phys_to_virt(uint64_t phys)
+{
+    return (void *)(phys + PHYS_MAP_BASE);
+}
+
 uint64_t virt_to_phys(uint64_t virt);
 void *early_alloc_page(void);
+void paging_init_cpu(void);
 void load_pml4(uint64_t *pml4);
 uint64_t *create_user_pml4(void);
 void map_range(uint64_t *pml4, uint64_t virt_start, uint64_t phys_start, uint64_t size, uint64_t flags);
-void map_user_segment(uint64_t *user_pml4, uint64_t virt, uint64_t phys, uint64_t size);
+void free_user_pml4(uint64_t *user_pml4);
+bool map_user_page(uint64_t *user_pml4, uint64_t virt, uint64_t phys, uint64_t flags);
+uint64_t user_lookup_pte(uint64_t *user_pml4, uint64_t virt);
+uint64_t user_next_table(uint64_t *user_pml4, uint64_t virt);
+uint64_t unmap_user_page(uint64_t *user_pml4, uint64_t virt);
+bool copy_user_range(uint64_t *dst, uint64_t *src, uint64_t start, uint64_t end, bool cow);
 void map_identity(struct MemoryMapEntry *entry);
+void map_mmio(uint64_t phys, uint64_t size);
 size_t map_virtual(struct MemoryMapEntry *entry);
 void setup_paging(struct MemoryMapParams *params, uint64_t fb_base, size_t fb_size);
 
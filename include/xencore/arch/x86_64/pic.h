@@ -2,5 +2,6 @@
 #define _PIC_H
 
 void remap_pic();
+void mask_pic();
 
 #endif
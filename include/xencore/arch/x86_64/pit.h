@@ -3,6 +3,6 @@
 
 #include <stdint.h>
 
-void setup_pit(uint32_t hz);
+uint64_t pit_measure_tsc(uint32_t ms);
 
 #endif
@@ -0,0 +1,19 @@
+#ifndef _RTC_H
+#define _RTC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+struct RTCTime {
+    uint16_t year;
+    uint8_t  month;
+    uint8_t  day;
+    uint8_t  hour;
+    uint8_t  minute;
+    uint8_t  second;
+};
+
+struct RTCTime rtc_read(void);
+uint64_t rtc_read_unix(void);
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef _SMPBOOT_H
+#define _SMPBOOT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Real-mode entry page for APs, must sit below 1 MiB and be 4 KiB aligned
+#define SMP_TRAMPOLINE_BASE     0x8000
+#define SMP_TRAMPOLINE_BASE_STR "0x8000"
+
+bool smp_prepare_trampoline(void);
+void smp_boot_ap(uint32_t cpu, uint32_t apic_id, uint64_t boot_stack, uint64_t rsp0, uint64_t ist1);
+
+#endif
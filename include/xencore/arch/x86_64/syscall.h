@@ -1,11 +1,51 @@
 #ifndef _SYSCALL_H
 #define _SYSCALL_H
 
-#define SYS_WRITE 1
-#define SYS_EXIT  60
+#include <stdint.h>
 
-#define SYSCALL_STACK_SIZE 0x1000
+#define SYS_READ                0
+#define SYS_WRITE               1
+#define SYS_OPEN                2
+#define SYS_CLOSE               3
+#define SYS_FSTAT               5
+#define SYS_LSEEK               8
+#define SYS_MMAP                9
+#define SYS_MUNMAP              11
+#define SYS_BRK                 12
+#define SYS_PREAD64             17
+#define SYS_PWRITE64            18
+#define SYS_READV               19
+#define SYS_WRITEV              20
+#define SYS_SCHED_YIELD         24
+#define SYS_GETPID              39
+#define SYS_FORK                57
+#define SYS_EXIT                60
+#define SYS_WAIT4               61
+#define SYS_FTRUNCATE           77
+#define SYS_GETPPID             110
+#define SYS_SCHED_SETAFFINITY   203
+#define SYS_GETDENTS64          217
+
+// HLOS specific
+#define SYS_SPAWN               500
+#define SYS_RING_SETUP          501
+#define SYS_RING_ENTER          502
+
+#define SYSCALL_COUNT           512     /* size of the dispatch table */
+
+// Kernel stack of a thread inside fork(), lowest address first: the
+// callee-saved registers pushed by sys_fork, then what syscall_entry saved
+struct SyscallFrame {
+    uint64_t rbx, rbp, r12, r13, r14, r15;
+    uint64_t kernel_rip;    /* back into syscall_entry */
+    uint64_t pad;
+    uint64_t r9, r8, r10, rdx, rsi, rdi;
+    uint64_t rflags;        /* from r11 */
+    uint64_t rip;           /* from rcx */
+    uint64_t rsp;
+};
 
 void setup_syscall(void);
+void syscall_init_cpu(void);
 
 #endif
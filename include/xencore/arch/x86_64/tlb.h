@@ -0,0 +1,39 @@
+#ifndef _TLB_H
+#define _TLB_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define CR4_PCIDE       (1ULL << 17)
+#define CR3_NOFLUSH     (1ULL << 63)
+#define CR3_PCID_MASK   0xFFFULL
+
+#define PCID_SLOTS      8           /* per CPU, PCID 0 is the kernel */
+
+#define TLB_FLUSH_ALL        UINT64_MAX  /* range end meaning "everything" */
+#define TLB_FLUSH_ALL_PAGES  32          /* beyond this, drop the whole PCID */
+#define TLB_QUEUE_LEN        16          /* pending requests per target CPU */
+#define TLB_BATCH_RANGES     8
+
+struct AddressSpace;
+
+// Revocations collected by one unmap operation and flushed together
+struct TlbBatch {
+    struct AddressSpace *as;
+    uint64_t start[TLB_BATCH_RANGES];
+    uint64_t end[TLB_BATCH_RANGES];
+    uint32_t count;
+    bool full;                     /* too much to track, flush everything */
+};
+
+void tlb_init_cpu(void);
+bool tlb_pcid_enabled(void);
+void tlb_switch_to(struct AddressSpace *as);
+void tlb_flush_range(struct AddressSpace *as, uint64_t start, uint64_t end);
+
+void tlb_batch_init(struct TlbBatch *batch, struct AddressSpace *as);
+void tlb_batch_add(struct TlbBatch *batch, uint64_t start, uint64_t end);
+void tlb_batch_flush(struct TlbBatch *batch);
+void tlb_shootdown_interrupt(void);
+
+#endif
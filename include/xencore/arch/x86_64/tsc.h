@@ -0,0 +1,24 @@
+#ifndef _TSC_H
+#define _TSC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+static inline uint64_t rdtsc(void) {
+    uint32_t lo, hi;
+    __asm__ volatile ("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+void calibrate_tsc(void);
+bool tsc_is_invariant(void);
+uint64_t tsc_get_hz(void);
+uint64_t tsc_get_base(void);
+uint64_t tsc_get_ns_mult(void);
+uint64_t tsc_to_ns(uint64_t cycles);
+uint64_t ns_to_tsc(uint64_t ns);
+uint64_t tsc_ns(void);
+uint64_t tsc_at_ns(uint64_t ns);
+void tsc_delay_ns(uint64_t ns);
+
+#endif
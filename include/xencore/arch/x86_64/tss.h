@@ -3,6 +3,9 @@
 
 #include <stdint.h>
 
+#define KERNEL_STACK_SIZE 16384
+#define IST_STACK_SIZE    4096
+
 struct __attribute__((packed)) TSS {
     uint32_t reserved0;
     uint64_t rsp0;
@@ -16,5 +19,7 @@ struct __attribute__((packed)) TSS {
 };
 
 void setup_tss();
+void setup_tss_cpu(uint32_t cpu, uint64_t rsp0, uint64_t ist1);
+struct TSS *get_tss(uint32_t cpu);
 
 #endif
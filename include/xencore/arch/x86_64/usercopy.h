@@ -0,0 +1,17 @@
+#ifndef _USERCOPY_H
+#define _USERCOPY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// All of these refuse ranges outside user space and fail, rather than
+// fault, when part of the buffer cannot be paged in
+bool copy_from_user(void *dst, uint64_t src, size_t len);
+bool copy_to_user(uint64_t dst, const void *src, size_t len);
+bool clear_user(uint64_t dst, size_t len);
+int64_t copy_string_from_user(char *dst, uint64_t src, size_t max);
+
+uint64_t usercopy_fixup(uint64_t rip);
+
+#endif
@@ -1,6 +1,8 @@
 #ifndef _INTERRUPTS_H
 #define _INTERRUPTS_H
 
+#include <stdint.h>
+
 #include <xencore/xenio/tty.h>
 
 static inline void disable_interrupts()
@@ -30,4 +32,38 @@ static inline void halt()
 #endif
 }
 
+// Atomically re-enable interrupts and halt: sti holds off delivery until
+// after the following instruction, so a wakeup cannot slip in between.
+static inline void wait_for_interrupt()
+{
+#ifdef ARCH_x86_64
+    __asm__ volatile ("sti; hlt" ::: "memory");
+#endif
+}
+
+// Spin-wait hint, eases pressure on the sibling hyperthread
+static inline void cpu_relax()
+{
+#ifdef ARCH_x86_64
+    __asm__ volatile ("pause" ::: "memory");
+#endif
+}
+
+// Disable interrupts, returning the previous flags for irq_restore()
+static inline uint64_t irq_save()
+{
+    uint64_t flags = 0;
+#ifdef ARCH_x86_64
+    __asm__ volatile ("pushfq; pop %0; cli" : "=r"(flags) : : "memory");
+#endif
+    return flags;
+}
+
+static inline void irq_restore(uint64_t flags)
+{
+#ifdef ARCH_x86_64
+    if (flags & (1ULL << 9)) __asm__ volatile ("sti" : : : "memory");
+#endif
+}
+
 #endif
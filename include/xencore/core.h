@@ -7,7 +7,8 @@
 
 #include <xencore/graphics/framebuffer.h>
 #include <xencore/xenfs/test_sample.h>
+#include <xencore/acpi/acpi.h>
 
-void resonance_cascade(struct FramebufferParams fb_params, struct TestSampleParams sample_params, struct MemoryMapParams memmap_params);
+void resonance_cascade(struct FramebufferParams fb_params, struct TestSampleParams sample_params, struct MemoryMapParams memmap_params, struct AcpiParams acpi_params);
 
 #endif
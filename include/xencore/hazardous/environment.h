@@ -3,18 +3,52 @@
 
 #define USER_STACK_TOP   0x00007FFFFFFFE000ULL
 #define USER_STACK_SIZE  (8 * 1024 * 1024) // 8 MiB
+#define USER_SPACE_END   0x0000800000000000ULL
+#define USER_MAP_MIN     0x0000000000010000ULL  // like mmap_min_addr, keeps NULL unmapped
+#define USER_MAP_END     USER_STACK_TOP         // ring and time pages above are the kernel's
+#define USER_BUFFER_END  0x00007FFFFFFFF000ULL  // the time page is nobody's buffer
+#define USER_MMAP_BASE   0x0000100000000000ULL  // mmap() hands out addresses
+#define USER_MMAP_TOP    0x00007F0000000000ULL  // top-down within this range
+#define USER_PIE_BASE    0x0000555555554000ULL  // where ET_DYN programs load
+#define USER_LIB_BASE    0x00007F0000000000ULL  // shared libraries, a range each
+#define USER_LIB_TOP     (USER_STACK_TOP - USER_STACK_SIZE)
 
 #include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
 
 #include <xencore/hazardous/xenloader.h>
 
+struct AddressSpace;
+struct ExecImage;
+struct SyscallFrame;
+
 struct HazardousContext {
-    uint64_t *page_table;
+    struct AddressSpace *aspace;
     uint64_t entry_point;
     uint64_t stack_top;
+    uint64_t load_base;            /* of the program, 0 unless PIE */
+    struct SyscallFrame *resume;   /* fork child: registers to return with */
 };
 
-struct HazardousContext *setup_hazardous_environment(Elf64 *elf);
+// Reject buffers that reach into the kernel half
+static inline bool user_range_ok(uint64_t addr, size_t len)
+{
+    return addr < USER_BUFFER_END && len <= USER_BUFFER_END - addr;
+}
+
+// Ranges mmap(), munmap() and the loader may place or remove mappings in.
+// Code can never sit in the last user page, whose end is not canonical.
+// The lowest 64 KiB stay unmapped, so a stray kernel NULL dereference
+// faults rather than reading memory a program placed there.
+static inline bool user_map_ok(uint64_t addr, size_t len)
+{
+    return addr >= USER_MAP_MIN && addr < USER_MAP_END && len <= USER_MAP_END - addr;
+}
+
+struct HazardousContext *setup_hazardous_environment(const struct ExecImage *image);
+struct HazardousContext *fork_hazardous_environment(struct HazardousContext *parent, const struct SyscallFrame *frame);
+void teardown_hazardous_environment(struct HazardousContext *ctx);
 void enter_hazardous_environment(struct HazardousContext *ctx);
 
 #endif
@@ -0,0 +1,85 @@
+#ifndef _FILEIO_H
+#define _FILEIO_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// open() flags, Linux values
+#define O_RDONLY        00
+#define O_WRONLY        01
+#define O_RDWR          02
+#define O_ACCMODE       03
+#define O_CREAT         0100
+#define O_EXCL          0200
+#define O_TRUNC         01000
+#define O_APPEND        02000
+#define O_DIRECTORY     0200000
+
+#define SEEK_SET        0
+#define SEEK_CUR        1
+#define SEEK_END        2
+
+#define S_IFMT          0170000
+#define S_IFDIR         0040000
+#define S_IFCHR         0020000
+#define S_IFREG         0100000
+#define S_IFLNK         0120000
+
+// d_type
+#define DT_UNKNOWN      0
+#define DT_CHR          2
+#define DT_DIR          4
+#define DT_REG          8
+#define DT_LNK          10
+
+#define FILEIO_IOV_MAX  1024
+
+// struct stat as x86_64 Linux lays it out
+struct fileio_stat {
+    uint64_t st_dev;
+    uint64_t st_ino;
+    uint64_t st_nlink;
+    uint32_t st_mode;
+    uint32_t st_uid;
+    uint32_t st_gid;
+    uint32_t pad0;
+    uint64_t st_rdev;
+    int64_t st_size;
+    int64_t st_blksize;
+    int64_t st_blocks;
+    int64_t st_atime_sec, st_atime_nsec;
+    int64_t st_mtime_sec, st_mtime_nsec;
+    int64_t st_ctime_sec, st_ctime_nsec;
+    int64_t reserved[3];
+};
+
+// One getdents64() record, padded to 8 bytes
+struct fileio_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;              /* position of the next record */
+    uint16_t d_reclen;
+    uint8_t d_type;
+    char d_name[];
+} __attribute__((packed));
+
+struct fileio_iovec {
+    uint64_t base;
+    uint64_t len;
+};
+
+struct Process;
+
+int64_t fileio_open(struct Process *proc, const char *path, uint32_t flags);
+int64_t fileio_close(struct Process *proc, int fd);
+int64_t fileio_read(struct Process *proc, int fd, uint64_t buf, size_t len);
+int64_t fileio_write(struct Process *proc, int fd, uint64_t buf, size_t len);
+int64_t fileio_pread(struct Process *proc, int fd, uint64_t buf, size_t len, int64_t offset);
+int64_t fileio_pwrite(struct Process *proc, int fd, uint64_t buf, size_t len, int64_t offset);
+int64_t fileio_readv(struct Process *proc, int fd, uint64_t iov, int count);
+int64_t fileio_writev(struct Process *proc, int fd, uint64_t iov, int count);
+int64_t fileio_ftruncate(struct Process *proc, int fd, int64_t length);
+int64_t fileio_lseek(struct Process *proc, int fd, int64_t offset, int whence);
+int64_t fileio_fstat(struct Process *proc, int fd, uint64_t buf);
+int64_t fileio_getdents(struct Process *proc, int fd, uint64_t buf, size_t len);
+
+#endif
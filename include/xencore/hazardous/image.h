@@ -0,0 +1,86 @@
+#ifndef _IMAGE_H
+#define _IMAGE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <xencore/hazardous/xenloader.h>
+#include <xencore/sync/spinlock.h>
+
+struct vfs_node;
+
+// Page-aligned pieces of a loaded PT_LOAD segment: [start, lazy_start) and
+// [lazy_end, end) are anonymous, [lazy_start, lazy_end) maps the file
+// from `offset` on. Pages in [start, lazy_start) and [lazy_end, file_end)
+// mix file data with something else and are built when the image loads.
+struct SegmentLayout {
+    uint64_t start;
+    uint64_t lazy_start;
+    uint64_t lazy_end;
+    uint64_t file_end;          /* first page without file data */
+    uint64_t end;
+    uint64_t offset;
+    uint32_t prot;              /* VMA_* */
+};
+
+// A page built at load time, shared read-only by every process. Pages that
+// mix file data with something else or hold relocated words end up here.
+struct ImagePage {
+    uint64_t vaddr;
+    uint64_t phys;              /* one reference belongs to the cache */
+    uint32_t prot;              /* VMA_* of every segment in the page */
+};
+
+// Dynamic symbol table, pointing into the file
+struct ExecSymbols {
+    const Elf64_Sym *symtab;
+    uint64_t syment;
+    const char *strtab;
+    uint64_t strsz;
+    const uint32_t *gnu_hash;
+};
+
+// Outcome of one lookup in a library, hits and misses alike
+struct SymbolSlot {
+    char *name;                 /* own copy, NULL while the slot is empty */
+    uint32_t hash;
+    bool found;
+    uint64_t value;
+};
+
+// Parsed and relocated program or shared library, built once per VFS node.
+// The cache holds one reference, and so does every user and every image
+// that depends on it.
+struct ExecImage {
+    struct vfs_node *node;
+    uint32_t refs;              /* under the image cache lock */
+    uint64_t generation;        /* of the file when the build started */
+    const uint8_t *data;        /* file bytes parsed, in place or `copy` */
+    uint64_t size;
+    void *copy;                 /* own copy of a file on the page tree */
+    Elf64 *elf;
+    uint64_t load_base;         /* added to every p_vaddr, 0 unless ET_DYN */
+    bool library;
+    struct ImagePage *pages;    /* sorted by address */
+    size_t page_count;
+    size_t page_capacity;
+
+    // Every library needed, directly or not, in search order
+    struct ExecImage **deps;
+    size_t dep_count;
+
+    // Exports, libraries only
+    struct ExecSymbols symbols;
+    struct SymbolSlot *symbol_cache;
+    spinlock_t symbol_lock;
+
+    struct ExecImage *next;
+};
+
+void exec_segment_layout(const Elf64_Phdr *phdr, uint64_t base, struct SegmentLayout *seg);
+struct ExecImage *exec_image_get(struct vfs_node *node);
+void exec_image_put(struct ExecImage *image);
+void exec_image_forget(struct vfs_node *node);
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef _MMAN_H
+#define _MMAN_H
+
+#include <stdint.h>
+
+#define PROT_NONE       0x0
+#define PROT_READ       0x1
+#define PROT_WRITE      0x2
+#define PROT_EXEC       0x4
+
+#define MAP_SHARED      0x01
+#define MAP_PRIVATE     0x02
+#define MAP_FIXED       0x10
+#define MAP_ANONYMOUS   0x20
+
+#define MAP_FAILED      ((uint64_t)-1)
+
+struct Process;
+
+uint64_t mman_mmap(struct Process *proc, uint64_t addr, uint64_t len, uint32_t prot, uint32_t flags, int fd, uint64_t offset);
+int64_t mman_munmap(struct Process *proc, uint64_t addr, uint64_t len);
+uint64_t mman_brk(struct Process *proc, uint64_t addr);
+
+#endif
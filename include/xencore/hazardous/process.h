@@ -0,0 +1,57 @@
+#ifndef _PROCESS_H
+#define _PROCESS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <xencore/hazardous/environment.h>
+#include <xencore/xenfs/vfs.h>
+
+#define PROC_MAX        64
+#define PROC_MAX_FILES  32
+#define PROC_NAME_LEN   32
+
+#define FD_USED     (1u << 0)
+#define FD_CONSOLE  (1u << 1)   /* tty, no VFS node behind it */
+#define FD_READ     (1u << 2)
+#define FD_WRITE    (1u << 3)
+#define FD_APPEND   (1u << 4)   /* every write goes to the end */
+
+struct XenRingCtx;
+struct SyscallFrame;
+
+typedef enum {
+    PROC_FREE,
+    PROC_RUNNING,
+    PROC_ZOMBIE
+} proc_state_t;
+
+struct FileDesc {
+    vfs_node_t *node;
+    uint64_t offset;            /* child index for directories */
+    uint32_t flags;
+};
+
+struct Process {
+    int32_t pid;
+    volatile proc_state_t state;
+    int exit_code;
+    bool orphan;                   /* parent is gone, nobody will wait */
+    struct Process *parent;        /* NULL if spawned by the kernel */
+    struct Thread *thread;         /* main thread, owns the kernel stack */
+    struct HazardousContext *env;  /* address space and entry point */
+    struct FileDesc files[PROC_MAX_FILES];
+    struct XenRingCtx *ring;       /* submission ring, NULL until set up */
+    char name[PROC_NAME_LEN];
+};
+
+void process_init(void);
+int32_t process_spawn(const char *path);
+int32_t process_fork(const struct SyscallFrame *frame);
+int32_t process_wait(int32_t pid, int *exit_code);
+__attribute__((noreturn)) void process_exit(int code);
+struct Process *current_process(void);
+int32_t process_parent_pid(struct Process *proc);
+struct FileDesc *process_get_fd(struct Process *proc, int fd);
+
+#endif
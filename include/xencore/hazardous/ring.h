@@ -0,0 +1,14 @@
+#ifndef _RING_H
+#define _RING_H
+
+#include <stdint.h>
+
+#include <xencore/hazardous/xenring.h>
+
+struct Process;
+
+int64_t xenring_setup(struct Process *proc, uint32_t flags);
+int64_t xenring_enter(struct Process *proc, uint32_t min_complete);
+void xenring_destroy(struct Process *proc);
+
+#endif
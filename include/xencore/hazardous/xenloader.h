@@ -4,7 +4,50 @@
 #include <stdint.h>
 #include <stdbool.h>
 
-#define PT_LOAD 1
+#define ET_EXEC     2
+#define ET_DYN      3
+
+#define PT_LOAD     1
+#define PT_DYNAMIC  2
+#define PT_INTERP   3
+
+// p_flags
+#define PF_X    (1u << 0)
+#define PF_W    (1u << 1)
+#define PF_R    (1u << 2)
+
+// d_tag
+#define DT_NULL     0
+#define DT_NEEDED   1
+#define DT_PLTRELSZ 2
+#define DT_STRTAB   5
+#define DT_SYMTAB   6
+#define DT_RELA     7
+#define DT_RELASZ   8
+#define DT_RELAENT  9
+#define DT_STRSZ    10
+#define DT_SYMENT   11
+#define DT_PLTREL   20
+#define DT_JMPREL   23
+#define DT_RELRSZ   35
+#define DT_RELR     36
+#define DT_RELRENT  37
+#define DT_GNU_HASH 0x6ffffef5
+
+// Relocation types
+#define R_X86_64_NONE       0
+#define R_X86_64_64         1
+#define R_X86_64_GLOB_DAT   6
+#define R_X86_64_JUMP_SLOT  7
+#define R_X86_64_RELATIVE   8
+
+#define ELF64_R_SYM(info)   ((uint32_t)((info) >> 32))
+#define ELF64_R_TYPE(info)  ((uint32_t)(info))
+#define ELF64_ST_BIND(info) ((info) >> 4)
+
+#define STB_LOCAL   0
+#define STB_WEAK    2
+#define SHN_UNDEF   0
 
 typedef struct {
     unsigned char e_ident[16];
@@ -34,6 +77,26 @@ typedef struct {
     uint64_t p_align;
 } __attribute__((packed)) Elf64_Phdr;
 
+typedef struct {
+    int64_t d_tag;
+    uint64_t d_val;
+} __attribute__((packed)) Elf64_Dyn;
+
+typedef struct {
+    uint64_t r_offset;
+    uint64_t r_info;
+    int64_t r_addend;
+} __attribute__((packed)) Elf64_Rela;
+
+typedef struct {
+    uint32_t st_name;
+    uint8_t st_info;
+    uint8_t st_other;
+    uint16_t st_shndx;
+    uint64_t st_value;
+    uint64_t st_size;
+} __attribute__((packed)) Elf64_Sym;
+
 typedef struct {
     uint32_t s_name;
     uint32_t s_type;
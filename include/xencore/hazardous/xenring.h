@@ -0,0 +1,85 @@
+#ifndef _XENRING_H
+#define _XENRING_H
+
+// Shared between the kernel and user programs: keep this header free of
+// anything but compiler-provided includes.
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define XENRING_USER_ADDR   0x00007FFFFFFFE000ULL   /* between stack and time page */
+
+#define XENRING_SQ_ENTRIES  64
+#define XENRING_CQ_ENTRIES  64
+
+// Operations
+#define XENRING_OP_NOP      0
+#define XENRING_OP_WRITE    1   /* fd, addr, len */
+#define XENRING_OP_READ     2   /* fd, addr, len */
+#define XENRING_OP_SLEEP    3   /* len = nanoseconds */
+
+// SYS_RING_SETUP flags
+#define XENRING_SETUP_SQPOLL    (1u << 0)   /* kernel thread polls the SQ */
+
+// XenRing.flags, set by the kernel
+#define XENRING_NEED_WAKEUP     (1u << 0)   /* poller went idle */
+
+struct XenRingSqe {
+    uint8_t opcode;
+    uint8_t reserved[3];
+    int32_t fd;
+    uint64_t addr;
+    uint64_t len;
+    uint64_t user_data;             /* copied into the completion */
+};
+
+struct XenRingCqe {
+    uint64_t user_data;
+    int64_t result;                 /* bytes transferred, or -1 */
+};
+
+// One page mapped read-write at XENRING_USER_ADDR. User code produces at
+// sq_tail and consumes at cq_head, the kernel does the opposite.
+struct XenRing {
+    volatile uint32_t sq_head;
+    volatile uint32_t sq_tail;
+    volatile uint32_t cq_head;
+    volatile uint32_t cq_tail;
+    volatile uint32_t flags;
+    uint32_t reserved[11];
+    struct XenRingSqe sq[XENRING_SQ_ENTRIES];
+    struct XenRingCqe cq[XENRING_CQ_ENTRIES];
+};
+
+_Static_assert(sizeof(struct XenRing) <= 4096, "XenRing must fit one page");
+
+// Next free submission slot, NULL if the queue is full
+static inline struct XenRingSqe *xenring_get_sqe(struct XenRing *ring, uint32_t *tail)
+{
+    uint32_t head = __atomic_load_n(&ring->sq_head, __ATOMIC_ACQUIRE);
+    if (*tail - head >= XENRING_SQ_ENTRIES) return NULL;
+    return &ring->sq[(*tail)++ % XENRING_SQ_ENTRIES];
+}
+
+// Hand everything up to `tail` to the kernel. Returns nonzero if the
+// poller went to sleep and needs a SYS_RING_ENTER to pick it up.
+static inline int xenring_publish(struct XenRing *ring, uint32_t tail)
+{
+    __atomic_store_n(&ring->sq_tail, tail, __ATOMIC_SEQ_CST);
+    return __atomic_load_n(&ring->flags, __ATOMIC_SEQ_CST) & XENRING_NEED_WAKEUP;
+}
+
+// Oldest unread completion, NULL if there is none
+static inline struct XenRingCqe *xenring_peek_cqe(struct XenRing *ring)
+{
+    uint32_t tail = __atomic_load_n(&ring->cq_tail, __ATOMIC_ACQUIRE);
+    if (ring->cq_head == tail) return NULL;
+    return &ring->cq[ring->cq_head % XENRING_CQ_ENTRIES];
+}
+
+static inline void xenring_cqe_seen(struct XenRing *ring)
+{
+    __atomic_store_n(&ring->cq_head, ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+#endif
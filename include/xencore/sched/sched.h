@@ -0,0 +1,39 @@
+#ifndef _SCHED_H
+#define _SCHED_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <xencore/sched/thread.h>
+#include <xencore/smp/cpu.h>
+
+#define SCHED_SLICE_NS   10000000ULL  // 10 ms
+#define SCHED_PRIORITIES 32
+
+struct SchedStats {
+    uint32_t nr_running;           /* queued, not counting the current thread */
+    uint64_t switches;
+    uint64_t steals;               /* threads this CPU took from others */
+    uint64_t stolen;               /* threads others took from this CPU */
+};
+
+void sched_init(void);
+__attribute__((noreturn)) void sched_ap_enter(void);
+bool sched_running(void);
+
+void schedule(void);
+void sched_yield(void);
+void thread_block(void);
+void thread_block_prepared(uint64_t flags);
+void thread_wake(struct Thread *thread);
+void sched_enqueue(struct Thread *thread);
+void sched_finish_switch(void);
+void sched_get_stats(uint32_t cpu, struct SchedStats *stats);
+void sched_dump_stats(void);
+
+static inline struct Thread *current_thread(void)
+{
+    return this_cpu()->current_thread;
+}
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef _THREAD_H
+#define _THREAD_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define THREAD_NAME_LEN   16
+#define THREAD_STACK_SIZE 16384
+
+#define THREAD_PRIO_HIGHEST 0
+#define THREAD_PRIO_DEFAULT 16
+#define THREAD_PRIO_LOWEST  31
+#define THREAD_AFFINITY_ALL (~0ULL)
+
+struct Process;
+struct AddressSpace;
+
+typedef void (*thread_entry_t)(void *arg);
+
+typedef enum {
+    THREAD_READY,
+    THREAD_RUNNING,
+    THREAD_BLOCKED,
+    THREAD_DEAD
+} thread_state_t;
+
+struct Thread {
+    uint64_t rsp;                  /* saved kernel stack pointer */
+    uint64_t kstack_top;           /* TSS.rsp0 while this thread runs */
+    void *kstack;                  /* NULL for adopted boot stacks */
+    struct AddressSpace *aspace;   /* NULL = kernel thread, runs on kernel_pml4 */
+    void *fpu_state;               /* XSAVE area, loaded lazily */
+    uint32_t fpu_cpu;              /* CPU whose registers last held it */
+    uint32_t fpu_irq;              /* interrupt nesting, FPU is scratch */
+    uint32_t tid;
+    uint32_t cpu;                  /* CPU it last ran on */
+    uint32_t priority;             /* 0 is most urgent */
+    uint64_t affinity;             /* bit per CPU allowed to run it */
+    volatile thread_state_t state;
+    volatile uint32_t on_cpu;      /* registers still live on some CPU */
+    struct Thread *next;           /* run queue / zombie list link */
+    struct Process *process;       /* NULL for kernel threads */
+    char name[THREAD_NAME_LEN];
+};
+
+struct Thread *thread_alloc(const char *name, thread_entry_t entry, void *arg);
+struct Thread *thread_create(const char *name, thread_entry_t entry, void *arg);
+struct Thread *thread_adopt(const char *name, uint64_t kstack_top);
+void thread_free(struct Thread *thread);
+void thread_set_priority(struct Thread *thread, uint32_t priority);
+void thread_set_affinity(struct Thread *thread, uint64_t affinity);
+__attribute__((noreturn)) void thread_exit(void);
+void thread_bootstrap(thread_entry_t entry, void *arg);
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef _CPU_H
+#define _CPU_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define MAX_CPUS 16
+
+// Offsets into struct PerCpu for assembly, checked in percpu.c
+#define PERCPU_KERNEL_STACK_TOP_STR "16"
+#define PERCPU_USER_RSP_STR         "24"
+
+struct Thread;
+struct RunQueue;
+struct XenAllocCache;
+
+// Per-CPU area, reached through the GS base on x86_64. `self` must stay
+// first so this_cpu() is a single gs-relative load.
+struct PerCpu {
+    struct PerCpu *self;
+    uint32_t id;
+    uint32_t lapic_id;
+    uint64_t kernel_stack_top;
+    uint64_t user_rsp;             /* syscall entry scratch */
+    struct Thread *current_thread;
+    struct Thread *idle_thread;
+    struct Thread *prev_thread;    /* switched away from, until finished */
+    struct Thread *fpu_owner;      /* whose state the FPU registers hold */
+    struct RunQueue *run_queue;
+    uint64_t slice_timer;
+    volatile bool need_resched;
+    struct XenAllocCache *alloc_cache;
+    volatile bool online;
+};
+
+extern struct PerCpu cpus[MAX_CPUS];
+extern uint32_t cpu_count;
+
+static inline struct PerCpu *this_cpu(void)
+{
+    struct PerCpu *cpu;
+#ifdef ARCH_x86_64
+    __asm__ volatile ("mov %%gs:0, %0" : "=r"(cpu));
+#else
+    cpu = &cpus[0];
+#endif
+    return cpu;
+}
+
+// Index of the executing CPU
+static inline uint32_t current_cpu(void)
+{
+    uint32_t id;
+#ifdef ARCH_x86_64
+    __asm__ volatile ("movl %%gs:%c1, %0" : "=r"(id) : "i"(offsetof(struct PerCpu, id)));
+#else
+    id = 0;
+#endif
+    return id;
+}
+
+void percpu_init(uint32_t id, uint32_t lapic_id, uint64_t kernel_stack_top);
+
+#endif
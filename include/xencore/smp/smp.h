@@ -0,0 +1,11 @@
+#ifndef _SMP_H
+#define _SMP_H
+
+#include <stdint.h>
+
+#include <xencore/smp/cpu.h>
+
+void smp_init(void);
+__attribute__((noreturn)) void smp_ap_main(uint32_t cpu);
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef _LOCKSTAT_H
+#define _LOCKSTAT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef ARCH_x86_64
+#include <xencore/arch/x86_64/tsc.h>
+#endif
+
+// Per-lock contention statistics, compiled in with -DHLOS_LOCKSTAT.
+// Counters are only written by the lock holder, so they need no atomics.
+struct LockStat {
+    const char *name;
+    uint64_t acquisitions;
+    uint64_t contentions;
+    uint64_t max_hold;             /* TSC cycles */
+    uint64_t acquired_at;
+    struct LockStat *next;
+    volatile uint32_t registered;
+};
+
+#ifdef HLOS_LOCKSTAT
+#define LOCKSTAT_FIELD          struct LockStat stat;
+#define LOCKSTAT_INIT(n)        , .stat = { .name = (n) }
+#else
+#define LOCKSTAT_FIELD
+#define LOCKSTAT_INIT(n)
+#endif
+
+void lockstat_register(struct LockStat *stat);
+void lockstat_dump(void);
+
+static inline uint64_t lockstat_clock(void)
+{
+#ifdef ARCH_x86_64
+    return rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static inline void lockstat_acquired(struct LockStat *stat, bool contended)
+{
+    if (!stat->registered) lockstat_register(stat);
+    stat->acquisitions++;
+    if (contended) stat->contentions++;
+    stat->acquired_at = lockstat_clock();
+}
+
+static inline void lockstat_released(struct LockStat *stat)
+{
+    uint64_t held = lockstat_clock() - stat->acquired_at;
+    if (held > stat->max_hold) stat->max_hold = held;
+}
+
+#endif
@@ -0,0 +1,98 @@
+#ifndef _RWLOCK_H
+#define _RWLOCK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <xencore/sync/lockstat.h>
+#include <xencore/common.h>
+
+/* -------------------------------------------------------------------------- */
+/*  Reader-writer spinlock                                                    */
+/*                                                                            */
+/*  Low bits count active readers. A waiting writer sets RW_PENDING so new    */
+/*  readers back off and a steady stream of lookups cannot starve it.         */
+/*  Hold times are tracked for writers only.                                  */
+/* -------------------------------------------------------------------------- */
+
+#define RW_WRITER   (1u << 31)
+#define RW_PENDING  (1u << 30)
+#define RW_READERS  (RW_PENDING - 1)
+
+typedef struct rwlock {
+    volatile uint32_t state;
+    LOCKSTAT_FIELD
+} rwlock_t;
+
+#define RWLOCK_INIT(name) { .state = 0 LOCKSTAT_INIT(name) }
+
+static inline void rwlock_init(rwlock_t *lock, const char *name)
+{
+    lock->state = 0;
+#ifdef HLOS_LOCKSTAT
+    lock->stat = (struct LockStat){ .name = name };
+#else
+    (void)name;
+#endif
+}
+
+static inline void read_lock(rwlock_t *lock)
+{
+    bool contended = false;
+    while (1) {
+        uint32_t state = __atomic_load_n(&lock->state, __ATOMIC_RELAXED);
+        if (!(state & (RW_WRITER | RW_PENDING)) &&
+            __atomic_compare_exchange_n(&lock->state, &state, state + 1, true, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            break;
+        contended = true;
+        cpu_relax();
+    }
+#ifdef HLOS_LOCKSTAT
+    // Readers share the lock, so count them without a hold timestamp
+    if (!lock->stat.registered) lockstat_register(&lock->stat);
+    __atomic_fetch_add(&lock->stat.acquisitions, 1, __ATOMIC_RELAXED);
+    if (contended) __atomic_fetch_add(&lock->stat.contentions, 1, __ATOMIC_RELAXED);
+#else
+    (void)contended;
+#endif
+}
+
+static inline void read_unlock(rwlock_t *lock)
+{
+    __atomic_fetch_sub(&lock->state, 1, __ATOMIC_RELEASE);
+}
+
+static inline void write_lock(rwlock_t *lock)
+{
+    bool contended = false;
+    while (1) {
+        uint32_t state = __atomic_load_n(&lock->state, __ATOMIC_RELAXED);
+        if ((state & ~RW_PENDING) == 0) {
+            // Free, possibly with writers queued: claim it, clearing PENDING
+            if (__atomic_compare_exchange_n(&lock->state, &state, RW_WRITER, true, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+                break;
+            continue;
+        }
+        if (!(state & RW_PENDING)) __atomic_fetch_or(&lock->state, RW_PENDING, __ATOMIC_RELAXED);
+        contended = true;
+        cpu_relax();
+    }
+#ifdef HLOS_LOCKSTAT
+    if (!lock->stat.registered) lockstat_register(&lock->stat);
+    __atomic_fetch_add(&lock->stat.acquisitions, 1, __ATOMIC_RELAXED);
+    if (contended) __atomic_fetch_add(&lock->stat.contentions, 1, __ATOMIC_RELAXED);
+    lock->stat.acquired_at = lockstat_clock();
+#else
+    (void)contended;
+#endif
+}
+
+static inline void write_unlock(rwlock_t *lock)
+{
+#ifdef HLOS_LOCKSTAT
+    lockstat_released(&lock->stat);
+#endif
+    __atomic_fetch_and(&lock->state, ~RW_WRITER, __ATOMIC_RELEASE);
+}
+
+#endif
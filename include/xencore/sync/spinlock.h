@@ -0,0 +1,141 @@
+#ifndef _SPINLOCK_H
+#define _SPINLOCK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <xencore/sync/lockstat.h>
+#include <xencore/common.h>
+
+/* -------------------------------------------------------------------------- */
+/*  Test-and-test-and-set spinlock                                            */
+/*                                                                            */
+/*  Waiters spin on a plain load so the cache line stays shared until the     */
+/*  holder releases it, and only then race with an exchange.                  */
+/* -------------------------------------------------------------------------- */
+
+typedef struct spinlock {
+    volatile uint32_t locked;
+    LOCKSTAT_FIELD
+} spinlock_t;
+
+#define SPINLOCK_INIT(name) { .locked = 0 LOCKSTAT_INIT(name) }
+
+static inline void spin_init(spinlock_t *lock, const char *name)
+{
+    lock->locked = 0;
+#ifdef HLOS_LOCKSTAT
+    lock->stat = (struct LockStat){ .name = name };
+#else
+    (void)name;
+#endif
+}
+
+static inline bool spin_trylock(spinlock_t *lock)
+{
+    if (__atomic_exchange_n(&lock->locked, 1, __ATOMIC_ACQUIRE) != 0) return false;
+#ifdef HLOS_LOCKSTAT
+    lockstat_acquired(&lock->stat, false);
+#endif
+    return true;
+}
+
+static inline void spin_lock(spinlock_t *lock)
+{
+    bool contended = false;
+    while (__atomic_exchange_n(&lock->locked, 1, __ATOMIC_ACQUIRE) != 0) {
+        contended = true;
+        while (__atomic_load_n(&lock->locked, __ATOMIC_RELAXED)) cpu_relax();
+    }
+#ifdef HLOS_LOCKSTAT
+    lockstat_acquired(&lock->stat, contended);
+#else
+    (void)contended;
+#endif
+}
+
+static inline void spin_unlock(spinlock_t *lock)
+{
+#ifdef HLOS_LOCKSTAT
+    lockstat_released(&lock->stat);
+#endif
+    __atomic_store_n(&lock->locked, 0, __ATOMIC_RELEASE);
+}
+
+// For locks also taken from interrupt handlers
+static inline uint64_t spin_lock_irqsave(spinlock_t *lock)
+{
+    uint64_t flags = irq_save();
+    spin_lock(lock);
+    return flags;
+}
+
+static inline void spin_unlock_irqrestore(spinlock_t *lock, uint64_t flags)
+{
+    spin_unlock(lock);
+    irq_restore(flags);
+}
+
+/* -------------------------------------------------------------------------- */
+/*  Ticket lock                                                               */
+/*                                                                            */
+/*  FIFO handoff: each waiter takes a ticket and spins until it is served,   */
+/*  so no CPU can be starved by a faster neighbour.                           */
+/* -------------------------------------------------------------------------- */
+
+typedef struct ticket_lock {
+    volatile uint16_t next;
+    volatile uint16_t owner;
+    LOCKSTAT_FIELD
+} ticket_lock_t;
+
+#define TICKET_LOCK_INIT(name) { .next = 0, .owner = 0 LOCKSTAT_INIT(name) }
+
+static inline void ticket_init(ticket_lock_t *lock, const char *name)
+{
+    lock->next = 0;
+    lock->owner = 0;
+#ifdef HLOS_LOCKSTAT
+    lock->stat = (struct LockStat){ .name = name };
+#else
+    (void)name;
+#endif
+}
+
+static inline void ticket_lock(ticket_lock_t *lock)
+{
+    uint16_t ticket = __atomic_fetch_add(&lock->next, 1, __ATOMIC_RELAXED);
+    bool contended = false;
+    while (__atomic_load_n(&lock->owner, __ATOMIC_ACQUIRE) != ticket) {
+        contended = true;
+        cpu_relax();
+    }
+#ifdef HLOS_LOCKSTAT
+    lockstat_acquired(&lock->stat, contended);
+#else
+    (void)contended;
+#endif
+}
+
+static inline void ticket_unlock(ticket_lock_t *lock)
+{
+#ifdef HLOS_LOCKSTAT
+    lockstat_released(&lock->stat);
+#endif
+    __atomic_store_n(&lock->owner, (uint16_t)(lock->owner + 1), __ATOMIC_RELEASE);
+}
+
+static inline uint64_t ticket_lock_irqsave(ticket_lock_t *lock)
+{
+    uint64_t flags = irq_save();
+    ticket_lock(lock);
+    return flags;
+}
+
+static inline void ticket_unlock_irqrestore(ticket_lock_t *lock, uint64_t flags)
+{
+    ticket_unlock(lock);
+    irq_restore(flags);
+}
+
+#endif
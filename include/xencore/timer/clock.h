@@ -0,0 +1,14 @@
+#ifndef _CLOCK_H
+#define _CLOCK_H
+
+#include <stdint.h>
+
+#include <xencore/timer/xentime.h>
+
+void clock_init(void);
+uint64_t clock_monotonic_ns(void);
+uint64_t clock_realtime_ns(void);
+void clock_set_realtime_ns(uint64_t ns);
+void clock_map_user(uint64_t *pml4);
+
+#endif
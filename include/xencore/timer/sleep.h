@@ -3,6 +3,10 @@
 
 #include <stdint.h>
 
+#define SLEEP_TICK_NS 10000000ULL // Legacy ksleep() tick, 10 ms
+
 void ksleep(uint64_t ticks);
+void ksleep_ns(uint64_t ns);
+void ksleep_until_ns(uint64_t deadline_ns);
 
 #endif
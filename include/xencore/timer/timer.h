@@ -0,0 +1,23 @@
+#ifndef _TIMER_H
+#define _TIMER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define TIMER_TICK_SHIFT   16  // Wheel tick = 2^16 ns (~65.5 us)
+#define TIMER_LEVEL_BITS   6
+#define TIMER_LEVEL_SIZE   (1 << TIMER_LEVEL_BITS)
+#define TIMER_LEVEL_MASK   (TIMER_LEVEL_SIZE - 1)
+#define TIMER_LEVELS       4   // Covers 2^24 ticks (~18 min), later timers cascade
+
+#define TIMER_INVALID      0
+
+typedef void (*timer_callback_t)(void *arg);
+typedef uint64_t timer_handle_t;
+
+void timer_init(void);
+timer_handle_t timer_add(uint64_t deadline_ns, timer_callback_t callback, void *arg);
+bool timer_cancel(timer_handle_t handle);
+void timer_interrupt(void);
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef _XENTIME_H
+#define _XENTIME_H
+
+// Shared between the kernel and user programs: keep this header free of
+// anything but compiler-provided includes.
+
+#include <stdint.h>
+
+#define XENTIME_USER_ADDR 0x00007FFFFFFFF000ULL
+
+#define CLOCK_REALTIME  0
+#define CLOCK_MONOTONIC 1
+
+// Read-only page mapped into every user address space. Readers retry
+// while `seq` is odd or changes underneath them.
+struct XenTimePage {
+    volatile uint32_t seq;
+    uint32_t reserved;
+    uint64_t tsc_base;      // TSC value at monotonic zero
+    uint64_t tsc_mult;      // ns = ((tsc - tsc_base) * tsc_mult) >> 32
+    uint64_t wall_offset;   // CLOCK_REALTIME - CLOCK_MONOTONIC, in ns
+};
+
+static inline uint64_t xentime_read(const struct XenTimePage *page, int clock_id)
+{
+    uint32_t seq;
+    uint64_t ns;
+
+    do {
+        seq = page->seq;
+        __asm__ volatile ("" : : : "memory");
+
+        uint32_t lo, hi;
+        __asm__ volatile ("rdtsc" : "=a"(lo), "=d"(hi));
+        uint64_t cycles = (((uint64_t)hi << 32) | lo) - page->tsc_base;
+        ns = (uint64_t)(((__uint128_t)cycles * page->tsc_mult) >> 32);
+        if (clock_id == CLOCK_REALTIME) ns += page->wall_offset;
+
+        __asm__ volatile ("" : : : "memory");
+    } while ((seq & 1) || seq != page->seq);
+
+    return ns;
+}
+
+#endif
@@ -2,27 +2,55 @@
 #define _VFS_H
 
 #include <stddef.h>
+#include <stdint.h>
 #include <stdbool.h>
 
+#include <xencore/sync/spinlock.h>
+
+#define VFS_PAGE_SIZE 4096
+#define VFS_FILE_MAX  (1ULL << 40)   // 1 TiB, four tree levels
+
 typedef enum {
     VFS_NODE_FILE,
     VFS_NODE_DIR,
     VFS_NODE_SYMLINK,
 } vfs_node_type_t;
 
+// Open-addressing table of a directory's children, keyed by name. It
+// grows into a fresh table while the old one drains a few slots at a time.
+struct vfs_dir_index {
+    struct vfs_node **slots;       /* power of two, linear probing */
+    size_t size;
+    size_t used;                   /* live entries and tombstones */
+    size_t count;                  /* live entries in both tables */
+    struct vfs_node **old_slots;   /* being migrated, NULL when done */
+    size_t old_size;
+    size_t old_pending;            /* live entries left in old_slots */
+    size_t migrated;               /* old slots visited so far */
+};
+
 typedef struct vfs_node {
     char *name;
+    uint32_t name_hash;
+    uint32_t name_len;
     vfs_node_type_t type;
     struct vfs_node *parent;
 
     union {
         struct {
-            struct vfs_node **children;
+            struct vfs_node **children;    /* in creation order */
             size_t child_count;
+            size_t child_capacity;
+            struct vfs_dir_index index;
         } dir;
         struct {
-            void *data;
+            void *data;            /* initrd image, NULL once the tree took over */
             size_t size;
+            void *backing;         /* allocation holding data */
+            uint64_t root;         /* page tree, see vfs.c */
+            uint32_t height;
+            uint64_t generation;   /* bumped around every change */
+            spinlock_t lock;       /* tree, size, data and generation */
         } file;
         struct {
             char *target;
@@ -32,9 +60,29 @@ typedef struct vfs_node {
     struct vfs_node *next_sibling;
 } vfs_node_t;
 
+// Components of a path, one at a time and in place. Reentrant, nothing
+// is copied or allocated; `name` is not NUL-terminated.
+typedef struct {
+    const char *cursor;
+    const char *name;
+    size_t len;
+} vfs_path_iter_t;
+
+void vfs_path_init(vfs_path_iter_t *it, const char *path);
+bool vfs_path_next(vfs_path_iter_t *it);
+bool vfs_path_last(const vfs_path_iter_t *it);
+
 void vfs_init(void);
 vfs_node_t *vfs_create(const char *path, vfs_node_type_t type);
 vfs_node_t *vfs_lookup(const char *path);
 bool vfs_remove(const char *path);
+vfs_node_t *vfs_child(vfs_node_t *dir, size_t index);
+vfs_node_t *vfs_child_named(vfs_node_t *dir, const char *name);
+bool vfs_file_alloc(vfs_node_t *node, size_t size);
+uint64_t vfs_file_map_page(vfs_node_t *node, size_t index, bool *frame);
+int64_t vfs_file_read(vfs_node_t *node, uint64_t offset, void *buf, size_t len, bool user);
+int64_t vfs_file_write(vfs_node_t *node, uint64_t offset, const void *buf, size_t len, bool user);
+bool vfs_file_truncate(vfs_node_t *node, uint64_t size);
+uint64_t vfs_file_generation(vfs_node_t *node);
 
 #endif
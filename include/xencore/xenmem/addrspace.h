@@ -0,0 +1,30 @@
+#ifndef _ADDRSPACE_H
+#define _ADDRSPACE_H
+
+#include <stdint.h>
+
+#include <xencore/smp/cpu.h>
+#include <xencore/sync/spinlock.h>
+
+struct Vma;
+
+// A user address space. The kernel half is shared with kernel_pml4, so
+// kernel threads never need one of these.
+struct AddressSpace {
+    uint64_t *pml4;
+    uint64_t cr3;                  /* physical PML4, no PCID bits */
+    uint64_t ctx_id;               /* unique for the lifetime of the system */
+    volatile uint64_t tlb_gen;     /* bumped whenever mappings are revoked */
+    volatile uint64_t active_cpus; /* CPUs with it loaded in CR3 */
+    uint8_t pcid[MAX_CPUS];        /* last PCID used on each CPU, 0 = none */
+    spinlock_t vma_lock;           /* VMA list and the user page tables */
+    struct Vma *vmas;              /* sorted by address */
+    uint64_t brk_start;            /* heap, grown by brk() */
+    uint64_t brk;
+};
+
+struct AddressSpace *addrspace_create(void);
+struct AddressSpace *addrspace_fork(struct AddressSpace *src);
+void addrspace_destroy(struct AddressSpace *as);
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef _VMA_H
+#define _VMA_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define VMA_READ    (1u << 0)
+#define VMA_WRITE   (1u << 1)
+#define VMA_EXEC    (1u << 2)
+
+#define VMA_ANON    (1u << 8)   /* zero-filled frames on first touch */
+#define VMA_FILE    (1u << 9)   /* pages of `file`, starting at `offset` */
+#define VMA_SHARED  (1u << 10)  /* no private copies, not on write or fork */
+
+// Page fault error code bits
+#define FAULT_PRESENT  (1u << 0)
+#define FAULT_WRITE    (1u << 1)
+#define FAULT_USER     (1u << 2)
+#define FAULT_FETCH    (1u << 4)
+
+struct AddressSpace;
+struct vfs_node;
+
+// One mapped range of a user address space, [start, end) page aligned.
+// Each address space keeps them sorted by address in a singly linked list.
+struct Vma {
+    uint64_t start;
+    uint64_t end;
+    uint32_t prot;
+    uint32_t flags;
+    struct vfs_node *file;         /* VMA_FILE only */
+    uint64_t offset;               /* file offset of `start` */
+    struct Vma *next;
+};
+
+bool vma_insert(struct AddressSpace *as, uint64_t start, uint64_t end, uint32_t prot, uint32_t flags);
+bool vma_insert_file(struct AddressSpace *as, uint64_t start, uint64_t end, uint32_t prot, uint32_t flags, struct vfs_node *file, uint64_t offset);
+bool vma_remove(struct AddressSpace *as, uint64_t start, uint64_t end);
+uint64_t vma_find_gap(struct AddressSpace *as, uint64_t len, uint64_t floor, uint64_t ceiling);
+bool vma_fault(struct AddressSpace *as, uint64_t addr, uint32_t error);
+bool vma_fork(struct AddressSpace *dst, struct AddressSpace *src);
+void vma_destroy(struct AddressSpace *as);
+
+#endif
@@ -2,9 +2,15 @@
 #define _XENALLOC_H
 
 #include <stddef.h>
+#include <stdint.h>
+
+struct XenAllocCache;
 
 void *xen_alloc_aligned(size_t size);
 void *xen_alloc(size_t size);
 void xen_free(void *ptr);
 
+// Small-block cache of a CPU, for its per-CPU area
+struct XenAllocCache *xen_alloc_cache(uint32_t cpu);
+
 #endif
@@ -0,0 +1,16 @@
+#ifndef _XENFRAME_H
+#define _XENFRAME_H
+
+#include <stdint.h>
+
+#define FRAME_SIZE 4096
+
+void xenframe_init(void);
+uint64_t frame_alloc(void);
+uint64_t frame_alloc_dirty(void);
+void frame_free(uint64_t phys);
+void frame_ref(uint64_t phys);
+uint32_t frame_refcount(uint64_t phys);
+uint64_t frame_free_count(void);
+
+#endif
@@ -2,7 +2,11 @@
 #define _XENMAP_H
 
 void xenmap_init(void);
+#include <stddef.h>
+
 void *alloc_page(void);
+void *alloc_pages(size_t count);
 void free_page(void *page);
+void free_pages(void *base, size_t count);
 
 #endif
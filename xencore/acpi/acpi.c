@@ -0,0 +1,64 @@
+#include <string.h>
+
+#include <xencore/acpi/acpi.h>
+#include <xencore/xenio/tty.h>
+
+static struct AcpiRsdp *acpi_rsdp = NULL;
+static struct AcpiSdtHeader *acpi_root = NULL;
+static bool acpi_xsdt = false;
+
+static bool acpi_checksum(const void *table, size_t length)
+{
+    uint8_t sum = 0;
+    for (size_t i = 0; i < length; ++i) sum += ((const uint8_t *)table)[i];
+    return sum == 0;
+}
+
+void acpi_init(struct AcpiParams *params)
+{
+    struct AcpiRsdp *rsdp = (struct AcpiRsdp *)params->rsdp;
+    if (!rsdp || memcmp(rsdp->signature, "RSD PTR ", 8) != 0 || !acpi_checksum(rsdp, 20)) {
+        tty_printf("[ACPI] No valid RSDP, tables unavailable\n");
+        return;
+    }
+
+    acpi_rsdp = rsdp;
+    if (rsdp->revision >= 2 && rsdp->xsdt_address) {
+        acpi_root = (struct AcpiSdtHeader *)rsdp->xsdt_address;
+        acpi_xsdt = true;
+    } else {
+        acpi_root = (struct AcpiSdtHeader *)(uint64_t)rsdp->rsdt_address;
+    }
+
+    if (!acpi_checksum(acpi_root, acpi_root->length)) {
+        tty_printf("[ACPI] Root table checksum mismatch\n");
+        acpi_root = NULL;
+        return;
+    }
+
+    tty_printf(
+        "[ACPI] Revision %u, %s @ 0x%x\n",
+        rsdp->revision, acpi_xsdt ? "XSDT" : "RSDT", (uint64_t)acpi_root
+    );
+}
+
+struct AcpiSdtHeader *acpi_find_table(const char *signature)
+{
+    if (!acpi_root) return NULL;
+
+    size_t entry_size = acpi_xsdt ? sizeof(uint64_t) : sizeof(uint32_t);
+    size_t count = (acpi_root->length - sizeof(struct AcpiSdtHeader)) / entry_size;
+    uint8_t *entries = (uint8_t *)(acpi_root + 1);
+
+    for (size_t i = 0; i < count; ++i) {
+        uint64_t address = acpi_xsdt
+            ? ((uint64_t *)entries)[i]
+            : ((uint32_t *)entries)[i];
+        struct AcpiSdtHeader *table = (struct AcpiSdtHeader *)address;
+        if (memcmp(table->signature, signature, 4) == 0 && acpi_checksum(table, table->length)) {
+            return table;
+        }
+    }
+
+    return NULL;
+}
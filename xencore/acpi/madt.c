@@ -0,0 +1,55 @@
+#include <string.h>
+
+#include <xencore/acpi/madt.h>
+#include <xencore/xenio/tty.h>
+
+bool madt_parse(struct MadtInfo *info)
+{
+    memset(info, 0, sizeof(struct MadtInfo));
+
+    struct AcpiMadt *madt = (struct AcpiMadt *)acpi_find_table("APIC");
+    if (!madt) {
+        tty_printf("[MADT] Table not found\n");
+        return false;
+    }
+
+    info->lapic_address = madt->lapic_address;
+
+    uint8_t *ptr = madt->entries;
+    uint8_t *end = (uint8_t *)madt + madt->header.length;
+    while (ptr + sizeof(struct MadtEntryHeader) <= end) {
+        struct MadtEntryHeader *entry = (struct MadtEntryHeader *)ptr;
+        if (entry->length == 0) break;
+
+        switch (entry->type) {
+            case MADT_LOCAL_APIC: {
+                struct MadtLocalApic *lapic = (struct MadtLocalApic *)entry;
+                // Online-capable but disabled CPUs need hot-plug, which we lack
+                if (!(lapic->flags & MADT_LAPIC_ENABLED)) break;
+                if (info->lapic_count >= MAX_CPUS) {
+                    tty_printf("[MADT] Ignoring LAPIC %u, MAX_CPUS reached\n", lapic->apic_id);
+                    break;
+                }
+                info->lapic_ids[info->lapic_count++] = lapic->apic_id;
+                break;
+            }
+
+            case MADT_IO_APIC: {
+                struct MadtIoApic *ioapic = (struct MadtIoApic *)entry;
+                if (!info->ioapic_address) info->ioapic_address = ioapic->address;
+                break;
+            }
+
+            default:
+                break;
+        }
+
+        ptr += entry->length;
+    }
+
+    tty_printf(
+        "[MADT] %u LAPICs, LAPIC @ 0x%x, IOAPIC @ 0x%x\n",
+        info->lapic_count, info->lapic_address, info->ioapic_address
+    );
+    return info->lapic_count > 0;
+}
@@ -0,0 +1,74 @@
+#include <xencore/arch/x86_64/context.h>
+#include <xencore/arch/x86_64/tss.h>
+#include <xencore/arch/x86_64/fpu.h>
+#include <xencore/arch/x86_64/tlb.h>
+
+#include <xencore/sched/thread.h>
+#include <xencore/smp/cpu.h>
+
+void switch_context(uint64_t *save_rsp, uint64_t load_rsp);
+
+// Only callee-saved registers are switched: every caller of
+// switch_context() is ordinary C code (or an ISR, which already saved the
+// rest), so the ABI guarantees nothing else is live across the call.
+__asm__ (
+    ".section .text\n"
+    ".global switch_context\n"
+    "switch_context:\n"
+    "    pushq %rbp\n"
+    "    pushq %rbx\n"
+    "    pushq %r12\n"
+    "    pushq %r13\n"
+    "    pushq %r14\n"
+    "    pushq %r15\n"
+    "    movq  %rsp, (%rdi)\n"
+    "    movq  %rsi, %rsp\n"
+    "    popq  %r15\n"
+    "    popq  %r14\n"
+    "    popq  %r13\n"
+    "    popq  %r12\n"
+    "    popq  %rbx\n"
+    "    popq  %rbp\n"
+    "    ret\n"
+
+    // First return into a new thread: r12 = entry, r13 = arg. Its clean
+    // FPU image is loaded by #NM on first use.
+    "context_thread_start:\n"
+    "    movq  %r12, %rdi\n"
+    "    movq  %r13, %rsi\n"
+    "    call  thread_bootstrap\n"
+    "    ud2\n"
+);
+
+extern uint8_t context_thread_start[];
+
+// Build a frame that switch_context() will pop into context_thread_start
+uint64_t context_init_stack(uint64_t stack_top, context_entry_t entry, void *arg)
+{
+    uint64_t *sp = (uint64_t *)((stack_top & ~0xFULL) - 16);
+
+    *--sp = (uint64_t)context_thread_start;  // return address
+    *--sp = 0;                               // rbp
+    *--sp = 0;                               // rbx
+    *--sp = (uint64_t)entry;                 // r12
+    *--sp = (uint64_t)arg;                   // r13
+    *--sp = 0;                               // r14
+    *--sp = 0;                               // r15
+
+    return (uint64_t)sp;
+}
+
+// No SIMD in here: prev's FPU registers may still be unsaved
+__attribute__((target("general-regs-only"))) void context_switch(struct Thread *prev, struct Thread *next)
+{
+    // Interrupts from user mode must land on the incoming thread's stack
+    get_tss(current_cpu())->rsp0 = next->kstack_top;
+    this_cpu()->kernel_stack_top = next->kstack_top;
+
+    // Kernel threads never borrow a process PML4, so an exiting process
+    // can free its tables as soon as it has left them.
+    tlb_switch_to(next->aspace);
+
+    fpu_switch(prev, next);
+    switch_context(&prev->rsp, next->rsp);
+}
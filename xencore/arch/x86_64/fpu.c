@@ -1,24 +1,274 @@
 #include <stdint.h>
+#include <string.h>
 
+#include <xencore/arch/x86_64/fpu.h>
+#include <xencore/arch/x86_64/cpuid.h>
+
+#include <xencore/sched/thread.h>
+#include <xencore/smp/cpu.h>
+#include <xencore/xenmem/xenalloc.h>
 #include <xencore/xenio/tty.h>
+#include <xencore/common.h>
+
+/* -------------------------------------------------------------------------- */
+/*  Lazy FPU switching                                                        */
+/*                                                                            */
+/*  A thread's FPU/SIMD state is saved with XSAVEOPT when it is switched out  */
+/*  after touching the FPU, but only restored when it next uses it: switches  */
+/*  set CR0.TS and the #NM handler reloads the state. If the registers still  */
+/*  hold the incoming thread's state (same CPU, nobody used the FPU since),   */
+/*  TS is left clear and nothing is reloaded at all.                          */
+/*                                                                            */
+/*  Interrupt handlers run kernel C code that may use SSE, so they bracket    */
+/*  it with fpu_irq_enter/exit: the live state is saved first and the         */
+/*  registers become scratch until the handler returns.                       */
+/* -------------------------------------------------------------------------- */
+
+#define CR0_MP (1ULL << 1)
+#define CR0_EM (1ULL << 2)
+#define CR0_TS (1ULL << 3)
+#define CR4_OSFXSR     (1ULL << 9)
+#define CR4_OSXMMEXCPT (1ULL << 10)
+#define CR4_OSXSAVE    (1ULL << 18)
+
+#define FPU_ALIGN      64
+#define FPU_MXCSR_INIT 0x1F80
+
+// Code that runs while the registers hold somebody's unsaved state
+#define FPU_SAFE __attribute__((target("general-regs-only")))
+
+static bool     fpu_xsave = false;
+static bool     fpu_xsaveopt = false;
+static uint64_t fpu_xcr0 = 0;
+static uint32_t fpu_state_size = 512;
+static uint8_t *fpu_init_state = NULL;
+
+// Used by interrupts that arrive before the scheduler gives us threads
+static uint8_t fpu_boot_area[MAX_CPUS][512] __attribute__((aligned(16)));
+static bool    fpu_boot_saved[MAX_CPUS];
+
+static inline FPU_SAFE void clts(void)
+{
+    __asm__ volatile ("clts" ::: "memory");
+}
+
+static inline FPU_SAFE void stts(void)
+{
+    uint64_t cr0;
+    __asm__ volatile ("mov %%cr0, %0" : "=r"(cr0));
+    __asm__ volatile ("mov %0, %%cr0" : : "r"(cr0 | CR0_TS) : "memory");
+}
+
+static inline FPU_SAFE bool fpu_live(void)
+{
+    uint64_t cr0;
+    __asm__ volatile ("mov %%cr0, %0" : "=r"(cr0));
+    return !(cr0 & CR0_TS);
+}
 
+static inline FPU_SAFE void fpu_save(void *area)
+{
+    uint32_t lo = (uint32_t)fpu_xcr0, hi = (uint32_t)(fpu_xcr0 >> 32);
+    if (fpu_xsaveopt) {
+        __asm__ volatile ("xsaveopt64 (%0)" : : "r"(area), "a"(lo), "d"(hi) : "memory");
+    } else if (fpu_xsave) {
+        __asm__ volatile ("xsave64 (%0)" : : "r"(area), "a"(lo), "d"(hi) : "memory");
+    } else {
+        __asm__ volatile ("fxsave64 (%0)" : : "r"(area) : "memory");
+    }
+}
+
+static inline FPU_SAFE void fpu_restore(void *area)
+{
+    uint32_t lo = (uint32_t)fpu_xcr0, hi = (uint32_t)(fpu_xcr0 >> 32);
+    if (fpu_xsave) {
+        __asm__ volatile ("xrstor64 (%0)" : : "r"(area), "a"(lo), "d"(hi) : "memory");
+    } else {
+        __asm__ volatile ("fxrstor64 (%0)" : : "r"(area) : "memory");
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+/*  Setup                                                                     */
+/* -------------------------------------------------------------------------- */
+
+// Runs on every CPU; the BSP also decides which state components to use
 void enable_fpu_sse(void) {
     uint64_t cr0, cr4;
 
     // Read CR0
     __asm__ volatile ("mov %%cr0, %0" : "=r"(cr0));
-    cr0 &= ~(1 << 2); // Clear EM: disable "no FPU"
-    cr0 |=  (1 << 1); // Set MP: monitor co-processor
+    cr0 &= ~CR0_EM;   // Clear EM: disable "no FPU"
+    cr0 &= ~CR0_TS;
+    cr0 |=  CR0_MP;   // Set MP: monitor co-processor, WAIT honours TS
     __asm__ volatile ("mov %0, %%cr0" : : "r"(cr0));
 
     // Read CR4
     __asm__ volatile ("mov %%cr4, %0" : "=r"(cr4));
-    cr4 |= (1 << 9);  // OSFXSR: enable FXSAVE/FXRSTOR
-    cr4 |= (1 << 10); // OSXMMEXCPT: unmasked SSE exceptions
+    cr4 |= CR4_OSFXSR;      // Enable FXSAVE/FXRSTOR
+    cr4 |= CR4_OSXMMEXCPT;  // Unmasked SSE exceptions
+
+    struct CPUIDResult leaf1 = cpuid(1, 0);
+    if (leaf1.ecx & CPUID_1_ECX_XSAVE) cr4 |= CR4_OSXSAVE;
     __asm__ volatile ("mov %0, %%cr4" : : "r"(cr4));
 
+    if (leaf1.ecx & CPUID_1_ECX_XSAVE) {
+        if (!fpu_xcr0) {
+            struct CPUIDResult xstate = cpuid(0xD, 0);
+            uint64_t supported = ((uint64_t)xstate.edx << 32) | xstate.eax;
+
+            fpu_xcr0 = XCR0_X87 | XCR0_SSE;
+            if ((leaf1.ecx & CPUID_1_ECX_AVX) && (supported & XCR0_AVX)) fpu_xcr0 |= XCR0_AVX;
+            fpu_xsave = true;
+            fpu_xsaveopt = cpuid(0xD, 1).eax & CPUID_D1_EAX_XSAVEOPT;
+        }
+
+        uint32_t lo = (uint32_t)fpu_xcr0, hi = (uint32_t)(fpu_xcr0 >> 32);
+        __asm__ volatile ("xsetbv" : : "c"(0), "a"(lo), "d"(hi));
+
+        // EBX reports the area size for the components now enabled in XCR0
+        fpu_state_size = cpuid(0xD, 0).ebx;
+    }
+
     // Initialize the FPU
     __asm__ volatile ("fninit");
 
+#ifdef HLOS_DEBUG
     tty_printf("[FPU] Test: %f\n", 0.123123);
+#endif
+}
+
+// Capture a clean register image for new threads, needs the allocator
+void fpu_init(void)
+{
+    fpu_init_state = fpu_state_alloc();
+    if (!fpu_init_state) {
+        tty_printf("[FPU] Failed to allocate initial state\n");
+        while (1) halt();
+    }
+
+    uint32_t mxcsr = FPU_MXCSR_INIT;
+    __asm__ volatile ("fninit; ldmxcsr %0" : : "m"(mxcsr));
+    __asm__ volatile ("xorps %%xmm0, %%xmm0" ::: "xmm0");
+    fpu_save(fpu_init_state);
+
+    bool avx2 = cpuid_max_leaf(0) >= 7 && (cpuid(7, 0).ebx & CPUID_7_EBX_AVX2);
+    tty_printf(
+        "[FPU] %s, XCR0=0x%x, state %u bytes, AVX %s, AVX2 %s\n",
+        fpu_xsaveopt ? "XSAVEOPT" : fpu_xsave ? "XSAVE" : "FXSAVE",
+        fpu_xcr0, fpu_state_size,
+        (fpu_xcr0 & XCR0_AVX) ? "on" : "off",
+        ((fpu_xcr0 & XCR0_AVX) && avx2) ? "on" : "off"
+    );
+}
+
+uint32_t fpu_get_state_size(void)
+{
+    return fpu_state_size;
+}
+
+// XSAVE areas must be 64-byte aligned, keep the raw pointer just below
+void *fpu_state_alloc(void)
+{
+    uint8_t *raw = xen_alloc(fpu_state_size + FPU_ALIGN + sizeof(void *));
+    if (!raw) return NULL;
+
+    uint8_t *area = (uint8_t *)(((uint64_t)raw + sizeof(void *) + FPU_ALIGN - 1) & ~(uint64_t)(FPU_ALIGN - 1));
+    ((void **)area)[-1] = raw;
+
+    if (fpu_init_state) memcpy(area, fpu_init_state, fpu_state_size);
+    else memset(area, 0, fpu_state_size);
+    return area;
+}
+
+void fpu_state_free(void *state)
+{
+    if (state) xen_free(((void **)state)[-1]);
+}
+
+/* -------------------------------------------------------------------------- */
+/*  Switching                                                                 */
+/* -------------------------------------------------------------------------- */
+
+// The calling flow's registers are live and belong to `thread`
+void fpu_adopt(struct Thread *thread)
+{
+    struct PerCpu *cpu = this_cpu();
+    cpu->fpu_owner = thread;
+    thread->fpu_cpu = cpu->id;
+}
+
+// Give `dst` the saved image of `src`, which must not be live anywhere: a
+// fork child starts with the registers its parent had at the syscall
+void fpu_copy_state(struct Thread *dst, const struct Thread *src)
+{
+    memcpy(dst->fpu_state, src->fpu_state, fpu_state_size);
+}
+
+FPU_SAFE void fpu_switch(struct Thread *prev, struct Thread *next)
+{
+    struct PerCpu *cpu = this_cpu();
+
+    // Save only if prev touched the FPU since it was last restored
+    if (cpu->fpu_owner == prev && fpu_live()) fpu_save(prev->fpu_state);
+
+    if (cpu->fpu_owner == next && next->fpu_cpu == cpu->id) clts();
+    else stts();
+}
+
+// #NM: first FPU instruction since TS was set
+FPU_SAFE void fpu_handle_nm(void)
+{
+    clts();
+
+    struct PerCpu *cpu = this_cpu();
+    struct Thread *thread = cpu->current_thread;
+
+    // Inside an interrupt the registers are scratch, nothing to load. They
+    // may still be another thread's if this one was switched back in, and
+    // that thread must not get them back as its own.
+    if (thread && thread->fpu_irq) cpu->fpu_owner = NULL;
+    if (!thread || thread->fpu_irq) return;
+    if (cpu->fpu_owner == thread && thread->fpu_cpu == cpu->id) return;
+
+    fpu_restore(thread->fpu_state);
+    cpu->fpu_owner = thread;
+    thread->fpu_cpu = cpu->id;
+}
+
+FPU_SAFE void fpu_irq_enter(void)
+{
+    struct PerCpu *cpu = this_cpu();
+    struct Thread *thread = cpu->current_thread;
+
+    if (!thread) {
+        if (fpu_live()) {
+            __asm__ volatile ("fxsave64 (%0)" : : "r"(fpu_boot_area[cpu->id]) : "memory");
+            fpu_boot_saved[cpu->id] = true;
+        }
+        return;
+    }
+
+    if (thread->fpu_irq++) return;
+
+    if (cpu->fpu_owner == thread && fpu_live()) fpu_save(thread->fpu_state);
+    cpu->fpu_owner = NULL;
+    clts();
+}
+
+FPU_SAFE void fpu_irq_exit(void)
+{
+    struct PerCpu *cpu = this_cpu();
+    struct Thread *thread = cpu->current_thread;
+
+    if (!thread) {
+        if (fpu_boot_saved[cpu->id]) {
+            __asm__ volatile ("fxrstor64 (%0)" : : "r"(fpu_boot_area[cpu->id]) : "memory");
+            fpu_boot_saved[cpu->id] = false;
+        }
+        return;
+    }
+
+    // The interrupted code reloads its state on its next FPU instruction
+    if (--thread->fpu_irq == 0) stts();
 }
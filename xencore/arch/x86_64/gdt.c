@@ -4,14 +4,14 @@
 #include <xencore/arch/x86_64/tss.h>
 #include <xencore/arch/x86_64/segments.h>
 
+#include <xencore/smp/cpu.h>
 #include <xencore/xenio/tty.h>
 
-extern struct TSS tss;
+// One GDT per CPU: each needs its own busy TSS descriptor
+__attribute__((aligned(16))) struct GDTEntry gdts[MAX_CPUS][GDT_ENTRIES];
+struct GDTPtr gdt_ptrs[MAX_CPUS];
 
-__attribute__((aligned(16))) struct GDTEntry gdt[GDT_ENTRIES];
-struct GDTPtr gdt_ptr;
-
-static inline void write_tss_descriptor(int idx, struct TSS* tss)
+static inline void write_tss_descriptor(struct GDTEntry *gdt, int idx, struct TSS* tss)
 {
     uint64_t base  = (uint64_t)tss;
     uint32_t limit = sizeof(struct TSS) - 1;
@@ -30,9 +30,12 @@ static inline void write_tss_descriptor(int idx, struct TSS* tss)
     high->reserved   = 0;
 }
 
-void setup_gdt(void)
+void setup_gdt_cpu(uint32_t cpu)
 {
-    memset(gdt, 0, sizeof(gdt));
+    struct GDTEntry *gdt = gdts[cpu];
+    struct GDTPtr *gdt_ptr = &gdt_ptrs[cpu];
+
+    memset(gdt, 0, sizeof(gdts[cpu]));
 
     // ---- Null ----
     // gdt[0] = null
@@ -78,23 +81,23 @@ void setup_gdt(void)
     };
 
     // ---- TSS descriptor (0x28) ----
-    write_tss_descriptor(GDT_TSS_LOW, &tss);
+    write_tss_descriptor(gdt, GDT_TSS_LOW, get_tss(cpu));
 
     // ---- GDT pointer ----
-    gdt_ptr.limit = sizeof(gdt) - 1;
-    gdt_ptr.base  = (uint64_t)&gdt;
+    gdt_ptr->limit = sizeof(gdts[cpu]) - 1;
+    gdt_ptr->base  = (uint64_t)gdt;
 
     // ---- Load GDT ----
-    __asm__ volatile ("lgdt %0" : : "m"(gdt_ptr));
+    __asm__ volatile ("lgdt %0" : : "m"(*gdt_ptr));
 
     // ---- Reload segments ----
+    // GS is left alone: loading it would zero the GS base percpu_init() set
     __asm__ volatile (
         "mov %[ds], %%ax\n\t"
         "mov %%ax, %%ds\n\t"
         "mov %%ax, %%es\n\t"
         "mov %%ax, %%ss\n\t"
         "mov %%ax, %%fs\n\t"
-        "mov %%ax, %%gs\n\t"
         // Far jump (flush pipeline & load CS)
         "pushq %[cs]\n\t"
         "lea 1f(%%rip), %%rax\n\t"
@@ -110,7 +113,12 @@ void setup_gdt(void)
     __asm__ volatile ("ltr %w0" : : "r"((uint16_t)TSS_SELECTOR));
 
     tty_printf(
-        "[GDT] Initialized. Base=0x%x, limit=%u\n",
-        (uint64_t)&gdt, gdt_ptr.limit
+        "[GDT] CPU %u initialized. Base=0x%x, limit=%u\n",
+        cpu, (uint64_t)gdt, gdt_ptr->limit
     );
 }
+
+void setup_gdt(void)
+{
+    setup_gdt_cpu(0);
+}
@@ -1,7 +1,7 @@
 #include <xencore/arch/x86_64/idt.h>
 #include <xencore/arch/x86_64/isrs.h>
 #include <xencore/arch/x86_64/ports.h>
-#include <xencore/arch/x86_64/pit.h>
+#include <xencore/arch/x86_64/lapic.h>
 
 #include <xencore/xenio/tty.h>
 
@@ -31,22 +31,32 @@ void setup_idt() {
 
     // Known exception overrides
     set_idt_entry(0, (void*)isr_divide_by_zero, 0);       // #DE
+    set_idt_entry(7, (void*)isr_device_not_available, 0); // #NM
     set_idt_entry(8, (void*)isr_double_fault, 1);         // #DF (with IST)
     set_idt_entry(13, (void*)isr_general_protection, 0);  // #GP
     set_idt_entry(14, (void*)isr_page_fault, 0);          // #PF
 
-    // IRQ0 (PIT)
-    set_idt_entry(IRQ_BASE + 0, (void*)isr_timer, 0);
-
-    // Fill the rest with default handler
-    for (int i = IRQ_BASE + 1; i < IDT_ENTRIES; ++i) {
+    // Legacy PIC lines are all masked, the LAPIC timer drives ticks
+    for (int i = IRQ_BASE; i < IDT_ENTRIES; ++i) {
         set_idt_entry(i, (void*)isr_default, 0);
     }
 
+    // LAPIC
+    set_idt_entry(LAPIC_TIMER_VECTOR, (void*)isr_lapic_timer, 0);
+    set_idt_entry(LAPIC_RESCHED_VECTOR, (void*)isr_resched, 0);
+    set_idt_entry(LAPIC_TLB_VECTOR, (void*)isr_tlb_shootdown, 0);
+    set_idt_entry(LAPIC_SPURIOUS_VECTOR, (void*)isr_spurious, 0);
+
     // Load IDT
     idt_ptr.limit = sizeof(idt) - 1;
     idt_ptr.base  = (uint64_t)&idt;
 
-    __asm__ volatile ("lidt %0" : : "m"(idt_ptr));
+    load_idt();
     tty_printf("[IDT] Base: 0x%x\n", idt_ptr.base);
 }
+
+// All CPUs share one IDT
+void load_idt(void)
+{
+    __asm__ volatile ("lidt %0" : : "m"(idt_ptr));
+}
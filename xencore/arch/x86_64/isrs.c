@@ -1,40 +1,168 @@
 #include <xencore/arch/x86_64/isrs.h>
 #include <xencore/arch/x86_64/ports.h>
+#include <xencore/arch/x86_64/lapic.h>
+#include <xencore/arch/x86_64/fpu.h>
+#include <xencore/arch/x86_64/tlb.h>
+#include <xencore/arch/x86_64/usercopy.h>
 
 #include <xencore/graphics/framebuffer.h>
 #include <xencore/xenio/tty.h>
+#include <xencore/timer/timer.h>
+#include <xencore/sched/sched.h>
+#include <xencore/smp/cpu.h>
+#include <xencore/hazardous/process.h>
+#include <xencore/xenmem/vma.h>
 #include <xencore/common.h>
 #include <xencore/gman/gman.h>
 
+/* -------------------------------------------------------------------------- */
+/*  Entry stubs                                                               */
+/*                                                                            */
+/*  While user code runs, GS_BASE holds its own value and the per-CPU pointer */
+/*  waits in KERNEL_GS_BASE. Every vector enters through a stub that swaps    */
+/*  them when it interrupted ring 3, and swaps back before the IRETQ, so the  */
+/*  handlers below always find this_cpu() behind GS.                          */
+/*                                                                            */
+/*  Stubs push a 0 where the CPU pushes no error code and the address of     */
+/*  their handler, then share one path that saves the caller-saved registers */
+/*  and calls it as handler(frame, error_code). The file is built without    */
+/*  SSE, handlers that run ordinary kernel code wrap it in fpu_irq_enter().   */
+/* -------------------------------------------------------------------------- */
+
+#define ISR_DISPATCH(handler)                   \
+    "    subq  $8, %rsp\n"                      \
+    "    pushq %rax\n"                          \
+    "    leaq  " #handler "(%rip), %rax\n"      \
+    "    movq  %rax, 8(%rsp)\n"                 \
+    "    popq  %rax\n"                          \
+    "    jmp   isr_common\n"
+
+#define ISR_ENTRY(name, handler)                \
+    ".global " #name "\n"                       \
+    #name ":\n"                                 \
+    "    pushq $0\n"                            \
+    ISR_DISPATCH(handler)
+
+#define ISR_ENTRY_ERR(name, handler)            \
+    ".global " #name "\n"                       \
+    #name ":\n"                                 \
+    ISR_DISPATCH(handler)
+
+__asm__ (
+    ".section .text\n"
+
+    // Stack: handler, error code, then RIP, CS, RFLAGS, RSP, SS from the CPU
+    "isr_common:\n"
+    "    testb $3, 24(%rsp)\n"
+    "    jz    1f\n"
+    "    swapgs\n"
+    "1:  pushq %rax\n"
+    "    pushq %rcx\n"
+    "    pushq %rdx\n"
+    "    pushq %rsi\n"
+    "    pushq %rdi\n"
+    "    pushq %r8\n"
+    "    pushq %r9\n"
+    "    pushq %r10\n"
+    "    pushq %r11\n"
+    "    cld\n"
+    "    leaq  88(%rsp), %rdi\n"                /* frame */
+    "    movq  80(%rsp), %rsi\n"                /* error code */
+    "    call  *72(%rsp)\n"                     /* 16-byte aligned here */
+    "    popq  %r11\n"
+    "    popq  %r10\n"
+    "    popq  %r9\n"
+    "    popq  %r8\n"
+    "    popq  %rdi\n"
+    "    popq  %rsi\n"
+    "    popq  %rdx\n"
+    "    popq  %rcx\n"
+    "    popq  %rax\n"
+    "    testb $3, 24(%rsp)\n"
+    "    jz    2f\n"
+    "    swapgs\n"
+    "2:  addq  $16, %rsp\n"
+    "    iretq\n"
+
+    ISR_ENTRY(isr_divide_by_zero, handle_divide_by_zero)
+    ISR_ENTRY(isr_device_not_available, handle_device_not_available)
+    ISR_ENTRY_ERR(isr_general_protection, handle_general_protection)
+    ISR_ENTRY_ERR(isr_page_fault, handle_page_fault)
+    ISR_ENTRY_ERR(isr_double_fault, handle_double_fault)
+    ISR_ENTRY(isr_lapic_timer, handle_lapic_timer)
+    ISR_ENTRY(isr_resched, handle_resched)
+    ISR_ENTRY(isr_tlb_shootdown, handle_tlb_shootdown)
+    ISR_ENTRY(isr_spurious, handle_spurious)
+    ISR_ENTRY(isr_default, handle_default)
+    ISR_ENTRY_ERR(isr_default_err, handle_default_err)
+);
+
 // ==== Exception Handlers ====
 
-__attribute__((interrupt)) void isr_divide_by_zero(struct interrupt_frame* frame)
+// Faults raised by user code end the offending process, not the machine.
+// Exit codes follow the shell convention of 128 + signal number.
+static void user_fault(struct interrupt_frame* frame, int signal)
+{
+    if (!(frame->cs & 3) || !current_process()) return;
+    tty_printf("[Hazardous] %s (pid %d) killed by signal %d\n", current_process()->name, current_process()->pid, signal);
+    process_exit(128 + signal);
+}
+
+__attribute__((used)) static void handle_divide_by_zero(struct interrupt_frame* frame)
 {
+    user_fault(frame, 8);     /* SIGFPE */
     disable_interrupts();
     tty_printf("[#DE] Divide by zero at RIP=0x%x\n", frame->rip);
     if (fb_is_double_buffered()) fb_present();
     while (1) __asm__ volatile ("hlt");
 }
 
-__attribute__((interrupt)) void isr_general_protection(struct interrupt_frame* frame, uint64_t error_code)
+__attribute__((used)) static void handle_device_not_available(__attribute__((unused)) struct interrupt_frame* frame)
+{
+    fpu_handle_nm();
+}
+
+__attribute__((used)) static void handle_general_protection(struct interrupt_frame* frame, uint64_t error_code)
 {
+    user_fault(frame, 11);    /* SIGSEGV */
     disable_interrupts();
     tty_printf("[#GP] General Protection Fault at RIP=0x%x, error=0x%x\n", frame->rip, error_code);
     if (fb_is_double_buffered()) fb_present();
     while (1) __asm__ volatile ("hlt");
 }
 
-__attribute__((interrupt)) void isr_page_fault(struct interrupt_frame* frame, uint64_t error_code)
+__attribute__((used)) static void handle_page_fault(struct interrupt_frame* frame, uint64_t error_code)
 {
-    disable_interrupts();
     uint64_t cr2;
     __asm__ volatile ("mov %%cr2, %0" : "=r"(cr2));
+
+    // Demand paging, also for the kernel touching user buffers in syscalls
+    struct Thread *thread = current_thread();
+    if (cr2 < USER_SPACE_END && thread && thread->aspace) {
+        fpu_irq_enter();
+        bool handled = vma_fault(thread->aspace, cr2, (uint32_t)error_code);
+        fpu_irq_exit();
+        if (handled) return;
+    }
+
+    // A user buffer the kernel was copying cannot be paged in
+    uint64_t fixup = (frame->cs & 3) ? 0 : usercopy_fixup(frame->rip);
+    if (fixup) {
+        frame->rip = fixup;
+        return;
+    }
+
+    if ((frame->cs & 3) && current_process()) {
+        tty_printf("[#PF] User fault at RIP=0x%x, CR2=0x%x, error=0x%x\n", frame->rip, cr2, error_code);
+    }
+    user_fault(frame, 11);    /* SIGSEGV */
+    disable_interrupts();
     tty_printf("[#PF] Page Fault at RIP=0x%x, CR2=0x%x, error=0x%x\n", frame->rip, cr2, error_code);
     if (fb_is_double_buffered()) fb_present();
     while (1) __asm__ volatile ("hlt");
 }
 
-__attribute__((interrupt)) void isr_double_fault(struct interrupt_frame* frame, uint64_t error_code)
+__attribute__((used)) static void handle_double_fault(struct interrupt_frame* frame, uint64_t error_code)
 {
     disable_interrupts();
     tty_printf("[#DF] Double Fault at RIP=0x%x, error=0x%x\n", frame->rip, error_code);
@@ -44,31 +172,46 @@ __attribute__((interrupt)) void isr_double_fault(struct interrupt_frame* frame,
 
 // ==== IRQ Handlers ====
 
-volatile uint64_t sleep_countdown = 0;
+__attribute__((used)) static void handle_lapic_timer(__attribute__((unused)) struct interrupt_frame* frame)
+{
+    // Timer callbacks are ordinary kernel code and may use SSE registers
+    fpu_irq_enter();
+
+    lapic_eoi();
+    timer_interrupt();
+    if (this_cpu()->need_resched) schedule();
 
-#ifdef HLOS_DEBUG
-volatile uint64_t timer_ticks = 0;
-#endif
+    fpu_irq_exit();
+}
 
-__attribute__((interrupt)) void isr_timer(__attribute__((unused)) struct interrupt_frame* frame)
+__attribute__((used)) static void handle_resched(__attribute__((unused)) struct interrupt_frame* frame)
 {
-#ifdef HLOS_DEBUG
-    timer_ticks++;
-    if (timer_ticks % 100 == 0) {
-        tty_printf("[Timer] Ticks: %u\n", timer_ticks);
-    }
-#endif
+    fpu_irq_enter();
 
-    if (sleep_countdown > 0) {
-        sleep_countdown--;
-    }
+    lapic_eoi();
+    schedule();
+
+    fpu_irq_exit();
+}
+
+__attribute__((used)) static void handle_tlb_shootdown(__attribute__((unused)) struct interrupt_frame* frame)
+{
+    fpu_irq_enter();
+
+    tlb_shootdown_interrupt();
+    lapic_eoi();
 
-    outb(0x20, 0x20); // EOI to PIC
+    fpu_irq_exit();
+}
+
+__attribute__((used)) static void handle_spurious(__attribute__((unused)) struct interrupt_frame* frame)
+{
+    // Spurious LAPIC interrupts must not be acknowledged
 }
 
 // ==== Default Handler (no error code) ====
 
-__attribute__((interrupt)) void isr_default(struct interrupt_frame* frame)
+__attribute__((used)) static void handle_default(struct interrupt_frame* frame)
 {
     disable_interrupts();
     tty_printf("[Unhandled] Interrupt at RIP=0x%x\n", frame->rip);
@@ -78,7 +221,7 @@ __attribute__((interrupt)) void isr_default(struct interrupt_frame* frame)
 
 // ==== Default Handler (with error code) ====
 
-__attribute__((interrupt)) void isr_default_err(struct interrupt_frame* frame, uint64_t error_code)
+__attribute__((used)) static void handle_default_err(struct interrupt_frame* frame, uint64_t error_code)
 {
     disable_interrupts();
     tty_printf("[Unhandled] Interrupt at RIP=0x%x, error=0x%x\n", frame->rip, error_code);
@@ -0,0 +1,163 @@
+#include <xencore/arch/x86_64/lapic.h>
+#include <xencore/arch/x86_64/cpuid.h>
+#include <xencore/arch/x86_64/paging.h>
+#include <xencore/arch/x86_64/msr.h>
+#include <xencore/arch/x86_64/tsc.h>
+
+#include <xencore/xenio/tty.h>
+
+#define MSR_APIC_BASE       0x1B
+#define MSR_TSC_DEADLINE    0x6E0
+#define APIC_BASE_ENABLE    (1ULL << 11)
+#define APIC_BASE_MASK      0xFFFFFFFFFF000ULL
+
+#define LAPIC_REG_ID        0x020
+#define LAPIC_REG_TPR       0x080
+#define LAPIC_REG_EOI       0x0B0
+#define LAPIC_REG_SVR       0x0F0
+#define LAPIC_REG_ICR_LOW   0x300
+#define LAPIC_REG_ICR_HIGH  0x310
+#define LAPIC_REG_LVT_TIMER 0x320
+#define LAPIC_REG_TIMER_ICR 0x380
+#define LAPIC_REG_TIMER_CCR 0x390
+#define LAPIC_REG_TIMER_DCR 0x3E0
+
+#define LAPIC_SVR_ENABLE        (1u << 8)
+#define LAPIC_LVT_MASKED        (1u << 16)
+#define LAPIC_LVT_ONESHOT       (0u << 17)
+#define LAPIC_LVT_TSC_DEADLINE  (2u << 17)
+#define LAPIC_DCR_DIV16         0x3
+
+#define LAPIC_ICR_FIXED         (0u << 8)
+#define LAPIC_ICR_INIT          (5u << 8)
+#define LAPIC_ICR_STARTUP       (6u << 8)
+#define LAPIC_ICR_PENDING       (1u << 12)
+#define LAPIC_ICR_ASSERT        (1u << 14)
+
+#define LAPIC_CALIBRATION_NS    10000000ULL // 10 ms
+
+static volatile uint32_t *lapic_base = NULL;
+static bool tsc_deadline = false;
+static uint64_t lapic_ticks_mult = 0; // lapic ticks = (cycles * mult) >> 32
+
+static inline uint32_t lapic_read(uint32_t reg)
+{
+    return lapic_base[reg / 4];
+}
+
+static inline void lapic_write(uint32_t reg, uint32_t val)
+{
+    lapic_base[reg / 4] = val;
+}
+
+// Run the one-shot counter against the TSC to find its rate
+static void calibrate_lapic_timer(void)
+{
+    lapic_write(LAPIC_REG_TIMER_DCR, LAPIC_DCR_DIV16);
+    lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_TIMER_VECTOR | LAPIC_LVT_MASKED);
+
+    uint64_t start = rdtsc();
+    lapic_write(LAPIC_REG_TIMER_ICR, 0xFFFFFFFF);
+    tsc_delay_ns(LAPIC_CALIBRATION_NS);
+    uint32_t elapsed = 0xFFFFFFFF - lapic_read(LAPIC_REG_TIMER_CCR);
+    uint64_t cycles = rdtsc() - start;
+    lapic_write(LAPIC_REG_TIMER_ICR, 0);
+
+    lapic_ticks_mult = (uint64_t)(((__uint128_t)elapsed << 32) / cycles);
+    tty_printf(
+        "[LAPIC] One-shot timer: %u ticks per %u ns\n",
+        (uint64_t)elapsed, LAPIC_CALIBRATION_NS
+    );
+}
+
+void setup_lapic(void)
+{
+    uint64_t apic_base = rdmsr(MSR_APIC_BASE);
+    wrmsr(MSR_APIC_BASE, apic_base | APIC_BASE_ENABLE);
+
+    uint64_t phys = apic_base & APIC_BASE_MASK;
+    if (!lapic_base) map_mmio(phys, PAGE_SIZE_4KB);
+    lapic_base = (volatile uint32_t *)phys;
+
+    lapic_write(LAPIC_REG_TPR, 0);
+    lapic_write(LAPIC_REG_SVR, LAPIC_SVR_ENABLE | LAPIC_SPURIOUS_VECTOR);
+
+    tsc_deadline = (cpuid(1, 0).ecx & CPUID_1_ECX_TSC_DEADLINE) != 0;
+    if (tsc_deadline) {
+        lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_TIMER_VECTOR | LAPIC_LVT_TSC_DEADLINE);
+    } else {
+        // Every LAPIC shares the bus clock, the BSP calibrates for all
+        if (!lapic_ticks_mult) calibrate_lapic_timer();
+        lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_TIMER_VECTOR | LAPIC_LVT_ONESHOT);
+    }
+
+    tty_printf(
+        "[LAPIC] Base: 0x%x, ID: %u, timer mode: %s\n",
+        phys, lapic_id(), tsc_deadline ? "TSC-deadline" : "one-shot"
+    );
+}
+
+uint32_t lapic_id(void)
+{
+    return lapic_read(LAPIC_REG_ID) >> 24;
+}
+
+static void lapic_send_icr(uint32_t apic_id, uint32_t icr)
+{
+    lapic_write(LAPIC_REG_ICR_HIGH, apic_id << 24);
+    lapic_write(LAPIC_REG_ICR_LOW, icr);
+    while (lapic_read(LAPIC_REG_ICR_LOW) & LAPIC_ICR_PENDING) __asm__ volatile ("pause");
+}
+
+void lapic_send_init(uint32_t apic_id)
+{
+    lapic_send_icr(apic_id, LAPIC_ICR_INIT | LAPIC_ICR_ASSERT);
+}
+
+void lapic_send_sipi(uint32_t apic_id, uint8_t page)
+{
+    lapic_send_icr(apic_id, LAPIC_ICR_STARTUP | LAPIC_ICR_ASSERT | page);
+}
+
+void lapic_send_ipi(uint32_t apic_id, uint8_t vector)
+{
+    lapic_send_icr(apic_id, LAPIC_ICR_FIXED | LAPIC_ICR_ASSERT | vector);
+}
+
+void lapic_eoi(void)
+{
+    lapic_write(LAPIC_REG_EOI, 0);
+}
+
+bool lapic_has_tsc_deadline(void)
+{
+    return tsc_deadline;
+}
+
+// Program the timer for a single absolute TSC deadline. Only the next
+// expiring event is ever armed, so an idle CPU sleeps until it is due.
+void lapic_timer_arm(uint64_t deadline_tsc)
+{
+    if (tsc_deadline) {
+        wrmsr(MSR_TSC_DEADLINE, deadline_tsc ? deadline_tsc : 1);
+        return;
+    }
+
+    uint64_t now = rdtsc();
+    uint64_t cycles = deadline_tsc > now ? deadline_tsc - now : 0;
+    uint64_t ticks = (uint64_t)(((__uint128_t)cycles * lapic_ticks_mult) >> 32);
+
+    // A deadline beyond the 32-bit counter fires early, callers re-arm
+    if (ticks == 0) ticks = 1;
+    if (ticks > 0xFFFFFFFF) ticks = 0xFFFFFFFF;
+    lapic_write(LAPIC_REG_TIMER_ICR, (uint32_t)ticks);
+}
+
+void lapic_timer_disarm(void)
+{
+    if (tsc_deadline) {
+        wrmsr(MSR_TSC_DEADLINE, 0);
+    } else {
+        lapic_write(LAPIC_REG_TIMER_ICR, 0);
+    }
+}
@@ -1,8 +1,13 @@
 #include <stdint.h>
 #include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
 
 #include <xencore/arch/x86_64/paging.h>
+#include <xencore/arch/x86_64/cpuid.h>
+#include <xencore/arch/x86_64/msr.h>
 
+#include <xencore/xenmem/xenframe.h>
 #include <xencore/xenio/tty.h>
 #include <xencore/common.h>
 
@@ -16,28 +21,36 @@
 __attribute__((aligned(PAGE_SIZE_4KB))) uint64_t kernel_pml4[512];
 
 uint64_t next_virtual_heap_addr = VIRT_HEAP_BASE;
+uint64_t page_nx = 0;
 
 static uint8_t *early_alloc_buffer = NULL;
 static size_t early_alloc_size = 0;
 static size_t early_alloc_offset = 0;
 
+// Until paging is enabled the firmware identity maps everything, after
+// that page tables are reached through the direct map.
+static bool direct_map_ready = false;
+
+static inline uint64_t *table_at(uint64_t entry)
+{
+    uint64_t phys = entry & PAGE_ADDR_MASK;
+    return direct_map_ready ? (uint64_t *)phys_to_virt(phys) : (uint64_t *)phys;
+}
+
 static uint64_t *get_or_create_table(uint64_t *parent, size_t index, uint64_t flags)
 {
     uint64_t entry = parent[index];
 
+    // Tables stay writable, permissions are decided by the leaf entries
     if (!(entry & PAGE_PRESENT)) {
         uint64_t *new_table = early_alloc_page();
         for (int i = 0; i < 512; ++i) new_table[i] = 0;
-        entry = ((uint64_t)new_table) | PAGE_PRESENT;
-        if (flags & PAGE_RW)   entry |= PAGE_RW;
+        entry = ((uint64_t)new_table) | PAGE_PRESENT | PAGE_RW;
         if (flags & PAGE_USER) entry |= PAGE_USER;
-    } else {
-        if (flags & PAGE_USER) entry |= PAGE_USER;   // TEMP: promote
-        if (flags & PAGE_RW)   entry |= PAGE_RW;     // TEMP: promote
+        parent[index] = entry;
     }
 
-    parent[index] = entry;
-    return (uint64_t *)(entry & ~0xFFFULL);
+    return table_at(entry);
 }
 
 // Map single 4K page
@@ -136,6 +149,17 @@ void *early_alloc_page(void)
     return (void *)ALIGN_UP_4K((uint64_t)ptr);
 }
 
+// Every CPU that may run user code, before it does. Without NX support
+// page_nx stays 0 and data is executable as before.
+void paging_init_cpu(void)
+{
+    if (cpuid_max_leaf(0x80000000) < 0x80000001) return;
+    if (!(cpuid(0x80000001, 0).edx & CPUID_80000001_EDX_NX)) return;
+
+    wrmsr(MSR_EFER, rdmsr(MSR_EFER) | EFER_NXE);
+    page_nx = PAGE_NX;
+}
+
 void load_pml4(uint64_t *pml4)
 {
     __asm__ volatile("mov %0, %%cr3" : : "r"(pml4) : "memory");
@@ -143,19 +167,160 @@ void load_pml4(uint64_t *pml4)
 
 uint64_t *create_user_pml4(void)
 {
-    // allocate a new PML4 for user space
-    uint64_t *user_pml4 = early_alloc_page();
+    uint64_t phys = frame_alloc();
+    if (!phys) return NULL;
+
+    // Share every kernel table, user mappings privatise their own path
+    uint64_t *user_pml4 = phys_to_virt(phys);
     for (int i = 0; i < 512; i++) {
-        user_pml4[i] = 0;
+        user_pml4[i] = (kernel_pml4[i] & PAGE_PRESENT) ? kernel_pml4[i] : 0;
     }
 
-    for (int i = 0; i < 512; i++) {
-        if (kernel_pml4[i] & 0x1) { // Present
-            user_pml4[i] = kernel_pml4[i];
+    return user_pml4;
+}
+
+/* -------------------------------------------------------------------------- */
+/*  User address spaces                                                       */
+/*                                                                            */
+/*  A process PML4 starts out pointing at the kernel's own tables. The first  */
+/*  user mapping below a shared entry copies that table into a frame of its   */
+/*  own (PAGE_PRIVATE), so processes never see each other's pages and the     */
+/*  kernel tables stay free of user bits. Leaf frames tagged PAGE_OWNED are   */
+/*  released together with the tables.                                       */
+/* -------------------------------------------------------------------------- */
+
+static uint64_t *get_or_clone_table(uint64_t *parent, size_t index)
+{
+    uint64_t entry = parent[index];
+    if ((entry & PAGE_PRESENT) && (entry & PAGE_PRIVATE)) return table_at(entry);
+
+    uint64_t phys = frame_alloc();
+    if (!phys) return NULL;
+
+    // A kernel large page here is shadowed by the user mapping
+    uint64_t *table = phys_to_virt(phys);
+    if ((entry & PAGE_PRESENT) && !(entry & PAGE_PS)) {
+        memcpy(table, table_at(entry), PAGE_SIZE_4KB);
+    }
+
+    parent[index] = phys | PAGE_PRIVATE | PAGE_USER | PAGE_RW | PAGE_PRESENT;
+    return table;
+}
+
+bool map_user_page(uint64_t *user_pml4, uint64_t virt, uint64_t phys, uint64_t flags)
+{
+    uint64_t *pdpt = get_or_clone_table(user_pml4, (virt >> 39) & 0x1FF);
+    uint64_t *pd   = pdpt ? get_or_clone_table(pdpt, (virt >> 30) & 0x1FF) : NULL;
+    uint64_t *pt   = pd   ? get_or_clone_table(pd,   (virt >> 21) & 0x1FF) : NULL;
+    if (!pt) {
+        tty_printf("[Paging] Out of frames mapping user page 0x%x\n", virt);
+        return false;
+    }
+
+    pt[(virt >> 12) & 0x1FF] = (phys & PAGE_ADDR_MASK) | (flags & ~(PAGE_PS | PAGE_PRIVATE)) | PAGE_PRESENT;
+    return true;
+}
+
+// Slot of the leaf entry for `virt`, NULL if no private table covers it
+static uint64_t *user_pte_slot(uint64_t *user_pml4, uint64_t virt)
+{
+    uint64_t *table = user_pml4;
+    for (int shift = 39; shift >= 21; shift -= 9) {
+        uint64_t entry = table[(virt >> shift) & 0x1FF];
+        if (!(entry & PAGE_PRESENT) || !(entry & PAGE_PRIVATE)) return NULL;
+        table = table_at(entry);
+    }
+    return &table[(virt >> 12) & 0x1FF];
+}
+
+// Leaf entry of a private user mapping, 0 if there is none
+uint64_t user_lookup_pte(uint64_t *user_pml4, uint64_t virt)
+{
+    uint64_t *slot = user_pte_slot(user_pml4, virt);
+    return (slot && (*slot & PAGE_PRESENT)) ? *slot : 0;
+}
+
+// `virt` if a private leaf table covers it, otherwise the end of the first
+// missing table on the way there, so walks can skip empty ranges whole
+uint64_t user_next_table(uint64_t *user_pml4, uint64_t virt)
+{
+    uint64_t *table = user_pml4;
+    for (int shift = 39; shift >= 21; shift -= 9) {
+        uint64_t entry = table[(virt >> shift) & 0x1FF];
+        if (!(entry & PAGE_PRESENT) || !(entry & PAGE_PRIVATE)) return (virt & ~((1ULL << shift) - 1)) + (1ULL << shift);
+        table = table_at(entry);
+    }
+    return virt;
+}
+
+// Clear a user mapping and return what it was. The caller flushes the TLB
+// before reusing the frame.
+uint64_t unmap_user_page(uint64_t *user_pml4, uint64_t virt)
+{
+    uint64_t *slot = user_pte_slot(user_pml4, virt);
+    if (!slot || !(*slot & PAGE_PRESENT)) return 0;
+
+    uint64_t pte = *slot;
+    *slot = 0;
+    return pte;
+}
+
+// Give `dst` the mappings of `src` in [start, end), skipping empty tables.
+// Owned frames gain a reference; with `cow` the writable ones turn
+// read-only on both sides. The caller flushes the TLB of `src`.
+bool copy_user_range(uint64_t *dst, uint64_t *src, uint64_t start, uint64_t end, bool cow)
+{
+    uint64_t virt = start;
+    while (virt < end) {
+        // Size of the range covered by the first missing table on the way
+        uint64_t skip = 0;
+        uint64_t *table = src;
+        for (int shift = 39; shift >= 21; shift -= 9) {
+            uint64_t entry = table[(virt >> shift) & 0x1FF];
+            if (!(entry & PAGE_PRESENT) || !(entry & PAGE_PRIVATE)) {
+                skip = 1ULL << shift;
+                break;
+            }
+            table = table_at(entry);
+        }
+        if (skip) {
+            virt = (virt & ~(skip - 1)) + skip;
+            continue;
+        }
+
+        uint64_t *slot = &table[(virt >> 12) & 0x1FF];
+        uint64_t pte = *slot;
+        if (pte & PAGE_PRESENT) {
+            if (cow) pte &= ~PAGE_RW;
+            if (!map_user_page(dst, virt, pte & PAGE_ADDR_MASK, pte & ~PAGE_ADDR_MASK)) return false;
+            if (pte & PAGE_OWNED) frame_ref(pte & PAGE_ADDR_MASK);
+            *slot = pte;
         }
+        virt += PAGE_SIZE_4KB;
     }
+    return true;
+}
 
-    return user_pml4;
+static void free_user_table(uint64_t *table, int level)
+{
+    for (int i = 0; i < 512; ++i) {
+        uint64_t entry = table[i];
+        if (!(entry & PAGE_PRESENT)) continue;
+
+        if (level > 1 && !(entry & PAGE_PS) && (entry & PAGE_PRIVATE)) {
+            free_user_table(table_at(entry), level - 1);
+        } else if (level == 1 && (entry & PAGE_OWNED)) {
+            frame_free(entry & PAGE_ADDR_MASK);
+        }
+    }
+
+    frame_free((uint64_t)table - PHYS_MAP_BASE);
+}
+
+// The caller must have moved off this address space on every CPU
+void free_user_pml4(uint64_t *user_pml4)
+{
+    if (user_pml4) free_user_table(user_pml4, 4);
 }
 
 // Hybrid mapper: uses 2M pages where possible, 4K for leftovers
@@ -181,11 +346,6 @@ void map_range(uint64_t *pml4, uint64_t virt_start, uint64_t phys_start, uint64_
     }
 }
 
-void map_user_segment(uint64_t *user_pml4, uint64_t virt, uint64_t phys, uint64_t size)
-{
-    map_range(user_pml4, virt, phys, size, PAGE_RW | PAGE_USER);
-}
-
 void map_identity(struct MemoryMapEntry *entry)
 {
     uint64_t phys_start = entry->physical_start;
@@ -200,6 +360,21 @@ void map_identity(struct MemoryMapEntry *entry)
 #endif
 }
 
+// Identity map device registers uncached
+void map_mmio(uint64_t phys, uint64_t size)
+{
+    uint64_t start = ALIGN_DOWN_4K(phys);
+    uint64_t end   = ALIGN_UP_4K(phys + size);
+
+    // Already covered by a firmware-reported MMIO range
+    if (virt_to_phys(start) == start) return;
+
+    map_range(kernel_pml4, start, start, end - start, PAGE_RW | PAGE_PCD | PAGE_PWT);
+#ifdef HLOS_DEBUG
+    tty_printf("[Paging] Mapped MMIO %u KiB @ 0x%x\n", (end - start) / 1024, start);
+#endif
+}
+
 size_t map_virtual(struct MemoryMapEntry *entry)
 {
     uint64_t phys_start = entry->physical_start;
@@ -218,21 +393,24 @@ size_t map_virtual(struct MemoryMapEntry *entry)
 
 void setup_paging(struct MemoryMapParams *params, uint64_t fb_base, size_t fb_size)
 {
-    // Find conventional memory size
+    // Find conventional memory size and where RAM ends
     size_t conventional_memory_size = 0;
+    uint64_t ram_top = 0;
     for (size_t i = 0; i < params->memory_map_size; i += params->descriptor_size) {
         struct MemoryMapEntry *entry = (struct MemoryMapEntry *)((uint8_t *)params->memory_map + i);
         if (entry->type == ConventionalMemory) {
             conventional_memory_size += entry->size_pages * PAGE_SIZE_4KB;
+            uint64_t end = entry->physical_start + entry->size_pages * PAGE_SIZE_4KB;
+            if (end > ram_top) ram_top = end;
         }
     }
 
-    // Find memory for early allocator
+    // Find memory for early allocator, keeping low memory free for the AP trampoline
     size_t alloc_start = 0;
     size_t alloc_size = conventional_memory_size / 2048;
     for (size_t i = 0; i < params->memory_map_size; i += params->descriptor_size) {
         struct MemoryMapEntry *entry = (struct MemoryMapEntry *)((uint8_t *)params->memory_map + i);
-        if (entry->type == ConventionalMemory && entry->size_pages * PAGE_SIZE_4KB >= alloc_size && !(entry->physical_start & (uint64_t)(PAGE_SIZE_2MB - 1))) {
+        if (entry->type == ConventionalMemory && entry->physical_start >= 0x100000 && entry->size_pages * PAGE_SIZE_4KB >= alloc_size && !(entry->physical_start & (uint64_t)(PAGE_SIZE_2MB - 1))) {
             alloc_start = ALIGN_UP_4K(entry->physical_start);
             entry->physical_start += alloc_size;
             entry->size_pages -= alloc_size / PAGE_SIZE_4KB;
@@ -302,6 +480,10 @@ void setup_paging(struct MemoryMapParams *params, uint64_t fb_base, size_t fb_si
         }
     }
 
+    // Direct map of all RAM in 2 MiB pages, holes in it stay uncached
+    // through the firmware MTRRs
+    map_range(kernel_pml4, PHYS_MAP_BASE, 0, ALIGN_UP_2M(ram_top), PAGE_RW);
+
     // Enable paging
     uint64_t pml4_phys = (uint64_t)kernel_pml4;
     uint64_t cr4_pae = (1 << 5);       // Enable PAE
@@ -319,6 +501,7 @@ void setup_paging(struct MemoryMapParams *params, uint64_t fb_base, size_t fb_si
         : "r"(pml4_phys), "r"(cr4_pae), "r"(cr0_pg)
         : "rax"
     );
+    direct_map_ready = true;
 
     tty_printf("[Paging] Initialized with hybrid mapping!\n");
 }
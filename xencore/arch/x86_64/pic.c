@@ -24,3 +24,8 @@ void remap_pic() {
 
     tty_printf("[PIC] Remapped IRQs\n");
 }
+
+void mask_pic() {
+    outb(0x21, 0xFF); // Mask every legacy IRQ, the LAPIC owns timing now
+    outb(0xA1, 0xFF);
+}
@@ -1,23 +1,28 @@
 #include <xencore/arch/x86_64/pit.h>
 #include <xencore/arch/x86_64/ports.h>
-
-#include <xencore/xenio/tty.h>
+#include <xencore/arch/x86_64/tsc.h>
 
 #define PIT_FREQUENCY 1193182
 #define PIT_COMMAND_PORT 0x43
-#define PIT_CHANNEL0_PORT 0x40
-
-void setup_pit(uint32_t hz) {
-    if (hz == 0 || hz > PIT_FREQUENCY) return;
+#define PIT_CHANNEL2_PORT 0x42
+#define PIT_GATE_PORT 0x61
 
-    uint16_t divisor = (uint16_t)(PIT_FREQUENCY / hz);
+// Count TSC cycles across a polled channel 2 countdown of `ms` milliseconds.
+// Channel 2 is gated through port 0x61 and never raises an IRQ.
+uint64_t pit_measure_tsc(uint32_t ms) {
+    uint32_t latch = (PIT_FREQUENCY / 1000) * ms;
+    if (latch == 0 || latch > 0xFFFF) return 0;
 
-    outb(PIT_COMMAND_PORT, 0x36); // Channel 0, LSB/MSB, mode 3 (square wave)
+    // Gate high, speaker off
+    outb(PIT_GATE_PORT, (inb(PIT_GATE_PORT) & ~0x02) | 0x01);
 
-    outb(PIT_CHANNEL0_PORT, divisor & 0xFF);        // LSB
-    outb(PIT_CHANNEL0_PORT, (divisor >> 8) & 0xFF); // MSB
+    outb(PIT_COMMAND_PORT, 0xB0); // Channel 2, LSB/MSB, mode 0 (terminal count)
+    outb(PIT_CHANNEL2_PORT, latch & 0xFF);
+    outb(PIT_CHANNEL2_PORT, (latch >> 8) & 0xFF);
 
-    outb(0x21, inb(0x21) & ~1); // Unmask IRQ0 (timer)
+    uint64_t start = rdtsc();
+    while (!(inb(PIT_GATE_PORT) & 0x20)) {} // OUT2 goes high on terminal count
+    uint64_t end = rdtsc();
 
-    tty_printf("[PIT] Set frequency to %u Hz\n", hz);
+    return end - start;
 }
@@ -0,0 +1,95 @@
+#include <xencore/arch/x86_64/rtc.h>
+#include <xencore/arch/x86_64/ports.h>
+
+#define CMOS_ADDRESS_PORT 0x70
+#define CMOS_DATA_PORT    0x71
+#define CMOS_NMI_DISABLE  0x80
+
+#define RTC_SECONDS   0x00
+#define RTC_MINUTES   0x02
+#define RTC_HOURS     0x04
+#define RTC_DAY       0x07
+#define RTC_MONTH     0x08
+#define RTC_YEAR      0x09
+#define RTC_STATUS_A  0x0A
+#define RTC_STATUS_B  0x0B
+
+#define RTC_A_UPDATE_IN_PROGRESS (1 << 7)
+#define RTC_B_24_HOUR            (1 << 1)
+#define RTC_B_BINARY             (1 << 2)
+#define RTC_HOUR_PM              0x80
+
+static uint8_t cmos_read(uint8_t reg)
+{
+    outb(CMOS_ADDRESS_PORT, reg | CMOS_NMI_DISABLE);
+    uint8_t value = inb(CMOS_DATA_PORT);
+    // Bit 7 of the address port masks NMIs for as long as it stays set
+    outb(CMOS_ADDRESS_PORT, reg);
+    return value;
+}
+
+static uint8_t bcd_to_bin(uint8_t v)
+{
+    return (v & 0x0F) + (v >> 4) * 10;
+}
+
+static struct RTCTime rtc_read_raw(void)
+{
+    while (cmos_read(RTC_STATUS_A) & RTC_A_UPDATE_IN_PROGRESS) {}
+
+    struct RTCTime t = {
+        .year   = cmos_read(RTC_YEAR),
+        .month  = cmos_read(RTC_MONTH),
+        .day    = cmos_read(RTC_DAY),
+        .hour   = cmos_read(RTC_HOURS),
+        .minute = cmos_read(RTC_MINUTES),
+        .second = cmos_read(RTC_SECONDS)
+    };
+    return t;
+}
+
+struct RTCTime rtc_read(void)
+{
+    // Read until two consecutive samples agree to dodge a mid-update read
+    struct RTCTime t = rtc_read_raw();
+    while (1) {
+        struct RTCTime again = rtc_read_raw();
+        if (again.second == t.second && again.minute == t.minute && again.hour == t.hour &&
+            again.day == t.day && again.month == t.month && again.year == t.year) break;
+        t = again;
+    }
+
+    uint8_t status_b = cmos_read(RTC_STATUS_B);
+    bool pm = t.hour & RTC_HOUR_PM;
+    t.hour &= ~RTC_HOUR_PM;
+
+    if (!(status_b & RTC_B_BINARY)) {
+        t.second = bcd_to_bin(t.second);
+        t.minute = bcd_to_bin(t.minute);
+        t.hour   = bcd_to_bin(t.hour);
+        t.day    = bcd_to_bin(t.day);
+        t.month  = bcd_to_bin(t.month);
+        t.year   = bcd_to_bin((uint8_t)t.year);
+    }
+
+    // 12-hour clocks count 12, 1, ..., 11: 12 AM is 0 and 12 PM is 12
+    if (!(status_b & RTC_B_24_HOUR)) t.hour = (t.hour % 12) + (pm ? 12 : 0);
+
+    t.year += 2000; // No century register without ACPI FADT
+    return t;
+}
+
+// Seconds since the Unix epoch (days-from-civil)
+uint64_t rtc_read_unix(void)
+{
+    struct RTCTime t = rtc_read();
+
+    int64_t y = t.year - (t.month <= 2);
+    int64_t era = y / 400;
+    int64_t yoe = y - era * 400;
+    int64_t doy = (153 * (t.month + (t.month > 2 ? -3 : 9)) + 2) / 5 + t.day - 1;
+    int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    int64_t days = era * 146097 + doe - 719468;
+
+    return (uint64_t)days * 86400 + t.hour * 3600 + t.minute * 60 + t.second;
+}
@@ -0,0 +1,151 @@
+#include <string.h>
+
+#include <xencore/arch/x86_64/smpboot.h>
+#include <xencore/arch/x86_64/paging.h>
+#include <xencore/arch/x86_64/lapic.h>
+#include <xencore/arch/x86_64/tsc.h>
+#include <xencore/arch/x86_64/gdt.h>
+#include <xencore/arch/x86_64/tss.h>
+#include <xencore/arch/x86_64/idt.h>
+#include <xencore/arch/x86_64/fpu.h>
+#include <xencore/arch/x86_64/syscall.h>
+#include <xencore/arch/x86_64/tlb.h>
+
+#include <xencore/smp/smp.h>
+#include <xencore/xenio/tty.h>
+
+extern uint8_t smp_trampoline_start[];
+extern uint8_t smp_trampoline_end[];
+extern uint8_t smp_trampoline_cr3[];
+extern uint8_t smp_trampoline_stack[];
+extern uint8_t smp_trampoline_entry[];
+extern uint8_t smp_trampoline_cpu[];
+
+// Real-mode entry for application processors. The SIPI starts each AP at
+// SMP_TRAMPOLINE_BASE with CS=0x0800; it jumps straight from real mode to
+// long mode on the kernel PML4, then calls smp_trampoline_entry(cpu) on
+// the stack prepared by the BSP. Everything is addressed relative to the
+// copy at SMP_TRAMPOLINE_BASE, so the code is position-independent.
+__asm__ (
+    ".section .text\n"
+    ".global smp_trampoline_start\n"
+    ".global smp_trampoline_end\n"
+    ".global smp_trampoline_cr3\n"
+    ".global smp_trampoline_stack\n"
+    ".global smp_trampoline_entry\n"
+    ".global smp_trampoline_cpu\n"
+    ".code16\n"
+    "smp_trampoline_start:\n"
+    "    cli\n"
+    "    cld\n"
+    "    movw %cs, %ax\n"
+    "    movw %ax, %ds\n"
+    "    lgdtl (smp_trampoline_gdt_ptr - smp_trampoline_start)\n"
+    "    movl %cr4, %eax\n"
+    "    orl $0x20, %eax\n"                                     /* PAE */
+    "    movl %eax, %cr4\n"
+    "    movl (smp_trampoline_cr3 - smp_trampoline_start), %eax\n"
+    "    movl %eax, %cr3\n"
+    "    movl $0xC0000080, %ecx\n"                              /* EFER */
+    "    rdmsr\n"
+    "    orl $0x100, %eax\n"                                    /* LME */
+    "    wrmsr\n"
+    "    movl %cr0, %eax\n"
+    "    orl $0x80000001, %eax\n"                               /* PG | PE */
+    "    movl %eax, %cr0\n"
+    "    ljmpl $0x08, $(" SMP_TRAMPOLINE_BASE_STR " + smp_trampoline_long - smp_trampoline_start)\n"
+    ".code64\n"
+    "smp_trampoline_long:\n"
+    "    movw $0x10, %ax\n"
+    "    movw %ax, %ds\n"
+    "    movw %ax, %es\n"
+    "    movw %ax, %ss\n"
+    "    movq (" SMP_TRAMPOLINE_BASE_STR " + smp_trampoline_stack - smp_trampoline_start), %rsp\n"
+    "    movq (" SMP_TRAMPOLINE_BASE_STR " + smp_trampoline_cpu - smp_trampoline_start), %rdi\n"
+    "    movq (" SMP_TRAMPOLINE_BASE_STR " + smp_trampoline_entry - smp_trampoline_start), %rax\n"
+    "    callq *%rax\n"
+    "1:  hlt\n"
+    "    jmp 1b\n"
+    ".balign 16\n"
+    "smp_trampoline_gdt:\n"
+    "    .quad 0\n"
+    "    .quad 0x00AF9A000000FFFF\n"                             /* 64-bit code */
+    "    .quad 0x00CF92000000FFFF\n"                             /* data */
+    "smp_trampoline_gdt_ptr:\n"
+    "    .word 23\n"
+    "    .long " SMP_TRAMPOLINE_BASE_STR " + smp_trampoline_gdt - smp_trampoline_start\n"
+    ".balign 8\n"
+    "smp_trampoline_cr3:   .quad 0\n"
+    "smp_trampoline_stack: .quad 0\n"
+    "smp_trampoline_entry: .quad 0\n"
+    "smp_trampoline_cpu:   .quad 0\n"
+    "smp_trampoline_end:\n"
+);
+
+#define TRAMPOLINE_FIELD(sym) \
+    ((uint64_t *)(SMP_TRAMPOLINE_BASE + ((sym) - smp_trampoline_start)))
+
+#define SIPI_INIT_DELAY_NS   10000000ULL  // 10 ms
+#define SIPI_RETRY_DELAY_NS  200000ULL    // 200 us
+
+static uint64_t ap_rsp0[MAX_CPUS];
+static uint64_t ap_ist1[MAX_CPUS];
+
+// First C code on an AP, still on the trampoline-provided boot stack
+static __attribute__((noreturn)) void ap_entry(uint64_t cpu)
+{
+    percpu_init(cpu, lapic_id(), ap_rsp0[cpu]);
+    setup_tss_cpu(cpu, ap_rsp0[cpu], ap_ist1[cpu]);
+    setup_gdt_cpu(cpu);
+    load_idt();
+    paging_init_cpu();
+    tlb_init_cpu();
+    enable_fpu_sse();
+    syscall_init_cpu();
+
+    smp_ap_main((uint32_t)cpu);
+}
+
+bool smp_prepare_trampoline(void)
+{
+    uint64_t cr3 = (uint64_t)kernel_pml4;
+    if (cr3 > 0xFFFFFFFFULL) {
+        tty_printf("[SMP] Kernel PML4 @ 0x%x is above 4 GiB, cannot boot APs\n", cr3);
+        return false;
+    }
+
+    // Low memory is identity mapped so the AP survives turning paging on
+    if (virt_to_phys(SMP_TRAMPOLINE_BASE) != SMP_TRAMPOLINE_BASE) {
+        struct MemoryMapEntry entry = {
+            .type = KernelCode,
+            .pad = 0,
+            .physical_start = SMP_TRAMPOLINE_BASE,
+            .virtual_start = SMP_TRAMPOLINE_BASE,
+            .size_pages = 1,
+            .attribute = PAGE_RW | PAGE_PRESENT
+        };
+        map_identity(&entry);
+    }
+
+    size_t size = (size_t)(smp_trampoline_end - smp_trampoline_start);
+    memcpy((void *)SMP_TRAMPOLINE_BASE, smp_trampoline_start, size);
+    *TRAMPOLINE_FIELD(smp_trampoline_cr3) = cr3;
+    *TRAMPOLINE_FIELD(smp_trampoline_entry) = (uint64_t)ap_entry;
+    return true;
+}
+
+void smp_boot_ap(uint32_t cpu, uint32_t apic_id, uint64_t boot_stack, uint64_t rsp0, uint64_t ist1)
+{
+    ap_rsp0[cpu] = rsp0;
+    ap_ist1[cpu] = ist1;
+    *TRAMPOLINE_FIELD(smp_trampoline_stack) = boot_stack;
+    *TRAMPOLINE_FIELD(smp_trampoline_cpu) = cpu;
+    __asm__ volatile ("mfence" : : : "memory");
+
+    // INIT-SIPI-SIPI
+    lapic_send_init(apic_id);
+    tsc_delay_ns(SIPI_INIT_DELAY_NS);
+    lapic_send_sipi(apic_id, SMP_TRAMPOLINE_BASE >> 12);
+    tsc_delay_ns(SIPI_RETRY_DELAY_NS);
+    if (!cpus[cpu].online) lapic_send_sipi(apic_id, SMP_TRAMPOLINE_BASE >> 12);
+}
@@ -1,153 +1,373 @@
-#include "xencore/xenmem/mem_entry.h"
 #include <string.h>
 
 #include <xencore/arch/x86_64/syscall.h>
 #include <xencore/arch/x86_64/paging.h>
 #include <xencore/arch/x86_64/segments.h>
 #include <xencore/arch/x86_64/msr.h>
+#include <xencore/arch/x86_64/usercopy.h>
 
-#include <xencore/xenmem/xenalloc.h>
+#include <xencore/hazardous/environment.h>
+#include <xencore/hazardous/process.h>
+#include <xencore/hazardous/ring.h>
+#include <xencore/hazardous/mman.h>
+#include <xencore/hazardous/fileio.h>
 #include <xencore/xenio/tty.h>
+#include <xencore/sched/sched.h>
+#include <xencore/smp/cpu.h>
 #include <xencore/common.h>
 
-#define MSR_EFER    0xC0000080
 #define MSR_STAR    0xC0000081
 #define MSR_LSTAR   0xC0000082
 #define MSR_FMASK   0xC0000084
-#define EFER_SCE    (1 << 0)    // Enable SYSCALL/SYSRET
 
-uint64_t syscall_stack_top = 0;
+#define SYSCALL_PATH_MAX 256
 
-uint64_t syscall_dispatch(
-    uint64_t num,
-    uint64_t a1, uint64_t a2, uint64_t a3,
-    uint64_t a4, uint64_t a5, uint64_t a6
-) {
-#ifdef HLOS_DEBUG
-    tty_printf(
-        "[Syscall] num=0x%x a1=0x%x a2=0x%x a3=0x%x a4=0x%x a5=0x%x a6=0x%x\n",
-        (uint64_t)num, a1, a2, a3, a4, a5, a6
+/* -------------------------------------------------------------------------- */
+/*  Handlers                                                                  */
+/* -------------------------------------------------------------------------- */
+
+// Every handler takes the six argument registers, used or not
+#define SYSCALL_ARGS \
+    __attribute__((unused)) uint64_t a1, __attribute__((unused)) uint64_t a2, \
+    __attribute__((unused)) uint64_t a3, __attribute__((unused)) uint64_t a4, \
+    __attribute__((unused)) uint64_t a5, __attribute__((unused)) uint64_t a6
+
+typedef uint64_t (*syscall_handler_t)(uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t);
+
+// NUL-terminated copy of a user string, cut at SYSCALL_PATH_MAX - 1
+static bool syscall_copy_path(uint64_t user, char *path)
+{
+    return copy_string_from_user(path, user, SYSCALL_PATH_MAX) >= 0;
+}
+
+static uint64_t sys_read(SYSCALL_ARGS)
+{
+    return (uint64_t)fileio_read(current_process(), (int)a1, a2, (size_t)a3);
+}
+
+static uint64_t sys_write(SYSCALL_ARGS)
+{
+    return (uint64_t)fileio_write(current_process(), (int)a1, a2, (size_t)a3);
+}
+
+static uint64_t sys_open(SYSCALL_ARGS)
+{
+    char path[SYSCALL_PATH_MAX];
+    if (!syscall_copy_path(a1, path)) return (uint64_t)-1;
+    return (uint64_t)fileio_open(current_process(), path, (uint32_t)a2);
+}
+
+static uint64_t sys_close(SYSCALL_ARGS)
+{
+    return (uint64_t)fileio_close(current_process(), (int)a1);
+}
+
+static uint64_t sys_fstat(SYSCALL_ARGS)
+{
+    return (uint64_t)fileio_fstat(current_process(), (int)a1, a2);
+}
+
+static uint64_t sys_lseek(SYSCALL_ARGS)
+{
+    return (uint64_t)fileio_lseek(current_process(), (int)a1, (int64_t)a2, (int)a3);
+}
+
+static uint64_t sys_pread64(SYSCALL_ARGS)
+{
+    return (uint64_t)fileio_pread(current_process(), (int)a1, a2, (size_t)a3, (int64_t)a4);
+}
+
+static uint64_t sys_pwrite64(SYSCALL_ARGS)
+{
+    return (uint64_t)fileio_pwrite(current_process(), (int)a1, a2, (size_t)a3, (int64_t)a4);
+}
+
+static uint64_t sys_readv(SYSCALL_ARGS)
+{
+    return (uint64_t)fileio_readv(current_process(), (int)a1, a2, (int)a3);
+}
+
+static uint64_t sys_writev(SYSCALL_ARGS)
+{
+    return (uint64_t)fileio_writev(current_process(), (int)a1, a2, (int)a3);
+}
+
+static uint64_t sys_ftruncate(SYSCALL_ARGS)
+{
+    return (uint64_t)fileio_ftruncate(current_process(), (int)a1, (int64_t)a2);
+}
+
+static uint64_t sys_getdents64(SYSCALL_ARGS)
+{
+    return (uint64_t)fileio_getdents(current_process(), (int)a1, a2, (size_t)a3);
+}
+
+static uint64_t sys_mmap(SYSCALL_ARGS)
+{
+    return mman_mmap(current_process(), a1, a2, (uint32_t)a3, (uint32_t)a4, (int)a5, a6);
+}
+
+static uint64_t sys_munmap(SYSCALL_ARGS)
+{
+    return (uint64_t)mman_munmap(current_process(), a1, a2);
+}
+
+static uint64_t sys_brk(SYSCALL_ARGS)
+{
+    return mman_brk(current_process(), a1);
+}
+
+static uint64_t sys_sched_yield(SYSCALL_ARGS)
+{
+    sched_yield();
+    return 0;
+}
+
+static uint64_t sys_getpid(SYSCALL_ARGS)
+{
+    struct Process *proc = current_process();
+    return proc ? (uint64_t)proc->pid : (uint64_t)-1;
+}
+
+static uint64_t sys_getppid(SYSCALL_ARGS)
+{
+    return (uint64_t)(int64_t)process_parent_pid(current_process());
+}
+
+static uint64_t sys_sched_setaffinity(SYSCALL_ARGS)
+{
+    // Only the caller itself, a single 64-bit mask is plenty
+    struct Process *proc = current_process();
+    uint64_t mask = 0;
+    if ((a1 != 0 && (!proc || a1 != (uint64_t)proc->pid)) || a2 < sizeof(mask) || !copy_from_user(&mask, a3, sizeof(mask)))
+        return (uint64_t)-1;
+
+    mask &= (cpu_count < 64) ? (1ULL << cpu_count) - 1 : ~0ULL;
+    if (!mask) return (uint64_t)-1;
+    thread_set_affinity(current_thread(), mask);
+    sched_yield();
+    return 0;
+}
+
+__attribute__((used)) static int64_t syscall_fork(const struct SyscallFrame *frame)
+{
+    return process_fork(frame);
+}
+
+// The child needs the caller's callee-saved registers as well, which C
+// handlers only keep somewhere in their own frames. Pushed on top of what
+// syscall_entry saved, they complete a struct SyscallFrame.
+__attribute__((naked)) static uint64_t sys_fork(SYSCALL_ARGS)
+{
+    __asm__ volatile (
+        "push  %r15\n\t"
+        "push  %r14\n\t"
+        "push  %r13\n\t"
+        "push  %r12\n\t"
+        "push  %rbp\n\t"
+        "push  %rbx\n\t"
+        "mov   %rsp, %rdi\n\t"
+        "sub   $8, %rsp\n\t"
+        "call  syscall_fork\n\t"
+        "add   $8, %rsp\n\t"
+        "pop   %rbx\n\t"
+        "pop   %rbp\n\t"
+        "pop   %r12\n\t"
+        "pop   %r13\n\t"
+        "pop   %r14\n\t"
+        "pop   %r15\n\t"
+        "ret\n\t"
     );
+}
+
+_Static_assert(sizeof(struct SyscallFrame) == 17 * 8, "SyscallFrame must match the pushes in syscall_entry");
+
+static uint64_t sys_exit(SYSCALL_ARGS)
+{
+    int code = (int)a1;
+#ifdef HLOS_DEBUG
+    tty_printf("[Syscall] exit(%d)\n", code);
 #endif
+    process_exit(code);
+}
+
+static uint64_t sys_wait4(SYSCALL_ARGS)
+{
+    if (a2 && !user_range_ok(a2, sizeof(int))) return (uint64_t)-1;
 
-    switch (num) {
-        case SYS_WRITE: {
-            int fd = (int)a1;
-            const char *buf = (const char*)a2;
-            size_t len = (size_t)a3;
-            if (fd == 1) {
-                for (size_t i = 0; i < len; ++i) tty_putc(buf[i]);
-                return len;
-            }
-            return (uint64_t)-1;
-        }
-
-        case SYS_EXIT: {
-            int code = (int)a1;
-            tty_printf("[Syscall] exit(%d)\n", code);
-            while (1) __asm__ volatile("hlt");
-        }
-
-        default:
-            tty_printf("[Syscall] Unknown num=0x%x\n", (uint64_t)num);
-            return (uint64_t)-1;
+    int code = 0;
+    int32_t pid = process_wait((int32_t)a1, &code);
+    if (pid > 0 && a2) {
+        int status = (code & 0xFF) << 8;
+        if (!copy_to_user(a2, &status, sizeof(status))) return (uint64_t)-1;
     }
+    return (uint64_t)(int64_t)pid;
+}
+
+static uint64_t sys_spawn(SYSCALL_ARGS)
+{
+    char path[SYSCALL_PATH_MAX];
+    if (!syscall_copy_path(a1, path)) return (uint64_t)-1;
+    return (uint64_t)(int64_t)process_spawn(path);
+}
+
+static uint64_t sys_ring_setup(SYSCALL_ARGS)
+{
+    return (uint64_t)xenring_setup(current_process(), (uint32_t)a1);
+}
+
+static uint64_t sys_ring_enter(SYSCALL_ARGS)
+{
+    return (uint64_t)xenring_enter(current_process(), (uint32_t)a1);
 }
 
+// Indexed straight from syscall_entry, holes are NULL
+__attribute__((used)) static const syscall_handler_t syscall_table[SYSCALL_COUNT] = {
+    [SYS_READ]              = sys_read,
+    [SYS_WRITE]             = sys_write,
+    [SYS_OPEN]              = sys_open,
+    [SYS_CLOSE]             = sys_close,
+    [SYS_FSTAT]             = sys_fstat,
+    [SYS_LSEEK]             = sys_lseek,
+    [SYS_MMAP]              = sys_mmap,
+    [SYS_MUNMAP]            = sys_munmap,
+    [SYS_BRK]               = sys_brk,
+    [SYS_PREAD64]           = sys_pread64,
+    [SYS_PWRITE64]          = sys_pwrite64,
+    [SYS_READV]             = sys_readv,
+    [SYS_WRITEV]            = sys_writev,
+    [SYS_SCHED_YIELD]       = sys_sched_yield,
+    [SYS_GETPID]            = sys_getpid,
+    [SYS_FORK]              = sys_fork,
+    [SYS_EXIT]              = sys_exit,
+    [SYS_WAIT4]             = sys_wait4,
+    [SYS_FTRUNCATE]         = sys_ftruncate,
+    [SYS_GETPPID]           = sys_getppid,
+    [SYS_SCHED_SETAFFINITY] = sys_sched_setaffinity,
+    [SYS_GETDENTS64]        = sys_getdents64,
+    [SYS_SPAWN]             = sys_spawn,
+    [SYS_RING_SETUP]        = sys_ring_setup,
+    [SYS_RING_ENTER]        = sys_ring_enter,
+};
+
+// ENOSYS, quietly: a process looping on a bad number must not flood the tty
+__attribute__((used)) static uint64_t syscall_unknown(__attribute__((unused)) uint64_t num)
+{
+#ifdef HLOS_DEBUG
+    tty_printf("[Syscall] Unknown num=0x%x\n", num);
+#endif
+    return (uint64_t)-1;
+}
+
+// SYSRET to a non-canonical RIP faults in ring 0 on Intel, already on the
+// user stack. Only a syscall ending the last user page returns there, and
+// that process dies the way a fault would have killed it.
+__attribute__((used, noreturn)) static void syscall_bad_return(void)
+{
+    struct Process *proc = current_process();
+    tty_printf("[Syscall] %s (pid %d) returns to a non-canonical address\n", proc->name, proc->pid);
+    process_exit(128 + 11);   /* SIGSEGV */
+}
+
+/* -------------------------------------------------------------------------- */
+/*  Entry                                                                     */
+/*                                                                            */
+/*  SYSCALL leaves the user RSP in place and the return RIP/RFLAGS in RCX     */
+/*  and R11. We swap to the kernel GS, park the user RSP in the per-CPU area  */
+/*  and move onto the calling thread's own kernel stack, so interrupts can    */
+/*  come back on right away and the thread may block or be preempted.         */
+/*                                                                            */
+/*  Handlers are plain C: RBX, RBP and R12-R15 survive them anyway. Only the  */
+/*  argument registers, which the syscall ABI also preserves, are saved.      */
+/*  RAX returns the result, RCX and R11 are clobbered as on Linux. SYSRET    */
+/*  is only taken back to a canonical RIP.                                    */
+/*                                                                            */
+/*  The vector registers are preserved too. Handlers may use SSE, so they     */
+/*  run inside fpu_irq_enter/exit like interrupt handlers: the user state is  */
+/*  saved on the way in and reloaded by #NM once user code touches it again.  */
+/*                                                                            */
+/*  The saved registers are read back as struct SyscallFrame by fork().       */
+/* -------------------------------------------------------------------------- */
+
+#define SYSCALL_STR_(x) #x
+#define SYSCALL_STR(x)  SYSCALL_STR_(x)
+
 __attribute__((naked)) void syscall_entry(void)
 {
     __asm__ volatile (
-        "cli\n\t"
-
-        "mov   %rsp, %r15\n\t"                /* r15 = user_rsp */
-
-        "mov   syscall_stack_top(%rip), %rsp\n\t"
-        "sub   $144, %rsp\n\t"
-
-        /* Save user state */
-        "mov   %r11,   0(%rsp)\n\t"
-        "mov   %rcx,   8(%rsp)\n\t"
-        "mov   %r15,  16(%rsp)\n\t"           /* user_rsp    */
-        "mov   %rax,  24(%rsp)\n\t"           /* user_rax (num) */
-        "mov   %rbx,  32(%rsp)\n\t"
-        "mov   %rcx,  40(%rsp)\n\t"           /* debug */
-        "mov   %rdx,  48(%rsp)\n\t"           /* a3 */
-        "mov   %rsi,  56(%rsp)\n\t"           /* a2 */
-        "mov   %rdi,  64(%rsp)\n\t"           /* a1 */
-        "mov   %rbp,  72(%rsp)\n\t"
-        "mov   %r8,   80(%rsp)\n\t"           /* a5 */
-        "mov   %r9,   88(%rsp)\n\t"           /* a6 */
-        "mov   %r10,  96(%rsp)\n\t"           /* a4 */
-        "mov   %r11, 104(%rsp)\n\t"           /* debug */
-        "mov   %r12, 112(%rsp)\n\t"
-        "mov   %r13, 120(%rsp)\n\t"
-        "mov   %r14, 128(%rsp)\n\t"
-        "mov   %r15, 136(%rsp)\n\t"           /* user_r15 (actually user_rsp) */
-
-        /* Build C call args. */
-        "mov   24(%rsp), %rdi\n\t"            /* num */
-        "mov   64(%rsp), %rsi\n\t"            /* a1 */
-        "mov   56(%rsp), %rdx\n\t"            /* a2 */
-        "mov   48(%rsp), %rcx\n\t"            /* a3 */
-        "mov   96(%rsp), %r8\n\t"             /* a4 */
-        "mov   80(%rsp), %r9\n\t"             /* a5 */
-        "mov   88(%rsp), %rax\n\t"            /* a6 tmp */
-        "push  %rax\n\t"                      /* 7th arg */
+        "swapgs\n\t"
+        "mov   %rsp, %gs:" PERCPU_USER_RSP_STR "\n\t"
+        "mov   %gs:" PERCPU_KERNEL_STACK_TOP_STR ", %rsp\n\t"
 
+        "pushq %gs:" PERCPU_USER_RSP_STR "\n\t"
+        "push  %rcx\n\t"                      /* user rip */
+        "push  %r11\n\t"                      /* user rflags */
+        "push  %rdi\n\t"
+        "push  %rsi\n\t"
+        "push  %rdx\n\t"
+        "push  %r10\n\t"
+        "push  %r8\n\t"
+        "push  %r9\n\t"
+        "sub   $8, %rsp\n\t"                  /* 16-byte alignment for the call */
+        "mov   %rax, (%rsp)\n\t"
+        "call  fpu_irq_enter\n\t"
         "sti\n\t"
-        "call  syscall_dispatch\n\t"
-        "cli\n\t"
 
-        "add   $8, %rsp\n\t"                  /* drop a6 */
-
-        /* Restore user GPRs (except %rax/%rcx/%r11). */
-        "mov   32(%rsp), %rbx\n\t"
-        "mov   72(%rsp), %rbp\n\t"
-        "mov  112(%rsp), %r12\n\t"
-        "mov  120(%rsp), %r13\n\t"
-        "mov  128(%rsp), %r14\n\t"
-        "mov  136(%rsp), %r15\n\t"
-        "mov   64(%rsp), %rdi\n\t"
-        "mov   56(%rsp), %rsi\n\t"            /* restore a2 */
-        "mov   48(%rsp), %rdx\n\t"
-        "mov   96(%rsp), %r10\n\t"
-        "mov   80(%rsp), %r8\n\t"
-        "mov   88(%rsp), %r9\n\t"
-
-        /* Load user_rflags & user_rip. */
-        "mov    0(%rsp), %r11\n\t"
-        "mov    8(%rsp), %rcx\n\t"
-
-        /* Switch directly back to the saved user stack */
-        "mov   16(%rsp), %rsp\n\t"
+        /* reload what the call clobbered, a4 goes to rcx as C wants it */
+        "mov   (%rsp), %rax\n\t"
+        "mov   48(%rsp), %rdi\n\t"
+        "mov   40(%rsp), %rsi\n\t"
+        "mov   32(%rsp), %rdx\n\t"
+        "mov   24(%rsp), %rcx\n\t"
+        "mov   16(%rsp), %r8\n\t"
+        "mov   8(%rsp), %r9\n\t"
+        "cmp   $" SYSCALL_STR(SYSCALL_COUNT) ", %rax\n\t"
+        "jae   1f\n\t"
+        "lea   syscall_table(%rip), %r11\n\t"
+        "mov   (%r11,%rax,8), %r11\n\t"
+        "test  %r11, %r11\n\t"
+        "jz    1f\n\t"
+        "call  *%r11\n\t"
+        "jmp   2f\n\t"
+        "1:\n\t"
+        "mov   %rax, %rdi\n\t"
+        "call  syscall_unknown\n\t"
+        "2:\n\t"
 
+        "mov   64(%rsp), %rcx\n\t"             /* user rip */
+        "shr   $47, %rcx\n\t"
+        "jnz   3f\n\t"
+        "mov   %rax, (%rsp)\n\t"
+        "cli\n\t"
+        "call  fpu_irq_exit\n\t"
+        "mov   (%rsp), %rax\n\t"
+        "add   $8, %rsp\n\t"
+        "pop   %r9\n\t"
+        "pop   %r8\n\t"
+        "pop   %r10\n\t"
+        "pop   %rdx\n\t"
+        "pop   %rsi\n\t"
+        "pop   %rdi\n\t"
+        "pop   %r11\n\t"
+        "pop   %rcx\n\t"
+        "pop   %rsp\n\t"                      /* back on the user stack */
+        "swapgs\n\t"
         "sysretq\n\t"
+        "3:\n\t"
+        "call  syscall_bad_return\n\t"
     );
 }
 
+// Syscalls run on the kernel stack of the calling thread, nothing to
+// allocate up front
 void setup_syscall(void)
 {
-    // Allocate syscall stack
-    syscall_stack_top = (uint64_t)xen_alloc_aligned(SYSCALL_STACK_SIZE);
-    if (!syscall_stack_top) {
-        tty_printf("[Syscall] Failed to allocate syscall stack\n");
-        while (1) halt();
-    }
-    memset((void *)syscall_stack_top, 0, SYSCALL_STACK_SIZE);
-
-    // Map syscall stack
-    syscall_stack_top = virt_to_phys(syscall_stack_top);
-    struct MemoryMapEntry entry = {
-        .type = KernelData,
-        .pad = 0,
-        .physical_start = syscall_stack_top,
-        .virtual_start = syscall_stack_top,
-        .size_pages = SYSCALL_STACK_SIZE / PAGE_SIZE_4KB,
-        .attribute = PAGE_RW | PAGE_PRESENT
-    };
-    map_identity(&entry);
-    syscall_stack_top += SYSCALL_STACK_SIZE; // Point to top of stack
+    syscall_init_cpu();
+}
 
+// SYSCALL MSRs are per CPU, every processor that may run user code needs them
+void syscall_init_cpu(void)
+{
     // Enable syscall in EFER
     uint64_t efer = rdmsr(MSR_EFER);
     efer |= EFER_SCE;
@@ -164,8 +384,10 @@ void setup_syscall(void)
     uint64_t fmask = (1ULL << 9) | (1ULL << 8) | (1ULL << 10);
     wrmsr(MSR_FMASK, fmask);
 
+#ifdef HLOS_DEBUG
     tty_printf(
-        "[Syscall] STAR=0x%x LSTAR=0x%x FMASK=0x%x syscall_stack_top=0x%x\n",
-        (uint64_t)star, &syscall_entry, fmask, syscall_stack_top
+        "[Syscall] CPU %u STAR=0x%x LSTAR=0x%x FMASK=0x%x\n",
+        current_cpu(), (uint64_t)star, &syscall_entry, fmask
     );
+#endif
 }
@@ -0,0 +1,412 @@
+#include <xencore/arch/x86_64/tlb.h>
+#include <xencore/arch/x86_64/cpuid.h>
+#include <xencore/arch/x86_64/paging.h>
+#include <xencore/arch/x86_64/lapic.h>
+
+#include <xencore/xenmem/addrspace.h>
+#include <xencore/smp/cpu.h>
+#include <xencore/sync/spinlock.h>
+#include <xencore/xenio/tty.h>
+#include <xencore/common.h>
+
+/* -------------------------------------------------------------------------- */
+/*  PCID-tagged address spaces                                                */
+/*                                                                            */
+/*  Every CPU hands out its own small set of PCIDs to the address spaces it   */
+/*  runs, round robin. Running out starts a new generation: all slots are     */
+/*  forgotten and each address space gets a PCID again on its next switch,   */
+/*  loaded without the no-flush bit so stale entries of the previous owner    */
+/*  go away. An address space whose tlb_gen moved on since this CPU last      */
+/*  synced with it is flushed the same way; everything else switches with     */
+/*  CR3_NOFLUSH and keeps its TLB entries.                                    */
+/* -------------------------------------------------------------------------- */
+
+#define INVPCID_ADDRESS 0
+#define INVPCID_CONTEXT 1
+
+#define SLOT_STALE      UINT64_MAX  /* tlb_gen that never matches */
+
+struct PcidSlot {
+    uint64_t ctx_id;               /* owner, 0 = free */
+    uint64_t tlb_gen;              /* owner's tlb_gen when last flushed */
+};
+
+struct PcidCache {
+    struct PcidSlot slots[PCID_SLOTS + 1];
+    uint32_t next;
+    uint64_t generation;
+    struct AddressSpace *loaded;   /* in CR3 right now, NULL = kernel */
+};
+
+/* -------------------------------------------------------------------------- */
+/*  Shootdown queues                                                          */
+/*                                                                            */
+/*  Revoking mappings bumps the address space's tlb_gen first and then reads  */
+/*  its active_cpus mask; switching to it sets the bit first and then reads   */
+/*  tlb_gen. Either the switching CPU sees the new generation and flushes by  */
+/*  itself, or it is in the mask and gets a request. Requests from every      */
+/*  sender pile up in the target's queue, ranges of one address space merge,  */
+/*  and the target only gets an IPI if none is outstanding already.           */
+/* -------------------------------------------------------------------------- */
+
+struct TlbRequest {
+    struct AddressSpace *as;
+    uint64_t start;
+    uint64_t end;                  /* TLB_FLUSH_ALL for the whole space */
+    uint64_t gen;                  /* tlb_gen this request brings it to */
+};
+
+struct TlbQueue {
+    spinlock_t lock;
+    struct TlbRequest requests[TLB_QUEUE_LEN];
+    uint32_t count;
+    bool overflow;                 /* dropped requests, flush everything */
+    bool ipi_pending;
+    volatile uint64_t posted;      /* requests accepted */
+    volatile uint64_t done;        /* requests completed */
+};
+
+static struct PcidCache pcid_caches[MAX_CPUS];
+static struct TlbQueue tlb_queues[MAX_CPUS];
+static bool pcid_enabled = false;
+static bool invpcid_supported = false;
+
+static inline uint64_t read_cr3(void)
+{
+    uint64_t cr3;
+    __asm__ volatile ("mov %%cr3, %0" : "=r"(cr3));
+    return cr3;
+}
+
+static inline void write_cr3(uint64_t cr3)
+{
+    __asm__ volatile ("mov %0, %%cr3" : : "r"(cr3) : "memory");
+}
+
+static inline void invlpg(uint64_t addr)
+{
+    __asm__ volatile ("invlpg (%0)" : : "r"(addr) : "memory");
+}
+
+static inline void invpcid(uint64_t type, uint64_t pcid, uint64_t addr)
+{
+    struct { uint64_t pcid; uint64_t addr; } desc = { pcid, addr };
+    __asm__ volatile ("invpcid %0, %1" : : "m"(desc), "r"(type) : "memory");
+}
+
+static inline bool range_is_large(uint64_t start, uint64_t end)
+{
+    return end == TLB_FLUSH_ALL || (end - start) / PAGE_SIZE_4KB > TLB_FLUSH_ALL_PAGES;
+}
+
+static uint32_t pcid_alloc(struct PcidCache *cache)
+{
+    if (cache->next == 0 || cache->next > PCID_SLOTS) {
+        for (uint32_t i = 1; i <= PCID_SLOTS; ++i) cache->slots[i].ctx_id = 0;
+        cache->next = 1;
+        cache->generation++;
+    }
+    return cache->next++;
+}
+
+// The BSP decides, APs follow: every CPU must agree on the CR3 format
+void tlb_init_cpu(void)
+{
+    if (current_cpu() == 0) {
+#ifndef HLOS_NO_PCID
+        pcid_enabled = (cpuid(1, 0).ecx & CPUID_1_ECX_PCID) != 0;
+#endif
+        invpcid_supported = pcid_enabled && cpuid_max_leaf(0) >= 7 && (cpuid(7, 0).ebx & CPUID_7_EBX_INVPCID);
+    }
+    spin_init(&tlb_queues[current_cpu()].lock, "tlb_queue");
+
+    if (pcid_enabled) {
+        // PCIDE may only be set while CR3 selects PCID 0
+        write_cr3(read_cr3() & ~CR3_PCID_MASK);
+        uint64_t cr4;
+        __asm__ volatile ("mov %%cr4, %0" : "=r"(cr4));
+        __asm__ volatile ("mov %0, %%cr4" : : "r"(cr4 | CR4_PCIDE) : "memory");
+    }
+
+    if (current_cpu() == 0) {
+        tty_printf(
+            "[TLB] PCID %s, INVPCID %s, %u PCIDs per CPU\n",
+            pcid_enabled ? "enabled" : "disabled", invpcid_supported ? "yes" : "no", PCID_SLOTS
+        );
+    }
+}
+
+bool tlb_pcid_enabled(void)
+{
+    return pcid_enabled;
+}
+
+/* -------------------------------------------------------------------------- */
+/*  Address space switch                                                      */
+/* -------------------------------------------------------------------------- */
+
+static void tlb_load(struct PcidCache *cache, struct AddressSpace *as)
+{
+    uint64_t base = as ? as->cr3 : (uint64_t)kernel_pml4;
+    uint64_t current = read_cr3();
+
+    if (!pcid_enabled) {
+        if (current != base) write_cr3(base);
+        return;
+    }
+
+    // Kernel mappings only change during bring-up, PCID 0 never needs a flush
+    if (!as) {
+        if (current != base) write_cr3(base | CR3_NOFLUSH);
+        return;
+    }
+
+    uint32_t cpu = current_cpu();
+    uint64_t gen = __atomic_load_n(&as->tlb_gen, __ATOMIC_SEQ_CST);
+    uint32_t pcid = as->pcid[cpu];
+    bool flush;
+
+    if (pcid && cache->slots[pcid].ctx_id == as->ctx_id) {
+        flush = cache->slots[pcid].tlb_gen != gen;
+        if (!flush && current == (base | pcid)) return;
+    } else {
+        pcid = pcid_alloc(cache);
+        cache->slots[pcid].ctx_id = as->ctx_id;
+        as->pcid[cpu] = (uint8_t)pcid;
+        flush = true;
+    }
+
+    cache->slots[pcid].tlb_gen = gen;
+    write_cr3(base | pcid | (flush ? 0 : CR3_NOFLUSH));
+}
+
+// Load `as`, or the kernel tables for NULL. Interrupts must be off.
+void tlb_switch_to(struct AddressSpace *as)
+{
+    struct PcidCache *cache = &pcid_caches[current_cpu()];
+    struct AddressSpace *prev = cache->loaded;
+    uint64_t bit = 1ULL << current_cpu();
+
+    // Publish before tlb_load() samples tlb_gen, see the shootdown notes
+    if (as && as != prev) __atomic_fetch_or(&as->active_cpus, bit, __ATOMIC_SEQ_CST);
+
+    tlb_load(cache, as);
+    cache->loaded = as;
+
+    if (prev && prev != as) __atomic_fetch_and(&prev->active_cpus, ~bit, __ATOMIC_RELEASE);
+}
+
+/* -------------------------------------------------------------------------- */
+/*  Local invalidation                                                        */
+/* -------------------------------------------------------------------------- */
+
+// Bring this CPU's view of `as` up to `gen` for [start, end)
+static void tlb_flush_local(struct AddressSpace *as, uint64_t start, uint64_t end, uint64_t gen)
+{
+    struct PcidCache *cache = &pcid_caches[current_cpu()];
+    uint32_t pcid = as->pcid[current_cpu()];
+    bool cached = pcid_enabled && pcid && cache->slots[pcid].ctx_id == as->ctx_id;
+    bool loaded = cache->loaded == as;
+    bool whole = range_is_large(start, end);
+
+    if (!loaded && !cached) return;  /* nothing of it left in this TLB */
+
+    if (!loaded && !invpcid_supported) {
+        // Cannot reach another PCID, make the next switch flush it
+        cache->slots[pcid].tlb_gen = SLOT_STALE;
+        return;
+    }
+
+    if (loaded && whole) {
+        write_cr3(read_cr3() & ~CR3_NOFLUSH);
+    } else if (loaded) {
+        for (uint64_t addr = start; addr < end; addr += PAGE_SIZE_4KB) invlpg(addr);
+    } else if (whole) {
+        invpcid(INVPCID_CONTEXT, pcid, 0);
+    } else {
+        for (uint64_t addr = start; addr < end; addr += PAGE_SIZE_4KB) invpcid(INVPCID_ADDRESS, pcid, addr);
+    }
+
+    // While loaded, every revocation reaches us as a request and older ones
+    // still in flight flush their own pages. Otherwise some may have skipped
+    // us, so only claim a generation that directly follows the known one.
+    uint64_t known = cached ? cache->slots[pcid].tlb_gen : SLOT_STALE;
+    if (known != SLOT_STALE && (loaded ? known < gen : known == gen - 1)) {
+        cache->slots[pcid].tlb_gen = gen;
+    }
+}
+
+// Queue overflowed: drop every user translation this CPU may hold
+static void tlb_flush_local_all(void)
+{
+    struct PcidCache *cache = &pcid_caches[current_cpu()];
+
+    if (!pcid_enabled) {
+        write_cr3(read_cr3());
+        return;
+    }
+
+    // Forget every owner, each PCID is flushed when it is handed out again
+    for (uint32_t i = 1; i <= PCID_SLOTS; ++i) cache->slots[i].ctx_id = 0;
+    cache->next = 0;
+    if (cache->loaded) tlb_load(cache, cache->loaded);
+}
+
+/* -------------------------------------------------------------------------- */
+/*  Shootdown                                                                 */
+/* -------------------------------------------------------------------------- */
+
+// Drain this CPU's queue. Runs from the IPI and from senders waiting on
+// others, so two CPUs shooting at each other cannot deadlock.
+static void tlb_process_queue(void)
+{
+    struct TlbQueue *q = &tlb_queues[current_cpu()];
+    struct TlbRequest requests[TLB_QUEUE_LEN];
+
+    uint64_t flags = spin_lock_irqsave(&q->lock);
+    uint32_t count = q->count;
+    bool overflow = q->overflow;
+    uint64_t ticket = q->posted;
+    for (uint32_t i = 0; i < count; ++i) requests[i] = q->requests[i];
+    q->count = 0;
+    q->overflow = false;
+    q->ipi_pending = false;
+    spin_unlock(&q->lock);
+
+    if (overflow) {
+        tlb_flush_local_all();
+    } else {
+        for (uint32_t i = 0; i < count; ++i) {
+            tlb_flush_local(requests[i].as, requests[i].start, requests[i].end, requests[i].gen);
+        }
+    }
+
+    __atomic_store_n(&q->done, ticket, __ATOMIC_RELEASE);
+    irq_restore(flags);
+}
+
+void tlb_shootdown_interrupt(void)
+{
+    tlb_process_queue();
+}
+
+// Append or merge one range into a target's queue. Returns the ticket to
+// wait for, sets *kick if the target needs an IPI.
+static uint64_t tlb_post(uint32_t cpu, struct AddressSpace *as, uint64_t start, uint64_t end, uint64_t gen, bool *kick)
+{
+    struct TlbQueue *q = &tlb_queues[cpu];
+    spin_lock(&q->lock);
+
+    struct TlbRequest *req = NULL;
+    for (uint32_t i = 0; i < q->count; ++i) {
+        if (q->requests[i].as == as) {
+            req = &q->requests[i];
+            break;
+        }
+    }
+
+    if (req) {
+        if (start < req->start) req->start = start;
+        if (end > req->end) req->end = end;
+        if (range_is_large(req->start, req->end)) req->end = TLB_FLUSH_ALL;
+        if (gen > req->gen) req->gen = gen;
+    } else if (q->count < TLB_QUEUE_LEN) {
+        q->requests[q->count++] = (struct TlbRequest){ as, start, end, gen };
+    } else {
+        q->overflow = true;
+    }
+
+    uint64_t ticket = ++q->posted;
+    *kick = !q->ipi_pending;
+    q->ipi_pending = true;
+    spin_unlock(&q->lock);
+    return ticket;
+}
+
+void tlb_batch_init(struct TlbBatch *batch, struct AddressSpace *as)
+{
+    batch->as = as;
+    batch->count = 0;
+    batch->full = false;
+}
+
+// Record revoked mappings, nothing is flushed until tlb_batch_flush()
+void tlb_batch_add(struct TlbBatch *batch, uint64_t start, uint64_t end)
+{
+    start &= ~(uint64_t)(PAGE_SIZE_4KB - 1);
+    if (batch->full || start >= end) return;
+
+    // Merge with an overlapping or adjacent range
+    for (uint32_t i = 0; i < batch->count; ++i) {
+        if (start <= batch->end[i] && end >= batch->start[i]) {
+            if (start < batch->start[i]) batch->start[i] = start;
+            if (end > batch->end[i]) batch->end[i] = end;
+            if (range_is_large(batch->start[i], batch->end[i])) batch->full = true;
+            return;
+        }
+    }
+
+    if (batch->count == TLB_BATCH_RANGES || range_is_large(start, end)) {
+        batch->full = true;
+        return;
+    }
+    batch->start[batch->count] = start;
+    batch->end[batch->count] = end;
+    batch->count++;
+}
+
+// Make every recorded revocation visible on all CPUs. Returns once no TLB
+// can still hold the old translations, so their frames may be reused.
+void tlb_batch_flush(struct TlbBatch *batch)
+{
+    struct AddressSpace *as = batch->as;
+    if (!as || (!batch->full && batch->count == 0)) return;
+
+    uint64_t lo = batch->full ? 0 : batch->start[0];
+    uint64_t hi = batch->full ? TLB_FLUSH_ALL : batch->end[0];
+    for (uint32_t i = 1; i < batch->count && !batch->full; ++i) {
+        if (batch->start[i] < lo) lo = batch->start[i];
+        if (batch->end[i] > hi) hi = batch->end[i];
+    }
+
+    uint64_t flags = irq_save();
+    uint32_t self = current_cpu();
+
+    // Bump first, then look at who is running it
+    uint64_t gen = __atomic_add_fetch(&as->tlb_gen, 1, __ATOMIC_SEQ_CST);
+    uint64_t targets = __atomic_load_n(&as->active_cpus, __ATOMIC_SEQ_CST) & ~(1ULL << self);
+
+    if (batch->full || range_is_large(lo, hi)) {
+        tlb_flush_local(as, 0, TLB_FLUSH_ALL, gen);
+    } else {
+        for (uint32_t i = 0; i < batch->count; ++i) tlb_flush_local(as, batch->start[i], batch->end[i], gen);
+    }
+
+    // Remote CPUs get the covering range, one request and at most one IPI each
+    uint64_t tickets[MAX_CPUS];
+    for (uint64_t pending = targets; pending; pending &= pending - 1) {
+        uint32_t cpu = __builtin_ctzll(pending);
+        bool kick;
+        tickets[cpu] = tlb_post(cpu, as, lo, hi, gen, &kick);
+        if (kick) lapic_send_ipi(cpus[cpu].lapic_id, LAPIC_TLB_VECTOR);
+    }
+
+    for (uint64_t pending = targets; pending; pending &= pending - 1) {
+        uint32_t cpu = __builtin_ctzll(pending);
+        while (__atomic_load_n(&tlb_queues[cpu].done, __ATOMIC_ACQUIRE) < tickets[cpu]) {
+            tlb_process_queue();
+            cpu_relax();
+        }
+    }
+
+    irq_restore(flags);
+    tlb_batch_init(batch, as);
+}
+
+void tlb_flush_range(struct AddressSpace *as, uint64_t start, uint64_t end)
+{
+    struct TlbBatch batch;
+    tlb_batch_init(&batch, as);
+    tlb_batch_add(&batch, start, end);
+    tlb_batch_flush(&batch);
+}
@@ -0,0 +1,89 @@
+#include <xencore/arch/x86_64/tsc.h>
+#include <xencore/arch/x86_64/cpuid.h>
+#include <xencore/arch/x86_64/pit.h>
+
+#include <xencore/xenio/tty.h>
+
+#define TSC_CALIBRATION_MS    10
+#define TSC_CALIBRATION_RUNS  5
+#define TSC_FALLBACK_HZ       1000000000ULL
+#define NS_PER_SEC            1000000000ULL
+
+static uint64_t tsc_hz = 0;
+static uint64_t tsc_boot = 0;
+static uint64_t tsc_ns_mult = 0;  // ns = (cycles * mult) >> 32
+static uint64_t tsc_cyc_mult = 0; // cycles = (ns * mult) >> 32
+static bool tsc_invariant = false;
+
+void calibrate_tsc(void)
+{
+    if (cpuid_max_leaf(0x80000000) >= 0x80000007) {
+        tsc_invariant = (cpuid(0x80000007, 0).edx & CPUID_80000007_EDX_INVTSC) != 0;
+    }
+
+    // Shortest run wins: anything that stretches a window only adds cycles
+    uint64_t best = 0;
+    for (int i = 0; i < TSC_CALIBRATION_RUNS; ++i) {
+        uint64_t cycles = pit_measure_tsc(TSC_CALIBRATION_MS);
+        if (cycles && (best == 0 || cycles < best)) best = cycles;
+    }
+
+    tsc_hz = best ? best * (1000 / TSC_CALIBRATION_MS) : TSC_FALLBACK_HZ;
+    tsc_ns_mult = (uint64_t)(((__uint128_t)NS_PER_SEC << 32) / tsc_hz);
+    tsc_cyc_mult = (uint64_t)(((__uint128_t)tsc_hz << 32) / NS_PER_SEC);
+    tsc_boot = rdtsc();
+
+    tty_printf(
+        "[TSC] Frequency: %u kHz (%s)\n",
+        tsc_hz / 1000, tsc_invariant ? "invariant" : "not invariant"
+    );
+}
+
+bool tsc_is_invariant(void)
+{
+    return tsc_invariant;
+}
+
+uint64_t tsc_get_hz(void)
+{
+    return tsc_hz;
+}
+
+// TSC value at monotonic zero
+uint64_t tsc_get_base(void)
+{
+    return tsc_boot;
+}
+
+uint64_t tsc_get_ns_mult(void)
+{
+    return tsc_ns_mult;
+}
+
+uint64_t tsc_to_ns(uint64_t cycles)
+{
+    return (uint64_t)(((__uint128_t)cycles * tsc_ns_mult) >> 32);
+}
+
+uint64_t ns_to_tsc(uint64_t ns)
+{
+    return (uint64_t)(((__uint128_t)ns * tsc_cyc_mult) >> 32);
+}
+
+// Nanoseconds since calibration
+uint64_t tsc_ns(void)
+{
+    return tsc_to_ns(rdtsc() - tsc_boot);
+}
+
+// TSC value at `ns` nanoseconds since calibration
+uint64_t tsc_at_ns(uint64_t ns)
+{
+    return tsc_boot + ns_to_tsc(ns);
+}
+
+void tsc_delay_ns(uint64_t ns)
+{
+    uint64_t end = rdtsc() + ns_to_tsc(ns);
+    while (rdtsc() < end) __asm__ volatile ("pause");
+}
@@ -2,16 +2,27 @@
 
 #include <xencore/arch/x86_64/tss.h>
 
+#include <xencore/smp/cpu.h>
 #include <xencore/xenio/tty.h>
 
-__attribute__((aligned(16))) struct TSS tss;
+__attribute__((aligned(16))) struct TSS tss[MAX_CPUS];
 __attribute__((aligned(16))) uint8_t kernel_stack[8192];  // main stack for kernel mode
 __attribute__((aligned(16))) uint8_t df_stack[4096];      // IST1 (double fault)
 
+void setup_tss_cpu(uint32_t cpu, uint64_t rsp0, uint64_t ist1)
+{
+    memset(&tss[cpu], 0, sizeof(struct TSS));
+    tss[cpu].rsp0 = rsp0;
+    tss[cpu].ist[0] = ist1;
+    tss[cpu].iopb_offset = sizeof(struct TSS);
+    tty_printf("[TSS] CPU %u base: 0x%x, Kernel stack top: 0x%x\n", cpu, (uint64_t)&tss[cpu], tss[cpu].rsp0);
+}
+
 void setup_tss() {
-    memset(&tss, 0, sizeof(tss));
-    tss.rsp0 = (uint64_t)(kernel_stack + sizeof(kernel_stack));
-    tss.ist[0] = (uint64_t)(df_stack + sizeof(df_stack));
-    tss.iopb_offset = sizeof(struct TSS);
-    tty_printf("[TSS] Base: 0x%x, Kernel stack top: 0x%x\n", (uint64_t)&tss, tss.rsp0);
+    setup_tss_cpu(0, (uint64_t)(kernel_stack + sizeof(kernel_stack)), (uint64_t)(df_stack + sizeof(df_stack)));
+}
+
+struct TSS *get_tss(uint32_t cpu)
+{
+    return &tss[cpu];
 }
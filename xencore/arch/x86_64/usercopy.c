@@ -0,0 +1,116 @@
+#include <xencore/arch/x86_64/usercopy.h>
+
+#include <xencore/hazardous/environment.h>
+
+/* -------------------------------------------------------------------------- */
+/*  Copies to and from user memory                                            */
+/*                                                                            */
+/*  The kernel touches user buffers directly, and the page fault handler     */
+/*  pages them in like it would for the process itself. When it cannot,      */
+/*  the fault came from ring 0 and would otherwise halt the machine. Every   */
+/*  instruction below that touches user memory is listed in a small          */
+/*  exception table instead: a fault there resumes at its fixup, which       */
+/*  makes the copy return early, and the syscall fails with -1.              */
+/* -------------------------------------------------------------------------- */
+
+// Return the number of bytes left undone, 0 on success
+uint64_t usercopy_movs(void *dst, const void *src, size_t len);
+uint64_t usercopy_stos(void *dst, size_t len);
+// Length of the string without its NUL, `max` if none within it, -1 on fault
+int64_t usercopy_str(char *dst, const char *src, size_t max);
+
+__asm__ (
+    ".section .text\n"
+    ".global usercopy_movs\n"
+    "usercopy_movs:\n"
+    "    movq  %rdx, %rcx\n"
+    "usercopy_movs_access:\n"
+    "    rep movsb\n"
+    "    movq  %rcx, %rax\n"
+    "    ret\n"
+
+    ".global usercopy_stos\n"
+    "usercopy_stos:\n"
+    "    movq  %rsi, %rcx\n"
+    "    xorl  %eax, %eax\n"
+    "usercopy_stos_access:\n"
+    "    rep stosb\n"
+    "    movq  %rcx, %rax\n"
+    "    ret\n"
+
+    // rep movsb/stosb stop with the remaining count in rcx
+    "usercopy_rep_fixup:\n"
+    "    movq  %rcx, %rax\n"
+    "    ret\n"
+
+    ".global usercopy_str\n"
+    "usercopy_str:\n"
+    "    xorl  %eax, %eax\n"
+    "1:  cmpq  %rdx, %rax\n"
+    "    jae   2f\n"
+    "usercopy_str_access:\n"
+    "    movzbl (%rsi,%rax), %ecx\n"
+    "    movb  %cl, (%rdi,%rax)\n"
+    "    testb %cl, %cl\n"
+    "    jz    2f\n"
+    "    incq  %rax\n"
+    "    jmp   1b\n"
+    "2:  ret\n"
+
+    "usercopy_str_fixup:\n"
+    "    movq  $-1, %rax\n"
+    "    ret\n"
+);
+
+extern const uint8_t usercopy_movs_access[], usercopy_stos_access[], usercopy_rep_fixup[];
+extern const uint8_t usercopy_str_access[], usercopy_str_fixup[];
+
+struct UserCopyFixup {
+    const uint8_t *access;
+    const uint8_t *fixup;
+};
+
+static const struct UserCopyFixup usercopy_table[] = {
+    { usercopy_movs_access, usercopy_rep_fixup },
+    { usercopy_stos_access, usercopy_rep_fixup },
+    { usercopy_str_access, usercopy_str_fixup },
+};
+
+// Called by the page fault handler for kernel faults it could not resolve.
+// Where to resume if the fault hit one of the accesses above, else 0.
+uint64_t usercopy_fixup(uint64_t rip)
+{
+    for (size_t i = 0; i < sizeof(usercopy_table) / sizeof(usercopy_table[0]); ++i) {
+        if (rip == (uint64_t)usercopy_table[i].access) return (uint64_t)usercopy_table[i].fixup;
+    }
+    return 0;
+}
+
+bool copy_from_user(void *dst, uint64_t src, size_t len)
+{
+    return user_range_ok(src, len) && usercopy_movs(dst, (const void *)src, len) == 0;
+}
+
+bool copy_to_user(uint64_t dst, const void *src, size_t len)
+{
+    return user_range_ok(dst, len) && usercopy_movs((void *)dst, src, len) == 0;
+}
+
+bool clear_user(uint64_t dst, size_t len)
+{
+    return user_range_ok(dst, len) && usercopy_stos((void *)dst, len) == 0;
+}
+
+// NUL-terminated copy of a user string, cut at `max` - 1 characters.
+// Returns its length, -1 if it faults.
+int64_t copy_string_from_user(char *dst, uint64_t src, size_t max)
+{
+    if (!max || !user_range_ok(src, 1)) return -1;
+
+    size_t limit = max - 1;
+    if (limit > USER_BUFFER_END - src) limit = USER_BUFFER_END - src;
+
+    int64_t len = usercopy_str(dst, (const char *)src, limit);
+    if (len >= 0) dst[len] = '\0';
+    return len;
+}
@@ -13,6 +13,7 @@
 \*-------------------------------------------------------------------------------------*/
 
 #include <stdbool.h>
+#include <string.h>
 
 #ifdef ARCH_x86_64
 #include <xencore/arch/x86_64/fpu.h>
@@ -20,9 +21,11 @@
 #include <xencore/arch/x86_64/gdt.h>
 #include <xencore/arch/x86_64/idt.h>
 #include <xencore/arch/x86_64/pic.h>
-#include <xencore/arch/x86_64/pit.h>
+#include <xencore/arch/x86_64/tsc.h>
+#include <xencore/arch/x86_64/lapic.h>
 #include <xencore/arch/x86_64/paging.h>
 #include <xencore/arch/x86_64/syscall.h>
+#include <xencore/arch/x86_64/tlb.h>
 #endif
 
 #include <xencore/common.h>
@@ -30,16 +33,53 @@
 #include <xencore/xenio/tty.h>
 #include <xencore/graphics/framebuffer.h>
 #include <xencore/xenmem/xenmap.h>
+#include <xencore/xenmem/xenframe.h>
 #include <xencore/xenfs/vfs.h>
 #include <xencore/xenfs/test_sample.h>
 #include <xencore/hazardous/xenloader.h>
 #include <xencore/hazardous/environment.h>
+#include <xencore/hazardous/process.h>
 #include <xencore/timer/sleep.h>
+#include <xencore/timer/timer.h>
+#include <xencore/timer/clock.h>
+#include <xencore/smp/cpu.h>
+#include <xencore/smp/smp.h>
+#include <xencore/sched/sched.h>
+#include <xencore/acpi/acpi.h>
+#include <xencore/sync/lockstat.h>
 #include <xencore/gman/gman.h>
 
 #include <demo/triangle.h>
 
-void resonance_cascade(struct FramebufferParams fb_params, struct TestSampleParams sample_params, struct MemoryMapParams memmap_params) {
+// Runs every ELF in the test sample as its own process, all at once, and
+// reaps them as they finish
+static void hazardous_thread(void *arg)
+{
+    vfs_node_t *dir = (vfs_node_t *)arg;
+    char path[256];
+    uint32_t spawned = 0;
+
+    vfs_node_t *node;
+    for (size_t i = 0; (node = vfs_child(dir, i)) != NULL; ++i) {
+        size_t len = strlen(node->name);
+        if (node->type != VFS_NODE_FILE || len < 4 || strcmp(node->name + len - 4, ".elf") != 0) continue;
+
+        strcpy(path, "/test_sample/");
+        strncat(path, node->name, sizeof(path) - strlen(path) - 1);
+        if (process_spawn(path) > 0) spawned++;
+    }
+
+    int code;
+    int32_t pid;
+    while ((pid = process_wait(-1, &code)) > 0) {
+        tty_printf("[Hazardous] pid %d exited with %d\n", pid, code);
+    }
+    tty_printf("[Hazardous] %u processes done, %u frames free\n", spawned, frame_free_count());
+}
+
+void resonance_cascade(struct FramebufferParams fb_params, struct TestSampleParams sample_params, struct MemoryMapParams memmap_params, struct AcpiParams acpi_params) {
+    // GS must point at a per-CPU area before anything takes a lock
+    percpu_init(0, 0, 0);
     serial_init();
     fb_init(&fb_params);
 
@@ -50,12 +90,28 @@ void resonance_cascade(struct FramebufferParams fb_params, struct TestSamplePara
     setup_gdt();
     setup_idt();
     setup_paging(&memmap_params, fb_params.base, fb_params.size);
+    paging_init_cpu();
+    tlb_init_cpu();
     remap_pic();
-    setup_pit(100);
+    mask_pic();
+    calibrate_tsc();
+    setup_lapic();
+    this_cpu()->lapic_id = lapic_id();
+    this_cpu()->kernel_stack_top = get_tss(0)->rsp0;
     enable_interrupts();
 #endif
     
     xenmap_init();
+    xenframe_init();
+    timer_init();
+    clock_init();
+    acpi_init(&acpi_params);
+#ifdef ARCH_x86_64
+    fpu_init();
+#endif
+    sched_init();
+    smp_init();
+    process_init();
     vfs_init();
     analyse_test_sample(&sample_params);
     
@@ -63,14 +119,15 @@ void resonance_cascade(struct FramebufferParams fb_params, struct TestSamplePara
     setup_syscall();
 #endif
 
-    // Test loading and running an ELF file in usermode
-    vfs_node_t *elf_file = vfs_lookup("/test_sample/test.elf");
-    if (elf_file) {
-        Elf64 *elf = load_elf64(elf_file->file.data);
-        struct HazardousContext *ctx = setup_hazardous_environment(elf);
-        enter_hazardous_environment(ctx);
-    }
+#ifdef HLOS_LOCKSTAT
+    lockstat_dump();
+#endif
+
+    // Test loading and running ELF files in usermode
+    vfs_node_t *sample_dir = vfs_lookup("/test_sample");
+    if (sample_dir) thread_create("hazardous", hazardous_thread, sample_dir);
 
+    // Meanwhile the boot thread keeps the demo running
     struct DemoTriangleState state = demo_triangle_init();
     while (1) demo_triangle_tick(&state);
 }
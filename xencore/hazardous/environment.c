@@ -1,54 +1,263 @@
+#include <string.h>
+
 #ifdef ARCH_x86_64
 #include <xencore/arch/x86_64/paging.h>
 #include <xencore/arch/x86_64/segments.h>
+#include <xencore/arch/x86_64/tlb.h>
+#include <xencore/arch/x86_64/fpu.h>
+#include <xencore/arch/x86_64/syscall.h>
 #endif
 
 #include <xencore/hazardous/environment.h>
+#include <xencore/hazardous/image.h>
+#include <xencore/hazardous/process.h>
 #include <xencore/xenmem/xenalloc.h>
+#include <xencore/xenmem/xenframe.h>
+#include <xencore/xenmem/addrspace.h>
+#include <xencore/xenmem/vma.h>
+#include <xencore/xenfs/vfs.h>
 #include <xencore/xenio/tty.h>
+#include <xencore/timer/clock.h>
+#include <xencore/sched/sched.h>
+
+/* -------------------------------------------------------------------------- */
+/*  ELF segments                                                              */
+/*                                                                            */
+/*  Segments are not copied at load time. Whole pages of file data become    */
+/*  private file VMAs over the VFS pages, so text is shared by everyone who  */
+/*  runs the program and data is copied a page at a time on first write.     */
+/*  Whole pages past the file data are demand-zero anonymous memory. The     */
+/*  few pages mixing file data with anything else come from the image       */
+/*  cache, shared read-only like the rest.                                   */
+/* -------------------------------------------------------------------------- */
 
-struct HazardousContext *setup_hazardous_environment(Elf64 *elf)
+// Reserve a segment's pages. A first page shared with the previous
+// segment, ending at `prev_end`, gets the permissions of both.
+static bool reserve_hazardous_segment(struct AddressSpace *as, const struct SegmentLayout *seg, struct vfs_node *file, uint64_t prev_end, uint32_t prev_prot)
 {
-    struct HazardousContext *ctx = xen_alloc(sizeof(struct HazardousContext));
+    uint64_t from = seg->start;
+    if (from < prev_end) {
+        vma_remove(as, from, from + FRAME_SIZE);
+        if (!vma_insert(as, from, from + FRAME_SIZE, seg->prot | prev_prot, VMA_ANON)) return false;
+        from += FRAME_SIZE;
+    }
+
+    if (from < seg->lazy_start && !vma_insert(as, from, seg->lazy_start, seg->prot, VMA_ANON)) return false;
+    if (seg->lazy_start < seg->lazy_end &&
+        !vma_insert_file(as, seg->lazy_start, seg->lazy_end, seg->prot, VMA_FILE, file, seg->offset)) return false;
+
+    if (from < seg->lazy_end) from = seg->lazy_end;
+    return from >= seg->end || vma_insert(as, from, seg->end, seg->prot, VMA_ANON);
+}
+
 #ifdef ARCH_x86_64
-    ctx->page_table = create_user_pml4();
+// Writes to the shared pages go through the copy-on-write path
+static bool map_hazardous_pages(uint64_t *pml4, const struct ExecImage *image)
+{
+    for (size_t i = 0; i < image->page_count; ++i) {
+        const struct ImagePage *page = &image->pages[i];
+        uint64_t nx = (page->prot & VMA_EXEC) ? 0 : page_nx;
+        frame_ref(page->phys);
+        if (!map_user_page(pml4, page->vaddr, page->phys, PAGE_USER | PAGE_OWNED | nx)) {
+            frame_free(page->phys);
+            return false;
+        }
+    }
+    return true;
+}
 #endif
-    ctx->entry_point = elf->header.e_entry;
 
-    // Map ELF segments
+// Reserve every segment of a program or library and map its built pages.
+// Returns the end of the highest segment, 0 on failure.
+static uint64_t load_hazardous_image(struct AddressSpace *as, const struct ExecImage *image)
+{
+    const Elf64 *elf = image->elf;
+    uint64_t prev_end = 0, top = 0;
+    uint32_t prev_prot = 0;
     for (size_t i = 0; i < elf->header.e_phnum; ++i) {
-        Elf64_Phdr *phdr = &elf->segments[i];
+        const Elf64_Phdr *phdr = &elf->segments[i];
+#ifdef HLOS_DEBUG
         tty_printf(
-            "[Hazardous] Segment %u: type=%u, vaddr=0x%x, paddr=0x%x, memsz=%u\n",
-            i, phdr->p_type, phdr->p_vaddr, phdr->p_paddr, phdr->p_memsz
+            "[Hazardous] Segment %u: type=%u, vaddr=0x%x, memsz=%u\n",
+            i, phdr->p_type, phdr->p_vaddr, phdr->p_memsz
         );
+#endif
+        if (phdr->p_type != PT_LOAD || !phdr->p_memsz) continue;
 
-        if (phdr->p_type == PT_LOAD) {
-            phdr->p_paddr = virt_to_phys(phdr->p_paddr);
-            tty_printf(
-                "[Hazardous] Mapping segment %u: virt 0x%x -> phys 0x%x, size %u\n",
-                i, phdr->p_vaddr, phdr->p_paddr, phdr->p_memsz
-            );
-            map_user_segment(ctx->page_table, phdr->p_vaddr, phdr->p_paddr, phdr->p_memsz);
+        struct SegmentLayout seg;
+        exec_segment_layout(phdr, image->load_base, &seg);
+        if (!reserve_hazardous_segment(as, &seg, image->node, prev_end, prev_prot)) {
+            tty_printf("[Hazardous] Cannot reserve segment %u of %s\n", i, image->node->name);
+            return 0;
         }
+        prev_end = seg.end;
+        prev_prot = seg.prot;
+        if (seg.end > top) top = seg.end;
+    }
+
+#ifdef ARCH_x86_64
+    if (!map_hazardous_pages(as->pml4, image)) {
+        tty_printf("[Hazardous] Out of memory mapping segments\n");
+        return 0;
     }
+#endif
+    return top;
+}
 
-    // Allocate and map user stack
-    uint64_t stack_bottom = USER_STACK_TOP - USER_STACK_SIZE;
-    uint64_t phys = virt_to_phys((uint64_t)xen_alloc_aligned(USER_STACK_SIZE));
-    map_range(ctx->page_table, stack_bottom, phys, USER_STACK_SIZE, PAGE_RW | PAGE_USER);
+// Libraries come already relocated from the image cache, so setting up
+// the Nth process of a program costs the same as the first
+struct HazardousContext *setup_hazardous_environment(const struct ExecImage *image)
+{
+    struct HazardousContext *ctx = xen_alloc(sizeof(struct HazardousContext));
+    if (!ctx) return NULL;
+    memset(ctx, 0, sizeof(struct HazardousContext));
+
+#ifdef ARCH_x86_64
+    ctx->aspace = addrspace_create();
+    if (!ctx->aspace) {
+        xen_free(ctx);
+        return NULL;
+    }
+#endif
+    ctx->load_base = image->load_base;
+    ctx->entry_point = image->load_base + image->elf->header.e_entry;
+
+    // The heap starts on the page after the program's highest segment
+    ctx->aspace->brk_start = load_hazardous_image(ctx->aspace, image);
+    bool ok = ctx->aspace->brk_start != 0;
+    for (size_t i = 0; ok && i < image->dep_count; ++i) ok = load_hazardous_image(ctx->aspace, image->deps[i]) != 0;
+    if (!ok) {
+        teardown_hazardous_environment(ctx);
+        return NULL;
+    }
+    ctx->aspace->brk = ctx->aspace->brk_start;
+
+    // The stack is demand paged like any other anonymous memory
+    if (!vma_insert(ctx->aspace, USER_STACK_TOP - USER_STACK_SIZE, USER_STACK_TOP, VMA_READ | VMA_WRITE, VMA_ANON)) {
+        tty_printf("[Hazardous] Out of memory reserving user stack\n");
+        teardown_hazardous_environment(ctx);
+        return NULL;
+    }
     ctx->stack_top = USER_STACK_TOP;
 
+    // Read-only clock page for syscall-free clock_gettime()
+    clock_map_user(ctx->aspace->pml4);
+
     return ctx;
 }
 
+// Copy of the calling process's environment that returns to user mode
+// from the same syscall as `frame`. The caller must own `parent`.
+struct HazardousContext *fork_hazardous_environment(struct HazardousContext *parent, const struct SyscallFrame *frame)
+{
+    struct HazardousContext *ctx = xen_alloc(sizeof(struct HazardousContext));
+    if (!ctx) return NULL;
+    memset(ctx, 0, sizeof(struct HazardousContext));
+    ctx->entry_point = parent->entry_point;
+    ctx->load_base = parent->load_base;
+    ctx->stack_top = parent->stack_top;
+
+#ifdef ARCH_x86_64
+    ctx->resume = xen_alloc(sizeof(struct SyscallFrame));
+    ctx->aspace = ctx->resume ? addrspace_fork(parent->aspace) : NULL;
+    if (!ctx->aspace) {
+        teardown_hazardous_environment(ctx);
+        return NULL;
+    }
+    *ctx->resume = *frame;
+
+    // Not in any VMA, so not copied along
+    clock_map_user(ctx->aspace->pml4);
+#endif
+    return ctx;
+}
+
+// Frees the address space and everything mapped PAGE_OWNED in it. Nothing
+// may be running on it anymore.
+void teardown_hazardous_environment(struct HazardousContext *ctx)
+{
+    if (!ctx) return;
+    addrspace_destroy(ctx->aspace);
+    xen_free(ctx->resume);
+    xen_free(ctx);
+}
+
+#ifdef ARCH_x86_64
+// A fork child leaves its first syscall with the parent's registers and 0
+__attribute__((noreturn)) static void resume_hazardous_environment(struct HazardousContext *ctx)
+{
+    struct SyscallFrame regs = *ctx->resume;
+    xen_free(ctx->resume);
+    ctx->resume = NULL;
+    regs.rflags |= 1ULL << 9;
+
+    // IRETQ faults in ring 0 on a non-canonical RIP, as SYSRET would
+    if (regs.rip >= USER_SPACE_END) process_exit(128 + 11);
+
+    __asm__ volatile ("cli" : : : "memory");
+    current_thread()->aspace = ctx->aspace;
+    tlb_switch_to(ctx->aspace);
+    fpu_irq_exit();     /* from process_start(), user code reloads its image */
+
+    // SYSRET would have left RIP in RCX and RFLAGS in R11
+    __asm__ volatile (
+        "mov   %[uds], %%ecx\n\t"
+        "mov   %%cx, %%ds\n\t"
+        "mov   %%cx, %%es\n\t"
+        "pushq %[uds]\n\t"
+        "pushq %c[rsp](%%rax)\n\t"
+        "pushq %c[rfl](%%rax)\n\t"
+        "pushq %[ucs]\n\t"
+        "pushq %c[rip](%%rax)\n\t"
+        "mov   %c[rbx](%%rax), %%rbx\n\t"
+        "mov   %c[rbp](%%rax), %%rbp\n\t"
+        "mov   %c[r12](%%rax), %%r12\n\t"
+        "mov   %c[r13](%%rax), %%r13\n\t"
+        "mov   %c[r14](%%rax), %%r14\n\t"
+        "mov   %c[r15](%%rax), %%r15\n\t"
+        "mov   %c[rdi](%%rax), %%rdi\n\t"
+        "mov   %c[rsi](%%rax), %%rsi\n\t"
+        "mov   %c[rdx](%%rax), %%rdx\n\t"
+        "mov   %c[r10](%%rax), %%r10\n\t"
+        "mov   %c[r8](%%rax), %%r8\n\t"
+        "mov   %c[r9](%%rax), %%r9\n\t"
+        "mov   %c[rip](%%rax), %%rcx\n\t"
+        "mov   %c[rfl](%%rax), %%r11\n\t"
+        "xor   %%eax, %%eax\n\t"
+        "swapgs\n\t"
+        "iretq\n\t"
+        :
+        : "a"(&regs),
+          [uds]"i"(USER_DS),
+          [ucs]"i"(USER_CS),
+          [rsp]"i"(offsetof(struct SyscallFrame, rsp)),
+          [rfl]"i"(offsetof(struct SyscallFrame, rflags)),
+          [rip]"i"(offsetof(struct SyscallFrame, rip)),
+          [rbx]"i"(offsetof(struct SyscallFrame, rbx)),
+          [rbp]"i"(offsetof(struct SyscallFrame, rbp)),
+          [r12]"i"(offsetof(struct SyscallFrame, r12)),
+          [r13]"i"(offsetof(struct SyscallFrame, r13)),
+          [r14]"i"(offsetof(struct SyscallFrame, r14)),
+          [r15]"i"(offsetof(struct SyscallFrame, r15)),
+          [rdi]"i"(offsetof(struct SyscallFrame, rdi)),
+          [rsi]"i"(offsetof(struct SyscallFrame, rsi)),
+          [rdx]"i"(offsetof(struct SyscallFrame, rdx)),
+          [r10]"i"(offsetof(struct SyscallFrame, r10)),
+          [r8]"i"(offsetof(struct SyscallFrame, r8)),
+          [r9]"i"(offsetof(struct SyscallFrame, r9))
+        : "memory"
+    );
+    __builtin_unreachable();
+}
+#endif
+
 __attribute__((noreturn)) void enter_hazardous_environment(struct HazardousContext *ctx)
 {
     uint64_t user_entry = ctx->entry_point;
     uint64_t user_stack = ctx->stack_top;
 
 #ifdef ARCH_x86_64
-    uint64_t cr3_phys = virt_to_phys((uint64_t)ctx->page_table);
+    if (ctx->resume) resume_hazardous_environment(ctx);
 
     uint64_t rflags;
     __asm__ volatile ("pushfq; pop %0" : "=r"(rflags));
@@ -56,23 +265,28 @@ __attribute__((noreturn)) void enter_hazardous_environment(struct HazardousConte
 
     tty_printf(
         "[Hazardous] entry=0x%x stack=0x%x cr3=0x%x\n",
-        (void*)user_entry, (void*)user_stack, (void*)cr3_phys
+        (void*)user_entry, (void*)user_stack, (void*)ctx->aspace->cr3
     );
 
-    load_pml4((uint64_t *)cr3_phys);
+    // The address space now belongs to this thread and follows it across
+    // switches. No interrupts from here on, the iretq turns them back on.
+    __asm__ volatile ("cli" : : : "memory");
+    current_thread()->aspace = ctx->aspace;
+    tlb_switch_to(ctx->aspace);
+    fpu_irq_exit();     /* from process_start(), user code reloads its image */
 
+    // The user GS base goes live with the SWAPGS, FS/GS selectors stay
     __asm__ volatile (
         "cli\n\t"
         "mov %[uds], %%ax\n\t"
         "mov %%ax, %%ds\n\t"
         "mov %%ax, %%es\n\t"
-        "mov %%ax, %%fs\n\t"
-        "mov %%ax, %%gs\n\t"
         "pushq %[uds]\n\t"
         "pushq %[stk]\n\t"
         "pushq %[rfl]\n\t"
         "pushq %[ucs]\n\t"
         "pushq %[rip]\n\t"
+        "swapgs\n\t"
         "iretq\n\t"
         :
         : [uds]"i"(USER_DS),
@@ -0,0 +1,288 @@
+#include <string.h>
+
+#include <xencore/arch/x86_64/usercopy.h>
+
+#include <xencore/hazardous/fileio.h>
+#include <xencore/hazardous/process.h>
+#include <xencore/hazardous/environment.h>
+#include <xencore/xenfs/vfs.h>
+#include <xencore/xenio/tty.h>
+
+/* -------------------------------------------------------------------------- */
+/*  File I/O, shared by the syscalls and the submission ring                  */
+/*                                                                            */
+/*  Descriptors index the process's own table and point straight at VFS       */
+/*  nodes; data is copied between the file's pages and the user buffer with   */
+/*  no staging in between. Slots 0-2 start out as the console, which can be   */
+/*  written but has no input yet. Offsets are per descriptor, a fork() child  */
+/*  gets copies of them. User memory is only touched through the usercopy    */
+/*  helpers, so a bad buffer fails the call instead of faulting the kernel.   */
+/* -------------------------------------------------------------------------- */
+
+#define FILEIO_PATH_MAX 256
+#define FILEIO_CONSOLE_CHUNK 128
+
+static struct FileDesc *fileio_fd(struct Process *proc, int fd, uint32_t need)
+{
+    struct FileDesc *file = process_get_fd(proc, fd);
+    if (!file) return NULL;
+    if (!(file->flags & FD_CONSOLE) && (file->flags & need) != need) return NULL;
+    return file;
+}
+
+static inline bool fileio_is_file(const struct FileDesc *file)
+{
+    return !(file->flags & FD_CONSOLE) && file->node && file->node->type == VFS_NODE_FILE;
+}
+
+// New empty file. Unlike vfs_create() the directory has to exist already.
+static vfs_node_t *fileio_create(const char *path)
+{
+    const char *slash = strrchr(path, '/');
+    size_t len = (size_t)(slash - path);
+    if (!slash[1] || len >= FILEIO_PATH_MAX) return NULL;
+
+    char dir_path[FILEIO_PATH_MAX];
+    memcpy(dir_path, path, len);
+    dir_path[len] = '\0';
+
+    vfs_node_t *dir = vfs_lookup(len ? dir_path : "/");
+    if (!dir || dir->type != VFS_NODE_DIR) return NULL;
+    return vfs_create(path, VFS_NODE_FILE);
+}
+
+// Returns the lowest free descriptor. Symlinks are not followed.
+int64_t fileio_open(struct Process *proc, const char *path, uint32_t flags)
+{
+    uint32_t access = flags & O_ACCMODE;
+    if (!proc || path[0] != '/' || access == O_ACCMODE) return -1;
+
+    vfs_node_t *node = vfs_lookup(path);
+    if (node && (flags & O_CREAT) && (flags & O_EXCL)) return -1;
+    if (!node && (!(flags & O_CREAT) || !(node = fileio_create(path)))) return -1;
+
+    if (node->type == VFS_NODE_SYMLINK) return -1;
+    if ((flags & O_DIRECTORY) && node->type != VFS_NODE_DIR) return -1;
+    if (node->type == VFS_NODE_DIR && access != O_RDONLY) return -1;
+    int fd = 0;
+    while (fd < PROC_MAX_FILES && (proc->files[fd].flags & FD_USED)) fd++;
+    if (fd == PROC_MAX_FILES) return -1;
+
+    // The slot is ours before the contents go, a full table loses nothing
+    struct FileDesc *file = &proc->files[fd];
+    file->flags = FD_USED;
+    if ((flags & O_TRUNC) && access != O_RDONLY && node->type == VFS_NODE_FILE
+        && !vfs_file_truncate(node, 0)) {
+        memset(file, 0, sizeof(struct FileDesc));
+        return -1;
+    }
+
+    file->node = node;
+    file->offset = 0;
+    file->flags = FD_USED
+                | ((access != O_WRONLY) ? FD_READ : 0)
+                | ((access != O_RDONLY) ? FD_WRITE : 0)
+                | ((flags & O_APPEND) ? FD_APPEND : 0);
+    return fd;
+}
+
+int64_t fileio_close(struct Process *proc, int fd)
+{
+    struct FileDesc *file = process_get_fd(proc, fd);
+    if (!file) return -1;
+    memset(file, 0, sizeof(struct FileDesc));
+    return 0;
+}
+
+/* -------------------------------------------------------------------------- */
+/*  Reading and writing                                                       */
+/* -------------------------------------------------------------------------- */
+
+int64_t fileio_pread(struct Process *proc, int fd, uint64_t buf, size_t len, int64_t offset)
+{
+    struct FileDesc *file = fileio_fd(proc, fd, FD_READ);
+    if (!file || offset < 0 || !user_range_ok(buf, len) || !fileio_is_file(file)) return -1;
+    return vfs_file_read(file->node, (uint64_t)offset, (void *)buf, len, true);
+}
+
+// Files grow as needed and may be left with holes
+int64_t fileio_pwrite(struct Process *proc, int fd, uint64_t buf, size_t len, int64_t offset)
+{
+    struct FileDesc *file = fileio_fd(proc, fd, FD_WRITE);
+    if (!file || offset < 0 || !user_range_ok(buf, len)) return -1;
+
+    if (file->flags & FD_CONSOLE) {
+        char chars[FILEIO_CONSOLE_CHUNK];
+        for (size_t done = 0; done < len;) {
+            size_t chunk = (len - done < sizeof(chars)) ? len - done : sizeof(chars);
+            if (!copy_from_user(chars, buf + done, chunk)) return done ? (int64_t)done : -1;
+            for (size_t i = 0; i < chunk; ++i) tty_putc(chars[i]);
+            done += chunk;
+        }
+        return (int64_t)len;
+    }
+    if (!fileio_is_file(file)) return -1;
+
+    int64_t written = vfs_file_write(file->node, (uint64_t)offset, (const void *)buf, len, true);
+    return (written > 0 || !len) ? written : -1;
+}
+
+int64_t fileio_read(struct Process *proc, int fd, uint64_t buf, size_t len)
+{
+    struct FileDesc *file = process_get_fd(proc, fd);
+    if (!file) return -1;
+
+    int64_t done = fileio_pread(proc, fd, buf, len, (int64_t)file->offset);
+    if (done > 0) file->offset += (uint64_t)done;
+    return done;
+}
+
+int64_t fileio_write(struct Process *proc, int fd, uint64_t buf, size_t len)
+{
+    struct FileDesc *file = process_get_fd(proc, fd);
+    if (!file) return -1;
+
+    if ((file->flags & FD_APPEND) && fileio_is_file(file)) file->offset = file->node->file.size;
+    int64_t done = fileio_pwrite(proc, fd, buf, len, (int64_t)file->offset);
+    if (done > 0 && !(file->flags & FD_CONSOLE)) file->offset += (uint64_t)done;
+    return done;
+}
+
+// Scattered buffers in one go, stopping at the first short transfer
+static int64_t fileio_vector(struct Process *proc, int fd, uint64_t iov, int count, bool write)
+{
+    if (count < 0 || count > FILEIO_IOV_MAX) return -1;
+    if (!user_range_ok(iov, (size_t)count * sizeof(struct fileio_iovec))) return -1;
+
+    int64_t total = 0;
+    for (int i = 0; i < count; ++i) {
+        struct fileio_iovec part;
+        if (!copy_from_user(&part, iov + (uint64_t)i * sizeof(part), sizeof(part))) return total ? total : -1;
+        if (!part.len) continue;
+
+        int64_t done = write ? fileio_write(proc, fd, part.base, part.len)
+                             : fileio_read(proc, fd, part.base, part.len);
+        if (done < 0) return total ? total : -1;
+        total += done;
+        if ((uint64_t)done < part.len) break;
+    }
+    return total;
+}
+
+int64_t fileio_readv(struct Process *proc, int fd, uint64_t iov, int count)
+{
+    return fileio_vector(proc, fd, iov, count, false);
+}
+
+int64_t fileio_writev(struct Process *proc, int fd, uint64_t iov, int count)
+{
+    return fileio_vector(proc, fd, iov, count, true);
+}
+
+/* -------------------------------------------------------------------------- */
+/*  Positions and metadata                                                    */
+/* -------------------------------------------------------------------------- */
+
+int64_t fileio_lseek(struct Process *proc, int fd, int64_t offset, int whence)
+{
+    struct FileDesc *file = process_get_fd(proc, fd);
+    if (!file || (file->flags & FD_CONSOLE) || !file->node) return -1;
+
+    int64_t base;
+    switch (whence) {
+        case SEEK_SET: base = 0; break;
+        case SEEK_CUR: base = (int64_t)file->offset; break;
+        case SEEK_END:
+            if (file->node->type != VFS_NODE_FILE) return -1;
+            base = (int64_t)file->node->file.size;
+            break;
+        default: return -1;
+    }
+
+    if ((offset < 0 && base + offset < 0) || (offset > 0 && base > INT64_MAX - offset)) return -1;
+    file->offset = (uint64_t)(base + offset);
+    return (int64_t)file->offset;
+}
+
+int64_t fileio_ftruncate(struct Process *proc, int fd, int64_t length)
+{
+    struct FileDesc *file = fileio_fd(proc, fd, FD_WRITE);
+    if (!file || length < 0 || !fileio_is_file(file)) return -1;
+    return vfs_file_truncate(file->node, (uint64_t)length) ? 0 : -1;
+}
+
+static uint32_t fileio_mode(const vfs_node_t *node)
+{
+    switch (node->type) {
+        case VFS_NODE_DIR:     return S_IFDIR | 0755;
+        case VFS_NODE_SYMLINK: return S_IFLNK | 0777;
+        default:               return S_IFREG | 0644;
+    }
+}
+
+int64_t fileio_fstat(struct Process *proc, int fd, uint64_t buf)
+{
+    struct FileDesc *file = process_get_fd(proc, fd);
+    if (!file || !user_range_ok(buf, sizeof(struct fileio_stat))) return -1;
+
+    struct fileio_stat st;
+    memset(&st, 0, sizeof(st));
+    st.st_nlink = 1;
+    st.st_blksize = VFS_PAGE_SIZE;
+
+    if (file->flags & FD_CONSOLE) {
+        st.st_mode = S_IFCHR | 0620;
+    } else if (file->node) {
+        st.st_ino = (uint64_t)(uintptr_t)file->node;
+        st.st_mode = fileio_mode(file->node);
+        if (file->node->type == VFS_NODE_FILE) st.st_size = (int64_t)file->node->file.size;
+        st.st_blocks = (st.st_size + 511) / 512;
+    }
+
+    return copy_to_user(buf, &st, sizeof(st)) ? 0 : -1;
+}
+
+static uint8_t fileio_dtype(const vfs_node_t *node)
+{
+    switch (node->type) {
+        case VFS_NODE_DIR:     return DT_DIR;
+        case VFS_NODE_FILE:    return DT_REG;
+        case VFS_NODE_SYMLINK: return DT_LNK;
+        default:               return DT_UNKNOWN;
+    }
+}
+
+// As many getdents64() records as fit. 0 at the end of the directory, -1
+// if not even the next one fits.
+int64_t fileio_getdents(struct Process *proc, int fd, uint64_t buf, size_t len)
+{
+    struct FileDesc *file = fileio_fd(proc, fd, FD_READ);
+    if (!file || (file->flags & FD_CONSOLE) || !user_range_ok(buf, len)) return -1;
+    if (!file->node || file->node->type != VFS_NODE_DIR) return -1;
+
+    size_t used = 0;
+    vfs_node_t *child;
+    while ((child = vfs_child(file->node, file->offset)) != NULL) {
+        size_t name_len = strlen(child->name);
+        size_t reclen = (sizeof(struct fileio_dirent64) + name_len + 1 + 7) & ~(size_t)7;
+        if (reclen > len - used) break;
+
+        struct fileio_dirent64 entry = {
+            .d_ino = (uint64_t)(uintptr_t)child,
+            .d_off = (int64_t)file->offset + 1,
+            .d_reclen = (uint16_t)reclen,
+            .d_type = fileio_dtype(child),
+        };
+        uint64_t out = buf + used;
+        if (!copy_to_user(out, &entry, sizeof(entry)) ||
+            !copy_to_user(out + sizeof(entry), child->name, name_len) ||
+            !clear_user(out + sizeof(entry) + name_len, reclen - sizeof(entry) - name_len)) {
+            return used ? (int64_t)used : -1;
+        }
+
+        used += reclen;
+        file->offset++;
+    }
+
+    return (used || !child) ? (int64_t)used : -1;
+}
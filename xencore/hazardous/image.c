@@ -0,0 +1,831 @@
+#include <string.h>
+
+#ifdef ARCH_x86_64
+#include <xencore/arch/x86_64/paging.h>
+#endif
+
+#include <xencore/hazardous/image.h>
+#include <xencore/hazardous/environment.h>
+#include <xencore/xenmem/xenalloc.h>
+#include <xencore/xenmem/xenframe.h>
+#include <xencore/xenmem/vma.h>
+#include <xencore/xenfs/vfs.h>
+#include <xencore/xenio/tty.h>
+#include <xencore/sync/spinlock.h>
+
+/* -------------------------------------------------------------------------- */
+/*  Executable image cache                                                    */
+/*                                                                            */
+/*  Parsing a program, relocating it and building the few pages that cannot   */
+/*  be mapped straight from the file happens once per VFS node. Every         */
+/*  process started from it maps those same frames read-only with a           */
+/*  reference of its own; the ones in writable segments are copied on their   */
+/*  first write like any other private page. The cache keeps its reference    */
+/*  until the file goes.                                                      */
+/*                                                                            */
+/*  PIE programs load at USER_PIE_BASE. One base per image is what lets the   */
+/*  relocated pages be shared: after the first spawn, relocations cost        */
+/*  nothing at all.                                                           */
+/* -------------------------------------------------------------------------- */
+
+#define IMAGE_BUCKETS       16
+#define IMAGE_PAGE_MASK     (FRAME_SIZE - 1)
+#define IMAGE_PAGES_INITIAL 8
+#define IMAGE_MAX_DEPS      32
+#define IMAGE_MAX_DEPTH     8
+#define IMAGE_LIB_ALIGN     0x200000
+#define SYMBOL_CACHE_SLOTS  128
+
+static struct ExecImage *image_buckets[IMAGE_BUCKETS];
+static spinlock_t image_lock = SPINLOCK_INIT("image");
+
+static inline size_t image_bucket(const struct vfs_node *node)
+{
+    return ((uint64_t)node >> 4) % IMAGE_BUCKETS;
+}
+
+void exec_segment_layout(const Elf64_Phdr *phdr, uint64_t base, struct SegmentLayout *seg)
+{
+    uint64_t vaddr = base + phdr->p_vaddr;
+    uint64_t data_end = vaddr + phdr->p_filesz;
+
+    seg->start = vaddr & ~(uint64_t)IMAGE_PAGE_MASK;
+    seg->end = (vaddr + phdr->p_memsz + IMAGE_PAGE_MASK) & ~(uint64_t)IMAGE_PAGE_MASK;
+    seg->file_end = (data_end + IMAGE_PAGE_MASK) & ~(uint64_t)IMAGE_PAGE_MASK;
+    seg->prot = ((phdr->p_flags & PF_R) ? VMA_READ : 0)
+              | ((phdr->p_flags & PF_W) ? VMA_WRITE : 0)
+              | ((phdr->p_flags & PF_X) ? VMA_EXEC : 0);
+
+    // File pages only line up with memory if both agree within a page
+    if ((phdr->p_offset & IMAGE_PAGE_MASK) == (vaddr & IMAGE_PAGE_MASK)) {
+        seg->lazy_start = (vaddr + IMAGE_PAGE_MASK) & ~(uint64_t)IMAGE_PAGE_MASK;
+        seg->lazy_end = data_end & ~(uint64_t)IMAGE_PAGE_MASK;
+        if (seg->lazy_end < seg->lazy_start) seg->lazy_end = seg->lazy_start;
+        seg->offset = phdr->p_offset + (seg->lazy_start - vaddr);
+    } else {
+        seg->lazy_start = seg->lazy_end = seg->start;
+        seg->offset = 0;
+    }
+}
+
+static void exec_image_free(struct ExecImage *image)
+{
+    for (size_t i = 0; i < image->page_count; ++i) frame_free(image->pages[i].phys);
+    xen_free(image->pages);
+    for (size_t i = 0; i < image->dep_count; ++i) exec_image_put(image->deps[i]);
+    xen_free(image->deps);
+    if (image->symbol_cache) {
+        for (size_t i = 0; i < SYMBOL_CACHE_SLOTS; ++i) xen_free(image->symbol_cache[i].name);
+        xen_free(image->symbol_cache);
+    }
+    free_elf64(image->elf);
+    xen_free(image->copy);
+    xen_free(image);
+}
+
+static void exec_image_hold(struct ExecImage *image)
+{
+    uint64_t flags = spin_lock_irqsave(&image_lock);
+    image->refs++;
+    spin_unlock_irqrestore(&image_lock, flags);
+}
+
+// Drop a reference from exec_image_get(), freeing the image with the last
+void exec_image_put(struct ExecImage *image)
+{
+    uint64_t flags = spin_lock_irqsave(&image_lock);
+    bool last = --image->refs == 0;
+    spin_unlock_irqrestore(&image_lock, flags);
+    if (last) exec_image_free(image);
+}
+
+/* -------------------------------------------------------------------------- */
+/*  Built pages                                                               */
+/* -------------------------------------------------------------------------- */
+
+// Frame holding `page`, filled with the file data of every segment that
+// reaches into it. Built on first request, NULL if out of memory.
+static struct ImagePage *exec_image_page(struct ExecImage *image, uint64_t page)
+{
+    size_t lo = 0, hi = image->page_count;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (image->pages[mid].vaddr == page) return &image->pages[mid];
+        if (image->pages[mid].vaddr < page) lo = mid + 1;
+        else hi = mid;
+    }
+
+    if (image->page_count == image->page_capacity) {
+        size_t capacity = image->page_capacity ? image->page_capacity * 2 : IMAGE_PAGES_INITIAL;
+        struct ImagePage *pages = xen_alloc(capacity * sizeof(struct ImagePage));
+        if (!pages) return NULL;
+        if (image->pages) memcpy(pages, image->pages, image->page_count * sizeof(struct ImagePage));
+        xen_free(image->pages);
+        image->pages = pages;
+        image->page_capacity = capacity;
+    }
+
+    uint64_t phys = frame_alloc();
+    if (!phys) return NULL;
+
+    uint32_t prot = 0;
+#ifdef ARCH_x86_64
+    const uint8_t *data = image->data;
+    uint8_t *frame = phys_to_virt(phys);
+    for (size_t i = 0; i < image->elf->header.e_phnum; ++i) {
+        const Elf64_Phdr *phdr = &image->elf->segments[i];
+        if (phdr->p_type != PT_LOAD || !phdr->p_memsz) continue;
+
+        struct SegmentLayout seg;
+        exec_segment_layout(phdr, image->load_base, &seg);
+        if (page < seg.start || page >= seg.end) continue;
+        prot |= seg.prot;
+
+        uint64_t seg_start = image->load_base + phdr->p_vaddr;
+        uint64_t data_end = seg_start + phdr->p_filesz;
+        uint64_t from = page > seg_start ? page : seg_start;
+        uint64_t to = page + FRAME_SIZE < data_end ? page + FRAME_SIZE : data_end;
+        if (from < to) memcpy(frame + (from - page), data + phdr->p_offset + (from - seg_start), to - from);
+    }
+#endif
+
+    memmove(&image->pages[lo + 1], &image->pages[lo], (image->page_count - lo) * sizeof(struct ImagePage));
+    image->pages[lo] = (struct ImagePage){ page, phys, prot };
+    image->page_count++;
+    return &image->pages[lo];
+}
+
+/* -------------------------------------------------------------------------- */
+/*  Relocations                                                               */
+/*                                                                            */
+/*  Applied to built pages in kernel memory, so text relocations work too     */
+/*  and no user address space is involved.                                    */
+/* -------------------------------------------------------------------------- */
+
+struct DynInfo {
+    const Elf64_Dyn *entries;
+    size_t entry_count;
+    const Elf64_Rela *rela;
+    uint64_t rela_count;
+    const Elf64_Rela *jmprel;
+    uint64_t jmprel_count;
+    const uint64_t *relr;
+    uint64_t relr_count;
+    struct ExecSymbols syms;
+};
+
+// File bytes behind [vaddr, vaddr + len) of the unrelocated program
+static const void *exec_image_file_ptr(const struct ExecImage *image, uint64_t vaddr, uint64_t len)
+{
+    for (size_t i = 0; i < image->elf->header.e_phnum; ++i) {
+        const Elf64_Phdr *phdr = &image->elf->segments[i];
+        if (phdr->p_type != PT_LOAD || vaddr < phdr->p_vaddr) continue;
+        if (vaddr - phdr->p_vaddr > phdr->p_filesz || len > phdr->p_filesz - (vaddr - phdr->p_vaddr)) continue;
+        return image->data + phdr->p_offset + (vaddr - phdr->p_vaddr);
+    }
+    return NULL;
+}
+
+static bool exec_image_mapped(const struct ExecImage *image, uint64_t addr)
+{
+    for (size_t i = 0; i < image->elf->header.e_phnum; ++i) {
+        const Elf64_Phdr *phdr = &image->elf->segments[i];
+        uint64_t start = image->load_base + phdr->p_vaddr;
+        if (phdr->p_type == PT_LOAD && addr >= start && addr - start < phdr->p_memsz) return true;
+    }
+    return false;
+}
+
+// Read-modify-write of one relocated word, which may straddle two pages
+static bool exec_image_reloc(struct ExecImage *image, uint64_t addr, uint64_t value, bool add)
+{
+    if (!exec_image_mapped(image, addr) || !exec_image_mapped(image, addr + 7)) return false;
+
+#ifdef ARCH_x86_64
+    struct ImagePage *page = exec_image_page(image, addr & ~(uint64_t)IMAGE_PAGE_MASK);
+    if (!page) return false;
+
+    uint64_t offset = addr & IMAGE_PAGE_MASK;
+    if (offset <= FRAME_SIZE - sizeof(uint64_t)) {
+        uint64_t *word = (uint64_t *)((uint8_t *)phys_to_virt(page->phys) + offset);
+        *word = add ? *word + value : value;
+        return true;
+    }
+
+    struct ImagePage *next = exec_image_page(image, (addr & ~(uint64_t)IMAGE_PAGE_MASK) + FRAME_SIZE);
+    if (!next) return false;
+    page = exec_image_page(image, addr & ~(uint64_t)IMAGE_PAGE_MASK);  /* may have moved */
+
+    uint8_t bytes[sizeof(uint64_t)];
+    size_t head = FRAME_SIZE - offset;
+    memcpy(bytes, (uint8_t *)phys_to_virt(page->phys) + offset, head);
+    memcpy(bytes + head, phys_to_virt(next->phys), sizeof(bytes) - head);
+
+    uint64_t word;
+    memcpy(&word, bytes, sizeof(word));
+    word = add ? word + value : value;
+    memcpy(bytes, &word, sizeof(word));
+
+    memcpy((uint8_t *)phys_to_virt(page->phys) + offset, bytes, head);
+    memcpy(phys_to_virt(next->phys), bytes + head, sizeof(bytes) - head);
+#endif
+    return true;
+}
+
+static bool exec_image_in_file(const struct ExecImage *image, const void *ptr, uint64_t len)
+{
+    const uint8_t *at = (const uint8_t *)ptr;
+    return at >= image->data && (uint64_t)(at - image->data) <= image->size &&
+           len <= image->size - (uint64_t)(at - image->data);
+}
+
+static const Elf64_Sym *exec_image_sym(const struct ExecImage *image, const struct ExecSymbols *syms, uint32_t index)
+{
+    if (!syms->symtab) return NULL;
+    const Elf64_Sym *sym = (const Elf64_Sym *)((const uint8_t *)syms->symtab + (uint64_t)index * syms->syment);
+    return exec_image_in_file(image, sym, sizeof(Elf64_Sym)) ? sym : NULL;
+}
+
+// The string table ends in a NUL, checked when it was found
+static inline const char *exec_image_string(const struct ExecSymbols *syms, uint64_t offset)
+{
+    return (syms->strtab && offset < syms->strsz) ? syms->strtab + offset : NULL;
+}
+
+static bool exec_image_parse_dynamic(const struct ExecImage *image, const Elf64_Phdr *phdr, struct DynInfo *dyn)
+{
+    const Elf64_Dyn *entries = exec_image_file_ptr(image, phdr->p_vaddr, phdr->p_filesz);
+    if (!entries) return false;
+
+    uint64_t rela = 0, rela_size = 0, jmprel = 0, jmprel_size = 0, relr = 0, relr_size = 0;
+    uint64_t symtab = 0, strtab = 0, gnu_hash = 0;
+    uint64_t relaent = sizeof(Elf64_Rela), relrent = sizeof(uint64_t), pltrel = DT_RELA;
+    dyn->syms.syment = sizeof(Elf64_Sym);
+    dyn->entries = entries;
+
+    size_t i;
+    for (i = 0; i < phdr->p_filesz / sizeof(Elf64_Dyn) && entries[i].d_tag != DT_NULL; ++i) {
+        uint64_t val = entries[i].d_val;
+        switch (entries[i].d_tag) {
+            case DT_RELA:     rela = val; break;
+            case DT_RELASZ:   rela_size = val; break;
+            case DT_RELAENT:  relaent = val; break;
+            case DT_JMPREL:   jmprel = val; break;
+            case DT_PLTRELSZ: jmprel_size = val; break;
+            case DT_PLTREL:   pltrel = val; break;
+            case DT_RELR:     relr = val; break;
+            case DT_RELRSZ:   relr_size = val; break;
+            case DT_RELRENT:  relrent = val; break;
+            case DT_SYMTAB:   symtab = val; break;
+            case DT_SYMENT:   dyn->syms.syment = val; break;
+            case DT_STRTAB:   strtab = val; break;
+            case DT_STRSZ:    dyn->syms.strsz = val; break;
+            case DT_GNU_HASH: gnu_hash = val; break;
+            default: break;
+        }
+    }
+    dyn->entry_count = i;
+
+    if (relaent != sizeof(Elf64_Rela) || relrent != sizeof(uint64_t) || pltrel != DT_RELA) return false;
+    if (dyn->syms.syment < sizeof(Elf64_Sym)) return false;
+
+    dyn->rela = rela_size ? exec_image_file_ptr(image, rela, rela_size) : NULL;
+    dyn->rela_count = dyn->rela ? rela_size / sizeof(Elf64_Rela) : 0;
+    dyn->jmprel = jmprel_size ? exec_image_file_ptr(image, jmprel, jmprel_size) : NULL;
+    dyn->jmprel_count = dyn->jmprel ? jmprel_size / sizeof(Elf64_Rela) : 0;
+    dyn->relr = relr_size ? exec_image_file_ptr(image, relr, relr_size) : NULL;
+    dyn->relr_count = dyn->relr ? relr_size / sizeof(uint64_t) : 0;
+    dyn->syms.symtab = symtab ? exec_image_file_ptr(image, symtab, sizeof(Elf64_Sym)) : NULL;
+
+    // A table that was announced but lies outside the file
+    if ((rela_size && !dyn->rela) || (jmprel_size && !dyn->jmprel) || (relr_size && !dyn->relr)) return false;
+
+    if (dyn->syms.strsz) {
+        dyn->syms.strtab = exec_image_file_ptr(image, strtab, dyn->syms.strsz);
+        if (!dyn->syms.strtab || dyn->syms.strtab[dyn->syms.strsz - 1] != '\0') return false;
+    }
+
+    // Header, bloom filter and buckets; chains are checked as they are walked
+    if (gnu_hash) {
+        const uint32_t *table = exec_image_file_ptr(image, gnu_hash, 4 * sizeof(uint32_t));
+        if (!table || !table[0] || !table[2]) return false;
+        uint64_t size = 4 * sizeof(uint32_t) + (uint64_t)table[2] * sizeof(uint64_t) + (uint64_t)table[0] * sizeof(uint32_t);
+        if (!exec_image_file_ptr(image, gnu_hash, size)) return false;
+        dyn->syms.gnu_hash = table;
+    }
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+/*  Shared libraries                                                          */
+/*                                                                            */
+/*  A DT_NEEDED library is looked up next to the program, then in /lib, and   */
+/*  cached like any program. Each one gets an address range of its own out    */
+/*  of [USER_LIB_BASE, USER_LIB_TOP) the first time it is built, the same in  */
+/*  every process, so its relocated pages are shared as well. Ranges are not  */
+/*  handed back; the window is a terabyte.                                    */
+/*                                                                            */
+/*  Symbols resolve to the image's own definition first, then to the first   */
+/*  library exporting them, in breadth-first DT_NEEDED order. Libraries are   */
+/*  searched through their GNU hash table and remember every answer, hits and */
+/*  misses, so the next program linking against them mostly skips the table. */
+/* -------------------------------------------------------------------------- */
+
+static uint64_t next_lib_base = USER_LIB_BASE;
+
+static struct ExecImage *exec_image_lookup(struct vfs_node *node, bool library, unsigned depth);
+
+static uint32_t exec_gnu_hash(const char *name)
+{
+    uint32_t hash = 5381;
+    for (const uint8_t *c = (const uint8_t *)name; *c; ++c) hash = hash * 33 + *c;
+    return hash;
+}
+
+// Address range for a library, 0 once the window is used up
+static uint64_t exec_image_lib_base(const Elf64 *elf)
+{
+    uint64_t span = 0;
+    for (size_t i = 0; i < elf->header.e_phnum; ++i) {
+        const Elf64_Phdr *phdr = &elf->segments[i];
+        if (phdr->p_type != PT_LOAD || !phdr->p_memsz) continue;
+        if (phdr->p_vaddr > USER_LIB_TOP - USER_LIB_BASE || phdr->p_memsz > USER_LIB_TOP - USER_LIB_BASE - phdr->p_vaddr) return 0;
+        if (phdr->p_vaddr + phdr->p_memsz > span) span = phdr->p_vaddr + phdr->p_memsz;
+    }
+    span = (span + IMAGE_LIB_ALIGN - 1) & ~(uint64_t)(IMAGE_LIB_ALIGN - 1);
+
+    uint64_t base = 0;
+    uint64_t flags = spin_lock_irqsave(&image_lock);
+    if (span <= USER_LIB_TOP - next_lib_base) {
+        base = next_lib_base;
+        next_lib_base += span;
+    }
+    spin_unlock_irqrestore(&image_lock, flags);
+    return base;
+}
+
+static bool exec_image_gnu_lookup(const struct ExecImage *lib, const char *name, uint32_t hash, uint64_t *value)
+{
+    const struct ExecSymbols *syms = &lib->symbols;
+    const uint32_t *table = syms->gnu_hash;
+    if (!table) return false;
+
+    uint32_t nbuckets = table[0], symoffset = table[1], bloom_size = table[2], bloom_shift = table[3];
+    const uint64_t *bloom = (const uint64_t *)&table[4];
+    const uint32_t *buckets = (const uint32_t *)&bloom[bloom_size];
+    const uint32_t *chain = &buckets[nbuckets];
+
+    uint64_t word = bloom[(hash / 64) % bloom_size];
+    uint64_t mask = (1ULL << (hash % 64)) | (1ULL << ((hash >> bloom_shift) % 64));
+    if ((word & mask) != mask) return false;
+
+    uint32_t index = buckets[hash % nbuckets];
+    if (index < symoffset) return false;
+
+    for (;; ++index) {
+        const uint32_t *link = &chain[index - symoffset];
+        const Elf64_Sym *sym = exec_image_sym(lib, syms, index);
+        if (!sym || !exec_image_in_file(lib, link, sizeof(uint32_t))) return false;
+
+        if ((*link | 1) == (hash | 1) && sym->st_shndx != SHN_UNDEF && ELF64_ST_BIND(sym->st_info) != STB_LOCAL) {
+            const char *sym_name = exec_image_string(syms, sym->st_name);
+            if (sym_name && strcmp(sym_name, name) == 0) {
+                *value = lib->load_base + sym->st_value;
+                return true;
+            }
+        }
+        if (*link & 1) return false;
+    }
+}
+
+// Symbol exported by a library, through its cache
+static bool exec_image_export(struct ExecImage *lib, const char *name, uint32_t hash, uint64_t *value)
+{
+    struct SymbolSlot *slot = &lib->symbol_cache[hash % SYMBOL_CACHE_SLOTS];
+
+    uint64_t flags = spin_lock_irqsave(&lib->symbol_lock);
+    if (slot->name && slot->hash == hash && strcmp(slot->name, name) == 0) {
+        bool found = slot->found;
+        *value = slot->value;
+        spin_unlock_irqrestore(&lib->symbol_lock, flags);
+        return found;
+    }
+    spin_unlock_irqrestore(&lib->symbol_lock, flags);
+
+    bool found = exec_image_gnu_lookup(lib, name, hash, value);
+
+    // The name belongs to whoever asked, so the slot keeps a copy
+    size_t len = strlen(name) + 1;
+    char *copy = xen_alloc(len);
+    if (!copy) return found;
+    memcpy(copy, name, len);
+
+    flags = spin_lock_irqsave(&lib->symbol_lock);
+    char *old = slot->name;
+    *slot = (struct SymbolSlot){ copy, hash, found, found ? *value : 0 };
+    spin_unlock_irqrestore(&lib->symbol_lock, flags);
+
+    xen_free(old);
+    return found;
+}
+
+// Next to the program first, then /lib
+static struct vfs_node *exec_image_find_library(struct vfs_node *from, const char *name)
+{
+    if (name[0] == '/') return vfs_lookup(name);
+
+    vfs_node_t *node = from->parent ? vfs_child_named(from->parent, name) : NULL;
+    if (node && node->type == VFS_NODE_FILE) return node;
+
+    char path[256] = "/lib/";
+    strncat(path, name, sizeof(path) - strlen(path) - 1);
+    node = vfs_lookup(path);
+    return (node && node->type == VFS_NODE_FILE) ? node : NULL;
+}
+
+// The image keeps a reference of its own to every library on its list
+static bool exec_image_add_dep(struct ExecImage *image, struct ExecImage *lib)
+{
+    if (lib == image) return true;
+    for (size_t i = 0; i < image->dep_count; ++i) {
+        if (image->deps[i] == lib) return true;
+    }
+    if (image->dep_count == IMAGE_MAX_DEPS) return false;
+    exec_image_hold(lib);
+    image->deps[image->dep_count++] = lib;
+    return true;
+}
+
+// Load every DT_NEEDED library, then pull in what they need in turn
+static bool exec_image_link(struct ExecImage *image, const struct DynInfo *dyn, unsigned depth)
+{
+    size_t direct = 0;
+    for (size_t i = 0; i < dyn->entry_count; ++i) {
+        if (dyn->entries[i].d_tag == DT_NEEDED) direct++;
+    }
+    if (!direct) return true;
+
+    if (depth >= IMAGE_MAX_DEPTH) {
+        tty_printf("[Image] %s: libraries nested too deep\n", image->node->name);
+        return false;
+    }
+
+    image->deps = xen_alloc(IMAGE_MAX_DEPS * sizeof(struct ExecImage *));
+    if (!image->deps) return false;
+
+    for (size_t i = 0; i < dyn->entry_count; ++i) {
+        if (dyn->entries[i].d_tag != DT_NEEDED) continue;
+
+        const char *name = exec_image_string(&dyn->syms, dyn->entries[i].d_val);
+        struct vfs_node *node = name ? exec_image_find_library(image->node, name) : NULL;
+        struct ExecImage *lib = node ? exec_image_lookup(node, true, depth + 1) : NULL;
+        if (!lib) {
+            tty_printf("[Image] %s: cannot load %s\n", image->node->name, name ? name : "?");
+            return false;
+        }
+        bool added = exec_image_add_dep(image, lib);
+        exec_image_put(lib);
+        if (!added) goto too_many;
+    }
+
+    direct = image->dep_count;
+    for (size_t i = 0; i < direct; ++i) {
+        const struct ExecImage *lib = image->deps[i];
+        for (size_t j = 0; j < lib->dep_count; ++j) {
+            if (!exec_image_add_dep(image, lib->deps[j])) goto too_many;
+        }
+    }
+    return true;
+
+too_many:
+    tty_printf("[Image] %s: more than %u libraries\n", image->node->name, IMAGE_MAX_DEPS);
+    return false;
+}
+
+// Value of symbol `index` for GLOB_DAT, JUMP_SLOT and R_X86_64_64
+static bool exec_image_symbol(const struct ExecImage *image, const struct DynInfo *dyn, uint32_t index, uint64_t *value)
+{
+    const Elf64_Sym *sym = exec_image_sym(image, &dyn->syms, index);
+    if (!sym) return false;
+
+    if (sym->st_shndx != SHN_UNDEF) {
+        *value = image->load_base + sym->st_value;
+        return true;
+    }
+
+    const char *name = exec_image_string(&dyn->syms, sym->st_name);
+    if (!name) return false;
+
+    uint32_t hash = exec_gnu_hash(name);
+    for (size_t i = 0; i < image->dep_count; ++i) {
+        if (exec_image_export(image->deps[i], name, hash, value)) return true;
+    }
+
+    *value = 0;
+    if (ELF64_ST_BIND(sym->st_info) == STB_WEAK) return true;
+    tty_printf("[Image] %s: undefined symbol %s\n", image->node->name, name);
+    return false;
+}
+
+static bool exec_image_apply_rela(struct ExecImage *image, const struct DynInfo *dyn, const Elf64_Rela *rela, uint64_t count)
+{
+    for (uint64_t i = 0; i < count; ++i) {
+        uint64_t addr = image->load_base + rela[i].r_offset;
+        uint64_t value;
+
+        switch (ELF64_R_TYPE(rela[i].r_info)) {
+            case R_X86_64_NONE:
+                continue;
+            case R_X86_64_RELATIVE:
+                value = image->load_base + rela[i].r_addend;
+                break;
+            case R_X86_64_64:
+                if (!exec_image_symbol(image, dyn, ELF64_R_SYM(rela[i].r_info), &value)) return false;
+                value += rela[i].r_addend;
+                break;
+            case R_X86_64_GLOB_DAT:
+            case R_X86_64_JUMP_SLOT:
+                if (!exec_image_symbol(image, dyn, ELF64_R_SYM(rela[i].r_info), &value)) return false;
+                break;
+            default:
+                tty_printf("[Image] %s: relocation type %u not supported\n", image->node->name, ELF64_R_TYPE(rela[i].r_info));
+                return false;
+        }
+
+        if (!exec_image_reloc(image, addr, value, false)) return false;
+    }
+    return true;
+}
+
+// DT_RELR: an even word is the address of a relative relocation, an odd
+// one a bitmap of which of the following 63 words are relocated too
+static bool exec_image_apply_relr(struct ExecImage *image, const struct DynInfo *dyn)
+{
+    uint64_t where = 0;
+    for (uint64_t i = 0; i < dyn->relr_count; ++i) {
+        uint64_t entry = dyn->relr[i];
+        if (!(entry & 1)) {
+            where = image->load_base + entry;
+            if (!exec_image_reloc(image, where, image->load_base, true)) return false;
+            where += sizeof(uint64_t);
+            continue;
+        }
+
+        for (uint64_t bits = entry >> 1, slot = where; bits; bits >>= 1, slot += sizeof(uint64_t)) {
+            if ((bits & 1) && !exec_image_reloc(image, slot, image->load_base, true)) return false;
+        }
+        where += 63 * sizeof(uint64_t);
+    }
+    return true;
+}
+
+// Parse PT_DYNAMIC, load the libraries it names and relocate against them
+static bool exec_image_relocate(struct ExecImage *image, unsigned depth)
+{
+    for (size_t i = 0; i < image->elf->header.e_phnum; ++i) {
+        const Elf64_Phdr *phdr = &image->elf->segments[i];
+        if (phdr->p_type != PT_DYNAMIC) continue;
+
+        struct DynInfo dyn;
+        memset(&dyn, 0, sizeof(dyn));
+        if (!exec_image_parse_dynamic(image, phdr, &dyn)) {
+            tty_printf("[Image] %s: bad dynamic section\n", image->node->name);
+            return false;
+        }
+
+        if (image->library) {
+            if (!dyn.syms.gnu_hash) {
+                tty_printf("[Image] %s: library without DT_GNU_HASH\n", image->node->name);
+                return false;
+            }
+            image->symbols = dyn.syms;
+        }
+
+        if (!exec_image_link(image, &dyn, depth)) return false;
+
+        if (!exec_image_apply_relr(image, &dyn) ||
+            !exec_image_apply_rela(image, &dyn, dyn.rela, dyn.rela_count) ||
+            !exec_image_apply_rela(image, &dyn, dyn.jmprel, dyn.jmprel_count)) {
+            tty_printf("[Image] %s: cannot relocate\n", image->node->name);
+            return false;
+        }
+    }
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+/*  Cache                                                                     */
+/* -------------------------------------------------------------------------- */
+
+// Bytes to parse. Initrd blobs are read in place: their pages outlive any
+// write or truncate, which only moves them onto the page tree. A file
+// already on the tree is read into a copy of its own.
+static bool exec_image_read_file(struct ExecImage *image, struct vfs_node *node)
+{
+    uint64_t flags = spin_lock_irqsave(&node->file.lock);
+    image->data = node->file.data;
+    image->size = node->file.size;
+    spin_unlock_irqrestore(&node->file.lock, flags);
+    if (image->data) return true;
+
+    // One NUL past the end, as blobs have
+    image->copy = xen_alloc(image->size + 1);
+    if (!image->copy) return false;
+    int64_t got = vfs_file_read(node, 0, image->copy, image->size, false);
+    if (got < 0) return false;
+    image->size = (uint64_t)got;
+    ((uint8_t *)image->copy)[image->size] = '\0';
+    image->data = image->copy;
+    return true;
+}
+
+// The loader trusts the ELF header's program and section header offsets
+static bool exec_image_headers_fit(const struct ExecImage *image)
+{
+    if (image->size < sizeof(Elf64_Ehdr)) return false;
+    const Elf64_Ehdr *ehdr = (const Elf64_Ehdr *)image->data;
+    uint64_t phsize = (uint64_t)ehdr->e_phnum * sizeof(Elf64_Phdr);
+    uint64_t shsize = (uint64_t)ehdr->e_shnum * sizeof(Elf64_Shdr);
+    return ehdr->e_phoff <= image->size && phsize <= image->size - ehdr->e_phoff &&
+           ehdr->e_shoff <= image->size && shsize <= image->size - ehdr->e_shoff;
+}
+
+static struct ExecImage *exec_image_build(struct vfs_node *node, bool library, unsigned depth)
+{
+    struct ExecImage *image = xen_alloc(sizeof(struct ExecImage));
+    if (!image) return NULL;
+    memset(image, 0, sizeof(struct ExecImage));
+    image->node = node;
+    image->generation = vfs_file_generation(node);
+
+    if (exec_image_read_file(image, node) && exec_image_headers_fit(image)) image->elf = load_elf64((void *)image->data);
+    if (!image->elf) {
+        exec_image_free(image);
+        return NULL;
+    }
+    Elf64 *elf = image->elf;
+    if (library && elf->header.e_type != ET_DYN) {
+        tty_printf("[Image] %s: not a shared library\n", node->name);
+        exec_image_free(image);
+        return NULL;
+    }
+
+    image->library = library;
+    spin_init(&image->symbol_lock, "symbols");
+
+    if (library) {
+        image->load_base = exec_image_lib_base(elf);
+        image->symbol_cache = xen_alloc(SYMBOL_CACHE_SLOTS * sizeof(struct SymbolSlot));
+        if (image->symbol_cache) memset(image->symbol_cache, 0, SYMBOL_CACHE_SLOTS * sizeof(struct SymbolSlot));
+        if (!image->load_base || !image->symbol_cache) {
+            tty_printf("[Image] %s: no room for the library\n", node->name);
+            exec_image_free(image);
+            return NULL;
+        }
+    } else {
+        image->load_base = (elf->header.e_type == ET_DYN) ? USER_PIE_BASE : 0;
+    }
+
+    // Everything is checked here once, later loads trust the headers
+    for (size_t i = 0; i < elf->header.e_phnum; ++i) {
+        Elf64_Phdr *phdr = &elf->segments[i];
+        if (phdr->p_type != PT_LOAD || !phdr->p_memsz) continue;
+
+        if (phdr->p_filesz > phdr->p_memsz || phdr->p_offset > image->size ||
+            phdr->p_filesz > image->size - phdr->p_offset ||
+            !user_map_ok(image->load_base + phdr->p_vaddr, phdr->p_memsz)) {
+            tty_printf("[Image] %s: segment %u does not fit the file or user space\n", node->name, i);
+            exec_image_free(image);
+            return NULL;
+        }
+    }
+
+    for (size_t i = 0; i < elf->header.e_phnum; ++i) {
+        Elf64_Phdr *phdr = &elf->segments[i];
+        if (phdr->p_type != PT_LOAD || !phdr->p_memsz) continue;
+
+        struct SegmentLayout seg;
+        exec_segment_layout(phdr, image->load_base, &seg);
+        bool ok = true;
+        for (uint64_t page = seg.start; ok && page < seg.lazy_start; page += FRAME_SIZE) ok = exec_image_page(image, page);
+        for (uint64_t page = seg.lazy_end; ok && page < seg.file_end; page += FRAME_SIZE) ok = exec_image_page(image, page);
+        if (!ok) {
+            tty_printf("[Image] %s: out of frames\n", node->name);
+            exec_image_free(image);
+            return NULL;
+        }
+    }
+
+    if (!exec_image_relocate(image, depth)) {
+        exec_image_free(image);
+        return NULL;
+    }
+
+    // Only a library's symbol lookups read the file after this
+    if (!library) {
+        xen_free(image->copy);
+        image->copy = NULL;
+        image->data = NULL;
+        image->size = 0;
+    }
+
+#ifdef HLOS_DEBUG
+    tty_printf("[Image] Cached %s at 0x%x, %u pages built, %u libraries\n", node->name, image->load_base, image->page_count, image->dep_count);
+#endif
+    return image;
+}
+
+static struct ExecImage *exec_image_find_locked(struct vfs_node *node)
+{
+    for (struct ExecImage *image = image_buckets[image_bucket(node)]; image; image = image->next) {
+        if (image->node == node) return image;
+    }
+    return NULL;
+}
+
+// Cached image with a reference taken, built on first use
+static struct ExecImage *exec_image_lookup(struct vfs_node *node, bool library, unsigned depth)
+{
+    uint64_t flags = spin_lock_irqsave(&image_lock);
+    struct ExecImage *image = exec_image_find_locked(node);
+    if (image && image->library == library) image->refs++;
+    spin_unlock_irqrestore(&image_lock, flags);
+    if (image) return image->library == library ? image : NULL;
+
+    // Built unlocked, whoever finishes first gets into the cache. A build
+    // that overlapped a write serves its caller alone, uncached.
+    struct ExecImage *built = exec_image_build(node, library, depth);
+    if (!built) return NULL;
+
+    flags = spin_lock_irqsave(&image_lock);
+    if (vfs_file_generation(node) != built->generation) {
+        spin_unlock_irqrestore(&image_lock, flags);
+        built->refs = 1;
+        return built;
+    }
+    image = exec_image_find_locked(node);
+    if (!image) {
+        size_t bucket = image_bucket(node);
+        built->next = image_buckets[bucket];
+        built->refs = 1;
+        image_buckets[bucket] = built;
+        image = built;
+        built = NULL;
+    }
+    bool match = image->library == library;
+    if (match) image->refs++;
+    spin_unlock_irqrestore(&image_lock, flags);
+
+    if (built) exec_image_free(built);
+    return match ? image : NULL;
+}
+
+// Cached image of an ELF program and its libraries, built on first use.
+// NULL if the file is not a loadable program. exec_image_put() it when
+// the process is set up.
+struct ExecImage *exec_image_get(struct vfs_node *node)
+{
+    return exec_image_lookup(node, false, 0);
+}
+
+// The file is going away or changing, and with it every image linked
+// against it. The cache drops its references; images still being loaded
+// live on until their last user puts them. Running processes keep their
+// own references to the built pages.
+void exec_image_forget(struct vfs_node *node)
+{
+    struct ExecImage *found = NULL, *dead = NULL;
+    uint64_t flags = spin_lock_irqsave(&image_lock);
+    for (struct ExecImage **link = &image_buckets[image_bucket(node)]; *link; link = &(*link)->next) {
+        if ((*link)->node == node) {
+            found = *link;
+            *link = found->next;
+            break;
+        }
+    }
+
+    // Dependency lists are transitive, one sweep finds everyone. It goes by
+    // node: a library built while the file changed was never cached itself.
+    for (size_t bucket = 0; bucket < IMAGE_BUCKETS; ++bucket) {
+        for (struct ExecImage **link = &image_buckets[bucket]; *link;) {
+            struct ExecImage *image = *link;
+            bool uses = false;
+            for (size_t i = 0; i < image->dep_count; ++i) uses |= image->deps[i]->node == node;
+            if (!uses) {
+                link = &image->next;
+                continue;
+            }
+            *link = image->next;
+            image->next = dead;
+            dead = image;
+        }
+    }
+    spin_unlock_irqrestore(&image_lock, flags);
+
+    while (dead) {
+        struct ExecImage *next = dead->next;
+        exec_image_put(dead);
+        dead = next;
+    }
+    if (found) exec_image_put(found);
+}
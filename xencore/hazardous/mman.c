@@ -0,0 +1,97 @@
+#include <xencore/hazardous/mman.h>
+#include <xencore/hazardous/process.h>
+#include <xencore/xenmem/addrspace.h>
+#include <xencore/xenmem/xenframe.h>
+#include <xencore/xenmem/vma.h>
+#include <xencore/xenio/tty.h>
+
+/* -------------------------------------------------------------------------- */
+/*  Memory management syscalls                                                */
+/*                                                                            */
+/*  Policy on top of the VMA list: where mmap() places things and how far    */
+/*  brk() may move. Nothing here allocates frames, the page fault handler    */
+/*  does that when the memory is first touched. File mappings hand out the   */
+/*  file's own pages, copies are only made for writes to private ones.       */
+/* -------------------------------------------------------------------------- */
+
+#define MMAN_PAGE_MASK ((uint64_t)FRAME_SIZE - 1)
+
+static inline uint64_t mman_page_up(uint64_t value)
+{
+    return (value + MMAN_PAGE_MASK) & ~MMAN_PAGE_MASK;
+}
+
+static inline uint32_t mman_vma_prot(uint32_t prot)
+{
+    return ((prot & PROT_READ) ? VMA_READ : 0)
+         | ((prot & PROT_WRITE) ? VMA_WRITE : 0)
+         | ((prot & PROT_EXEC) ? VMA_EXEC : 0);
+}
+
+static inline struct AddressSpace *mman_aspace(struct Process *proc)
+{
+    return (proc && proc->env) ? proc->env->aspace : NULL;
+}
+
+// Anonymous memory, or a VFS file. Returns the mapping or MAP_FAILED.
+uint64_t mman_mmap(struct Process *proc, uint64_t addr, uint64_t len, uint32_t prot, uint32_t flags, int fd, uint64_t offset)
+{
+    struct AddressSpace *as = mman_aspace(proc);
+    if (!as || !len || len > USER_MMAP_TOP) return MAP_FAILED;
+    if (!(flags & (MAP_SHARED | MAP_PRIVATE)) || (offset & MMAN_PAGE_MASK)) return MAP_FAILED;
+
+    vfs_node_t *file = NULL;
+    uint32_t vma_flags = VMA_ANON;
+    if (flags & MAP_ANONYMOUS) {
+        // Shared anonymous memory stays shared with fork() children
+        if (flags & MAP_SHARED) vma_flags |= VMA_SHARED;
+        offset = 0;
+    } else {
+        struct FileDesc *desc = process_get_fd(proc, fd);
+        if (!desc || (desc->flags & FD_CONSOLE) || !desc->node || desc->node->type != VFS_NODE_FILE) return MAP_FAILED;
+        if (!(desc->flags & FD_READ) || ((flags & MAP_SHARED) && (prot & PROT_WRITE) && !(desc->flags & FD_WRITE))) return MAP_FAILED;
+        file = desc->node;
+        vma_flags = VMA_FILE | ((flags & MAP_SHARED) ? VMA_SHARED : 0);
+    }
+
+    len = mman_page_up(len);
+
+    if (flags & MAP_FIXED) {
+        if ((addr & MMAN_PAGE_MASK) || !user_map_ok(addr, len)) return MAP_FAILED;
+        vma_remove(as, addr, addr + len);
+    } else {
+        addr = vma_find_gap(as, len, USER_MMAP_BASE, USER_MMAP_TOP);
+        if (!addr) return MAP_FAILED;
+    }
+
+    if (!vma_insert_file(as, addr, addr + len, mman_vma_prot(prot), vma_flags, file, offset)) return MAP_FAILED;
+    return addr;
+}
+
+int64_t mman_munmap(struct Process *proc, uint64_t addr, uint64_t len)
+{
+    struct AddressSpace *as = mman_aspace(proc);
+    if (!as || !len || (addr & MMAN_PAGE_MASK) || !user_map_ok(addr, len)) return -1;
+    return vma_remove(as, addr, addr + mman_page_up(len)) ? 0 : -1;
+}
+
+// Move the program break. Returns the new break, or the old one if the
+// request cannot be met, like the raw Linux syscall.
+uint64_t mman_brk(struct Process *proc, uint64_t addr)
+{
+    struct AddressSpace *as = mman_aspace(proc);
+    if (!as) return 0;
+    if (addr < as->brk_start || addr >= USER_MMAP_BASE) return as->brk;
+
+    uint64_t old_end = mman_page_up(as->brk);
+    uint64_t new_end = mman_page_up(addr);
+
+    if (new_end > old_end) {
+        if (!vma_insert(as, old_end, new_end, VMA_READ | VMA_WRITE, VMA_ANON)) return as->brk;
+    } else if (new_end < old_end) {
+        vma_remove(as, new_end, old_end);
+    }
+
+    as->brk = addr;
+    return addr;
+}
@@ -0,0 +1,320 @@
+#include <string.h>
+
+#ifdef ARCH_x86_64
+#include <xencore/arch/x86_64/tlb.h>
+#include <xencore/arch/x86_64/fpu.h>
+#endif
+
+#include <xencore/hazardous/process.h>
+#include <xencore/hazardous/image.h>
+#include <xencore/hazardous/ring.h>
+#include <xencore/sched/sched.h>
+#include <xencore/sync/spinlock.h>
+#include <xencore/xenio/tty.h>
+#include <xencore/common.h>
+
+/* -------------------------------------------------------------------------- */
+/*  Process table                                                             */
+/*                                                                            */
+/*  A process is one user thread plus what it owns: a PML4, the frames        */
+/*  mapped in it and a file table. The address space is torn down by the      */
+/*  exiting thread itself; the slot lingers as a zombie until the parent      */
+/*  (or, for spawns from kernel threads, any kernel thread) collects the      */
+/*  exit code with process_wait().                                            */
+/* -------------------------------------------------------------------------- */
+
+// Stack-allocated by every thread sleeping in process_wait()
+struct ProcWaiter {
+    struct Thread *thread;
+    struct ProcWaiter *next;
+};
+
+static struct Process proc_table[PROC_MAX];
+static struct ProcWaiter *proc_waiters = NULL;
+static int32_t next_pid = 1;
+static spinlock_t proc_lock = SPINLOCK_INIT("proc");
+
+/* -------------------------------------------------------------------------- */
+/*  Table management, caller holds proc_lock                                  */
+/* -------------------------------------------------------------------------- */
+
+static struct Process *proc_alloc_locked(struct Process *parent)
+{
+    for (size_t i = 0; i < PROC_MAX; ++i) {
+        struct Process *proc = &proc_table[i];
+        if (proc->state != PROC_FREE) continue;
+
+        memset(proc, 0, sizeof(struct Process));
+        proc->pid = next_pid++;
+        proc->state = PROC_RUNNING;
+        proc->parent = parent;
+        return proc;
+    }
+    return NULL;
+}
+
+static void proc_release_locked(struct Process *proc)
+{
+    memset(proc, 0, sizeof(struct Process));
+}
+
+static void proc_wake_waiters_locked(void)
+{
+    struct ProcWaiter *waiter = proc_waiters;
+    proc_waiters = NULL;
+
+    while (waiter) {
+        struct ProcWaiter *next = waiter->next;
+        thread_wake(waiter->thread);
+        waiter = next;
+    }
+}
+
+static void proc_unlink_waiter_locked(struct ProcWaiter *waiter)
+{
+    for (struct ProcWaiter **link = &proc_waiters; *link; link = &(*link)->next) {
+        if (*link == waiter) {
+            *link = waiter->next;
+            return;
+        }
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+/*  Lifecycle                                                                 */
+/* -------------------------------------------------------------------------- */
+
+static void process_start(void *arg)
+{
+    struct Process *proc = (struct Process *)arg;
+#ifdef ARCH_x86_64
+    // Kernel code until the switch to user mode treats the registers as
+    // scratch, the saved image is what the program starts with
+    fpu_irq_enter();
+#endif
+    enter_hazardous_environment(proc->env);
+}
+
+void process_init(void)
+{
+    tty_printf("[Process] Table ready, %u slots, %u files each\n", PROC_MAX, PROC_MAX_FILES);
+}
+
+struct Process *current_process(void)
+{
+    struct Thread *thread = current_thread();
+    return thread ? thread->process : NULL;
+}
+
+// 0 when spawned by the kernel or orphaned
+int32_t process_parent_pid(struct Process *proc)
+{
+    if (!proc) return -1;
+
+    uint64_t flags = spin_lock_irqsave(&proc_lock);
+    int32_t ppid = proc->parent ? proc->parent->pid : 0;
+    spin_unlock_irqrestore(&proc_lock, flags);
+    return ppid;
+}
+
+// Give a filled-in slot its thread and queue it, starting from the FPU
+// state of `fpu_from` if given. On failure the slot and its environment
+// are released.
+static int32_t process_launch(struct Process *proc, const struct Thread *fpu_from)
+{
+    struct Thread *thread = thread_alloc(proc->name, process_start, proc);
+    if (!thread) {
+        teardown_hazardous_environment(proc->env);
+        uint64_t flags = spin_lock_irqsave(&proc_lock);
+        proc_release_locked(proc);
+        spin_unlock_irqrestore(&proc_lock, flags);
+        return -1;
+    }
+
+#ifdef ARCH_x86_64
+    if (fpu_from) fpu_copy_state(thread, fpu_from);
+#else
+    (void)fpu_from;
+#endif
+
+    int32_t pid = proc->pid;
+    thread->process = proc;
+    thread->aspace = proc->env->aspace;
+    proc->thread = thread;
+
+#ifdef HLOS_DEBUG
+    tty_printf("[Process] Started %s (pid %d)\n", proc->name, pid);
+#endif
+    sched_enqueue(thread);
+    return pid;
+}
+
+// Load an ELF from the VFS into a fresh address space and queue it
+int32_t process_spawn(const char *path)
+{
+    vfs_node_t *node = vfs_lookup(path);
+    if (!node || node->type != VFS_NODE_FILE) {
+        tty_printf("[Process] %s: no such file\n", path);
+        return -1;
+    }
+
+    struct ExecImage *image = exec_image_get(node);
+    if (!image) {
+        tty_printf("[Process] %s: not a loadable ELF\n", path);
+        return -1;
+    }
+
+    struct HazardousContext *env = setup_hazardous_environment(image);
+    exec_image_put(image);
+    if (!env) return -1;
+
+    uint64_t flags = spin_lock_irqsave(&proc_lock);
+    struct Process *proc = proc_alloc_locked(current_process());
+    spin_unlock_irqrestore(&proc_lock, flags);
+    if (!proc) {
+        tty_printf("[Process] Process table full\n");
+        teardown_hazardous_environment(env);
+        return -1;
+    }
+
+    const char *base = strrchr(path, '/');
+    strncpy(proc->name, base ? base + 1 : path, PROC_NAME_LEN - 1);
+    proc->env = env;
+
+    // stdin, stdout and stderr all go to the console
+    for (int fd = 0; fd < 3; ++fd) proc->files[fd].flags = FD_USED | FD_CONSOLE;
+
+    return process_launch(proc, NULL);
+}
+
+// Duplicate the calling process. Its pages are shared copy-on-write, its
+// file table is copied and the child returns 0 from the same syscall.
+int32_t process_fork(const struct SyscallFrame *frame)
+{
+    struct Process *parent = current_process();
+    if (!parent || !parent->env) return -1;
+
+    struct HazardousContext *env = fork_hazardous_environment(parent->env, frame);
+    if (!env) {
+        tty_printf("[Process] %s: out of memory in fork\n", parent->name);
+        return -1;
+    }
+
+    uint64_t flags = spin_lock_irqsave(&proc_lock);
+    struct Process *proc = proc_alloc_locked(parent);
+    spin_unlock_irqrestore(&proc_lock, flags);
+    if (!proc) {
+        tty_printf("[Process] Process table full\n");
+        teardown_hazardous_environment(env);
+        return -1;
+    }
+
+    memcpy(proc->name, parent->name, PROC_NAME_LEN);
+    memcpy(proc->files, parent->files, sizeof(proc->files));
+    proc->env = env;
+
+    // Inside the syscall the parent's user FPU state is saved, not live
+    return process_launch(proc, current_thread());
+}
+
+// Collect an exited child, any child if pid is negative. Returns its pid,
+// or -1 if there is no such child.
+int32_t process_wait(int32_t pid, int *exit_code)
+{
+    struct Process *self = current_process();
+    struct ProcWaiter waiter = { current_thread(), NULL };
+
+    uint64_t flags = spin_lock_irqsave(&proc_lock);
+    while (1) {
+        bool found = false;
+        for (size_t i = 0; i < PROC_MAX; ++i) {
+            struct Process *proc = &proc_table[i];
+            if (proc->state == PROC_FREE || proc->orphan || proc->parent != self) continue;
+            if (pid > 0 && proc->pid != pid) continue;
+
+            found = true;
+            if (proc->state != PROC_ZOMBIE) continue;
+
+            int32_t reaped = proc->pid;
+            if (exit_code) *exit_code = proc->exit_code;
+            proc_release_locked(proc);
+            spin_unlock_irqrestore(&proc_lock, flags);
+            return reaped;
+        }
+
+        if (!found) {
+            spin_unlock_irqrestore(&proc_lock, flags);
+            return -1;
+        }
+
+        // Published as blocked before the lock drops, so an exit racing
+        // with us turns into a wakeup instead of being lost
+        waiter.next = proc_waiters;
+        proc_waiters = &waiter;
+        __atomic_store_n(&current_thread()->state, THREAD_BLOCKED, __ATOMIC_SEQ_CST);
+        spin_unlock(&proc_lock);
+        thread_block_prepared(flags);
+
+        flags = spin_lock_irqsave(&proc_lock);
+        proc_unlink_waiter_locked(&waiter);
+    }
+}
+
+void process_exit(int code)
+{
+    struct Thread *self = current_thread();
+    struct Process *proc = self->process;
+    if (!proc) thread_exit();
+
+    // The poller runs on our tables too
+    xenring_destroy(proc);
+
+    // Step onto the kernel tables first. Kernel threads never borrow a
+    // user PML4, so once we are off it no CPU can still walk it.
+    uint64_t flags = irq_save();
+    self->aspace = NULL;
+#ifdef ARCH_x86_64
+    tlb_switch_to(NULL);
+#endif
+    irq_restore(flags);
+
+    teardown_hazardous_environment(proc->env);
+    proc->env = NULL;
+    memset(proc->files, 0, sizeof(proc->files));
+
+#ifdef HLOS_DEBUG
+    tty_printf("[Process] %s (pid %d) exited with %d\n", proc->name, proc->pid, code);
+#endif
+
+    flags = spin_lock_irqsave(&proc_lock);
+
+    // Our children are left to fend for themselves
+    for (size_t i = 0; i < PROC_MAX; ++i) {
+        struct Process *child = &proc_table[i];
+        if (child->state == PROC_FREE || child->parent != proc) continue;
+
+        child->parent = NULL;
+        child->orphan = true;
+        if (child->state == PROC_ZOMBIE) proc_release_locked(child);
+    }
+
+    self->process = NULL;
+    proc->thread = NULL;
+    proc->exit_code = code;
+    if (proc->orphan) {
+        proc_release_locked(proc);
+    } else {
+        proc->state = PROC_ZOMBIE;
+        proc_wake_waiters_locked();
+    }
+    spin_unlock_irqrestore(&proc_lock, flags);
+
+    thread_exit();
+}
+
+struct FileDesc *process_get_fd(struct Process *proc, int fd)
+{
+    if (!proc || fd < 0 || fd >= PROC_MAX_FILES) return NULL;
+    struct FileDesc *file = &proc->files[fd];
+    return (file->flags & FD_USED) ? file : NULL;
+}
@@ -0,0 +1,359 @@
+#include <string.h>
+
+#ifdef ARCH_x86_64
+#include <xencore/arch/x86_64/paging.h>
+#include <xencore/arch/x86_64/tlb.h>
+#endif
+
+#include <xencore/hazardous/ring.h>
+#include <xencore/hazardous/process.h>
+#include <xencore/hazardous/fileio.h>
+#include <xencore/xenmem/xenalloc.h>
+#include <xencore/xenmem/xenframe.h>
+#include <xencore/xenmem/addrspace.h>
+#include <xencore/timer/timer.h>
+#include <xencore/timer/clock.h>
+#include <xencore/sched/sched.h>
+#include <xencore/sync/spinlock.h>
+#include <xencore/xenio/tty.h>
+#include <xencore/common.h>
+
+/* -------------------------------------------------------------------------- */
+/*  Submission ring                                                           */
+/*                                                                            */
+/*  A page shared with the process holds a submission and a completion        */
+/*  queue. The process queues any number of operations and hands them over    */
+/*  with one SYS_RING_ENTER, or with none at all when it asked for a poller   */
+/*  thread: that one runs on the process's tables, picks up submissions as    */
+/*  they appear and only goes to sleep after XENRING_POLL_IDLE_NS without     */
+/*  work, telling the process so through XENRING_NEED_WAKEUP.                 */
+/*                                                                            */
+/*  The kernel keeps its own copies of the indices it owns, so whatever the   */
+/*  process scribbles into the page only ever confuses the process.           */
+/*  Operations are only taken while the completion queue has room for them,   */
+/*  sleeps included, so posting a completion never fails.                     */
+/* -------------------------------------------------------------------------- */
+
+#define XENRING_POLL_IDLE_NS 2000000   /* 2 ms */
+
+struct XenRingSleep {
+    struct XenRingCtx *ctx;
+    timer_handle_t timer;
+    uint64_t user_data;
+    bool used;
+};
+
+struct XenRingCtx {
+    struct XenRing *ring;          /* kernel view through the direct map */
+    struct Process *proc;
+    uint32_t sq_head;              /* next submission to take */
+    uint32_t cq_tail;              /* next completion to post */
+    spinlock_t lock;               /* completions, waiter, sleeps */
+    struct Thread *waiter;         /* blocked in xenring_enter() */
+    uint32_t wanted;               /* unread completions it waits for */
+    uint32_t inflight;             /* sleeps still running */
+    struct Thread *poller;         /* NULL without XENRING_SETUP_SQPOLL */
+    volatile bool stopping;
+    volatile bool poller_gone;
+    struct XenRingSleep sleeps[XENRING_CQ_ENTRIES];
+};
+
+/* -------------------------------------------------------------------------- */
+/*  Completions, caller holds ctx->lock                                       */
+/* -------------------------------------------------------------------------- */
+
+static inline uint32_t ring_unread_locked(struct XenRingCtx *ctx)
+{
+    return ctx->cq_tail - __atomic_load_n(&ctx->ring->cq_head, __ATOMIC_ACQUIRE);
+}
+
+static void ring_complete_locked(struct XenRingCtx *ctx, uint64_t user_data, int64_t result)
+{
+    ctx->ring->cq[ctx->cq_tail % XENRING_CQ_ENTRIES] = (struct XenRingCqe){ user_data, result };
+    __atomic_store_n(&ctx->ring->cq_tail, ++ctx->cq_tail, __ATOMIC_RELEASE);
+
+    if (ctx->waiter && ring_unread_locked(ctx) >= ctx->wanted) {
+        thread_wake(ctx->waiter);
+        ctx->waiter = NULL;
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+/*  Operations                                                                */
+/* -------------------------------------------------------------------------- */
+
+// Timer callback, runs in interrupt context on the CPU that armed it
+static void ring_sleep_done(void *arg)
+{
+    struct XenRingSleep *sleep = (struct XenRingSleep *)arg;
+    struct XenRingCtx *ctx = sleep->ctx;
+
+    uint64_t flags = spin_lock_irqsave(&ctx->lock);
+    ring_complete_locked(ctx, sleep->user_data, 0);
+    sleep->used = false;
+    ctx->inflight--;
+    spin_unlock_irqrestore(&ctx->lock, flags);
+}
+
+static bool ring_sleep(struct XenRingCtx *ctx, const struct XenRingSqe *sqe)
+{
+    bool armed = false;
+    uint64_t flags = spin_lock_irqsave(&ctx->lock);
+
+    for (size_t i = 0; i < XENRING_CQ_ENTRIES; ++i) {
+        struct XenRingSleep *sleep = &ctx->sleeps[i];
+        if (sleep->used) continue;
+
+        // Interrupts are off, the callback cannot beat us to the lock
+        sleep->user_data = sqe->user_data;
+        sleep->timer = timer_add(clock_monotonic_ns() + sqe->len, ring_sleep_done, sleep);
+        if (sleep->timer != TIMER_INVALID) {
+            sleep->used = true;
+            ctx->inflight++;
+            armed = true;
+        }
+        break;
+    }
+
+    spin_unlock_irqrestore(&ctx->lock, flags);
+    return armed;
+}
+
+static void ring_execute(struct XenRingCtx *ctx, const struct XenRingSqe *sqe)
+{
+    int64_t result;
+
+    switch (sqe->opcode) {
+        case XENRING_OP_NOP:
+            result = 0;
+            break;
+
+        case XENRING_OP_WRITE:
+            result = fileio_write(ctx->proc, sqe->fd, sqe->addr, sqe->len);
+            break;
+
+        case XENRING_OP_READ:
+            result = fileio_read(ctx->proc, sqe->fd, sqe->addr, sqe->len);
+            break;
+
+        case XENRING_OP_SLEEP:
+            if (ring_sleep(ctx, sqe)) return;  /* completes from the timer */
+            result = -1;
+            break;
+
+        default:
+            result = -1;
+            break;
+    }
+
+    uint64_t flags = spin_lock_irqsave(&ctx->lock);
+    ring_complete_locked(ctx, sqe->user_data, result);
+    spin_unlock_irqrestore(&ctx->lock, flags);
+}
+
+static inline uint32_t ring_pending(struct XenRingCtx *ctx)
+{
+    return __atomic_load_n(&ctx->ring->sq_tail, __ATOMIC_SEQ_CST) - ctx->sq_head;
+}
+
+static bool ring_has_room(struct XenRingCtx *ctx)
+{
+    uint64_t flags = spin_lock_irqsave(&ctx->lock);
+    bool room = ring_unread_locked(ctx) + ctx->inflight < XENRING_CQ_ENTRIES;
+    spin_unlock_irqrestore(&ctx->lock, flags);
+    return room;
+}
+
+// Take what the process queued, at most one ring's worth per call
+static uint32_t ring_submit(struct XenRingCtx *ctx)
+{
+    uint32_t submitted = 0;
+
+    while (submitted < XENRING_SQ_ENTRIES && ring_pending(ctx) && ring_has_room(ctx)) {
+        struct XenRingSqe sqe = ctx->ring->sq[ctx->sq_head % XENRING_SQ_ENTRIES];
+        __atomic_store_n(&ctx->ring->sq_head, ++ctx->sq_head, __ATOMIC_RELEASE);
+
+        ring_execute(ctx, &sqe);
+        submitted++;
+    }
+    return submitted;
+}
+
+/* -------------------------------------------------------------------------- */
+/*  Poller                                                                    */
+/* -------------------------------------------------------------------------- */
+
+static void ring_poller(void *arg)
+{
+    struct XenRingCtx *ctx = (struct XenRingCtx *)arg;
+    uint64_t idle_since = clock_monotonic_ns();
+
+    while (!ctx->stopping) {
+        if (ring_submit(ctx)) {
+            idle_since = clock_monotonic_ns();
+            continue;
+        }
+        if (clock_monotonic_ns() - idle_since < XENRING_POLL_IDLE_NS) {
+            sched_yield();
+            continue;
+        }
+
+        // Raise the flag before the last look, a producer that missed it
+        // published early enough for us to see its entries
+        uint64_t flags = spin_lock_irqsave(&ctx->lock);
+        __atomic_or_fetch(&ctx->ring->flags, XENRING_NEED_WAKEUP, __ATOMIC_SEQ_CST);
+        if (!ctx->stopping && !ring_pending(ctx)) {
+            __atomic_store_n(&current_thread()->state, THREAD_BLOCKED, __ATOMIC_SEQ_CST);
+            spin_unlock(&ctx->lock);
+            thread_block_prepared(flags);
+            flags = spin_lock_irqsave(&ctx->lock);
+        }
+        __atomic_and_fetch(&ctx->ring->flags, ~XENRING_NEED_WAKEUP, __ATOMIC_SEQ_CST);
+        spin_unlock_irqrestore(&ctx->lock, flags);
+        idle_since = clock_monotonic_ns();
+    }
+
+    // Off the process's tables before they are torn down
+    uint64_t flags = irq_save();
+    current_thread()->aspace = NULL;
+#ifdef ARCH_x86_64
+    tlb_switch_to(NULL);
+#endif
+    irq_restore(flags);
+
+    __atomic_store_n(&ctx->poller_gone, true, __ATOMIC_RELEASE);
+    thread_exit();
+}
+
+/* -------------------------------------------------------------------------- */
+/*  Process interface                                                         */
+/* -------------------------------------------------------------------------- */
+
+// Map the ring into the process. Returns its user address.
+int64_t xenring_setup(struct Process *proc, uint32_t flags)
+{
+    if (!proc || !proc->env || proc->ring) return -1;
+
+    struct XenRingCtx *ctx = xen_alloc(sizeof(struct XenRingCtx));
+    if (!ctx) return -1;
+    memset(ctx, 0, sizeof(struct XenRingCtx));
+    spin_init(&ctx->lock, "xenring");
+    ctx->proc = proc;
+    for (size_t i = 0; i < XENRING_CQ_ENTRIES; ++i) ctx->sleeps[i].ctx = ctx;
+
+    if (flags & XENRING_SETUP_SQPOLL) {
+        ctx->poller = thread_alloc("xenring", ring_poller, ctx);
+        if (!ctx->poller) {
+            xen_free(ctx);
+            return -1;
+        }
+        ctx->poller->aspace = proc->env->aspace;
+    }
+
+    struct AddressSpace *as = proc->env->aspace;
+    uint64_t phys = frame_alloc();
+#ifdef ARCH_x86_64
+    if (phys) {
+        // The mapping owns one reference, the context the other: the
+        // kernel keeps posting completions whatever happens to the user's
+        // page tables. Those are shared with the fault handler.
+        frame_ref(phys);
+        uint64_t irq = spin_lock_irqsave(&as->vma_lock);
+        bool mapped = map_user_page(as->pml4, XENRING_USER_ADDR, phys, PAGE_RW | PAGE_USER | PAGE_OWNED | page_nx);
+        spin_unlock_irqrestore(&as->vma_lock, irq);
+        if (!mapped) {
+            frame_free(phys);
+            frame_free(phys);
+            phys = 0;
+        }
+    }
+#endif
+    if (!phys) {
+        if (ctx->poller) thread_free(ctx->poller);
+        xen_free(ctx);
+        return -1;
+    }
+    ctx->ring = (struct XenRing *)phys_to_virt(phys);
+
+    proc->ring = ctx;
+    if (ctx->poller) sched_enqueue(ctx->poller);
+
+#ifdef HLOS_DEBUG
+    tty_printf("[XenRing] %s (pid %d) ring at 0x%x%s\n", proc->name, proc->pid, XENRING_USER_ADDR, ctx->poller ? ", polled" : "");
+#endif
+    return (int64_t)XENRING_USER_ADDR;
+}
+
+// Submit what is queued, or kick the poller, then wait until at least
+// `min_complete` completions are unread. Returns the number submitted.
+int64_t xenring_enter(struct Process *proc, uint32_t min_complete)
+{
+    struct XenRingCtx *ctx = proc ? proc->ring : NULL;
+    if (!ctx) return -1;
+
+    uint32_t submitted = 0;
+    uint64_t flags;
+    if (ctx->poller) {
+        flags = spin_lock_irqsave(&ctx->lock);
+        thread_wake(ctx->poller);
+        spin_unlock_irqrestore(&ctx->lock, flags);
+    } else {
+        submitted = ring_submit(ctx);
+    }
+    if (!min_complete) return submitted;
+
+    flags = spin_lock_irqsave(&ctx->lock);
+
+    // Never wait for more than can still arrive
+    uint32_t reachable = ring_unread_locked(ctx) + ctx->inflight + (ctx->poller ? ring_pending(ctx) : 0);
+    uint32_t wanted = min_complete < reachable ? min_complete : reachable;
+    if (wanted > XENRING_CQ_ENTRIES) wanted = XENRING_CQ_ENTRIES;
+
+    while (ring_unread_locked(ctx) < wanted) {
+        ctx->waiter = current_thread();
+        ctx->wanted = wanted;
+        __atomic_store_n(&current_thread()->state, THREAD_BLOCKED, __ATOMIC_SEQ_CST);
+        spin_unlock(&ctx->lock);
+        thread_block_prepared(flags);
+        flags = spin_lock_irqsave(&ctx->lock);
+    }
+    ctx->waiter = NULL;
+
+    spin_unlock_irqrestore(&ctx->lock, flags);
+    return submitted;
+}
+
+// Stop the poller and pending sleeps, then drop the context's reference
+// to the page. The mapping's goes away with the address space.
+void xenring_destroy(struct Process *proc)
+{
+    struct XenRingCtx *ctx = proc->ring;
+    if (!ctx) return;
+
+    uint64_t flags = spin_lock_irqsave(&ctx->lock);
+    ctx->stopping = true;
+    for (size_t i = 0; i < XENRING_CQ_ENTRIES; ++i) {
+        struct XenRingSleep *sleep = &ctx->sleeps[i];
+        if (sleep->used && timer_cancel(sleep->timer)) {
+            sleep->used = false;
+            ctx->inflight--;
+        }
+    }
+    if (ctx->poller) thread_wake(ctx->poller);
+    spin_unlock_irqrestore(&ctx->lock, flags);
+
+    // Callbacks that already fired and the poller wind down on their own
+    while (1) {
+        flags = spin_lock_irqsave(&ctx->lock);
+        bool busy = ctx->inflight || (ctx->poller && !ctx->poller_gone);
+        spin_unlock_irqrestore(&ctx->lock, flags);
+        if (!busy) break;
+        sched_yield();
+    }
+
+    proc->ring = NULL;
+#ifdef ARCH_x86_64
+    frame_free(virt_to_phys((uint64_t)ctx->ring));
+#endif
+    xen_free(ctx);
+}
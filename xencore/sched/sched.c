@@ -0,0 +1,495 @@
+#ifdef ARCH_x86_64
+#include <xencore/arch/x86_64/context.h>
+#include <xencore/arch/x86_64/lapic.h>
+#endif
+
+#include <xencore/sched/sched.h>
+#include <xencore/timer/timer.h>
+#include <xencore/timer/clock.h>
+#include <xencore/timer/sleep.h>
+#include <xencore/sync/spinlock.h>
+#include <xencore/xenio/tty.h>
+#include <xencore/common.h>
+
+/* -------------------------------------------------------------------------- */
+/*  Per-CPU priority scheduler                                                */
+/*                                                                            */
+/*  Every CPU owns a run queue: one FIFO per priority plus a bitmap of the    */
+/*  non-empty ones, so picking the next thread is a single ctz. A CPU only    */
+/*  ever takes its own queue lock to switch; it is held across the switch     */
+/*  and dropped by the incoming thread. Idle CPUs steal from the busiest      */
+/*  neighbour. Thread->on_cpu keeps a thread that is still being switched     */
+/*  out from being resumed or freed anywhere else.                            */
+/* -------------------------------------------------------------------------- */
+
+struct RunQueue {
+    spinlock_t lock;
+    uint32_t bitmap;
+    struct Thread *head[SCHED_PRIORITIES];
+    struct Thread *tail[SCHED_PRIORITIES];
+    volatile uint32_t nr_running;
+    uint64_t switches;
+    uint64_t steals;
+    uint64_t stolen;
+    struct Thread *migrate;        /* prev lost its affinity for this CPU */
+};
+
+static struct RunQueue run_queues[MAX_CPUS];
+
+static spinlock_t zombie_lock = SPINLOCK_INIT("zombies");
+static struct Thread *zombies = NULL;
+static struct Thread *reaper = NULL;
+static volatile bool sched_started = false;
+
+static inline bool thread_allowed(struct Thread *thread, uint32_t cpu)
+{
+    return (thread->affinity >> cpu) & 1;
+}
+
+static inline bool cpu_is_idle(struct PerCpu *cpu)
+{
+    return cpu->online && cpu->idle_thread && cpu->current_thread == cpu->idle_thread;
+}
+
+/* -------------------------------------------------------------------------- */
+/*  Run queue operations, caller holds rq->lock                               */
+/* -------------------------------------------------------------------------- */
+
+static void rq_push(struct RunQueue *rq, struct Thread *thread)
+{
+    uint32_t prio = thread->priority;
+
+    thread->next = NULL;
+    if (rq->tail[prio]) rq->tail[prio]->next = thread;
+    else rq->head[prio] = thread;
+    rq->tail[prio] = thread;
+
+    rq->bitmap |= 1u << prio;
+    rq->nr_running++;
+}
+
+static struct Thread *rq_pop(struct RunQueue *rq)
+{
+    if (!rq->bitmap) return NULL;
+
+    uint32_t prio = __builtin_ctz(rq->bitmap);
+    struct Thread *thread = rq->head[prio];
+
+    rq->head[prio] = thread->next;
+    if (!rq->head[prio]) {
+        rq->tail[prio] = NULL;
+        rq->bitmap &= ~(1u << prio);
+    }
+
+    thread->next = NULL;
+    rq->nr_running--;
+    return thread;
+}
+
+// Most urgent thread that may run on `cpu` and is fully switched out
+static struct Thread *rq_steal(struct RunQueue *rq, uint32_t cpu)
+{
+    uint32_t bitmap = rq->bitmap;
+    while (bitmap) {
+        uint32_t prio = __builtin_ctz(bitmap);
+        bitmap &= bitmap - 1;
+
+        struct Thread *prev = NULL;
+        for (struct Thread *t = rq->head[prio]; t; prev = t, t = t->next) {
+            if (!thread_allowed(t, cpu) || __atomic_load_n(&t->on_cpu, __ATOMIC_ACQUIRE)) continue;
+
+            if (prev) prev->next = t->next;
+            else rq->head[prio] = t->next;
+            if (rq->tail[prio] == t) rq->tail[prio] = prev;
+            if (!rq->head[prio]) rq->bitmap &= ~(1u << prio);
+
+            t->next = NULL;
+            rq->nr_running--;
+            return t;
+        }
+    }
+    return NULL;
+}
+
+/* -------------------------------------------------------------------------- */
+/*  Placement and wakeups                                                     */
+/* -------------------------------------------------------------------------- */
+
+// Nudge `cpu` to reschedule if it idles or runs something less urgent
+static void sched_kick(uint32_t cpu_id, struct Thread *thread)
+{
+    struct PerCpu *cpu = &cpus[cpu_id];
+    struct Thread *running = cpu->current_thread;
+    if (!cpu_is_idle(cpu) && (!running || running->priority <= thread->priority)) return;
+
+    if (cpu_id == current_cpu()) {
+        cpu->need_resched = true;
+    } else {
+#ifdef ARCH_x86_64
+        lapic_send_ipi(cpu->lapic_id, LAPIC_RESCHED_VECTOR);
+#endif
+    }
+}
+
+// Wake one idle CPU so it can steal, used when work piles up on a busy one
+static void sched_kick_idle(uint32_t except)
+{
+    for (uint32_t i = 0; i < cpu_count; ++i) {
+        if (i == except || !cpu_is_idle(&cpus[i])) continue;
+#ifdef ARCH_x86_64
+        if (i != current_cpu()) lapic_send_ipi(cpus[i].lapic_id, LAPIC_RESCHED_VECTOR);
+        else cpus[i].need_resched = true;
+#endif
+        return;
+    }
+}
+
+// Prefer the CPU the thread last ran on (warm cache), unless an allowed
+// CPU is sitting idle.
+static uint32_t sched_select_cpu(struct Thread *thread)
+{
+    uint32_t last = thread->cpu < cpu_count ? thread->cpu : 0;
+    if (thread_allowed(thread, last) && cpu_is_idle(&cpus[last])) return last;
+
+    for (uint32_t i = 0; i < cpu_count; ++i) {
+        if (thread_allowed(thread, i) && cpu_is_idle(&cpus[i])) return i;
+    }
+
+    if (thread_allowed(thread, last) && cpus[last].online) return last;
+    for (uint32_t i = 0; i < cpu_count; ++i) {
+        if (thread_allowed(thread, i) && cpus[i].online) return i;
+    }
+    return current_cpu();
+}
+
+static void sched_enqueue_on(uint32_t cpu_id, struct Thread *thread)
+{
+    struct RunQueue *rq = &run_queues[cpu_id];
+
+    uint64_t flags = spin_lock_irqsave(&rq->lock);
+    thread->state = THREAD_READY;
+    rq_push(rq, thread);
+    uint32_t queued = rq->nr_running;
+    spin_unlock_irqrestore(&rq->lock, flags);
+
+    sched_kick(cpu_id, thread);
+    if (queued > 1) sched_kick_idle(cpu_id);
+}
+
+void sched_enqueue(struct Thread *thread)
+{
+    sched_enqueue_on(sched_select_cpu(thread), thread);
+}
+
+void thread_wake(struct Thread *thread)
+{
+    thread_state_t expected = THREAD_BLOCKED;
+    if (!__atomic_compare_exchange_n(&thread->state, &expected, THREAD_READY, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+        return;
+
+    sched_enqueue(thread);
+}
+
+/* -------------------------------------------------------------------------- */
+/*  Context switch                                                            */
+/* -------------------------------------------------------------------------- */
+
+static void sched_slice_expired(__attribute__((unused)) void *arg)
+{
+    this_cpu()->slice_timer = TIMER_INVALID;
+    this_cpu()->need_resched = true;
+}
+
+// Pick the next thread and switch to it. Called with this CPU's queue lock
+// held and interrupts disabled; returns, possibly much later and on another
+// CPU, with both released.
+static void sched_switch_locked(uint64_t flags)
+{
+    struct PerCpu *cpu = this_cpu();
+    struct RunQueue *rq = cpu->run_queue;
+    struct Thread *prev = cpu->current_thread;
+    cpu->need_resched = false;
+
+    if (prev->state == THREAD_RUNNING && prev != cpu->idle_thread) {
+        prev->state = THREAD_READY;
+        if (thread_allowed(prev, cpu->id)) rq_push(rq, prev);
+        else rq->migrate = prev;
+    }
+
+    struct Thread *next = rq_pop(rq);
+    if (!next) next = cpu->idle_thread;
+
+    // Woken elsewhere before its last CPU finished switching it out
+    if (next != prev) {
+        while (__atomic_load_n(&next->on_cpu, __ATOMIC_ACQUIRE)) cpu_relax();
+    }
+
+    next->state = THREAD_RUNNING;
+    next->cpu = cpu->id;
+
+    if (cpu->slice_timer != TIMER_INVALID) timer_cancel(cpu->slice_timer);
+    cpu->slice_timer = next == cpu->idle_thread
+        ? TIMER_INVALID
+        : timer_add(clock_monotonic_ns() + SCHED_SLICE_NS, sched_slice_expired, NULL);
+
+    if (next != prev) {
+        next->on_cpu = 1;
+        cpu->current_thread = next;
+        cpu->prev_thread = prev;
+        rq->switches++;
+#ifdef ARCH_x86_64
+        context_switch(prev, next);
+#endif
+    }
+
+    sched_finish_switch();
+    irq_restore(flags);
+}
+
+// Runs on the incoming thread right after every switch
+void sched_finish_switch(void)
+{
+    struct PerCpu *cpu = this_cpu();
+    struct RunQueue *rq = cpu->run_queue;
+    struct Thread *prev = cpu->prev_thread;
+    struct Thread *migrate = rq->migrate;
+
+    cpu->prev_thread = NULL;
+    rq->migrate = NULL;
+    spin_unlock(&rq->lock);
+
+    if (prev) __atomic_store_n(&prev->on_cpu, 0, __ATOMIC_RELEASE);
+    if (migrate) sched_enqueue(migrate);
+}
+
+void schedule(void)
+{
+    uint64_t flags = irq_save();
+    spin_lock(&this_cpu()->run_queue->lock);
+    sched_switch_locked(flags);
+}
+
+void sched_yield(void)
+{
+    schedule();
+}
+
+void thread_block(void)
+{
+    uint64_t flags = irq_save();
+    spin_lock(&this_cpu()->run_queue->lock);
+    current_thread()->state = THREAD_BLOCKED;
+    sched_switch_locked(flags);
+}
+
+// Second half of a sleep whose caller already marked itself BLOCKED,
+// with interrupts off, before dropping the lock guarding its condition.
+// A wakeup that got in first has queued us again and set READY, so the
+// state is left alone and the switch simply takes us off this CPU.
+void thread_block_prepared(uint64_t flags)
+{
+    spin_lock(&this_cpu()->run_queue->lock);
+    sched_switch_locked(flags);
+}
+
+void thread_exit(void)
+{
+    uint64_t flags = irq_save();
+    struct Thread *self = current_thread();
+
+    // The reaper waits for on_cpu to drop before touching our stack
+    spin_lock(&zombie_lock);
+    self->next = zombies;
+    zombies = self;
+    spin_unlock(&zombie_lock);
+    if (reaper) thread_wake(reaper);
+
+    spin_lock(&this_cpu()->run_queue->lock);
+    self->state = THREAD_DEAD;
+    sched_switch_locked(flags);
+    __builtin_unreachable();
+}
+
+/* -------------------------------------------------------------------------- */
+/*  Load balancing                                                            */
+/* -------------------------------------------------------------------------- */
+
+// Pull one thread from the busiest neighbour into our own queue
+static bool sched_steal(void)
+{
+    uint32_t self = current_cpu();
+    uint32_t victim = self;
+    uint32_t busiest = 0;
+
+    for (uint32_t i = 1; i < cpu_count; ++i) {
+        uint32_t cpu = (self + i) % cpu_count;
+        uint32_t queued = __atomic_load_n(&run_queues[cpu].nr_running, __ATOMIC_RELAXED);
+        if (cpus[cpu].online && queued > busiest) {
+            busiest = queued;
+            victim = cpu;
+        }
+    }
+    if (victim == self) return false;
+
+    struct RunQueue *from = &run_queues[victim];
+    if (!spin_trylock(&from->lock)) return false;
+    struct Thread *thread = rq_steal(from, self);
+    if (thread) from->stolen++;
+    spin_unlock(&from->lock);
+    if (!thread) return false;
+
+    struct RunQueue *rq = &run_queues[self];
+    spin_lock(&rq->lock);
+    rq_push(rq, thread);
+    rq->steals++;
+    spin_unlock(&rq->lock);
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+/*  Housekeeping threads                                                      */
+/* -------------------------------------------------------------------------- */
+
+static void sched_idle_loop(__attribute__((unused)) void *arg)
+{
+    struct RunQueue *rq = this_cpu()->run_queue;
+
+    while (1) {
+        irq_save();
+        if (__atomic_load_n(&rq->bitmap, __ATOMIC_RELAXED) || this_cpu()->need_resched || sched_steal()) {
+            schedule();
+            continue;
+        }
+        wait_for_interrupt();
+    }
+}
+
+// Frees dead threads once nothing can be running on their stacks
+static void sched_reaper(__attribute__((unused)) void *arg)
+{
+    while (1) {
+        // Mark ourselves blocked before looking, so an exit racing with
+        // the check turns into a wakeup instead of being lost.
+        uint64_t flags = irq_save();
+        struct Thread *self = current_thread();
+        __atomic_store_n(&self->state, THREAD_BLOCKED, __ATOMIC_SEQ_CST);
+
+        spin_lock(&zombie_lock);
+        struct Thread *dead = zombies;
+        zombies = NULL;
+        spin_unlock(&zombie_lock);
+
+        if (!dead) {
+            spin_lock(&this_cpu()->run_queue->lock);
+            sched_switch_locked(flags);
+            continue;
+        }
+
+        thread_state_t expected = THREAD_BLOCKED;
+        bool woken = !__atomic_compare_exchange_n(&self->state, &expected, THREAD_RUNNING, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+        irq_restore(flags);
+        if (woken) schedule();  /* already queued by thread_exit() */
+
+        while (dead) {
+            struct Thread *next = dead->next;
+            while (__atomic_load_n(&dead->on_cpu, __ATOMIC_ACQUIRE)) cpu_relax();
+            thread_free(dead);
+            dead = next;
+        }
+    }
+}
+
+#ifdef HLOS_DEBUG
+static void sched_stats_thread(__attribute__((unused)) void *arg)
+{
+    while (1) {
+        ksleep_ns(5000000000ULL);
+        sched_dump_stats();
+    }
+}
+#endif
+
+/* -------------------------------------------------------------------------- */
+/*  Statistics                                                                */
+/* -------------------------------------------------------------------------- */
+
+void sched_get_stats(uint32_t cpu, struct SchedStats *stats)
+{
+    struct RunQueue *rq = &run_queues[cpu];
+    stats->nr_running = rq->nr_running;
+    stats->switches = rq->switches;
+    stats->steals = rq->steals;
+    stats->stolen = rq->stolen;
+}
+
+void sched_dump_stats(void)
+{
+    for (uint32_t i = 0; i < cpu_count; ++i) {
+        struct SchedStats stats;
+        sched_get_stats(i, &stats);
+        tty_printf(
+            "[Sched] CPU %u: queued %u, switches %u, steals %u, stolen %u\n",
+            i, stats.nr_running, stats.switches, stats.steals, stats.stolen
+        );
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+/*  Bring-up                                                                  */
+/* -------------------------------------------------------------------------- */
+
+bool sched_running(void)
+{
+    return sched_started;
+}
+
+static void sched_init_cpu(struct PerCpu *cpu)
+{
+    struct RunQueue *rq = &run_queues[cpu->id];
+    spin_init(&rq->lock, "runqueue");
+    cpu->run_queue = rq;
+    cpu->slice_timer = TIMER_INVALID;
+}
+
+// Turn the boot flow of the BSP into a schedulable thread
+void sched_init(void)
+{
+    struct PerCpu *cpu = this_cpu();
+    sched_init_cpu(cpu);
+
+    cpu->current_thread = thread_adopt("cascade", cpu->kernel_stack_top);
+    cpu->idle_thread = thread_alloc("idle/0", sched_idle_loop, NULL);
+    if (!cpu->current_thread || !cpu->idle_thread) {
+        tty_printf("[Sched] Failed to create boot threads\n");
+        while (1) halt();
+    }
+    thread_set_affinity(cpu->idle_thread, 1ULL << cpu->id);
+    cpu->online = true;
+
+    reaper = thread_create("reaper", sched_reaper, NULL);
+#ifdef HLOS_DEBUG
+    thread_create("schedstat", sched_stats_thread, NULL);
+#endif
+    sched_started = true;
+
+    tty_printf("[Sched] Preemptive scheduling started, %u priorities, %u ms slices\n", SCHED_PRIORITIES, SCHED_SLICE_NS / 1000000);
+}
+
+// The boot flow of an AP becomes its idle thread
+void sched_ap_enter(void)
+{
+    struct PerCpu *cpu = this_cpu();
+    sched_init_cpu(cpu);
+
+    struct Thread *idle = thread_adopt("idle", cpu->kernel_stack_top);
+    if (!idle) {
+        tty_printf("[Sched] CPU %u failed to create idle thread\n", cpu->id);
+        while (1) halt();
+    }
+    thread_set_affinity(idle, 1ULL << cpu->id);
+    cpu->current_thread = idle;
+    cpu->idle_thread = idle;
+
+    sched_idle_loop(NULL);
+    __builtin_unreachable();
+}
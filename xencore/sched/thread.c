@@ -0,0 +1,121 @@
+#include <string.h>
+
+#ifdef ARCH_x86_64
+#include <xencore/arch/x86_64/context.h>
+#include <xencore/arch/x86_64/fpu.h>
+#endif
+
+#include <xencore/sched/thread.h>
+#include <xencore/sched/sched.h>
+#include <xencore/xenmem/xenalloc.h>
+#include <xencore/xenio/tty.h>
+#include <xencore/common.h>
+
+static volatile uint32_t next_tid = 0;
+
+static struct Thread *thread_new(const char *name)
+{
+    struct Thread *thread = xen_alloc(sizeof(struct Thread));
+    if (!thread) return NULL;
+
+    memset(thread, 0, sizeof(struct Thread));
+    thread->tid = __atomic_fetch_add(&next_tid, 1, __ATOMIC_RELAXED);
+    strncpy(thread->name, name, THREAD_NAME_LEN - 1);
+    thread->priority = THREAD_PRIO_DEFAULT;
+    thread->affinity = THREAD_AFFINITY_ALL;
+    thread->cpu = current_cpu();
+    thread->fpu_cpu = UINT32_MAX;
+#ifdef ARCH_x86_64
+    thread->fpu_state = fpu_state_alloc();
+    if (!thread->fpu_state) {
+        xen_free(thread);
+        return NULL;
+    }
+#endif
+    return thread;
+}
+
+// New thread with its own kernel stack, not yet runnable
+struct Thread *thread_alloc(const char *name, thread_entry_t entry, void *arg)
+{
+    struct Thread *thread = thread_new(name);
+    if (!thread) return NULL;
+
+    thread->kstack = xen_alloc(THREAD_STACK_SIZE);
+    if (!thread->kstack) {
+        thread_free(thread);
+        return NULL;
+    }
+
+    thread->kstack_top = (uint64_t)thread->kstack + THREAD_STACK_SIZE;
+    thread->state = THREAD_READY;
+#ifdef ARCH_x86_64
+    thread->rsp = context_init_stack(thread->kstack_top, entry, arg);
+#endif
+
+#ifdef HLOS_DEBUG
+    tty_printf("[Thread] Created %s (tid %u), stack top 0x%x\n", thread->name, thread->tid, thread->kstack_top);
+#endif
+    return thread;
+}
+
+struct Thread *thread_create(const char *name, thread_entry_t entry, void *arg)
+{
+    struct Thread *thread = thread_alloc(name, entry, arg);
+    if (!thread) {
+        tty_printf("[Thread] Failed to create %s\n", name);
+        return NULL;
+    }
+
+    sched_enqueue(thread);
+    return thread;
+}
+
+// Wrap the flow of control already running on this CPU
+struct Thread *thread_adopt(const char *name, uint64_t kstack_top)
+{
+    struct Thread *thread = thread_new(name);
+    if (!thread) return NULL;
+
+    thread->kstack_top = kstack_top;
+    thread->state = THREAD_RUNNING;
+    thread->on_cpu = 1;
+#ifdef ARCH_x86_64
+    fpu_adopt(thread);
+#endif
+    return thread;
+}
+
+// Both take effect the next time the thread is queued
+void thread_set_priority(struct Thread *thread, uint32_t priority)
+{
+    thread->priority = priority > THREAD_PRIO_LOWEST ? THREAD_PRIO_LOWEST : priority;
+}
+
+void thread_set_affinity(struct Thread *thread, uint64_t affinity)
+{
+    if (affinity) thread->affinity = affinity;
+}
+
+void thread_free(struct Thread *thread)
+{
+#ifdef HLOS_DEBUG
+    tty_printf("[Thread] Reaped %s (tid %u)\n", thread->name, thread->tid);
+#endif
+    if (thread->kstack) xen_free(thread->kstack);
+#ifdef ARCH_x86_64
+    fpu_state_free(thread->fpu_state);
+#endif
+    xen_free(thread);
+}
+
+// First C code of every new thread, entered from the context switch with
+// the scheduler lock still held and interrupts disabled.
+void thread_bootstrap(thread_entry_t entry, void *arg)
+{
+    sched_finish_switch();
+    irq_restore(1ULL << 9);
+
+    entry(arg);
+    thread_exit();
+}
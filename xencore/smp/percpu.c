@@ -0,0 +1,34 @@
+#include <string.h>
+
+#ifdef ARCH_x86_64
+#include <xencore/arch/x86_64/msr.h>
+#endif
+
+#include <xencore/smp/cpu.h>
+#include <xencore/xenio/tty.h>
+#include <xencore/xenmem/xenalloc.h>
+
+_Static_assert(offsetof(struct PerCpu, kernel_stack_top) == 16, "PERCPU_KERNEL_STACK_TOP_STR out of date");
+_Static_assert(offsetof(struct PerCpu, user_rsp) == 24, "PERCPU_USER_RSP_STR out of date");
+
+struct PerCpu cpus[MAX_CPUS];
+uint32_t cpu_count = 1;
+
+void percpu_init(uint32_t id, uint32_t lapic_id, uint64_t kernel_stack_top)
+{
+    struct PerCpu *cpu = &cpus[id];
+    memset(cpu, 0, sizeof(struct PerCpu));
+    cpu->self = cpu;
+    cpu->id = id;
+    cpu->lapic_id = lapic_id;
+    cpu->kernel_stack_top = kernel_stack_top;
+    cpu->alloc_cache = xen_alloc_cache(id);
+
+#ifdef ARCH_x86_64
+    // The kernel runs on this GS base. User code can load a GS selector, so
+    // it runs on its own base and every entry from ring 3 swaps them. User
+    // selectors only ever yield base 0, which then waits in KERNEL_GS_BASE.
+    wrmsr(MSR_GS_BASE, (uint64_t)cpu);
+    wrmsr(MSR_KERNEL_GS_BASE, 0);
+#endif
+}
@@ -0,0 +1,87 @@
+#ifdef ARCH_x86_64
+#include <xencore/arch/x86_64/smpboot.h>
+#include <xencore/arch/x86_64/lapic.h>
+#include <xencore/arch/x86_64/tss.h>
+#include <xencore/arch/x86_64/tsc.h>
+#endif
+
+#include <xencore/smp/smp.h>
+#include <xencore/acpi/madt.h>
+#include <xencore/timer/timer.h>
+#include <xencore/sched/sched.h>
+#include <xencore/xenmem/xenalloc.h>
+#include <xencore/xenio/tty.h>
+#include <xencore/common.h>
+
+#define AP_ONLINE_TIMEOUT_NS 100000000ULL  // 100 ms
+
+static uint64_t alloc_stack(size_t size)
+{
+    uint8_t *stack = xen_alloc(size);
+    if (!stack) return 0;
+    return ((uint64_t)stack + size) & ~0xFULL;
+}
+
+// Runs on every AP once its descriptor tables are loaded
+void smp_ap_main(uint32_t cpu)
+{
+#ifdef ARCH_x86_64
+    setup_lapic();
+#endif
+    timer_init();
+
+    __asm__ volatile ("" : : : "memory");
+    cpus[cpu].online = true;
+
+    sched_ap_enter();
+}
+
+void smp_init(void)
+{
+    struct MadtInfo info;
+    if (!madt_parse(&info) || info.lapic_count < 2) {
+        tty_printf("[SMP] Single processor system\n");
+        return;
+    }
+
+#ifdef ARCH_x86_64
+    if (!smp_prepare_trampoline()) return;
+
+    uint32_t bsp_apic = this_cpu()->lapic_id;
+    uint32_t next = 1;
+
+    for (uint32_t i = 0; i < info.lapic_count && next < MAX_CPUS; ++i) {
+        uint32_t apic_id = info.lapic_ids[i];
+        if (apic_id == bsp_apic) continue;
+
+        uint64_t boot_stack = alloc_stack(KERNEL_STACK_SIZE);
+        uint64_t rsp0 = alloc_stack(KERNEL_STACK_SIZE);
+        uint64_t ist1 = alloc_stack(IST_STACK_SIZE);
+        if (!boot_stack || !rsp0 || !ist1) {
+            tty_printf("[SMP] Out of memory for CPU %u stacks\n", next);
+            break;
+        }
+
+        smp_boot_ap(next, apic_id, boot_stack, rsp0, ist1);
+
+        uint64_t deadline = tsc_ns() + AP_ONLINE_TIMEOUT_NS;
+        while (!cpus[next].online && tsc_ns() < deadline) cpu_relax();
+
+        if (!cpus[next].online) {
+            // Park it in wait-for-SIPI so it cannot claim this slot later
+            lapic_send_init(apic_id);
+            tty_printf("[SMP] CPU with APIC ID %u did not respond\n", apic_id);
+            continue;
+        }
+
+#ifdef HLOS_DEBUG
+        tty_printf("[SMP] CPU %u online, APIC ID %u\n", next, apic_id);
+#endif
+        next++;
+    }
+
+    cpu_count = next;
+#endif
+
+    tty_printf("[SMP] %u of %u processors online\n", cpu_count, info.lapic_count);
+}
@@ -0,0 +1,33 @@
+#include <xencore/sync/lockstat.h>
+#include <xencore/xenio/tty.h>
+
+static struct LockStat *lockstat_list = NULL;
+
+// Called once per lock on its first acquisition
+void lockstat_register(struct LockStat *stat)
+{
+    uint32_t expected = 0;
+    if (!__atomic_compare_exchange_n(&stat->registered, &expected, 1, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+        return;
+
+    struct LockStat *head = __atomic_load_n(&lockstat_list, __ATOMIC_RELAXED);
+    do {
+        stat->next = head;
+    } while (!__atomic_compare_exchange_n(&lockstat_list, &head, stat, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+void lockstat_dump(void)
+{
+#ifdef HLOS_LOCKSTAT
+    tty_printf("[Lockstat] name: acquired / contended / max hold (cycles)\n");
+    for (struct LockStat *s = __atomic_load_n(&lockstat_list, __ATOMIC_ACQUIRE); s; s = s->next) {
+        tty_printf(
+            "[Lockstat] %s: %u / %u / %u\n",
+            s->name ? s->name : "(anonymous)",
+            s->acquisitions, s->contentions, s->max_hold
+        );
+    }
+#else
+    tty_printf("[Lockstat] Not compiled in, build with -DHLOS_LOCKSTAT\n");
+#endif
+}
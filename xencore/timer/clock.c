@@ -0,0 +1,69 @@
+#include <string.h>
+
+#ifdef ARCH_x86_64
+#include <xencore/arch/x86_64/paging.h>
+#include <xencore/arch/x86_64/tsc.h>
+#include <xencore/arch/x86_64/rtc.h>
+#endif
+
+#include <xencore/timer/clock.h>
+#include <xencore/xenio/tty.h>
+#include <xencore/common.h>
+
+#define NS_PER_SEC 1000000000ULL
+
+static struct XenTimePage *time_page = NULL;
+
+void clock_init(void)
+{
+#ifdef ARCH_x86_64
+    time_page = early_alloc_page();
+    memset(time_page, 0, PAGE_SIZE_4KB);
+    time_page->tsc_base = tsc_get_base();
+    time_page->tsc_mult = tsc_get_ns_mult();
+
+    clock_set_realtime_ns(rtc_read_unix() * NS_PER_SEC);
+#endif
+
+    tty_printf(
+        "[Clock] Time page @ 0x%x, realtime %u s since epoch\n",
+        (uint64_t)time_page, clock_realtime_ns() / NS_PER_SEC
+    );
+}
+
+uint64_t clock_monotonic_ns(void)
+{
+#ifdef ARCH_x86_64
+    return tsc_ns();
+#else
+    return 0;
+#endif
+}
+
+uint64_t clock_realtime_ns(void)
+{
+    if (!time_page) return 0;
+    return xentime_read(time_page, CLOCK_REALTIME);
+}
+
+// Seqlock writer: readers spin while `seq` is odd
+void clock_set_realtime_ns(uint64_t ns)
+{
+    if (!time_page) return;
+
+    uint64_t flags = irq_save();
+    time_page->seq++;
+    __asm__ volatile ("" : : : "memory");
+    time_page->wall_offset = ns - clock_monotonic_ns();
+    __asm__ volatile ("" : : : "memory");
+    time_page->seq++;
+    irq_restore(flags);
+}
+
+void clock_map_user(uint64_t *pml4)
+{
+    if (!time_page) return;
+#ifdef ARCH_x86_64
+    map_user_page(pml4, XENTIME_USER_ADDR, (uint64_t)time_page, PAGE_USER | page_nx);
+#endif
+}
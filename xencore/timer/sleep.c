@@ -1,10 +1,59 @@
+#include <stdbool.h>
+
 #include <xencore/timer/sleep.h>
+#include <xencore/timer/timer.h>
+#include <xencore/timer/clock.h>
+#include <xencore/sched/sched.h>
 #include <xencore/common.h>
 
-extern uint64_t sleep_countdown;
+static void ksleep_wake(void *arg)
+{
+    *(volatile bool *)arg = true;
+}
+
+static void ksleep_wake_thread(void *arg)
+{
+    thread_wake((struct Thread *)arg);
+}
+
+void ksleep_until_ns(uint64_t deadline_ns)
+{
+    // Block the thread and let others run. Interrupts stay off until the
+    // switch so the per-CPU timer cannot fire before we are blocked.
+    if (sched_running()) {
+        uint64_t flags = irq_save();
+        if (timer_add(deadline_ns, ksleep_wake_thread, current_thread()) != TIMER_INVALID) {
+            thread_block();
+            irq_restore(flags);
+            return;
+        }
+        irq_restore(flags);
+    }
+
+    volatile bool woken = false;
+
+    if (timer_add(deadline_ns, ksleep_wake, (void *)&woken) == TIMER_INVALID) {
+        // No timer slot left: spin instead of sleeping through the deadline
+        while (clock_monotonic_ns() < deadline_ns) __asm__ volatile ("pause");
+        return;
+    }
+
+    // Check and halt with interrupts off so the wakeup cannot fire
+    // between the test and the hlt.
+    while (1) {
+        __asm__ volatile ("cli");
+        if (woken) break;
+        wait_for_interrupt();
+    }
+    __asm__ volatile ("sti");
+}
+
+void ksleep_ns(uint64_t ns)
+{
+    ksleep_until_ns(clock_monotonic_ns() + ns);
+}
 
 void ksleep(uint64_t ticks)
 {
-    sleep_countdown = ticks;
-    while (sleep_countdown > 0) halt();
+    ksleep_ns(ticks * SLEEP_TICK_NS);
 }
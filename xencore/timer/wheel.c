@@ -0,0 +1,343 @@
+#ifdef ARCH_x86_64
+#include <xencore/arch/x86_64/tsc.h>
+#include <xencore/arch/x86_64/lapic.h>
+#endif
+
+#include <xencore/timer/timer.h>
+#include <xencore/timer/clock.h>
+#include <xencore/smp/cpu.h>
+#include <xencore/xenmem/xenalloc.h>
+#include <xencore/xenio/tty.h>
+#include <xencore/common.h>
+#include <xencore/sync/spinlock.h>
+
+/* -------------------------------------------------------------------------- */
+/*  Hashed hierarchical timer wheel                                           */
+/*                                                                            */
+/*  Level L has 64 buckets of 64^L ticks each. A timer is hashed into the     */
+/*  lowest level whose span still covers its distance from the wheel clock,   */
+/*  and is cascaded one level down when the clock reaches its bucket. Insert  */
+/*  and cancel are O(1) list operations; per-level occupancy bitmaps let the  */
+/*  wheel skip empty stretches and find the next expiry without scanning.    */
+/* -------------------------------------------------------------------------- */
+
+#define TIMER_POOL_SIZE  1024          /* per CPU, allocated up front */
+#define TIMER_NO_BUCKET  0xFFFF
+#define TIMER_NEVER      UINT64_MAX
+#define TIMER_MAX_DELTA  ((1ULL << (TIMER_LEVEL_BITS * TIMER_LEVELS)) - 1)
+
+struct Timer {
+    struct Timer *next;
+    struct Timer **pprev;
+    uint64_t deadline_ns;
+    timer_callback_t callback;
+    void *arg;
+    uint32_t generation;
+    uint16_t bucket;               /* level * 64 + slot */
+};
+
+struct TimerWheel {
+    uint64_t clk;                  /* next tick to be processed */
+    uint64_t armed_ns;             /* deadline currently in the LAPIC */
+    uint64_t occupied[TIMER_LEVELS];
+    struct Timer *buckets[TIMER_LEVELS][TIMER_LEVEL_SIZE];
+    struct Timer *pool;
+    struct Timer *free;
+    uint32_t cpu;
+    spinlock_t lock;               /* cancel may come from another CPU */
+};
+
+static struct TimerWheel timer_wheels[MAX_CPUS];
+
+static inline uint64_t ns_to_tick(uint64_t ns)
+{
+    return ns >> TIMER_TICK_SHIFT;
+}
+
+static inline uint64_t tick_to_ns(uint64_t tick)
+{
+    return tick << TIMER_TICK_SHIFT;
+}
+
+static inline timer_handle_t make_handle(struct TimerWheel *w, struct Timer *t)
+{
+    uint64_t index = (uint64_t)(t - w->pool);
+    return ((uint64_t)w->cpu << 56) | ((uint64_t)(t->generation & 0xFFFFFF) << 32) | (index + 1);
+}
+
+/* -------------------------------------------------------------------------- */
+/*  Bucket lists                                                              */
+/* -------------------------------------------------------------------------- */
+
+static void list_push(struct Timer **head, struct Timer *t)
+{
+    t->next = *head;
+    if (t->next) t->next->pprev = &t->next;
+    t->pprev = head;
+    *head = t;
+}
+
+static void list_unlink(struct Timer *t)
+{
+    *t->pprev = t->next;
+    if (t->next) t->next->pprev = t->pprev;
+    t->next = NULL;
+    t->pprev = NULL;
+}
+
+static void wheel_enqueue(struct TimerWheel *w, struct Timer *t)
+{
+    uint64_t expires = ns_to_tick(t->deadline_ns);
+    if (expires < w->clk) expires = w->clk;
+
+    uint64_t delta = expires - w->clk;
+    if (delta > TIMER_MAX_DELTA) {
+        /* Park in the farthest bucket, it is re-hashed when cascaded */
+        delta = TIMER_MAX_DELTA;
+        expires = w->clk + delta;
+    }
+
+    int level = 0;
+    while (level < TIMER_LEVELS - 1 && delta >= (1ULL << (TIMER_LEVEL_BITS * (level + 1))))
+        level++;
+
+    int slot = (expires >> (TIMER_LEVEL_BITS * level)) & TIMER_LEVEL_MASK;
+    list_push(&w->buckets[level][slot], t);
+    w->occupied[level] |= 1ULL << slot;
+    t->bucket = (uint16_t)(level * TIMER_LEVEL_SIZE + slot);
+}
+
+static void wheel_dequeue(struct TimerWheel *w, struct Timer *t)
+{
+    int level = t->bucket / TIMER_LEVEL_SIZE;
+    int slot  = t->bucket % TIMER_LEVEL_SIZE;
+
+    list_unlink(t);
+    if (!w->buckets[level][slot]) w->occupied[level] &= ~(1ULL << slot);
+    t->bucket = TIMER_NO_BUCKET;
+}
+
+/* Detach a whole bucket so callbacks may freely add or cancel timers */
+static struct Timer *wheel_detach(struct TimerWheel *w, int level, int slot, struct Timer **head)
+{
+    *head = w->buckets[level][slot];
+    if (*head) (*head)->pprev = head;
+    w->buckets[level][slot] = NULL;
+    w->occupied[level] &= ~(1ULL << slot);
+    return *head;
+}
+
+static void wheel_cascade(struct TimerWheel *w, int level, int slot)
+{
+    struct Timer *head;
+    wheel_detach(w, level, slot, &head);
+    while (head) {
+        struct Timer *t = head;
+        list_unlink(t);
+        wheel_enqueue(w, t);
+    }
+}
+
+static void wheel_expire(struct TimerWheel *w, int slot, uint64_t now_ns)
+{
+    struct Timer *head;
+    wheel_detach(w, 0, slot, &head);
+    while (head) {
+        struct Timer *t = head;
+        list_unlink(t);
+
+        if (t->deadline_ns > now_ns) {
+            wheel_enqueue(w, t);   /* later in the current tick */
+            continue;
+        }
+
+        timer_callback_t callback = t->callback;
+        void *arg = t->arg;
+
+        t->bucket = TIMER_NO_BUCKET;
+        t->generation++;
+        t->next = w->free;
+        w->free = t;
+
+        /* Callbacks may add timers on this wheel, so run them unlocked.
+           The detached list is only touched again with the lock held. */
+        spin_unlock(&w->lock);
+        callback(arg);
+        spin_lock(&w->lock);
+    }
+}
+
+static void wheel_run(struct TimerWheel *w, uint64_t now_ns)
+{
+    uint64_t now_tick = ns_to_tick(now_ns);
+
+    while (w->clk <= now_tick) {
+        int index = w->clk & TIMER_LEVEL_MASK;
+
+        if (index == 0) {
+            for (int level = 1; level < TIMER_LEVELS; ++level) {
+                int slot = (w->clk >> (TIMER_LEVEL_BITS * level)) & TIMER_LEVEL_MASK;
+                wheel_cascade(w, level, slot);
+                if (slot != 0) break;
+            }
+        }
+
+        wheel_expire(w, index, now_ns);
+        if (w->clk == now_tick) break;  /* current tick is only partly due */
+
+        /* Skip straight to the next occupied slot or the next cascade point */
+        w->clk++;
+        if (w->clk & TIMER_LEVEL_MASK) {
+            uint64_t pending = w->occupied[0] & (~0ULL << (w->clk & TIMER_LEVEL_MASK));
+            uint64_t next = pending
+                ? (w->clk & ~(uint64_t)TIMER_LEVEL_MASK) + __builtin_ctzll(pending)
+                : (w->clk | TIMER_LEVEL_MASK) + 1;
+            w->clk = next < now_tick ? next : now_tick;
+        }
+    }
+}
+
+static uint64_t wheel_next_event(struct TimerWheel *w)
+{
+    uint64_t best = TIMER_NEVER;
+
+    if (w->occupied[0]) {
+        /* Nearest level 0 bucket holds exact deadlines, take the earliest */
+        int index = w->clk & TIMER_LEVEL_MASK;
+        uint64_t rotated = (w->occupied[0] >> index) | (index ? w->occupied[0] << (64 - index) : 0);
+        int slot = (index + __builtin_ctzll(rotated)) & TIMER_LEVEL_MASK;
+        for (struct Timer *t = w->buckets[0][slot]; t; t = t->next) {
+            if (t->deadline_ns < best) best = t->deadline_ns;
+        }
+    }
+
+    /* Higher levels only need a wakeup when their bucket is cascaded */
+    for (int level = 1; level < TIMER_LEVELS; ++level) {
+        if (!w->occupied[level]) continue;
+
+        int shift = TIMER_LEVEL_BITS * level;
+        int index = (w->clk >> shift) & TIMER_LEVEL_MASK;
+        uint64_t rotated = (w->occupied[level] >> index) | (index ? w->occupied[level] << (64 - index) : 0);
+        bool aligned = (w->clk & ((1ULL << shift) - 1)) == 0;
+        if (!aligned) rotated &= ~1ULL;
+
+        uint64_t distance = rotated ? (uint64_t)__builtin_ctzll(rotated) : TIMER_LEVEL_SIZE;
+        uint64_t cascade_ns = tick_to_ns(((w->clk >> shift) + distance) << shift);
+        if (cascade_ns < best) best = cascade_ns;
+    }
+
+    return best;
+}
+
+static void wheel_program(struct TimerWheel *w)
+{
+    uint64_t next = wheel_next_event(w);
+    w->armed_ns = next;
+
+#ifdef ARCH_x86_64
+    if (next == TIMER_NEVER) {
+        lapic_timer_disarm();
+    } else {
+        lapic_timer_arm(tsc_at_ns(next));
+    }
+#endif
+}
+
+/* -------------------------------------------------------------------------- */
+/*  Public interface                                                          */
+/* -------------------------------------------------------------------------- */
+
+void timer_init(void)
+{
+    struct TimerWheel *w = &timer_wheels[current_cpu()];
+
+    w->cpu = current_cpu();
+    spin_init(&w->lock, "timer_wheel");
+    w->clk = ns_to_tick(clock_monotonic_ns());
+    w->armed_ns = TIMER_NEVER;
+    w->pool = xen_alloc(sizeof(struct Timer) * TIMER_POOL_SIZE);
+    if (!w->pool) {
+        tty_printf("[Timer] Failed to allocate timer pool\n");
+        while (1) halt();
+    }
+
+    w->free = NULL;
+    for (int i = TIMER_POOL_SIZE - 1; i >= 0; --i) {
+        struct Timer *t = &w->pool[i];
+        t->bucket = TIMER_NO_BUCKET;
+        t->generation = 0;
+        t->next = w->free;
+        w->free = t;
+    }
+
+    tty_printf("[Timer] CPU %u wheel ready, %u timers, tick %u ns\n", w->cpu, TIMER_POOL_SIZE, 1 << TIMER_TICK_SHIFT);
+}
+
+timer_handle_t timer_add(uint64_t deadline_ns, timer_callback_t callback, void *arg)
+{
+    if (!callback) return TIMER_INVALID;
+
+    uint64_t flags = irq_save();
+    struct TimerWheel *w = &timer_wheels[current_cpu()];
+    spin_lock(&w->lock);
+
+    struct Timer *t = w->free;
+    if (!t) {
+        spin_unlock_irqrestore(&w->lock, flags);
+#ifdef HLOS_DEBUG
+        tty_printf("[Timer] CPU %u timer pool exhausted\n", w->cpu);
+#endif
+        return TIMER_INVALID;
+    }
+    w->free = t->next;
+
+    t->deadline_ns = deadline_ns;
+    t->callback = callback;
+    t->arg = arg;
+    wheel_enqueue(w, t);
+
+    timer_handle_t handle = make_handle(w, t);
+    if (deadline_ns < w->armed_ns) wheel_program(w);
+
+    spin_unlock_irqrestore(&w->lock, flags);
+    return handle;
+}
+
+bool timer_cancel(timer_handle_t handle)
+{
+    uint32_t cpu = handle >> 56;
+    uint32_t generation = (handle >> 32) & 0xFFFFFF;
+    uint64_t index = (handle & 0xFFFFFFFF) - 1;
+    if (handle == TIMER_INVALID || cpu >= MAX_CPUS || index >= TIMER_POOL_SIZE) return false;
+
+    struct TimerWheel *w = &timer_wheels[cpu];
+    if (!w->pool) return false;
+
+    uint64_t flags = spin_lock_irqsave(&w->lock);
+
+    struct Timer *t = &w->pool[index];
+    if (t->bucket == TIMER_NO_BUCKET || (t->generation & 0xFFFFFF) != generation) {
+        spin_unlock_irqrestore(&w->lock, flags);
+        return false;  /* already fired or cancelled */
+    }
+
+    wheel_dequeue(w, t);
+    t->generation++;
+    t->next = w->free;
+    w->free = t;
+
+    spin_unlock_irqrestore(&w->lock, flags);
+    return true;
+}
+
+/* Called from the LAPIC timer interrupt with interrupts disabled */
+void timer_interrupt(void)
+{
+    struct TimerWheel *w = &timer_wheels[current_cpu()];
+    if (!w->pool) return;
+
+    spin_lock(&w->lock);
+    wheel_run(w, clock_monotonic_ns());
+    wheel_program(w);
+    spin_unlock(&w->lock);
+}
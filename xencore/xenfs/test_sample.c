@@ -96,9 +96,11 @@ static void parse_tar(const void *tar_start, size_t tar_size) {
 
         switch (node->type) {
             case VFS_NODE_FILE:
-                node->file.size = file_size;
-                node->file.data = (void *)xen_alloc(file_size + 1);
-                ((uint8_t *)node->file.data)[file_size] = 0;
+                // Page aligned, mmap() maps these pages without copying
+                if (!vfs_file_alloc(node, file_size)) {
+                    tty_printf("[Test Sample] Error: Out of memory for %s\n", hdr->name);
+                    break;
+                }
                 memcpy(node->file.data, file_data, file_size);
                 break;
             
@@ -1,44 +1,291 @@
 #include <string.h>
+#include <stdint.h>
 
 #ifdef ARCH_x86_64
 #include <xencore/arch/x86_64/paging.h>
+#include <xencore/arch/x86_64/usercopy.h>
 #endif
 
 #include <xencore/xenfs/vfs.h>
 #include <xencore/xenio/tty.h>
 #include <xencore/xenmem/xenalloc.h>
+#include <xencore/xenmem/xenframe.h>
+#include <xencore/hazardous/image.h>
+#include <xencore/sync/rwlock.h>
+#include <xencore/sync/spinlock.h>
 
 static vfs_node_t *vfs_root = (vfs_node_t *)NULL;
 
-static void vfs_add_child(vfs_node_t *parent, vfs_node_t *child)
+// Lookups are far more common than tree changes
+static rwlock_t vfs_lock = RWLOCK_INIT("vfs");
+
+/* -------------------------------------------------------------------------- */
+/*  Directory index                                                           */
+/*                                                                            */
+/*  Every directory hashes its children by name, so a path costs one probe   */
+/*  per component however big the directories are. Nodes carry their name's  */
+/*  hash and length, which settles most mismatches before any memcmp. When   */
+/*  the table fills up a bigger one takes over and each later insert or      */
+/*  remove moves a few slots of the old one across; lookups check both       */
+/*  until it is empty. The children array only keeps vfs_child() ordered.    */
+/* -------------------------------------------------------------------------- */
+
+#define VFS_INDEX_MIN       8
+#define VFS_INDEX_MIGRATE   8       /* old slots moved per change */
+#define VFS_CHILDREN_MIN    4
+
+static vfs_node_t vfs_tombstone;
+#define VFS_TOMBSTONE (&vfs_tombstone)
+
+static uint32_t vfs_name_hash(const char *name, size_t len)
 {
-    size_t new_count = parent->dir.child_count + 1;
-    size_t new_size = new_count * sizeof(vfs_node_t *);
-    vfs_node_t **new_array = xen_alloc(new_size);
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; ++i) hash = (hash ^ (uint8_t)name[i]) * 16777619u;
+    return hash;
+}
 
-    if (parent->dir.child_count > 0) {
-        memcpy(new_array, parent->dir.children, parent->dir.child_count * sizeof(vfs_node_t *));
-        xen_free(parent->dir.children);
+static vfs_node_t **vfs_index_probe(vfs_node_t **slots, size_t size, const char *name, size_t len, uint32_t hash)
+{
+    if (!slots) return NULL;
+
+    size_t mask = size - 1;
+    for (size_t i = hash & mask, n = 0; n < size; i = (i + 1) & mask, ++n) {
+        vfs_node_t *node = slots[i];
+        if (!node) return NULL;
+        if (node != VFS_TOMBSTONE && node->name_hash == hash && node->name_len == len &&
+            memcmp(node->name, name, len) == 0) return &slots[i];
     }
+    return NULL;
+}
 
-    new_array[parent->dir.child_count] = child;
-    parent->dir.children = new_array;
-    parent->dir.child_count = new_count;
+// The table has a free slot, the load factor makes sure of it
+static void vfs_index_place(struct vfs_dir_index *index, vfs_node_t *node)
+{
+    size_t mask = index->size - 1;
+    size_t i = node->name_hash & mask;
+    while (index->slots[i] && index->slots[i] != VFS_TOMBSTONE) i = (i + 1) & mask;
+    if (!index->slots[i]) index->used++;
+    index->slots[i] = node;
 }
 
-static vfs_node_t *vfs_find_child(vfs_node_t *parent, const char *name)
+static void vfs_index_migrate(struct vfs_dir_index *index, size_t steps)
 {
-    if (!parent || parent->type != VFS_NODE_DIR) return NULL;
+    while (index->old_slots && steps--) {
+        vfs_node_t **slot = &index->old_slots[index->migrated];
+        if (*slot && *slot != VFS_TOMBSTONE) {
+            vfs_index_place(index, *slot);
+            *slot = VFS_TOMBSTONE;
+            index->old_pending--;
+        }
 
-    for (size_t i = 0; i < parent->dir.child_count; i++) {
-        if (strcmp(parent->dir.children[i]->name, name) == 0) {
-            return parent->dir.children[i];
+        if (++index->migrated == index->old_size) {
+            xen_free(index->old_slots);
+            index->old_slots = NULL;
+            index->old_size = index->old_pending = index->migrated = 0;
         }
     }
+}
 
-    return NULL;
+static bool vfs_index_insert(struct vfs_dir_index *index, vfs_node_t *node)
+{
+    vfs_index_migrate(index, VFS_INDEX_MIGRATE);
+
+    if ((index->used + index->old_pending + 1) * 4 > index->size * 3) {
+        // Filled up again before the last growth was done, rare enough
+        if (index->old_slots) vfs_index_migrate(index, SIZE_MAX);
+
+        size_t size = VFS_INDEX_MIN;
+        while (size < (index->count + 1) * 2) size *= 2;
+        vfs_node_t **slots = xen_alloc(size * sizeof(vfs_node_t *));
+        if (!slots) return false;
+        memset(slots, 0, size * sizeof(vfs_node_t *));
+
+        if (index->slots) {
+            index->old_slots = index->slots;
+            index->old_size = index->size;
+            index->old_pending = index->count;
+            index->migrated = 0;
+        }
+        index->slots = slots;
+        index->size = size;
+        index->used = 0;
+    }
+
+    vfs_index_place(index, node);
+    index->count++;
+    return true;
+}
+
+static void vfs_index_remove(struct vfs_dir_index *index, vfs_node_t *node)
+{
+    vfs_node_t **slot = vfs_index_probe(index->slots, index->size, node->name, node->name_len, node->name_hash);
+    if (!slot) {
+        slot = vfs_index_probe(index->old_slots, index->old_size, node->name, node->name_len, node->name_hash);
+        if (slot) index->old_pending--;
+    }
+    if (slot) {
+        *slot = VFS_TOMBSTONE;
+        index->count--;
+    }
+    vfs_index_migrate(index, VFS_INDEX_MIGRATE);
+}
+
+static vfs_node_t *vfs_find_child(vfs_node_t *parent, const char *name, size_t len)
+{
+    if (!parent || parent->type != VFS_NODE_DIR) return NULL;
+
+    struct vfs_dir_index *index = &parent->dir.index;
+    uint32_t hash = vfs_name_hash(name, len);
+    vfs_node_t **slot = vfs_index_probe(index->slots, index->size, name, len, hash);
+    if (!slot) slot = vfs_index_probe(index->old_slots, index->old_size, name, len, hash);
+    return slot ? *slot : NULL;
+}
+
+/* -------------------------------------------------------------------------- */
+/*  Path cache                                                                */
+/*                                                                            */
+/*  Whole paths as passed to vfs_lookup(), mapped to their node or to         */
+/*  nothing, so opening the same file again is a single probe. Entries are    */
+/*  invalidated wholesale: any create retires every negative entry, any       */
+/*  remove every positive one. The tree hardly changes once the initrd is     */
+/*  unpacked, and neither kind of change can make the other kind stale.       */
+/*  Both generations only move under the write lock.                          */
+/* -------------------------------------------------------------------------- */
+
+#define VFS_DCACHE_SLOTS 256
+
+struct vfs_dentry {
+    uint32_t hash;
+    uint32_t generation;
+    vfs_node_t *node;          /* NULL for a path that does not exist */
+    size_t len;
+    char path[];
+};
+
+static struct vfs_dentry *vfs_dcache[VFS_DCACHE_SLOTS];
+static spinlock_t vfs_dcache_lock = SPINLOCK_INIT("dcache");
+static uint32_t vfs_dcache_pos_gen = 0;
+static uint32_t vfs_dcache_neg_gen = 0;
+
+static inline uint32_t vfs_dentry_generation(const vfs_node_t *node)
+{
+    return node ? vfs_dcache_pos_gen : vfs_dcache_neg_gen;
+}
+
+static bool vfs_dcache_get(const char *path, size_t len, uint32_t hash, vfs_node_t **node)
+{
+    bool hit = false;
+    uint64_t flags = spin_lock_irqsave(&vfs_dcache_lock);
+    struct vfs_dentry *entry = vfs_dcache[hash % VFS_DCACHE_SLOTS];
+    if (entry && entry->hash == hash && entry->len == len && memcmp(entry->path, path, len) == 0 &&
+        entry->generation == vfs_dentry_generation(entry->node)) {
+        *node = entry->node;
+        hit = true;
+    }
+    spin_unlock_irqrestore(&vfs_dcache_lock, flags);
+    return hit;
+}
+
+static void vfs_dcache_put(const char *path, size_t len, uint32_t hash, vfs_node_t *node)
+{
+    struct vfs_dentry *entry = xen_alloc(sizeof(struct vfs_dentry) + len);
+    if (!entry) return;
+    entry->hash = hash;
+    entry->generation = vfs_dentry_generation(node);
+    entry->node = node;
+    entry->len = len;
+    memcpy(entry->path, path, len);
+
+    uint64_t flags = spin_lock_irqsave(&vfs_dcache_lock);
+    struct vfs_dentry *old = vfs_dcache[hash % VFS_DCACHE_SLOTS];
+    vfs_dcache[hash % VFS_DCACHE_SLOTS] = entry;
+    spin_unlock_irqrestore(&vfs_dcache_lock, flags);
+    xen_free(old);
+}
+
+/* -------------------------------------------------------------------------- */
+/*  Path walking                                                              */
+/* -------------------------------------------------------------------------- */
+
+void vfs_path_init(vfs_path_iter_t *it, const char *path)
+{
+    it->cursor = path;
+    it->name = NULL;
+    it->len = 0;
+}
+
+// Step to the next component, false once there is none
+bool vfs_path_next(vfs_path_iter_t *it)
+{
+    const char *at = it->cursor;
+    while (*at == '/') at++;
+    if (*at == '\0') {
+        it->cursor = at;
+        return false;
+    }
+
+    it->name = at;
+    while (*at && *at != '/') at++;
+    it->len = (size_t)(at - it->name);
+    it->cursor = at;
+    return true;
+}
+
+// Whether the current component is the final one
+bool vfs_path_last(const vfs_path_iter_t *it)
+{
+    const char *at = it->cursor;
+    while (*at == '/') at++;
+    return *at == '\0';
+}
+
+static bool vfs_add_child(vfs_node_t *parent, vfs_node_t *child)
+{
+    if (parent->dir.child_count == parent->dir.child_capacity) {
+        size_t capacity = parent->dir.child_capacity ? parent->dir.child_capacity * 2 : VFS_CHILDREN_MIN;
+        vfs_node_t **children = xen_alloc(capacity * sizeof(vfs_node_t *));
+        if (!children) return false;
+        if (parent->dir.child_count) memcpy(children, parent->dir.children, parent->dir.child_count * sizeof(vfs_node_t *));
+        xen_free(parent->dir.children);
+        parent->dir.children = children;
+        parent->dir.child_capacity = capacity;
+    }
+
+    if (!vfs_index_insert(&parent->dir.index, child)) return false;
+    parent->dir.children[parent->dir.child_count++] = child;
+    vfs_dcache_neg_gen++;
+    return true;
 }
 
+static vfs_node_t *vfs_new_node(vfs_node_t *parent, const char *name, size_t len, vfs_node_type_t type)
+{
+    vfs_node_t *node = xen_alloc(sizeof(vfs_node_t));
+    if (!node) return NULL;
+    memset(node, 0, sizeof(vfs_node_t));
+
+    node->name = xen_alloc(len + 1);
+    if (!node->name) {
+        xen_free(node);
+        return NULL;
+    }
+    memcpy(node->name, name, len);
+    node->name[len] = '\0';
+    node->name_hash = vfs_name_hash(name, len);
+    node->name_len = (uint32_t)len;
+    node->type = type;
+    node->parent = parent;
+    if (type == VFS_NODE_FILE) spin_init(&node->file.lock, "file");
+
+    if (parent && !vfs_add_child(parent, node)) {
+        xen_free(node->name);
+        xen_free(node);
+        return NULL;
+    }
+    return node;
+}
+
+static void vfs_file_release(vfs_node_t *node);
+
 static void xen_free_node(vfs_node_t *node) {
     if (!node) return;
 
@@ -49,8 +296,11 @@ static void xen_free_node(vfs_node_t *node) {
             xen_free_node(node->dir.children[i]);
         }
         xen_free(node->dir.children);
+        xen_free(node->dir.index.slots);
+        xen_free(node->dir.index.old_slots);
     } else if (node->type == VFS_NODE_FILE) {
-        xen_free(node->file.data);
+        exec_image_forget(node);
+        vfs_file_release(node);
     } else if (node->type == VFS_NODE_SYMLINK) {
         xen_free(node->symlink.target);
     }
@@ -58,105 +308,80 @@ static void xen_free_node(vfs_node_t *node) {
     xen_free(node);
 }
 
-vfs_node_t *vfs_create(const char *path, vfs_node_type_t type) {
+static vfs_node_t *vfs_create_locked(const char *path, vfs_node_type_t type) {
     if (!path || path[0] != '/') return NULL;
 
-    char temp[256];
-    strncpy(temp, path, sizeof(temp));
-    temp[sizeof(temp) - 1] = '\0';
-
     vfs_node_t *current = vfs_root;
-    char *token = strtok(temp + 1, "/");
-    char *next = NULL;
-
-    while (token) {
-        next = strtok(NULL, "/");
+    vfs_path_iter_t it;
+    vfs_path_init(&it, path);
 
-        vfs_node_t *child = vfs_find_child(current, token);
-        if (next == NULL) {
+    while (vfs_path_next(&it)) {
+        vfs_node_t *child = vfs_find_child(current, it.name, it.len);
+        if (vfs_path_last(&it)) {
             // Final component — create node if not found
             if (child) return child;
-
-            vfs_node_t *node = xen_alloc(sizeof(vfs_node_t));
-            node->name = xen_alloc(strlen(token) + 1);
-            strcpy(node->name, token);
-            node->type = type;
-            node->parent = current;
-
-            if (type == VFS_NODE_DIR) {
-                node->dir.children = NULL;
-                node->dir.child_count = 0;
-            }
-
-            vfs_add_child(current, node);
-            return node;
+            return vfs_new_node(current, it.name, it.len, type);
         }
 
         // Intermediate component — must be directory
         if (!child) {
             // Create missing intermediate directory
-            child = xen_alloc(sizeof(vfs_node_t));
-            child->name = xen_alloc(strlen(token) + 1);
-            strcpy(child->name, token);
-            child->type = VFS_NODE_DIR;
-            child->parent = current;
-            child->dir.children = NULL;
-            child->dir.child_count = 0;
-
-            vfs_add_child(current, child);
+            child = vfs_new_node(current, it.name, it.len, VFS_NODE_DIR);
+            if (!child) return NULL;
         } else if (child->type != VFS_NODE_DIR) {
             return NULL; // Conflict: intermediate is not a directory
         }
 
         current = child;
-        token = next;
     }
 
     return NULL;
 }
 
-vfs_node_t *vfs_lookup(const char *path) {
-    if (!path || path[0] != '/') return NULL;
-    if (strcmp(path, "/") == 0) return vfs_root;
-
-    char temp[256];
-    strncpy(temp, path, sizeof(temp));
-    temp[sizeof(temp) - 1] = '\0';
-
+static vfs_node_t *vfs_walk_locked(const char *path) {
     vfs_node_t *current = vfs_root;
-    char *token = strtok(temp + 1, "/");
+    vfs_path_iter_t it;
+    vfs_path_init(&it, path);
 
-    while (token) {
+    while (vfs_path_next(&it)) {
         if (current->type != VFS_NODE_DIR) return NULL;
 
-        vfs_node_t *child = vfs_find_child(current, token);
+        vfs_node_t *child = vfs_find_child(current, it.name, it.len);
         if (!child) return NULL;
 
         current = child;
-        token = strtok(NULL, "/");
     }
 
     return current;
 }
 
-bool vfs_remove(const char *path) {
-    if (!path || path[0] != '/') return false;
+// Caller holds the lock for reading at least
+static vfs_node_t *vfs_lookup_locked(const char *path) {
+    if (!path || path[0] != '/') return NULL;
+
+    size_t len = strlen(path);
+    uint32_t hash = vfs_name_hash(path, len);
+    vfs_node_t *node;
+    if (vfs_dcache_get(path, len, hash, &node)) return node;
 
-    char temp[256];
-    strncpy(temp, path, sizeof(temp));
-    temp[sizeof(temp) - 1] = '\0';
+    node = vfs_walk_locked(path);
+    vfs_dcache_put(path, len, hash, node);
+    return node;
+}
+
+static bool vfs_remove_locked(const char *path) {
+    if (!path || path[0] != '/') return false;
 
     vfs_node_t *current = vfs_root;
-    char *token = strtok(temp + 1, "/");
-    char *next = NULL;
+    vfs_path_iter_t it;
+    vfs_path_init(&it, path);
 
-    while (token) {
-        next = strtok(NULL, "/");
-        vfs_node_t *child = vfs_find_child(current, token);
+    while (vfs_path_next(&it)) {
+        vfs_node_t *child = vfs_find_child(current, it.name, it.len);
 
         if (!child) return false;
 
-        if (!next) {
+        if (vfs_path_last(&it)) {
             // Found target node
             if (child == vfs_root) return false; // Cannot remove root
 
@@ -176,37 +401,395 @@ bool vfs_remove(const char *path) {
             }
 
             current->dir.child_count--;
-            if (current->dir.child_count > 0) {
-                size_t new_size = current->dir.child_count * sizeof(vfs_node_t *);
-                vfs_node_t **new_array = xen_alloc(new_size);
-                memcpy(new_array, current->dir.children, new_size);
-                xen_free(current->dir.children);
-                current->dir.children = new_array;
-            } else {
-                xen_free(current->dir.children);
-                current->dir.children = NULL;
-            }
-
+            vfs_index_remove(&current->dir.index, child);
+            vfs_dcache_pos_gen++;
             xen_free_node(child);
             return true;
         }
 
         if (child->type != VFS_NODE_DIR) return false;
         current = child;
-        token = next;
     }
 
     return false;
 }
 
+vfs_node_t *vfs_create(const char *path, vfs_node_type_t type) {
+    write_lock(&vfs_lock);
+    vfs_node_t *node = vfs_create_locked(path, type);
+    write_unlock(&vfs_lock);
+    return node;
+}
+
+vfs_node_t *vfs_lookup(const char *path) {
+    read_lock(&vfs_lock);
+    vfs_node_t *node = vfs_lookup_locked(path);
+    read_unlock(&vfs_lock);
+    return node;
+}
+
+bool vfs_remove(const char *path) {
+    write_lock(&vfs_lock);
+    bool removed = vfs_remove_locked(path);
+    write_unlock(&vfs_lock);
+    return removed;
+}
+
+// Directory entries by position, NULL past the last one
+vfs_node_t *vfs_child(vfs_node_t *dir, size_t index) {
+    vfs_node_t *child = NULL;
+    read_lock(&vfs_lock);
+    if (dir && dir->type == VFS_NODE_DIR && index < dir->dir.child_count) {
+        child = dir->dir.children[index];
+    }
+    read_unlock(&vfs_lock);
+    return child;
+}
+
+// Single path component inside `dir`
+vfs_node_t *vfs_child_named(vfs_node_t *dir, const char *name) {
+    read_lock(&vfs_lock);
+    vfs_node_t *child = vfs_find_child(dir, name, strlen(name));
+    read_unlock(&vfs_lock);
+    return child;
+}
+
 void vfs_init()
 {
-    vfs_root = xen_alloc(sizeof(vfs_node_t));
-    vfs_root->name = xen_alloc(2);
-    strcpy(vfs_root->name, "/");
-    vfs_root->type = VFS_NODE_DIR;
-    vfs_root->parent = NULL;
-    vfs_root->dir.children = NULL;
-    vfs_root->dir.child_count = 0;
+    vfs_root = vfs_new_node(NULL, "/", 1, VFS_NODE_DIR);
     tty_printf("[VFS] Initialized!\n");
 }
+
+/* -------------------------------------------------------------------------- */
+/*  File contents                                                             */
+/*                                                                            */
+/*  Files unpacked from the initrd start out as one page-aligned blob, which  */
+/*  the ELF loader reads in place; it copies files on the tree out through    */
+/*  vfs_file_read() instead. Anything that grows or truncates a file          */
+/*  moves it onto a radix tree of 4 KiB pages, 512 slots per level like the   */
+/*  page tables: height 0 is a single page, each level above covers 512       */
+/*  times more. The blob's pages simply become the first leaves. Missing      */
+/*  leaves are holes that read as zeros, appending only ever touches the      */
+/*  last page, and truncation frees whole pages.                              */
+/*                                                                            */
+/*  Pages the tree allocated are reference-counted frames. Readers, writers   */
+/*  and mmap() take a reference under the file lock and copy or map outside   */
+/*  it, so a page truncated away under a mapping lives on until unmapped.     */
+/* -------------------------------------------------------------------------- */
+
+#define VFS_TREE_SHIFT  9
+#define VFS_TREE_SLOTS  (1u << VFS_TREE_SHIFT)
+#define VFS_PAGE_FRAME  1ULL                                /* leaf is a frame of ours */
+#define VFS_PAGE_ADDR   (~(uint64_t)(VFS_PAGE_SIZE - 1))
+
+static inline uint64_t vfs_pages(uint64_t size)
+{
+    return (size + VFS_PAGE_SIZE - 1) / VFS_PAGE_SIZE;
+}
+
+static inline uint8_t *vfs_page_data(uint64_t entry)
+{
+#ifdef ARCH_x86_64
+    return phys_to_virt(entry & VFS_PAGE_ADDR);
+#else
+    (void)entry;
+    return NULL;
+#endif
+}
+
+static inline uint64_t vfs_blob_page(const vfs_node_t *node, uint64_t index)
+{
+#ifdef ARCH_x86_64
+    return virt_to_phys((uint64_t)node->file.data + index * VFS_PAGE_SIZE);
+#else
+    (void)node;
+    (void)index;
+    return 0;
+#endif
+}
+
+// Drop the reference vfs_file_get() took
+static inline void vfs_page_put(uint64_t entry)
+{
+    if (entry & VFS_PAGE_FRAME) frame_free(entry & VFS_PAGE_ADDR);
+}
+
+static uint64_t *vfs_tree_table(void)
+{
+    uint64_t phys = frame_alloc();
+    return phys ? (uint64_t *)vfs_page_data(phys) : NULL;
+}
+
+static void vfs_tree_free(uint64_t entry, uint32_t level)
+{
+    if (!entry) return;
+    if (level == 0) {
+        vfs_page_put(entry);
+        return;
+    }
+
+    uint64_t *table = (uint64_t *)(uintptr_t)entry;
+    for (size_t i = 0; i < VFS_TREE_SLOTS; ++i) vfs_tree_free(table[i], level - 1);
+#ifdef ARCH_x86_64
+    frame_free(virt_to_phys((uint64_t)table));
+#endif
+}
+
+// Leaf slot of page `index`. Without `create`, NULL where the tree has
+// nothing; with it, NULL only when out of memory.
+static uint64_t *vfs_tree_slot(vfs_node_t *node, uint64_t index, bool create)
+{
+    while (index >> (VFS_TREE_SHIFT * node->file.height)) {
+        if (!create) return NULL;
+        if (node->file.root) {
+            uint64_t *top = vfs_tree_table();
+            if (!top) return NULL;
+            top[0] = node->file.root;
+            node->file.root = (uint64_t)(uintptr_t)top;
+        }
+        node->file.height++;
+    }
+
+    uint64_t *slot = &node->file.root;
+    for (uint32_t level = node->file.height; level > 0; --level) {
+        if (!*slot) {
+            uint64_t *table = create ? vfs_tree_table() : NULL;
+            if (!table) return NULL;
+            *slot = (uint64_t)(uintptr_t)table;
+        }
+        uint64_t *table = (uint64_t *)(uintptr_t)*slot;
+        slot = &table[(index >> (VFS_TREE_SHIFT * (level - 1))) & (VFS_TREE_SLOTS - 1)];
+    }
+    return slot;
+}
+
+// Free every page from `first` on in the subtree at `slot`, which starts
+// at page `base`
+static void vfs_tree_trim(uint64_t *slot, uint32_t level, uint64_t base, uint64_t first)
+{
+    if (!*slot) return;
+    if (base >= first) {
+        vfs_tree_free(*slot, level);
+        *slot = 0;
+        return;
+    }
+    if (level == 0) return;
+
+    uint64_t span = 1ULL << (VFS_TREE_SHIFT * (level - 1));
+    uint64_t *table = (uint64_t *)(uintptr_t)*slot;
+    for (size_t i = 0; i < VFS_TREE_SLOTS; ++i) {
+        uint64_t child = base + i * span;
+        if (child + span > first) vfs_tree_trim(&table[i], level - 1, child, first);
+    }
+}
+
+// Move a blob file onto the tree, caller holds the file lock
+static bool vfs_file_detach_locked(vfs_node_t *node)
+{
+    if (!node->file.data) return true;
+
+    for (uint64_t i = 0; i < vfs_pages(node->file.size); ++i) {
+        uint64_t *slot = vfs_tree_slot(node, i, true);
+        if (!slot) return false;
+        *slot = vfs_blob_page(node, i);
+    }
+    node->file.data = NULL;
+    return true;
+}
+
+// Page `index` with a reference taken, 0 for a hole. With `create` a hole
+// gets a fresh zeroed page; writes that reach `end` past the blob move the
+// file onto the tree first.
+static uint64_t vfs_file_get(vfs_node_t *node, uint64_t index, bool create, uint64_t end)
+{
+    uint64_t entry = 0;
+    uint64_t flags = spin_lock_irqsave(&node->file.lock);
+
+    if (node->file.data && (!create || end <= node->file.size)) {
+        if (index < vfs_pages(node->file.size)) entry = vfs_blob_page(node, index);
+    } else if (vfs_file_detach_locked(node)) {
+        uint64_t *slot = vfs_tree_slot(node, index, create);
+        if (slot && !*slot && create) {
+            uint64_t phys = frame_alloc();
+            if (phys) *slot = phys | VFS_PAGE_FRAME;
+        }
+        entry = slot ? *slot : 0;
+    }
+
+    if (entry & VFS_PAGE_FRAME) frame_ref(entry & VFS_PAGE_ADDR);
+    spin_unlock_irqrestore(&node->file.lock, flags);
+    return entry;
+}
+
+static void vfs_file_release(vfs_node_t *node)
+{
+    vfs_tree_free(node->file.root, node->file.height);
+    node->file.root = 0;
+    node->file.height = 0;
+    xen_free(node->file.backing);
+    node->file.backing = NULL;
+    node->file.data = NULL;
+    node->file.size = 0;
+}
+
+// Give a file `size` bytes of page-aligned storage, so mmap() can hand its
+// pages to user space as they are. The tail of the last page is zeroed and
+// always holds at least one NUL after the data.
+bool vfs_file_alloc(vfs_node_t *node, size_t size)
+{
+    if (!node || node->type != VFS_NODE_FILE) return false;
+
+    size_t span = (size + 1 + VFS_PAGE_SIZE - 1) & ~(size_t)(VFS_PAGE_SIZE - 1);
+    void *backing = xen_alloc(span + VFS_PAGE_SIZE - 1);
+    if (!backing) return false;
+
+    uint8_t *data = (uint8_t *)(((uintptr_t)backing + VFS_PAGE_SIZE - 1) & ~(uintptr_t)(VFS_PAGE_SIZE - 1));
+    memset(data + size, 0, span - size);
+
+    vfs_file_release(node);
+    node->file.backing = backing;
+    node->file.data = data;
+    node->file.size = size;
+    return true;
+}
+
+// Physical page `index` of a file for mmap(), 0 past its end. Holes are
+// filled in so shared mappings see each other's writes. If `*frame` comes
+// back true the caller owns a reference to the frame.
+uint64_t vfs_file_map_page(vfs_node_t *node, size_t index, bool *frame)
+{
+    if (!node || node->type != VFS_NODE_FILE || index >= vfs_pages(node->file.size)) return 0;
+
+    uint64_t end = ((uint64_t)index + 1) * VFS_PAGE_SIZE;
+    uint64_t entry = vfs_file_get(node, index, true, end < node->file.size ? end : node->file.size);
+    *frame = entry & VFS_PAGE_FRAME;
+    return entry & VFS_PAGE_ADDR;
+}
+
+// Called before a write or truncate touches the file and again once it is
+// done. An image built from the file in between sees the generation move
+// and stays out of the cache, one that slipped in is dropped the second time.
+static void vfs_file_changed(vfs_node_t *node)
+{
+    uint64_t flags = spin_lock_irqsave(&node->file.lock);
+    node->file.generation++;
+    spin_unlock_irqrestore(&node->file.lock, flags);
+
+    exec_image_forget(node);
+}
+
+// Taken before reading a file that is cached in some form, compared after
+uint64_t vfs_file_generation(vfs_node_t *node)
+{
+    uint64_t flags = spin_lock_irqsave(&node->file.lock);
+    uint64_t generation = node->file.generation;
+    spin_unlock_irqrestore(&node->file.lock, flags);
+    return generation;
+}
+
+// Buffers belong to the kernel or, with `user`, to the calling process,
+// whose pages may fail to come in
+static bool vfs_copy(void *dst, const void *src, size_t len, bool to_user, bool from_user)
+{
+#ifdef ARCH_x86_64
+    if (to_user) return src ? copy_to_user((uint64_t)dst, src, len) : clear_user((uint64_t)dst, len);
+    if (from_user) return copy_from_user(dst, (uint64_t)src, len);
+#else
+    (void)to_user;
+    (void)from_user;
+#endif
+    if (src) memcpy(dst, src, len);
+    else memset(dst, 0, len);
+    return true;
+}
+
+// Copy up to `len` bytes out of a file, fewer at its end. -1 if the
+// buffer faults before anything was copied.
+int64_t vfs_file_read(vfs_node_t *node, uint64_t offset, void *buf, size_t len, bool user)
+{
+    if (!node || node->type != VFS_NODE_FILE) return 0;
+
+    size_t size = __atomic_load_n(&node->file.size, __ATOMIC_RELAXED);
+    if (offset >= size) return 0;
+    if (len > size - offset) len = size - offset;
+
+    size_t done = 0;
+    while (done < len) {
+        uint64_t pos = offset + done;
+        size_t in_page = pos % VFS_PAGE_SIZE;
+        size_t chunk = VFS_PAGE_SIZE - in_page < len - done ? VFS_PAGE_SIZE - in_page : len - done;
+
+        uint64_t entry = vfs_file_get(node, pos / VFS_PAGE_SIZE, false, 0);
+        bool ok = vfs_copy((uint8_t *)buf + done, entry ? vfs_page_data(entry) + in_page : NULL, chunk, user, false);
+        vfs_page_put(entry);
+        if (!ok) return done ? (int64_t)done : -1;
+        done += chunk;
+    }
+    return (int64_t)done;
+}
+
+// Body of vfs_file_write(), between the two generation bumps
+static int64_t vfs_file_write_pages(vfs_node_t *node, uint64_t offset, const void *buf, size_t len, bool user)
+{
+    size_t done = 0;
+    while (done < len) {
+        uint64_t pos = offset + done;
+        size_t in_page = pos % VFS_PAGE_SIZE;
+        size_t chunk = VFS_PAGE_SIZE - in_page < len - done ? VFS_PAGE_SIZE - in_page : len - done;
+
+        uint64_t entry = vfs_file_get(node, pos / VFS_PAGE_SIZE, true, pos + chunk);
+        if (!entry) break;
+        bool ok = vfs_copy(vfs_page_data(entry) + in_page, (const uint8_t *)buf + done, chunk, false, user);
+        if (!ok) {
+            // Whatever part of the chunk lies past the end must stay zero
+            uint64_t size = __atomic_load_n(&node->file.size, __ATOMIC_RELAXED);
+            if (pos + chunk > size) {
+                uint64_t from = pos > size ? pos : size;
+                memset(vfs_page_data(entry) + in_page + (from - pos), 0, pos + chunk - from);
+            }
+        }
+        vfs_page_put(entry);
+        if (!ok) return done ? (int64_t)done : -1;
+        done += chunk;
+
+        uint64_t flags = spin_lock_irqsave(&node->file.lock);
+        if (pos + chunk > node->file.size) node->file.size = pos + chunk;
+        spin_unlock_irqrestore(&node->file.lock, flags);
+    }
+    return (int64_t)done;
+}
+
+// Write anywhere, growing the file as needed. Returns how much made it
+// before memory ran out, -1 if the buffer faults before anything did.
+int64_t vfs_file_write(vfs_node_t *node, uint64_t offset, const void *buf, size_t len, bool user)
+{
+    if (!node || node->type != VFS_NODE_FILE || offset > VFS_FILE_MAX || len > VFS_FILE_MAX - offset) return 0;
+
+    // Programs built from the old contents are stale now
+    vfs_file_changed(node);
+    int64_t done = vfs_file_write_pages(node, offset, buf, len, user);
+    vfs_file_changed(node);
+    return done;
+}
+
+// Growing leaves a hole, shrinking frees every page past the new end and
+// zeroes the rest of the last one
+bool vfs_file_truncate(vfs_node_t *node, uint64_t size)
+{
+    if (!node || node->type != VFS_NODE_FILE || size > VFS_FILE_MAX) return false;
+    vfs_file_changed(node);
+
+    uint64_t flags = spin_lock_irqsave(&node->file.lock);
+    bool ok = size == node->file.size || vfs_file_detach_locked(node);
+    if (ok && size < node->file.size) {
+        vfs_tree_trim(&node->file.root, node->file.height, 0, vfs_pages(size));
+
+        uint64_t *slot = (size % VFS_PAGE_SIZE) ? vfs_tree_slot(node, size / VFS_PAGE_SIZE, false) : NULL;
+        if (slot && *slot) memset(vfs_page_data(*slot) + size % VFS_PAGE_SIZE, 0, VFS_PAGE_SIZE - size % VFS_PAGE_SIZE);
+    }
+    if (ok) node->file.size = size;
+    spin_unlock_irqrestore(&node->file.lock, flags);
+
+    vfs_file_changed(node);
+    return ok;
+}
@@ -4,12 +4,39 @@
 #include <xencore/graphics/fonts/8x14.h>
 #include <xencore/xenio/serial.h>
 #include <xencore/xenio/tty.h>
+#include <xencore/sync/spinlock.h>
+#include <xencore/smp/cpu.h>
 
 static uint32_t tty_x = 0, tty_y = 0;
 static uint32_t tty_cols = 0, tty_rows = 0;
 static fb_color_t tty_fg = 0xFFFFFFFF, tty_bg = 0xFF000000;
 static const uint8_t *tty_font = NULL;
 
+// Serializes output so lines from different CPUs do not interleave. The
+// owner CPU may re-enter, e.g. when an exception fires mid-print.
+static spinlock_t tty_lock = SPINLOCK_INIT("tty");
+static volatile uint32_t tty_owner = UINT32_MAX;
+
+static uint64_t tty_acquire(bool *nested)
+{
+    uint64_t flags = irq_save();
+    *nested = tty_owner == current_cpu();
+    if (!*nested) {
+        spin_lock(&tty_lock);
+        tty_owner = current_cpu();
+    }
+    return flags;
+}
+
+static void tty_release(uint64_t flags, bool nested)
+{
+    if (!nested) {
+        tty_owner = UINT32_MAX;
+        spin_unlock(&tty_lock);
+    }
+    irq_restore(flags);
+}
+
 void tty_init(fb_color_t fg, fb_color_t bg, const uint8_t *font) {
     tty_x = 0;
     tty_y = 0;
@@ -34,20 +61,31 @@ void tty_setpos(uint32_t x, uint32_t y) {
 uint32_t tty_getx(void) { return tty_x; }
 uint32_t tty_gety(void) { return tty_y; }
 
-void tty_reset()
+static void tty_reset_locked(void)
 {
     tty_x = 0;
     tty_y = 0;
     fb_clear(tty_bg);
 }
 
+void tty_reset()
+{
+    bool nested;
+    uint64_t flags = tty_acquire(&nested);
+    tty_reset_locked();
+    tty_release(flags, nested);
+}
+
 void tty_setfont(const uint8_t *font)
 {
     if (font != NULL) {
+        bool nested;
+        uint64_t flags = tty_acquire(&nested);
         tty_font = font;
         tty_cols = fb_get_width() / font[0];
         tty_rows = fb_get_height() / font[1];
-        tty_reset();
+        tty_reset_locked();
+        tty_release(flags, nested);
     }
 }
 
@@ -57,7 +95,7 @@ static void tty_scroll(void) {
     if (tty_y > 0) tty_y--;
 }
 
-void tty_putc(char c) {
+static void tty_emit(char c) {
     serial_print_char(c);
     if (!fb_is_initialized()) return;
     
@@ -92,16 +130,32 @@ void tty_putc(char c) {
     }
 }
 
+static void tty_emit_str(const char *s) {
+    while (*s) tty_emit(*s++);
+}
+
+void tty_putc(char c) {
+    bool nested;
+    uint64_t flags = tty_acquire(&nested);
+    tty_emit(c);
+    tty_release(flags, nested);
+}
+
 void tty_puts(const char *s) {
-    while (*s) tty_putc(*s++);
+    bool nested;
+    uint64_t flags = tty_acquire(&nested);
+    tty_emit_str(s);
+    tty_release(flags, nested);
 }
 
 void tty_printf(const char* fmt, ...) {
+    bool nested;
+    uint64_t flags = tty_acquire(&nested);
     va_list args;
     va_start(args, fmt);
     while (*fmt) {
         if (*fmt != '%') {
-            tty_putc(*fmt++);
+            tty_emit(*fmt++);
             continue;
         }
         ++fmt;
@@ -117,7 +171,7 @@ void tty_printf(const char* fmt, ...) {
                 if (val == 0) *--p = '0';
                 while (val) { *--p = '0' + (val % 10); val /= 10; }
                 if (neg) *--p = '-';
-                tty_puts(p);
+                tty_emit_str(p);
                 break;
             }
             case 'u': {
@@ -127,7 +181,7 @@ void tty_printf(const char* fmt, ...) {
                 *--p = 0;
                 if (val == 0) *--p = '0';
                 while (val) { *--p = '0' + (val % 10); val /= 10; }
-                tty_puts(p);
+                tty_emit_str(p);
                 break;
             }
             case 'x': {
@@ -138,12 +192,12 @@ void tty_printf(const char* fmt, ...) {
                 *--p = 0;
                 if (val == 0) *--p = '0';
                 while (val) { *--p = digits[val % 16]; val /= 16; }
-                tty_puts(p);
+                tty_emit_str(p);
                 break;
             }
             case 'f': {
                 double value = va_arg(args, double);
-                if (value < 0) { tty_putc('-'); value = -value; }
+                if (value < 0) { tty_emit('-'); value = -value; }
                 long long int_part = (long long)value;
                 double frac_part = value - int_part;
                 char buf[32];
@@ -152,36 +206,37 @@ void tty_printf(const char* fmt, ...) {
                 if (int_part == 0) *--p = '0';
                 long long v = int_part;
                 while (v) { *--p = '0' + (v % 10); v /= 10; }
-                tty_puts(p);
-                tty_putc('.');
+                tty_emit_str(p);
+                tty_emit('.');
                 for (int i = 0; i < 6; ++i) frac_part *= 10;
                 unsigned long long frac = (unsigned long long)frac_part;
                 char fbuf[8];
                 char *fp = fbuf + sizeof(fbuf);
                 *--fp = 0;
                 for (int i = 0; i < 6; ++i) { *--fp = '0' + (frac % 10); frac /= 10; }
-                tty_puts(fp);
+                tty_emit_str(fp);
                 break;
             }
             case 's': {
                 const char* str = va_arg(args, const char*);
-                tty_puts(str ? str : "(null)");
+                tty_emit_str(str ? str : "(null)");
                 break;
             }
             case 'c':
-                tty_putc((char)va_arg(args, int));
+                tty_emit((char)va_arg(args, int));
                 break;
             case '%':
-                tty_putc('%');
+                tty_emit('%');
                 break;
             default:
-                tty_putc('%');
-                tty_putc(*fmt);
+                tty_emit('%');
+                tty_emit(*fmt);
                 break;
         }
         ++fmt;
     }
     va_end(args);
+    tty_release(flags, nested);
 }
 
 
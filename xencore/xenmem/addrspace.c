@@ -0,0 +1,59 @@
+#include <string.h>
+
+#ifdef ARCH_x86_64
+#include <xencore/arch/x86_64/paging.h>
+#endif
+
+#include <xencore/xenmem/addrspace.h>
+#include <xencore/xenmem/xenalloc.h>
+#include <xencore/xenmem/vma.h>
+
+static volatile uint64_t next_ctx_id = 1;
+
+struct AddressSpace *addrspace_create(void)
+{
+    struct AddressSpace *as = xen_alloc(sizeof(struct AddressSpace));
+    if (!as) return NULL;
+    memset(as, 0, sizeof(struct AddressSpace));
+    spin_init(&as->vma_lock, "vma");
+
+#ifdef ARCH_x86_64
+    as->pml4 = create_user_pml4();
+    if (!as->pml4) {
+        xen_free(as);
+        return NULL;
+    }
+    as->cr3 = virt_to_phys((uint64_t)as->pml4);
+#endif
+
+    // Never reused, so a recycled PML4 frame cannot inherit stale PCID
+    // entries of its previous owner
+    as->ctx_id = __atomic_fetch_add(&next_ctx_id, 1, __ATOMIC_RELAXED);
+    return as;
+}
+
+// Copy-on-write duplicate of `src`, which must be the caller's own
+struct AddressSpace *addrspace_fork(struct AddressSpace *src)
+{
+    struct AddressSpace *as = addrspace_create();
+    if (!as) return NULL;
+
+    as->brk_start = src->brk_start;
+    as->brk = src->brk;
+    if (!vma_fork(as, src)) {
+        addrspace_destroy(as);
+        return NULL;
+    }
+    return as;
+}
+
+// Nothing may be running on it anymore
+void addrspace_destroy(struct AddressSpace *as)
+{
+    if (!as) return;
+    vma_destroy(as);
+#ifdef ARCH_x86_64
+    free_user_pml4(as->pml4);
+#endif
+    xen_free(as);
+}
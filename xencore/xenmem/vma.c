@@ -0,0 +1,372 @@
+#include <string.h>
+
+#ifdef ARCH_x86_64
+#include <xencore/arch/x86_64/paging.h>
+#include <xencore/arch/x86_64/tlb.h>
+#endif
+
+#include <xencore/xenmem/vma.h>
+#include <xencore/xenmem/addrspace.h>
+#include <xencore/xenmem/xenalloc.h>
+#include <xencore/xenmem/xenframe.h>
+#include <xencore/xenfs/vfs.h>
+#include <xencore/xenio/tty.h>
+
+/* -------------------------------------------------------------------------- */
+/*  Virtual memory areas                                                      */
+/*                                                                            */
+/*  A VMA only reserves addresses; anonymous ones get their frames from the  */
+/*  page fault handler the first time each page is touched, so a reservation */
+/*  costs one list node until it is used. vma_lock covers both the list and  */
+/*  the user page tables, and is never held across a TLB shootdown: other    */
+/*  CPUs may be spinning on it with interrupts off inside a fault.           */
+/*                                                                            */
+/*  File VMAs map the file's own pages. Shared ones write straight into the   */
+/*  file; private ones map them read-only and copy a page on its first write. */
+/*  fork() does the same to every private page of both processes; the last   */
+/*  holder of a frame takes it back writable without copying.                */
+/* -------------------------------------------------------------------------- */
+
+#define VMA_PAGE_MASK     (FRAME_SIZE - 1)
+#define VMA_UNMAP_CHUNK   64      /* frames released per TLB flush */
+#define VMA_UNMAP_SCAN    512     /* pages walked per lock hold */
+
+static inline bool vma_mergeable(const struct Vma *a, const struct Vma *b)
+{
+    if (a->end != b->start || a->prot != b->prot || a->flags != b->flags || a->file != b->file) return false;
+    return !a->file || a->offset + (a->end - a->start) == b->offset;
+}
+
+static inline bool vma_access_ok(const struct Vma *vma, uint32_t error)
+{
+    if (!(vma->prot & (VMA_READ | VMA_WRITE | VMA_EXEC))) return false;
+    if ((error & FAULT_WRITE) && !(vma->prot & VMA_WRITE)) return false;
+    if ((error & FAULT_FETCH) && !(vma->prot & VMA_EXEC)) return false;
+    return true;
+}
+
+// Reserve [start, end) for pages of `file` from `offset` on. Fails if any
+// part of the range is already taken.
+bool vma_insert_file(struct AddressSpace *as, uint64_t start, uint64_t end, uint32_t prot, uint32_t flags, struct vfs_node *file, uint64_t offset)
+{
+    if (start >= end || ((start | end | offset) & VMA_PAGE_MASK)) return false;
+
+    // Allocated up front, the heap is not touched with vma_lock held
+    struct Vma *vma = xen_alloc(sizeof(struct Vma));
+    if (!vma) return false;
+    *vma = (struct Vma){ start, end, prot, flags, file, offset, NULL };
+
+    uint64_t irq = spin_lock_irqsave(&as->vma_lock);
+
+    struct Vma *prev = NULL;
+    struct Vma **link = &as->vmas;
+    while (*link && (*link)->start < start) {
+        prev = *link;
+        link = &prev->next;
+    }
+    if ((prev && prev->end > start) || (*link && (*link)->start < end)) {
+        spin_unlock_irqrestore(&as->vma_lock, irq);
+        xen_free(vma);
+        return false;
+    }
+
+    vma->next = *link;
+    *link = vma;
+
+    // Absorb neighbours with the same attributes, brk() grows this way
+    struct Vma *merged_next = NULL, *merged_self = NULL;
+    if (vma->next && vma_mergeable(vma, vma->next)) {
+        merged_next = vma->next;
+        vma->end = merged_next->end;
+        vma->next = merged_next->next;
+    }
+    if (prev && vma_mergeable(prev, vma)) {
+        prev->end = vma->end;
+        prev->next = vma->next;
+        merged_self = vma;
+    }
+
+    spin_unlock_irqrestore(&as->vma_lock, irq);
+    if (merged_next) xen_free(merged_next);
+    if (merged_self) xen_free(merged_self);
+    return true;
+}
+
+bool vma_insert(struct AddressSpace *as, uint64_t start, uint64_t end, uint32_t prot, uint32_t flags)
+{
+    return vma_insert_file(as, start, end, prot, flags, NULL, 0);
+}
+
+#ifdef ARCH_x86_64
+// Drop every page in [start, end), stepping over missing page tables.
+// Frames go back to the allocator only after no TLB can reach them anymore.
+static void vma_unmap_pages(struct AddressSpace *as, uint64_t start, uint64_t end)
+{
+    uint64_t frames[VMA_UNMAP_CHUNK];
+    struct TlbBatch batch;
+    uint64_t addr = start;
+
+    while (addr < end) {
+        uint32_t count = 0;
+        tlb_batch_init(&batch, as);
+
+        uint64_t irq = spin_lock_irqsave(&as->vma_lock);
+        for (uint32_t scanned = 0; addr < end && count < VMA_UNMAP_CHUNK && scanned < VMA_UNMAP_SCAN; ++scanned) {
+            uint64_t next = user_next_table(as->pml4, addr);
+            if (next != addr) {
+                addr = next;
+                continue;
+            }
+
+            uint64_t pte = unmap_user_page(as->pml4, addr);
+            if (pte) {
+                tlb_batch_add(&batch, addr, addr + FRAME_SIZE);
+                if (pte & PAGE_OWNED) frames[count++] = pte & PAGE_ADDR_MASK;
+            }
+            addr += FRAME_SIZE;
+        }
+        spin_unlock_irqrestore(&as->vma_lock, irq);
+
+        tlb_batch_flush(&batch);
+        for (uint32_t i = 0; i < count; ++i) frame_free(frames[i]);
+    }
+}
+#endif
+
+// Release [start, end), splitting VMAs that straddle its edges. Only pages
+// the removed VMAs covered are unmapped; the ring and time pages, which
+// have none, stay where they are.
+bool vma_remove(struct AddressSpace *as, uint64_t start, uint64_t end)
+{
+    if (start >= end || ((start | end) & VMA_PAGE_MASK)) return false;
+
+    // Needed if the range falls strictly inside one VMA
+    struct Vma *split = xen_alloc(sizeof(struct Vma));
+    if (!split) return false;
+
+    // Parts cut off VMAs that live on, at most one at each edge
+    uint64_t cut_start[2], cut_end[2];
+    uint32_t cuts = 0;
+
+    struct Vma *dead = NULL;
+    uint64_t irq = spin_lock_irqsave(&as->vma_lock);
+
+    struct Vma **link = &as->vmas;
+    while (*link) {
+        struct Vma *vma = *link;
+        if (vma->end <= start) {
+            link = &vma->next;
+            continue;
+        }
+        if (vma->start >= end) break;
+
+        if (vma->start < start && vma->end > end) {
+            cut_start[cuts] = start;
+            cut_end[cuts++] = end;
+            *split = *vma;
+            split->start = end;
+            split->offset += end - vma->start;
+            vma->end = start;
+            vma->next = split;
+            split = NULL;
+            break;
+        } else if (vma->start < start) {
+            cut_start[cuts] = start;
+            cut_end[cuts++] = vma->end;
+            vma->end = start;
+            link = &vma->next;
+        } else if (vma->end > end) {
+            cut_start[cuts] = vma->start;
+            cut_end[cuts++] = end;
+            vma->offset += end - vma->start;
+            vma->start = end;
+            break;
+        } else {
+            *link = vma->next;
+            vma->next = dead;
+            dead = vma;
+        }
+    }
+
+    spin_unlock_irqrestore(&as->vma_lock, irq);
+
+#ifdef ARCH_x86_64
+    for (uint32_t i = 0; i < cuts; ++i) vma_unmap_pages(as, cut_start[i], cut_end[i]);
+#endif
+
+    while (dead) {
+        struct Vma *next = dead->next;
+#ifdef ARCH_x86_64
+        vma_unmap_pages(as, dead->start, dead->end);
+#endif
+        xen_free(dead);
+        dead = next;
+    }
+    if (split) xen_free(split);
+    return true;
+}
+
+// Highest free range of `len` bytes within [floor, ceiling), 0 if none
+uint64_t vma_find_gap(struct AddressSpace *as, uint64_t len, uint64_t floor, uint64_t ceiling)
+{
+    if (!len || ceiling <= floor || ceiling - floor < len) return 0;
+
+    uint64_t found = 0;
+    uint64_t gap_start = floor;
+    uint64_t irq = spin_lock_irqsave(&as->vma_lock);
+
+    for (struct Vma *vma = as->vmas; ; vma = vma->next) {
+        uint64_t gap_end = (vma && vma->start < ceiling) ? vma->start : ceiling;
+        if (gap_end > gap_start && gap_end - gap_start >= len) found = gap_end - len;
+        if (!vma || vma->end >= ceiling) break;
+        if (vma->end > gap_start) gap_start = vma->end;
+    }
+
+    spin_unlock_irqrestore(&as->vma_lock, irq);
+    return found;
+}
+
+#ifdef ARCH_x86_64
+// Data is never executable unless the mapping asks for it
+static inline uint64_t vma_pte_nx(const struct Vma *vma)
+{
+    return (vma->prot & VMA_EXEC) ? 0 : page_nx;
+}
+
+// Give `page` a private, writable copy of the frame at `from`
+static bool vma_copy_page(struct AddressSpace *as, const struct Vma *vma, uint64_t page, uint64_t from)
+{
+    uint64_t phys = frame_alloc_dirty();
+    if (!phys) {
+        tty_printf("[VMA] Out of frames at 0x%x\n", page);
+        return false;
+    }
+
+    memcpy(phys_to_virt(phys), phys_to_virt(from), FRAME_SIZE);
+    if (map_user_page(as->pml4, page, phys, PAGE_USER | PAGE_RW | PAGE_OWNED | vma_pte_nx(vma))) return true;
+    frame_free(phys);
+    return false;
+}
+
+static bool vma_map_file_page(struct AddressSpace *as, struct Vma *vma, uint64_t page, uint32_t error)
+{
+    bool frame = false;
+    uint64_t phys = vfs_file_map_page(vma->file, (vma->offset + (page - vma->start)) / FRAME_SIZE, &frame);
+    if (!phys) return false;  /* past the end of the file */
+
+    // Written right away: skip the read-only stage
+    bool shared = vma->flags & VMA_SHARED;
+    if ((error & FAULT_WRITE) && !shared) {
+        bool copied = vma_copy_page(as, vma, page, phys);
+        if (frame) frame_free(phys);
+        return copied;
+    }
+
+    // A page the file allocated itself is held by the mapping too, and
+    // outlives a truncate while mapped
+    uint64_t flags = PAGE_USER | vma_pte_nx(vma) | ((shared && (vma->prot & VMA_WRITE)) ? PAGE_RW : 0) | (frame ? PAGE_OWNED : 0);
+    if (map_user_page(as->pml4, page, phys, flags)) return true;
+    if (frame) frame_free(phys);
+    return false;
+}
+#endif
+
+// Page fault on a user address. Returns false if the access is not
+// allowed, in which case the fault is the process's own.
+bool vma_fault(struct AddressSpace *as, uint64_t addr, uint32_t error)
+{
+    uint64_t page = addr & ~(uint64_t)VMA_PAGE_MASK;
+    bool handled = false;
+    bool replaced = false;
+    uint64_t release = 0;
+    uint64_t irq = spin_lock_irqsave(&as->vma_lock);
+
+    struct Vma *vma = as->vmas;
+    while (vma && vma->end <= addr) vma = vma->next;
+
+    if (vma && vma->start <= addr && vma_access_ok(vma, error)) {
+#ifdef ARCH_x86_64
+        uint64_t pte = user_lookup_pte(as->pml4, page);
+        uint64_t phys = pte & PAGE_ADDR_MASK;
+        if (pte && (error & FAULT_WRITE) && !(pte & PAGE_RW) && !(vma->flags & VMA_SHARED)) {
+            // Copy on write into a private mapping. Nobody else can take a
+            // new reference while we hold the lock, so a count of one stays
+            // that way.
+            if ((pte & PAGE_OWNED) && frame_refcount(phys) == 1) {
+                handled = map_user_page(as->pml4, page, phys, (pte & ~PAGE_ADDR_MASK) | PAGE_RW);
+            } else {
+                handled = replaced = vma_copy_page(as, vma, page, phys);
+                if (replaced && (pte & PAGE_OWNED)) release = phys;
+            }
+        } else if (pte) {
+            // Another thread of the address space got here first
+            handled = !(error & FAULT_WRITE) || (pte & PAGE_RW);
+        } else if (vma->flags & VMA_FILE) {
+            handled = vma_map_file_page(as, vma, page, error);
+        } else if (vma->flags & VMA_ANON) {
+            phys = frame_alloc();
+            uint64_t flags = PAGE_USER | PAGE_OWNED | vma_pte_nx(vma) | ((vma->prot & VMA_WRITE) ? PAGE_RW : 0);
+            handled = phys && map_user_page(as->pml4, page, phys, flags);
+            if (!handled && phys) frame_free(phys);
+            if (!phys) tty_printf("[VMA] Out of frames at 0x%x\n", addr);
+        }
+#endif
+    }
+
+    spin_unlock_irqrestore(&as->vma_lock, irq);
+
+#ifdef ARCH_x86_64
+    // Other CPUs may still hold the read-only translation, and the other
+    // holder of the frame must not see it writable before they drop it
+    if (replaced) tlb_flush_range(as, page, page + FRAME_SIZE);
+#endif
+    if (release) frame_free(release);
+    return handled;
+}
+
+// Copy the VMAs and page tables of `src` into the empty `dst`. Private
+// pages end up shared read-only by both and are copied on write. Only the
+// thread owning `src` changes its VMA list, and that thread is us.
+bool vma_fork(struct AddressSpace *dst, struct AddressSpace *src)
+{
+    struct Vma **tail = &dst->vmas;
+    for (struct Vma *vma = src->vmas; vma; vma = vma->next) {
+        struct Vma *copy = xen_alloc(sizeof(struct Vma));
+        if (!copy) return false;
+        *copy = *vma;
+        copy->next = NULL;
+        *tail = copy;
+        tail = &copy->next;
+    }
+
+    bool ok = true;
+#ifdef ARCH_x86_64
+    struct TlbBatch batch;
+    tlb_batch_init(&batch, src);
+
+    uint64_t irq = spin_lock_irqsave(&src->vma_lock);
+    for (struct Vma *vma = src->vmas; vma && ok; vma = vma->next) {
+        bool cow = !(vma->flags & VMA_SHARED);
+        ok = copy_user_range(dst->pml4, src->pml4, vma->start, vma->end, cow);
+        if (cow) tlb_batch_add(&batch, vma->start, vma->end);
+    }
+    spin_unlock_irqrestore(&src->vma_lock, irq);
+
+    // Our own writes have to fault from here on, even if the copy failed
+    tlb_batch_flush(&batch);
+#endif
+    return ok;
+}
+
+// Frees the list only, the pages go with the page tables
+void vma_destroy(struct AddressSpace *as)
+{
+    struct Vma *vma = as->vmas;
+    as->vmas = NULL;
+
+    while (vma) {
+        struct Vma *next = vma->next;
+        xen_free(vma);
+        vma = next;
+    }
+}
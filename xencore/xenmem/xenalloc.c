@@ -10,6 +10,8 @@
 #include <xencore/xenmem/xenmap.h>
 #include <xencore/xenio/tty.h>
 #include <xencore/common.h>
+#include <xencore/sync/spinlock.h>
+#include <xencore/smp/cpu.h>
 
 /* -------------------------------------------------------------------------- */
 /*  Config / Macros                                                           */
@@ -42,41 +44,106 @@ typedef struct xen_page {
 /* Global state */
 static xen_page_t  *xen_pages      = NULL;
 static xen_block_t *xen_free_list  = NULL;
+static spinlock_t   xen_alloc_lock = SPINLOCK_INIT("xenalloc");
+
+/* Per-CPU stacks of freed small blocks, binned by size class: bin i holds
+ * blocks of at least XEN_CACHE_MIN << i bytes. They are reached with
+ * interrupts off and never cross CPUs, so they take no lock.
+ */
+#define XEN_CACHE_MIN     16
+#define XEN_CACHE_CLASSES 7   /* 16 .. 1024 bytes */
+#define XEN_CACHE_DEPTH   16
+
+struct XenAllocCache {
+    xen_block_t *bins[XEN_CACHE_CLASSES];
+    uint32_t     count[XEN_CACHE_CLASSES];
+};
+
+static struct XenAllocCache xen_caches[MAX_CPUS];
 
 /* Computed at runtime: payload size per arena page */
 #define XEN_PAGE_HEADER_SIZE ALIGN_UP(sizeof(xen_page_t), 16)
 /* We'll allocate arena pages as raw 2MiB pages and place xen_page_t header at top. */
 #define XEN_PAGE_DATA_SIZE (PAGE_SIZE_2MB - XEN_PAGE_HEADER_SIZE)
 
-/* Allocate N 2MiB pages physically contiguous (assumption: alloc_page() returns
- * page-aligned and subsequent calls fill contiguous space *in current early
- * allocator*. If это не гарантируется, надо строить виртуальное непрерывное
- * пространство через map_range() — TODO.)
+/* N contiguous 2MiB pages of the kernel heap, claimed from the page map in
+ * one go: other CPUs may be allocating pages at the same time.
  */
 static void *xen_alloc_pages(size_t pages)
 {
-    void *base = NULL;
-    for (size_t i = 0; i < pages; ++i) {
-        void *p = alloc_page();
-        if (!p) {
-            /* rollback */
-            if (base) {
-                for (size_t j = 0; j < i; ++j)
-                    free_page((void *)((uintptr_t)base + j * PAGE_SIZE_2MB));
-            }
-            return NULL;
+    return alloc_pages(pages);
+}
+
+static void xen_free_pages(void *base, size_t pages)
+{
+    free_pages(base, pages);
+}
+
+/* -------------------------------------------------------------------------- */
+/*  Per-CPU cache                                                             */
+/* -------------------------------------------------------------------------- */
+
+struct XenAllocCache *xen_alloc_cache(uint32_t cpu)
+{
+    return &xen_caches[cpu];
+}
+
+/* Smallest bin whose blocks all fit `size`, -1 if too big to cache */
+static int xen_cache_fit_class(size_t size)
+{
+    for (int i = 0; i < XEN_CACHE_CLASSES; ++i) {
+        if (size <= ((size_t)XEN_CACHE_MIN << i)) return i;
+    }
+    return -1;
+}
+
+/* Bin a freed block of `size` belongs to, -1 if it should not be cached.
+ * Blocks twice the top class or more go back to the shared list instead of
+ * being handed out for far smaller requests.
+ */
+static int xen_cache_block_class(size_t size)
+{
+    if (size < XEN_CACHE_MIN) return -1;
+    for (int i = XEN_CACHE_CLASSES - 1; i >= 0; --i) {
+        if (size >= ((size_t)XEN_CACHE_MIN << i)) {
+            return size < ((size_t)XEN_CACHE_MIN << (i + 1)) ? i : -1;
         }
-        if (i == 0)
-            base = p;
     }
-    return base;
+    return -1;
 }
 
-static void xen_free_pages(void *base, size_t pages)
+static xen_block_t *xen_cache_pop(size_t size)
+{
+    int cls = xen_cache_fit_class(size);
+    if (cls < 0) return NULL;
+
+    uint64_t flags = irq_save();
+    struct XenAllocCache *cache = this_cpu()->alloc_cache;
+    xen_block_t *blk = cache ? cache->bins[cls] : NULL;
+    if (blk) {
+        cache->bins[cls] = blk->next;
+        cache->count[cls]--;
+        blk->next = NULL;
+    }
+    irq_restore(flags);
+    return blk;
+}
+
+static bool xen_cache_push(xen_block_t *blk)
 {
-    for (size_t i = 0; i < pages; ++i) {
-        free_page((void *)((uintptr_t)base + i * PAGE_SIZE_2MB));
+    int cls = xen_cache_block_class(blk->size);
+    if (cls < 0) return false;
+
+    uint64_t flags = irq_save();
+    struct XenAllocCache *cache = this_cpu()->alloc_cache;
+    bool cached = cache && cache->count[cls] < XEN_CACHE_DEPTH;
+    if (cached) {
+        blk->next = cache->bins[cls];
+        cache->bins[cls] = blk;
+        cache->count[cls]++;
     }
+    irq_restore(flags);
+    return cached;
 }
 
 /* -------------------------------------------------------------------------- */
@@ -201,6 +268,21 @@ void *xen_alloc(size_t size)
 {
     size = ALIGN_UP(size, 8);
 
+    /* Large blocks own their pages and never touch the shared lists */
+    if (size + sizeof(xen_block_t) > XEN_PAGE_DATA_SIZE) {
+        return xen_large_alloc(size);
+    }
+
+    xen_block_t *cached = xen_cache_pop(size);
+    if (cached) {
+#ifdef HLOS_DEBUG
+        tty_printf("[XenAlloc] Reuse %u bytes @ 0x%x (cpu cache)\n", size, (void*)(cached+1));
+#endif
+        return (void *)(cached + 1);
+    }
+
+    uint64_t flags = spin_lock_irqsave(&xen_alloc_lock);
+
     /* First, check free list */
     xen_block_t **pprev = &xen_free_list;
     xen_block_t *blk = xen_free_list;
@@ -208,6 +290,7 @@ void *xen_alloc(size_t size)
         if (blk->size >= size) {
             *pprev = blk->next;
             blk->next = NULL;
+            spin_unlock_irqrestore(&xen_alloc_lock, flags);
 #ifdef HLOS_DEBUG
             tty_printf("[XenAlloc] Reuse %u bytes @ 0x%x\n", size, (void*)(blk+1));
 #endif
@@ -217,12 +300,9 @@ void *xen_alloc(size_t size)
         blk = blk->next;
     }
 
-    /* Decide path */
-    if (size + sizeof(xen_block_t) > XEN_PAGE_DATA_SIZE) {
-        return xen_large_alloc(size);
-    } else {
-        return xen_small_alloc(size);
-    }
+    void *ptr = xen_small_alloc(size);
+    spin_unlock_irqrestore(&xen_alloc_lock, flags);
+    return ptr;
 }
 
 /* -------------------------------------------------------------------------- */
@@ -241,10 +321,12 @@ void xen_free(void *ptr)
         if (blk->flags & XEN_BLOCK_LARGE) {
             /* came from xen_large_alloc() */
             xen_free_pages((void *)blk, blk->page_count);
-        } else {
-            /* small -> push to freelist */
+        } else if (!xen_cache_push(blk)) {
+            /* small, cache full -> push to freelist */
+            uint64_t flags = spin_lock_irqsave(&xen_alloc_lock);
             blk->next = xen_free_list;
             xen_free_list = blk;
+            spin_unlock_irqrestore(&xen_alloc_lock, flags);
         }
 #ifdef HLOS_DEBUG
         tty_printf(
@@ -0,0 +1,128 @@
+#include <stdbool.h>
+#include <string.h>
+
+#ifdef ARCH_x86_64
+#include <xencore/arch/x86_64/paging.h>
+#endif
+
+#include <xencore/xenmem/xenframe.h>
+#include <xencore/xenmem/xenmap.h>
+#include <xencore/xenio/tty.h>
+#include <xencore/common.h>
+#include <xencore/sync/spinlock.h>
+
+/* -------------------------------------------------------------------------- */
+/*  4 KiB physical frames                                                     */
+/*                                                                            */
+/*  Page tables and user memory are handed out a frame at a time. Frames are  */
+/*  carved from 2 MiB xenmap pages on demand and kept on a free list linked   */
+/*  through the frames themselves, addressed via the direct map.              */
+/*                                                                            */
+/*  Frames can be shared between address spaces after fork(), so each one    */
+/*  carries a reference count. The first frame of every chunk holds the      */
+/*  counts for the rest of it, which keeps the lookup a mask away.            */
+/* -------------------------------------------------------------------------- */
+
+#define FRAMES_PER_CHUNK (PAGE_SIZE_2MB / FRAME_SIZE)
+
+_Static_assert(FRAMES_PER_CHUNK * sizeof(uint32_t) <= FRAME_SIZE, "refcounts must fit one frame");
+
+static uint64_t free_frames = 0;       /* physical address of the list head */
+static uint64_t free_count = 0;
+static spinlock_t xenframe_lock = SPINLOCK_INIT("xenframe");
+
+static inline uint64_t *frame_link(uint64_t phys)
+{
+    return (uint64_t *)phys_to_virt(phys);
+}
+
+static inline uint32_t *frame_refs(uint64_t phys)
+{
+    uint32_t *counts = phys_to_virt(phys & ~(uint64_t)(PAGE_SIZE_2MB - 1));
+    return &counts[(phys & (PAGE_SIZE_2MB - 1)) / FRAME_SIZE];
+}
+
+// Caller holds xenframe_lock
+static bool xenframe_refill(void)
+{
+    void *chunk = alloc_page();
+    if (!chunk) return false;
+
+    // xenmap pages are 2 MiB aligned in physical memory too
+    uint64_t base = virt_to_phys((uint64_t)chunk);
+    memset(phys_to_virt(base), 0, FRAME_SIZE);
+
+    for (uint64_t i = FRAMES_PER_CHUNK - 1; i > 0; --i) {
+        uint64_t phys = base + i * FRAME_SIZE;
+        *frame_link(phys) = free_frames;
+        free_frames = phys;
+    }
+    free_count += FRAMES_PER_CHUNK - 1;
+    return true;
+}
+
+void xenframe_init(void)
+{
+    uint64_t flags = spin_lock_irqsave(&xenframe_lock);
+    bool ok = xenframe_refill();
+    spin_unlock_irqrestore(&xenframe_lock, flags);
+
+    if (!ok) {
+        tty_printf("[Xenframe] No memory for frames\n");
+        while (1) halt();
+    }
+    tty_printf("[Xenframe] Initialized, %u frames free\n", free_count);
+}
+
+// Contents undefined, for frames about to be overwritten anyway
+uint64_t frame_alloc_dirty(void)
+{
+    uint64_t flags = spin_lock_irqsave(&xenframe_lock);
+    if (!free_frames && !xenframe_refill()) {
+        spin_unlock_irqrestore(&xenframe_lock, flags);
+        return 0;
+    }
+
+    uint64_t phys = free_frames;
+    free_frames = *frame_link(phys);
+    free_count--;
+    *frame_refs(phys) = 1;
+    spin_unlock_irqrestore(&xenframe_lock, flags);
+    return phys;
+}
+
+uint64_t frame_alloc(void)
+{
+    uint64_t phys = frame_alloc_dirty();
+    if (phys) memset(phys_to_virt(phys), 0, FRAME_SIZE);
+    return phys;
+}
+
+// One more holder of an allocated frame
+void frame_ref(uint64_t phys)
+{
+    __atomic_add_fetch(frame_refs(phys), 1, __ATOMIC_RELAXED);
+}
+
+uint32_t frame_refcount(uint64_t phys)
+{
+    return __atomic_load_n(frame_refs(phys), __ATOMIC_ACQUIRE);
+}
+
+// Drop a reference, the frame goes back on the list with the last one
+void frame_free(uint64_t phys)
+{
+    if (!phys) return;
+    if (__atomic_sub_fetch(frame_refs(phys), 1, __ATOMIC_ACQ_REL)) return;
+
+    uint64_t flags = spin_lock_irqsave(&xenframe_lock);
+    *frame_link(phys) = free_frames;
+    free_frames = phys;
+    free_count++;
+    spin_unlock_irqrestore(&xenframe_lock, flags);
+}
+
+uint64_t frame_free_count(void)
+{
+    return __atomic_load_n(&free_count, __ATOMIC_RELAXED);
+}
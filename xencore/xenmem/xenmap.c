@@ -6,6 +6,7 @@
 
 #include <xencore/xenmem/xenmap.h>
 #include <xencore/xenio/tty.h>
+#include <xencore/sync/spinlock.h>
 
 #define MAP_GIB     2048
 #define MAP_PAGES   (MAP_GIB * 512)     // 1 page = 2 MiB, 1 GiB = 512 pages
@@ -15,6 +16,7 @@ extern uint64_t next_virtual_heap_addr;
 
 static uint64_t page_xenmap[BITMAP_SIZE];
 static size_t   total_pages = 0;
+static spinlock_t xenmap_lock = SPINLOCK_INIT("xenmap");
 
 void xenmap_init()
 {
@@ -23,26 +25,53 @@ void xenmap_init()
     tty_printf("[Xenmap] Total pages: %u\n", total_pages);
 }
 
-void *alloc_page()
+static inline bool page_used(size_t i)
+{
+    return page_xenmap[i / 64] & (1ULL << (i % 64));
+}
+
+// `count` virtually contiguous pages, found and claimed under one lock hold
+// so that concurrent callers can never be handed overlapping runs
+void *alloc_pages(size_t count)
 {
+    if (!count) return NULL;
+
+    uint64_t flags = spin_lock_irqsave(&xenmap_lock);
+    size_t run = 0;
     for (size_t i = 0; i < total_pages; ++i) {
-        if (!(page_xenmap[i / 64] & (1 << (i % 64)))) {
-            page_xenmap[i / 64] |= (1 << (i % 64)); // mark as used
-            uint64_t addr = VIRT_HEAP_BASE + i * PAGE_SIZE_2MB;
+        run = page_used(i) ? 0 : run + 1;
+        if (run < count) continue;
+
+        size_t first = i + 1 - count;
+        for (size_t j = first; j <= i; ++j) page_xenmap[j / 64] |= (1ULL << (j % 64)); // mark as used
+        spin_unlock_irqrestore(&xenmap_lock, flags);
+        uint64_t addr = VIRT_HEAP_BASE + first * PAGE_SIZE_2MB;
 #ifdef HLOS_DEBUG
-            tty_printf("[Xenmap] Allocated page @ 0x%x (page index %u)\n", addr, i);
+        tty_printf("[Xenmap] Allocated %u pages @ 0x%x (page index %u)\n", count, addr, first);
 #endif
-            return (void *)addr;
-        }
+        return (void *)addr;
     }
+    spin_unlock_irqrestore(&xenmap_lock, flags);
     return NULL; // out of memory
 }
 
-void free_page(void *page)
+void *alloc_page()
 {
-    uint64_t page_index = ((uint64_t)page - VIRT_HEAP_BASE) / PAGE_SIZE_2MB;
-    page_xenmap[page_index / 64] &= ~(1 << (page_index % 64)); // mark as free
+    return alloc_pages(1);
+}
+
+void free_pages(void *base, size_t count)
+{
+    uint64_t first = ((uint64_t)base - VIRT_HEAP_BASE) / PAGE_SIZE_2MB;
+    uint64_t flags = spin_lock_irqsave(&xenmap_lock);
+    for (uint64_t i = first; i < first + count; ++i) page_xenmap[i / 64] &= ~(1ULL << (i % 64)); // mark as free
+    spin_unlock_irqrestore(&xenmap_lock, flags);
 #ifdef HLOS_DEBUG
-    tty_printf("[Xenmap] Freed page @ 0x%x (page index %u)\n", (uint64_t)page, page_index);
+    tty_printf("[Xenmap] Freed %u pages @ 0x%x (page index %u)\n", count, (uint64_t)base, first);
 #endif
 }
+
+void free_page(void *page)
+{
+    free_pages(page, 1);
+}